@@ -0,0 +1,354 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "autotune.h"
+
+#define TRIAL_WARPS		8
+#define TRIAL_BUDGET_USECS	60000 /* per kernel or effect, once two warps were timed */
+/* Effects 0, 3 and 6, a sample of the access patterns for the kernel trial */
+#define TRIAL_EFFECTS		0x49
+
+/* Serializes the updates of the results file by concurrent instances */
+G_LOCK_DEFINE_STATIC(config);
+
+static gchar *config_path(void)
+{
+	return g_build_filename(g_get_user_config_dir(), "infinity-plugin", "autotune.ini", NULL);
+}
+
+static GKeyFile *load_config(void)
+{
+	GKeyFile *config = g_key_file_new();
+	gchar *path = config_path();
+
+	/* a missing or broken file just has no winners */
+	g_key_file_load_from_file(config, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+	g_free(path);
+	return config;
+}
+
+gchar *autotune_cpu_model(void)
+{
+	gchar *contents, *model = NULL;
+
+	if (g_file_get_contents("/proc/cpuinfo", &contents, NULL, NULL)) {
+		gchar **lines = g_strsplit(contents, "\n", 0);
+		gint32 i;
+
+		for (i = 0; lines[i] != NULL; i++) {
+			const gchar *colon = strchr(lines[i], ':');
+
+			if (colon != NULL && g_str_has_prefix(lines[i], "model name")) {
+				model = g_strstrip(g_strdup(colon + 1));
+				break;
+			}
+		}
+		g_strfreev(lines);
+		g_free(contents);
+	}
+	if (model == NULL || *model == '\0') {
+		g_free(model);
+		model = g_strdup("unknown");
+	}
+	/* not allowed in group names */
+	return g_strdelimit(model, "[]", '_');
+}
+
+/*
+ * The value saved for this CPU under the resolution, followed by suffix.
+ */
+static gchar *lookup_value(gint32 width, gint32 height, const gchar *suffix)
+{
+	GKeyFile *config;
+	gchar *model = autotune_cpu_model();
+	gchar *key = g_strdup_printf("%dx%d%s", width, height, suffix);
+	gchar *value;
+
+	G_LOCK(config);
+	config = load_config();
+	G_UNLOCK(config);
+	value = g_key_file_get_string(config, model, key, NULL);
+	g_free(key);
+	g_free(model);
+	g_key_file_free(config);
+	return value;
+}
+
+static gboolean save_value(gint32 width, gint32 height, const gchar *suffix, const gchar *value)
+{
+	GKeyFile *config;
+	GError *error = NULL;
+	gchar *model, *key, *path, *dir, *data;
+	gsize length;
+	gboolean saved = FALSE;
+
+	model = autotune_cpu_model();
+	key = g_strdup_printf("%dx%d%s", width, height, suffix);
+	G_LOCK(config);
+	config = load_config();
+	g_key_file_set_string(config, model, key, value);
+	data = g_key_file_to_data(config, &length, NULL);
+	path = config_path();
+	dir = g_path_get_dirname(path);
+	if (g_mkdir_with_parents(dir, 0755) != 0)
+		g_warning("Infinity: cannot create '%s'", dir);
+	else if (!g_file_set_contents(path, data, (gssize)length, &error))
+		g_warning("Infinity: cannot save autotune results: %s", error->message);
+	else
+		saved = TRUE;
+	G_UNLOCK(config);
+	g_clear_error(&error);
+	g_free(dir);
+	g_free(path);
+	g_free(data);
+	g_free(key);
+	g_free(model);
+	g_key_file_free(config);
+	return saved;
+}
+
+gint32 autotune_lookup(gint32 width, gint32 height)
+{
+	gchar *name = lookup_value(width, height, "");
+	gint32 kernel, found = -1;
+
+	for (kernel = 0; name != NULL && kernel < compute_kernel_count(); kernel++)
+		if (strcmp(compute_kernel_info(kernel)->name, name) == 0) {
+			found = kernel;
+			break;
+		}
+	g_free(name);
+	return found;
+}
+
+gboolean autotune_save(gint32 width, gint32 height, gint32 kernel)
+{
+	g_return_val_if_fail(kernel >= 0 && kernel < compute_kernel_count(), FALSE);
+
+	return save_value(width, height, "", compute_kernel_info(kernel)->name);
+}
+
+/* Saved as a bit mask of effect numbers */
+gboolean autotune_lookup_fieldless(gint32 width, gint32 height, guint32 *fieldless)
+{
+	gchar *value = lookup_value(width, height, "-fieldless");
+	gchar *end = NULL;
+	guint64 mask = 0;
+
+	if (value != NULL)
+		mask = g_ascii_strtoull(value, &end, 10);
+	if (value == NULL || end == value || *end != '\0' || mask >= 1u << NB_FCT) {
+		g_free(value);
+		return FALSE;
+	}
+	g_free(value);
+	*fieldless = (guint32)mask;
+	return TRUE;
+}
+
+gboolean autotune_save_fieldless(gint32 width, gint32 height, guint32 fieldless)
+{
+	gchar *value = g_strdup_printf("%u", fieldless);
+	gboolean saved = save_value(width, height, "-fieldless", value);
+
+	g_free(value);
+	return saved;
+}
+
+static byte *random_surface(gsize size)
+{
+	byte *surface = g_malloc(size);
+	GRand *rng = g_rand_new_with_seed(1);
+	gsize i;
+
+	for (i = 0; i < size; i++)
+		surface[i] = (byte)g_rand_int_range(rng, 0, 256);
+	g_rand_free(rng);
+	return surface;
+}
+
+gint32 autotune_trial(const vector_field_t *vector_field, gint64 *usecs)
+{
+	const gint32 width = vector_field->width, height = vector_field->height;
+	const gsize size = (gsize)(width + 1) * (height + 1);
+	const t_interpol *vectors[NB_FCT];
+	gint32 nb_vectors = 0;
+	byte *src = random_surface(size);
+	byte *dest = g_malloc(size);
+	gint64 best_usecs = G_MAXINT64;
+	gint32 kernel, best = 0;
+	gsize i;
+
+	/* Fields may lack the vectors of the effects warped without them */
+	for (i = 0; i < NB_FCT; i++)
+		if (vector_field->vector[i] != NULL)
+			vectors[nb_vectors++] = vector_field->vector[i];
+
+	for (kernel = 0; nb_vectors > 0 && kernel < compute_kernel_count(); kernel++) {
+		const compute_warp_func warp = compute_kernel_info(kernel)->warp;
+		gint64 t_trial, t_begin, fastest = G_MAXINT64;
+		gint32 n;
+
+		/* warm up caches and page in dest */
+		warp(vectors[0], src, dest, width, height);
+		t_trial = g_get_monotonic_time();
+		for (n = 0; n < TRIAL_WARPS; n++) {
+			if (n >= 2 && g_get_monotonic_time() - t_trial > TRIAL_BUDGET_USECS)
+				break;
+			t_begin = g_get_monotonic_time();
+			warp(vectors[n % nb_vectors], src, dest, width, height);
+			fastest = MIN(fastest, g_get_monotonic_time() - t_begin);
+		}
+		if (usecs != NULL)
+			usecs[kernel] = fastest;
+		if (fastest < best_usecs) {
+			best_usecs = fastest;
+			best = kernel;
+		}
+	}
+	g_free(src);
+	g_free(dest);
+	return best;
+}
+
+gint32 autotune_select_kernel(gint32 width, gint32 height)
+{
+	const gchar *mode = g_getenv("INFINITY_AUTOTUNE");
+	vector_field_t *vector_field;
+	gint64 t_begin;
+	gint32 kernel;
+
+	if (g_strcmp0(mode, "off") == 0)
+		return 0;
+	if (g_strcmp0(mode, "force") != 0) {
+		kernel = autotune_lookup(width, height);
+		if (kernel >= 0)
+			return kernel;
+	}
+	t_begin = g_get_monotonic_time();
+	vector_field = compute_vector_field_new_for(width, height, TRIAL_EFFECTS);
+	compute_generate_vector_field(vector_field);
+	kernel = autotune_trial(vector_field, NULL);
+	compute_vector_field_destroy(vector_field);
+	g_message("Infinity: autotuned %dx%d in %d ms, kernel '%s' is the fastest",
+		  width, height, (gint)((g_get_monotonic_time() - t_begin) / 1000),
+		  compute_kernel_info(kernel)->name);
+	autotune_save(width, height, kernel);
+	return kernel;
+}
+
+/*
+ * Best time of a few warps of effect, through vector or with the fast
+ * path of compute when vector is NULL.
+ */
+static gint64 time_effect(compute_t *compute, guint32 effect, const t_interpol *vector,
+			  const byte *src, byte *dest, gint32 width, gint32 height)
+{
+	const compute_warp_func warp = compute_kernel_info(compute_get_kernel(compute))->warp;
+	gint64 t_trial, t_begin, fastest = G_MAXINT64;
+	gint32 n;
+
+	/* warm up caches, page in dest and make the fast path tables */
+	if (vector != NULL)
+		warp(vector, src, dest, width, height);
+	else
+		compute_warp_fast(compute, effect, src, dest);
+	t_trial = g_get_monotonic_time();
+	for (n = 0; n < TRIAL_WARPS; n++) {
+		if (n >= 2 && g_get_monotonic_time() - t_trial > TRIAL_BUDGET_USECS)
+			break;
+		t_begin = g_get_monotonic_time();
+		if (vector != NULL)
+			warp(vector, src, dest, width, height);
+		else
+			compute_warp_fast(compute, effect, src, dest);
+		fastest = MIN(fastest, g_get_monotonic_time() - t_begin);
+	}
+	return fastest;
+}
+
+/* The field of one effect at a time: the trial must not need them all */
+guint32 autotune_trial_fieldless(gint32 width, gint32 height, gint32 kernel,
+				 gint64 *field_usecs, gint64 *fieldless_usecs)
+{
+	const gsize size = (gsize)(width + 1) * (height + 1);
+	byte *src = random_surface(size);
+	byte *dest = g_malloc(size);
+	compute_t *compute = compute_new(width, height);
+	guint32 effect, fieldless = 0;
+
+	compute_set_kernel(compute, kernel);
+	for (effect = 0; effect < NB_FCT; effect++) {
+		vector_field_t *vector_field;
+		gint64 with_field, without_field;
+
+		if (!compute_has_fast_warp(effect)) {
+			if (field_usecs != NULL)
+				field_usecs[effect] = 0;
+			if (fieldless_usecs != NULL)
+				fieldless_usecs[effect] = 0;
+			continue;
+		}
+		vector_field = compute_vector_field_new_for(width, height, 1u << effect);
+		compute_generate_vector_field(vector_field);
+		with_field = time_effect(compute, effect, vector_field->vector[effect], src, dest,
+					 width, height);
+		compute_vector_field_destroy(vector_field);
+		without_field = time_effect(compute, effect, NULL, src, dest, width, height);
+		if (without_field < with_field)
+			fieldless |= 1u << effect;
+		if (field_usecs != NULL)
+			field_usecs[effect] = with_field;
+		if (fieldless_usecs != NULL)
+			fieldless_usecs[effect] = without_field;
+	}
+	compute_destroy(compute);
+	g_free(src);
+	g_free(dest);
+	return fieldless;
+}
+
+guint32 autotune_select_fieldless(gint32 width, gint32 height, gint32 kernel)
+{
+	const gchar *mode = g_getenv("INFINITY_AUTOTUNE");
+	const gchar *fast_warp = g_getenv("INFINITY_FAST_WARP");
+	gint64 t_begin;
+	guint32 fieldless, effect;
+	gint32 count = 0;
+
+	if (g_strcmp0(fast_warp, "off") == 0)
+		return 0;
+	if (g_strcmp0(fast_warp, "on") == 0)
+		return (1u << NB_FCT) - 1;
+	if (g_strcmp0(mode, "off") == 0)
+		return 0;
+	if (g_strcmp0(mode, "force") != 0 && autotune_lookup_fieldless(width, height, &fieldless))
+		return fieldless & COMPUTE_EXACT_FAST_WARPS;
+	t_begin = g_get_monotonic_time();
+	fieldless = autotune_trial_fieldless(width, height, kernel, NULL, NULL);
+	autotune_save_fieldless(width, height, fieldless);
+	/* The approximate fast paths are only taken when asked for */
+	fieldless &= COMPUTE_EXACT_FAST_WARPS;
+	for (effect = 0; effect < NB_FCT; effect++)
+		if (fieldless & (1u << effect))
+			count++;
+	g_message("Infinity: autotuned %dx%d in %d ms, %d of %d effects are faster without a field",
+		  width, height, (gint)((g_get_monotonic_time() - t_begin) / 1000), count, NB_FCT);
+	return fieldless;
+}
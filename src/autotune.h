@@ -0,0 +1,85 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_AUTOTUNE__
+#define __INFINITY_AUTOTUNE__
+
+#include <glib.h>
+#include "compute.h"
+
+/*
+ * Picks the fastest compute_surface() kernel for a CPU and resolution,
+ * and the effects that are faster to warp without a stored field.
+ *
+ * Winners are saved per CPU model and resolution in
+ * $XDG_CONFIG_HOME/infinity-plugin/autotune.ini. INFINITY_AUTOTUNE
+ * set to "off" keeps the reference kernel and the fields, and set to
+ * "force" runs the trials again even if winners were saved.
+ */
+
+/*
+ * Returns the kernel to render at width x height with: the saved winner
+ * for this CPU and resolution, or else the winner of a trial run now (at
+ * most a few hundred milliseconds), which gets saved.
+ */
+gint32 autotune_select_kernel(gint32 width, gint32 height);
+
+/*
+ * Times every kernel warping through vector_field, filling usecs (one
+ * entry per kernel, may be NULL) with the best time of a warp, and
+ * returns the fastest kernel.
+ */
+gint32 autotune_trial(const vector_field_t *vector_field, gint64 *usecs);
+
+/*
+ * Returns the kernel saved for this CPU at width x height, -1 if none.
+ */
+gint32 autotune_lookup(gint32 width, gint32 height);
+
+gboolean autotune_save(gint32 width, gint32 height, gint32 kernel);
+
+/*
+ * Returns the effects to warp without a field at width x height with
+ * kernel, a bit mask of effect numbers: among those whose fast path is
+ * exact, the saved winners for this CPU and resolution, or else the ones
+ * whose fast path beat their field in a trial run now, which get saved.
+ * INFINITY_FAST_WARP set to "on" selects all of them, approximate or
+ * not, and "off" none.
+ */
+guint32 autotune_select_fieldless(gint32 width, gint32 height, gint32 kernel);
+
+/*
+ * Times the warp of every effect with kernel, through its field and with
+ * its fast path, filling field_usecs and fieldless_usecs (NB_FCT entries
+ * each, may be NULL, 0 for effects without a fast path), and returns the
+ * effects whose fast path was faster.
+ */
+guint32 autotune_trial_fieldless(gint32 width, gint32 height, gint32 kernel,
+				 gint64 *field_usecs, gint64 *fieldless_usecs);
+
+/*
+ * Sets fieldless to the effects saved for this CPU at width x height,
+ * returns FALSE if none were.
+ */
+gboolean autotune_lookup_fieldless(gint32 width, gint32 height, guint32 *fieldless);
+
+gboolean autotune_save_fieldless(gint32 width, gint32 height, guint32 fieldless);
+
+/*
+ * The CPU model winners are saved under, to be freed with g_free().
+ */
+gchar *autotune_cpu_model(void);
+
+#endif /* __INFINITY_AUTOTUNE__ */
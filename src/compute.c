@@ -14,6 +14,7 @@
  *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 #include <math.h>
+#include <string.h>
 #include <glib.h>
 
 #include "compute.h"
@@ -28,246 +29,1558 @@ typedef struct t_complex {
 	gfloat x, y;
 } t_complex;
 
-static gint32 width, height, scale;
+/* The parameters each effect uses: 1 for p1, 2 for p2 */
+static const guint32 effect_params[NB_FCT] = { 3, 3, 2, 0, 0, 0, 0 };
+/* Effects with a fast path: the exact ones and the angular one */
+#define FAST_WARP_EFFECTS	((1u << NB_FCT) - 1)
+#define FAST_WARP_ANGULAR	6
+/* The effects added, from NB_FCT on, and their number with the built-in ones */
+static warpexpr_t *expr_effects[COMPUTE_MAX_EFFECTS];
+static gint effect_count = NB_FCT;
+/* Effects symmetric through the center, whose vectors can be mirrored */
+static guint32 symmetric_effects = (1u << NB_FCT) - 1;
+/* Those whose warp_at(-a) is exactly -warp_at(a): effect 6 is an ulp off here and there */
+#define ODD_EFFECTS		((1u << 6) - 1)
+/* Steps of the grids standing for vectors, tried from the coarsest */
+static const gint32 grid_steps[] = { 32, 16, 8 };
+#define GRID_MIN_STEP		8
 
-static byte *surface1;
-static byte *surface2;
+struct _compute {
+	gint32		width;
+	gint32		height;
+	gint32		kernel;
+	byte *		surface1; /* last warped surface */
+	byte *		surface2;
+	gfloat *	radial[NB_FCT]; /* fast path tables, made on first use */
+	t_interpol *	row; /* vectors of the row warped by a fast path or a grid */
+	gfloat *	grid_row; /* grid points interpolated at that row, then its points */
+};
 
-static inline t_complex fct(t_complex a, guint32 n, gint32 p1, gint32 p2)   /* p1 et p2:0-4 */
-{
-	t_complex b;
-	gfloat fact;
-	gfloat an;
+static void warp_reference(const t_interpol *vector, const byte *src, byte *dest,
+			   gint32 width, gint32 height);
+static void warp_flat(const t_interpol *vector, const byte *src, byte *dest,
+		      gint32 width, gint32 height);
+
+static const compute_kernel_t kernels[] = {
+	{ "reference", warp_reference, 0 },
+	{ "flat", warp_flat, 0 },
+};
+
+/* Fields shared by compute_vector_field_get(), one per size and effects */
+static GSList *shared_fields;
+/* Bytes of their vectors, and the budget of those nobody holds */
+static gsize fields_bytes;
+static gsize fields_budget_bytes = (gsize)128 * 1048576;
+static gboolean budget_set;
+/* Ordering of the holds and releases, for the least recently used */
+static guint64 fields_clock;
+/* Signaled when an effect of a field is generated */
+static GCond field_generated;
+/* Until when the fields generated are made small, after memory pressure */
+static gint64 pressure_until;
+/* Generates the prefetched effects, made on first use, while there are fields */
+static GThreadPool *prefetcher;
+/* Prefetches it is yet to make, the latest first, one per item pushed to it */
+static GSList *prefetches;
+G_LOCK_DEFINE_STATIC(shared_fields);
+
+/* What the warp of an effect takes from its parameters, not from the point */
+typedef struct {
+	gfloat co, si; /* of the angle it turns by */
 	gfloat circle_size;
 	gfloat speed;
-	gfloat co, si;
+} warp_consts_t;
 
-	a.x -= width / 2;
-	a.y -= height / 2;
+static inline warp_consts_t warp_consts(guint32 n, gint32 p1, gint32 p2,   /* p1 et p2:0-4 */
+					gint32 height)
+{
+	warp_consts_t k = { 1.0f, 0.0f, 0.0f, 1.0f };
+	gfloat an = 0.002;
 
 	switch (n) {
 	case 0:
 		an = 0.025 * (p1 - 2) + 0.002;
-		co = cos(an);
-		si = sin(an);
-		circle_size = height * 0.25;
-		speed = (gfloat)2000 + p2 * 500;
-		b.x = (co * a.x - si * a.y);
-		b.y = (si * a.x + co * a.y);
-		fact = -(sqrt(b.x * b.x + b.y * b.y) - circle_size) / speed + 1;
-		b.x *= fact;
-		b.y *= fact;
+		k.circle_size = height * 0.25;
+		k.speed = (gfloat)2000 + p2 * 500;
 		break;
 	case 1:
 		an = 0.015 * (p1 - 2) + 0.002;
-		co = cos(an);
-		si = sin(an);
-		circle_size = height * 0.45;
-		speed = (gfloat)4000 + p2 * 1000;
-		b.x = (co * a.x - si * a.y);
-		b.y = (si * a.x + co * a.y);
-		fact = (sqrt(b.x * b.x + b.y * b.y) - circle_size) / speed + 1;
-		b.x *= fact;
-		b.y *= fact;
+		k.circle_size = height * 0.45;
+		k.speed = (gfloat)4000 + p2 * 1000;
 		break;
 	case 2:
-		an = 0.002;
-		co = cos(an);
-		si = sin(an);
-		circle_size = height * 0.25;
-		speed = (gfloat)400 + p2 * 100;
-		b.x = (co * a.x - si * a.y);
-		b.y = (si * a.x + co * a.y);
-		fact = -(sqrt(b.x * b.x + b.y * b.y) - circle_size) / speed + 1;
-		b.x *= fact;
-		b.y *= fact;
+		k.circle_size = height * 0.25;
+		k.speed = (gfloat)400 + p2 * 100;
 		break;
-	case 3:
-		an = (sin(sqrt(a.x * a.x + a.y * a.y) / 20) / 20) + 0.002;
-		co = cos(an);
-		si = sin(an);
-		circle_size = height * 0.25;
-		speed = (gfloat)4000;
-		b.x = (co * a.x - si * a.y);
-		b.y = (si * a.x + co * a.y);
-		fact = -(sqrt(b.x * b.x + b.y * b.y) - circle_size) / speed + 1;
-		b.x *= fact;
-		b.y *= fact;
+	case 3: /* turns by an angle of the point */
+		k.circle_size = height * 0.25;
+		k.speed = (gfloat)4000;
 		break;
-	case 4:
-		an = 0.002;
-		co = cos(an);
-		si = sin(an);
-		circle_size = height * 0.25;
-		speed = sin(sqrt(a.x * a.x + a.y * a.y) / 5) * 3000 + 4000;
-		b.x = (co * a.x - si * a.y);
-		b.y = (si * a.x + co * a.y);
-		fact = -(sqrt(b.x * b.x + b.y * b.y) - circle_size) / speed + 1;
-		b.x *= fact;
-		b.y *= fact;
+	case 4: /* at a speed of the point */
+		k.circle_size = height * 0.25;
 		break;
+	}
+	k.co = cos(an);
+	k.si = sin(an);
+	return k;
+}
+
+/* The angle effect 3 turns a point by, d being its squared distance to the center */
+static inline gfloat turn_angle(gfloat d)
+{
+	return (sin(sqrt(d) / 20) / 20) + 0.002;
+}
+
+/* The speed of effect 4 at such a point */
+static inline gfloat radial_speed(gfloat d)
+{
+	return sin(sqrt(d) / 5) * 3000 + 4000;
+}
+
+/* The warp of effects 0 to 4 once the angle and the speed at a are known */
+static inline t_complex turn_and_scale(t_complex a, const guint32 n, gfloat co, gfloat si,
+				       gfloat circle_size, gfloat speed)
+{
+	t_complex b;
+	gfloat fact;
+
+	b.x = (co * a.x - si * a.y);
+	b.y = (si * a.x + co * a.y);
+	if (n == 1)
+		fact = (sqrt(b.x * b.x + b.y * b.y) - circle_size) / speed + 1;
+	else
+		fact = -(sqrt(b.x * b.x + b.y * b.y) - circle_size) / speed + 1;
+	b.x *= fact;
+	b.y *= fact;
+	return b;
+}
+
+/*
+ * The warp of effect n about the center, of constants k: a is relative
+ * to it. Where n is a constant, only the code of its effect is left.
+ */
+static inline t_complex warp_at(t_complex a, const guint32 n, const warp_consts_t *k)
+{
+	t_complex b;
+	gfloat fact;
+	gfloat an;
+
+	switch (n) {
+	case 3:
+		an = turn_angle(a.x * a.x + a.y * a.y);
+		return turn_and_scale(a, n, cos(an), sin(an), k->circle_size, k->speed);
+	case 4:
+		return turn_and_scale(a, n, k->co, k->si, k->circle_size,
+				      radial_speed(a.x * a.x + a.y * a.y));
 	case 5:
 		b.x = a.x * 1.02;
 		b.y = a.y * 1.02;
-		break;
+		return b;
 	case 6:
-		an = 0.002;
-		co = cos(an);
-		si = sin(an);
-		//circle_size = height * 0.25;
 		fact = 1 + cos(atan(a.x / (a.y + 0.00001)) * 6) * 0.02;
-		b.x = (co * a.x - si * a.y);
-		b.y = (si * a.x + co * a.y);
-		b.x *= fact;
-		b.y *= fact;
-		break;
-	default:
+		b.x = (k->co * a.x - k->si * a.y) * fact;
+		b.y = (k->si * a.x + k->co * a.y) * fact;
+		return b;
+	}
+	if (n >= NB_FCT) {
 		b.x = (gfloat)0.0;
 		b.y = (gfloat)0.0;
+		return b;
 	}
-	b.x += width / 2;
-	b.y += height / 2;
-	if (b.x < 0.0)
-		b.x = 0.0;
-	if (b.y < 0.0)
-		b.y = 0.0;
-	if (b.x > (gfloat)width - 1)
-		b.x = (gfloat)width - 1;
-	if (b.y > (gfloat)height - 1)
-		b.y = (gfloat)height - 1;
-	return b;
+	return turn_and_scale(a, n, k->co, k->si, k->circle_size, k->speed);
+}
+
+/*
+ * The warp of effect n about the center: a is relative to it.
+ */
+static inline t_complex fct_centered(t_complex a, guint32 n, gint32 p1, gint32 p2,   /* p1 et p2:0-4 */
+				     gint32 height)
+{
+	const warp_consts_t k = warp_consts(n, p1, p2, height);
+
+	return warp_at(a, n, &k);
+}
+
+/*
+ * The interpolation vector of the source point b, relative to the center
+ * of a surface of half_width x half_height whose last pixel is (max_x,
+ * max_y). The source points are clamped to the surface, so flooring them
+ * is truncating them, and they fit signed integers, which vectorize.
+ */
+static inline t_interpol source_interpol(t_complex b, gfloat half_width, gfloat half_height,
+					 gfloat max_x, gfloat max_y)
+{
+	const gint32 prop_transmitted = 249;
+	gint32 x, y, rw, lw, w1, w2, w3, w4;
+	gfloat fpy;
+	t_interpol interpol;
+
+	b.x += half_width;
+	b.y += half_height;
+	b.x = b.x < 0.0f ? 0.0f : b.x;
+	b.y = b.y < 0.0f ? 0.0f : b.y;
+	b.x = b.x > max_x ? max_x : b.x;
+	b.y = b.y > max_y ? max_y : b.y;
+	x = (gint32)b.x;
+	y = (gint32)b.y;
+	fpy = b.y - (gfloat)y;
+	rw = (gint32)((gdouble)(b.x - (gfloat)x) * prop_transmitted);
+	lw = prop_transmitted - rw;
+	w4 = (gint32)(fpy * rw);
+	w2 = rw - w4;
+	w3 = (gint32)(fpy * lw);
+	w1 = lw - w3;
+	interpol.coord = (guint32)x << 16 | (guint32)y;
+	interpol.weight = (guint32)w1 << 24 | (guint32)w2 << 16 | (guint32)w3 << 8 | (guint32)w4;
+	return interpol;
 }
 
-/* We are trusting here on vector_field != NULL !!! */
-static inline void compute_generate_sector(guint32 g, guint32 f, guint32 p1, guint32 p2,
-					   guint32 debut, guint32 step, vector_field_t *vector_field)
+/*
+ * Generates the first rows of the vector of effect n, with what does not
+ * change from pixel to pixel worked out once. n is a constant in each
+ * instance made by SPECIALIZE(), so the loop has no test on it.
+ */
+static inline void rows_of(t_interpol *vector, const guint32 n, gint32 p1, gint32 p2,
+			   gint32 width, gint32 height, gint32 rows)
 {
-	const guint32 width = (guint32)vector_field->width;
-	const guint32 height = (guint32)vector_field->height;
-	const guint32 prop_transmitted = 249;
-	const guint32 b_add = g * width * height;
-	t_interpol *vector = vector_field->vector;
-	guint32 fin = debut + step;
-	guint32 cx, cy;
+	const warp_consts_t k = warp_consts(n, p1, p2, height);
+	const gfloat half_width = width / 2, half_height = height / 2;
+	const gfloat max_x = (gfloat)width - 1, max_y = (gfloat)height - 1;
+	gint32 cx, cy;
+
+	for (cy = 0; cy < rows; cy++) {
+		t_interpol *row = vector + cy * width;
+		const gfloat ay = (gfloat)cy - half_height;
 
-	if (fin > height)
-		fin = height;
-	for (cy = debut; cy < fin; cy++) {
 		for (cx = 0; cx < width; cx++) {
-			t_complex a;
-			gfloat fpy;
-			guint32 rw, lw, add;
-			guint32 w1, w2, w3, w4;
-			guint32 x, y;
-
-			a.x = (gfloat)cx;
-			a.y = (gfloat)cy;
-			a = fct(a, f, p1, p2);
-			add = cx + cy * width;
-			x = (guint32)(a.x);
-			y = (guint32)(a.y);
-			vector[b_add + add].coord = (x << 16) | y;
-
-			fpy = a.y - floor(a.y);
-			rw = (guint32)((a.x - floor(a.x)) * prop_transmitted);
-			lw = prop_transmitted - rw;
-			w4 = (guint32)(fpy * rw);
-			w2 = rw - w4;
-			w3 = (guint32)(fpy * lw);
-			w1 = lw - w3;
-			vector[b_add + add].weight = \
-				(w1 << 24) | (w2 << 16) | (w3 << 8) | w4;
+			const t_complex a = { (gfloat)cx - half_width, ay };
+
+			row[cx] = source_interpol(warp_at(a, n, &k), half_width, half_height,
+						  max_x, max_y);
 		}
 	}
 }
 
-void compute_init(gint32 _width, gint32 _height, gint32 _scale)
+/* The batch form of rows_of(), for source_points() */
+static inline void points_of(const guint32 n, gint32 p1, gint32 p2, gint32 height,
+			     const gfloat *ax, const gfloat *ay, gint32 count, gfloat *bx, gfloat *by)
 {
-	width = _width;
-	height = _height;
-	scale = _scale;
+	const warp_consts_t k = warp_consts(n, p1, p2, height);
+	gint32 i;
+
+	for (i = 0; i < count; i++) {
+		t_complex a = { ax[i], ay[i] }, b;
 
-	surface1 = (byte *)g_malloc((gulong)(width + 1) * (height + 1));
-	surface2 = (byte *)g_malloc((gulong)(width + 1) * (height + 1));
+		b = warp_at(a, n, &k);
+		bx[i] = b.x;
+		by[i] = b.y;
+	}
 }
 
-void compute_resize(gint32 _width, gint32 _height)
+typedef struct {
+	void (*rows)(t_interpol *vector, gint32 p1, gint32 p2, gint32 width, gint32 height,
+		     gint32 rows);
+	void (*points)(gint32 p1, gint32 p2, gint32 height, const gfloat *ax, const gfloat *ay,
+		       gint32 count, gfloat *bx, gfloat *by);
+} generator_t;
+
+#define SPECIALIZE(n) \
+static void rows_##n(t_interpol *vector, gint32 p1, gint32 p2, gint32 width, gint32 height, \
+		     gint32 rows) \
+{ \
+	rows_of(vector, n, p1, p2, width, height, rows); \
+} \
+\
+static void points_##n(gint32 p1, gint32 p2, gint32 height, const gfloat *ax, const gfloat *ay, \
+		       gint32 count, gfloat *bx, gfloat *by) \
+{ \
+	points_of(n, p1, p2, height, ax, ay, count, bx, by); \
+}
+
+SPECIALIZE(0)
+SPECIALIZE(1)
+SPECIALIZE(2)
+SPECIALIZE(3)
+SPECIALIZE(4)
+SPECIALIZE(5)
+SPECIALIZE(6)
+
+static const generator_t generators[NB_FCT] = {
+	{ rows_0, points_0 }, { rows_1, points_1 }, { rows_2, points_2 }, { rows_3, points_3 },
+	{ rows_4, points_4 }, { rows_5, points_5 }, { rows_6, points_6 },
+};
+
+/*
+ * The source points (bx[i], by[i]) of the n points (ax[i], ay[i]) for
+ * effect, all relative to the center. The points where an expression is
+ * not defined stay in place.
+ */
+static void source_points(guint32 effect, gint32 p1, gint32 p2, gint32 width, gint32 height,
+			  const gfloat *ax, const gfloat *ay, gint32 n, gfloat *bx, gfloat *by)
 {
-	width = _width;
-	height = _height;
-	g_free(surface1);
-	g_free(surface2);
-	surface1 = (byte *)g_malloc((gulong)(width + 1) * (height + 1));
-	surface2 = (byte *)g_malloc((gulong)(width + 1) * (height + 1));
+	gint32 i;
+
+	if (effect < NB_FCT) {
+		generators[effect].points(p1, p2, height, ax, ay, n, bx, by);
+		return;
+	}
+	warpexpr_eval(expr_effects[effect], ax, ay, n, width, height, p1, p2, bx, by);
+	for (i = 0; i < n; i++)
+		if (!isfinite(bx[i]) || !isfinite(by[i])) {
+			bx[i] = ax[i];
+			by[i] = ay[i];
+		}
 }
 
-vector_field_t *compute_vector_field_new(gint32 width, gint32 height)
+/*
+ * The interpolation vector of the source point (bx, by), relative to the
+ * center, as source_interpol() makes it but in single precision:
+ * the source points are clamped to the surface first, so truncating
+ * them is flooring them.
+ */
+static inline t_interpol interpol_at(gfloat bx, gfloat by, gint32 width, gint32 height)
+{
+	const gfloat max_x = (gfloat)width - 1, max_y = (gfloat)height - 1;
+	const gint32 prop_transmitted = 249;
+	gint32 x, y, rw, lw, w1, w2, w3, w4;
+	gfloat fpy;
+	t_interpol interpol;
+
+	bx += width / 2;
+	by += height / 2;
+	bx = bx < 0.0f ? 0.0f : bx;
+	by = by < 0.0f ? 0.0f : by;
+	bx = bx > max_x ? max_x : bx;
+	by = by > max_y ? max_y : by;
+	x = (gint32)bx;
+	y = (gint32)by;
+	fpy = by - (gfloat)y;
+	rw = (gint32)((bx - (gfloat)x) * prop_transmitted);
+	lw = prop_transmitted - rw;
+	w4 = (gint32)(fpy * rw);
+	w2 = rw - w4;
+	w3 = (gint32)(fpy * lw);
+	w1 = lw - w3;
+	interpol.coord = (guint32)x << 16 | (guint32)y;
+	interpol.weight = (guint32)w1 << 24 | (guint32)w2 << 16 | (guint32)w3 << 8 | (guint32)w4;
+	return interpol;
+}
+
+/*
+ * Generates the first rows of the vector of effect f. Those of the
+ * expressions are evaluated a row at a time.
+ */
+static void generate_vector(t_interpol *vector, guint32 f, gint32 p1, gint32 p2,
+			    gint32 width, gint32 height, gint32 rows)
+{
+	gfloat *ax, *ay, *bx, *by;
+	gint32 cx, cy;
+
+	if (f < NB_FCT) {
+		generators[f].rows(vector, p1, p2, width, height, rows);
+		return;
+	}
+	ax = g_new(gfloat, 4 * (gsize)width);
+	ay = ax + width;
+	bx = ay + width;
+	by = bx + width;
+	for (cx = 0; cx < width; cx++)
+		ax[cx] = (gfloat)(cx - width / 2);
+	for (cy = 0; cy < rows; cy++) {
+		for (cx = 0; cx < width; cx++)
+			ay[cx] = (gfloat)(cy - height / 2);
+		source_points(f, p1, p2, width, height, ax, ay, width, bx, by);
+		for (cx = 0; cx < width; cx++)
+			vector[cx + cy * width] = interpol_at(bx[cx], by[cx], width, height);
+	}
+	g_free(ax);
+}
+
+static void grid_destroy(compute_grid_t *grid)
+{
+	g_free(grid->points);
+	g_free(grid);
+}
+
+static compute_grid_t *grid_new(guint32 effect, gint32 p1, gint32 p2, gint32 step,
+				gint32 width, gint32 height)
+{
+	compute_grid_t *grid = g_new(compute_grid_t, 1);
+	gfloat *ax, *ay, *bx, *by;
+	gint32 i, j;
+
+	grid->step = step;
+	grid->columns = (width - 1) / step + 2;
+	grid->rows = (height - 1) / step + 2;
+	grid->points = g_new(gfloat, 2 * grid->columns * grid->rows);
+	ax = g_new(gfloat, 4 * grid->columns);
+	ay = ax + grid->columns;
+	bx = ay + grid->columns;
+	by = bx + grid->columns;
+	for (i = 0; i < grid->rows; i++) {
+		for (j = 0; j < grid->columns; j++) {
+			ax[j] = (gfloat)(j * step - width / 2);
+			ay[j] = (gfloat)(i * step - height / 2);
+		}
+		source_points(effect, p1, p2, width, height, ax, ay, grid->columns, bx, by);
+		for (j = 0; j < grid->columns; j++) {
+			grid->points[2 * (i * grid->columns + j)] = bx[j];
+			grid->points[2 * (i * grid->columns + j) + 1] = by[j];
+		}
+	}
+	g_free(ax);
+	return grid;
+}
+
+/*
+ * Largest distance between the exact source points of the surface and
+ * the ones interpolated on grid, where a bilinear interpolation strays
+ * most: in the middle of the cells and of their edges. The exact points
+ * of a row of cells are made together.
+ */
+static gfloat grid_error(const compute_grid_t *grid, guint32 effect, gint32 p1, gint32 p2,
+			 gint32 width, gint32 height)
+{
+	static const gfloat probes[3][2] = { { 0.5f, 0.5f }, { 0.5f, 0.0f }, { 0.0f, 0.5f } };
+	const gfloat max_x = (gfloat)width - 1, max_y = (gfloat)height - 1;
+	const gint32 step = grid->step, n = 3 * (grid->columns - 1);
+	gfloat *ax = g_new(gfloat, 4 * n), *ay = ax + n, *bx = ay + n, *by = bx + n;
+	gfloat error = 0.0f;
+	gint32 i, j, k, c;
+
+	for (i = 0; i < grid->rows - 1; i++) {
+		for (j = 0; j < grid->columns - 1; j++)
+			for (k = 0; k < 3; k++) {
+				ax[3 * j + k] = (gfloat)(j * step + (gint32)(probes[k][0] * step) - width / 2);
+				ay[3 * j + k] = (gfloat)(i * step + (gint32)(probes[k][1] * step) - height / 2);
+			}
+		source_points(effect, p1, p2, width, height, ax, ay, n, bx, by);
+		for (j = 0; j < grid->columns - 1; j++)
+			for (k = 0; k < 3; k++) {
+				const gfloat fx = probes[k][0], fy = probes[k][1];
+				const gint32 cx = j * step + (gint32)(fx * step);
+				const gint32 cy = i * step + (gint32)(fy * step);
+				const gfloat *top = grid->points + 2 * (i * grid->columns + j);
+				const gfloat *bottom = top + 2 * grid->columns;
+				gfloat exact[2], interpolated[2];
+
+				if (cx >= width || cy >= height)
+					continue;
+				exact[0] = bx[3 * j + k];
+				exact[1] = by[3 * j + k];
+				for (c = 0; c < 2; c++)
+					interpolated[c] = (1 - fy) * ((1 - fx) * top[c] + fx * top[c + 2])
+							  + fy * ((1 - fx) * bottom[c] + fx * bottom[c + 2]);
+				/* clamped as the warp does */
+				exact[0] = CLAMP(exact[0] + width / 2, 0.0f, max_x);
+				exact[1] = CLAMP(exact[1] + height / 2, 0.0f, max_y);
+				interpolated[0] = CLAMP(interpolated[0] + width / 2, 0.0f, max_x);
+				interpolated[1] = CLAMP(interpolated[1] + height / 2, 0.0f, max_y);
+				error = MAX(error, fabsf(exact[0] - interpolated[0]));
+				error = MAX(error, fabsf(exact[1] - interpolated[1]));
+			}
+	}
+	g_free(ax);
+	return error;
+}
+
+/*
+ * The coarsest grid within COMPUTE_GRID_TOLERANCE of the vector of
+ * effect, NULL if none is: the grids are checked for a few points per
+ * cell, so each costs a small part of the vector.
+ */
+static compute_grid_t *grid_for(guint32 effect, gint32 p1, gint32 p2, gint32 width, gint32 height)
+{
+	compute_grid_t *grid;
+	guint32 i;
+
+	for (i = 0; i < G_N_ELEMENTS(grid_steps); i++) {
+		grid = grid_new(effect, p1, p2, grid_steps[i], width, height);
+		if (grid_error(grid, effect, p1, p2, width, height) <= COMPUTE_GRID_TOLERANCE)
+			return grid;
+		grid_destroy(grid);
+	}
+	return NULL;
+}
+
+static void free_radial(compute_t *compute)
+{
+	guint32 n;
+
+	for (n = 0; n < NB_FCT; n++) {
+		g_free(compute->radial[n]);
+		compute->radial[n] = NULL;
+	}
+}
+
+compute_t *compute_new(gint32 width, gint32 height)
+{
+	compute_t *compute = g_new0(compute_t, 1);
+
+	compute_resize(compute, width, height);
+	return compute;
+}
+
+void compute_destroy(compute_t *compute)
+{
+	g_return_if_fail(compute != NULL);
+
+	free_radial(compute);
+	g_free(compute->row);
+	g_free(compute->grid_row);
+	g_free(compute->surface1);
+	g_free(compute->surface2);
+	g_free(compute);
+}
+
+void compute_resize(compute_t *compute, gint32 width, gint32 height)
+{
+	free_radial(compute);
+	compute->width = width;
+	compute->height = height;
+	g_free(compute->surface1);
+	g_free(compute->surface2);
+	g_free(compute->row);
+	g_free(compute->grid_row);
+	compute->row = g_new(t_interpol, width);
+	compute->grid_row = g_new(gfloat, 2 * ((width - 1) / GRID_MIN_STEP + 2) + 2 * width);
+	compute->surface1 = (byte *)g_malloc0((gulong)(width + 1) * (height + 1));
+	compute->surface2 = (byte *)g_malloc0((gulong)(width + 1) * (height + 1));
+}
+
+/* The rows of the vector of effect in vector_field */
+static inline gint32 effect_rows(const vector_field_t *vector_field, guint32 effect)
+{
+	return vector_field->edges[effect] != NULL ? vector_field->rows : vector_field->height;
+}
+
+/*
+ * The vector of the pixel mirroring the one of v through the center.
+ * Every effect is odd about the center, fct_centered(-a) is
+ * -fct_centered(a), so the source point mirrors too: its top left pixel
+ * is the mirror of the bottom right one of v, and its weights are those
+ * of v in the reverse order. Where that pixel is off the surface, next
+ * to an edge, the vector is not one, but then it is an edge.
+ */
+static inline t_interpol mirror_interpol(t_interpol v, gint32 width, gint32 height)
+{
+	const gint32 x = 2 * (width / 2) - (gint32)(v.coord >> 16) - 1;
+	const gint32 y = 2 * (height / 2) - (gint32)(v.coord & 0xFFFF) - 1;
+	t_interpol mirror;
+
+	mirror.coord = (guint32)x << 16 | ((guint32)y & 0xFFFF);
+	mirror.weight = GUINT32_SWAP_LE_BE(v.weight);
+	return mirror;
+}
+
+/*
+ * Whether the mirrored vector m stands for the exact one e. Both have
+ * weights adding up to 249, so the levels they warp to differ by at most
+ * half the sum of the differences of their weights.
+ */
+static inline gboolean mirrors(t_interpol m, t_interpol e)
+{
+	const gint32 difference =
+		ABS((gint32)(m.weight >> 24) - (gint32)(e.weight >> 24)) +
+		ABS((gint32)(m.weight >> 16 & 0xFF) - (gint32)(e.weight >> 16 & 0xFF)) +
+		ABS((gint32)(m.weight >> 8 & 0xFF) - (gint32)(e.weight >> 8 & 0xFF)) +
+		ABS((gint32)(m.weight & 0xFF) - (gint32)(e.weight & 0xFF));
+
+	/* Without a branch, so that the loops comparing rows vectorize */
+	return (m.coord == e.coord) & (difference <= 2 * COMPUTE_MIRROR_TOLERANCE);
+}
+
+static void edges_destroy(compute_edges_t *edges)
+{
+	g_free(edges->starts);
+	g_free(edges->columns);
+	g_free(edges->vectors);
+	g_free(edges);
+}
+
+/* The first vector of the bottom rows of a mirrored vector */
+static inline const t_interpol *mirrored_row(const t_interpol *vector, gint32 cy,
+					     gint32 width, gint32 height)
+{
+	return vector + (gsize)(2 * (height / 2) - cy) * width + 2 * (width / 2);
+}
+
+/* The vector of the source point (bx, by) of effect, as generate_vector() makes it */
+static inline t_interpol effect_interpol(guint32 effect, gfloat bx, gfloat by,
+					 gint32 width, gint32 height)
+{
+	const t_complex b = { bx, by };
+
+	if (effect < NB_FCT)
+		return source_interpol(b, width / 2, height / 2, (gfloat)width - 1,
+				       (gfloat)height - 1);
+	return interpol_at(bx, by, width, height);
+}
+
+/*
+ * rows_of() for the effects in ODD_EFFECTS, which also appends to misses
+ * the pixels of the rows, as offsets in vector, where the mirror of their
+ * vector misses the vector of the pixel mirroring them: that one is made
+ * from the source point mirrored, which is exact for them. Each step has
+ * a loop of its own, so that the first ones vectorize.
+ */
+static inline void mirrored_rows_of(t_interpol *vector, GArray *misses, const guint32 n,
+				    gint32 p1, gint32 p2, gint32 width, gint32 height, gint32 rows)
+{
+	const warp_consts_t k = warp_consts(n, p1, p2, height);
+	const gfloat half_width = width / 2, half_height = height / 2;
+	const gfloat max_x = (gfloat)width - 1, max_y = (gfloat)height - 1;
+	gfloat *bx = g_new(gfloat, 2 * (gsize)width), *by = bx + width;
+	guint8 *missed = g_new(guint8, width);
+	gint32 cx, cy;
+
+	for (cy = 0; cy < rows; cy++) {
+		t_interpol *row = vector + cy * width;
+		const gfloat ay = (gfloat)cy - half_height;
+
+		for (cx = 0; cx < width; cx++) {
+			const t_complex a = { (gfloat)cx - half_width, ay };
+			const t_complex b = warp_at(a, n, &k);
+
+			bx[cx] = b.x;
+			by[cx] = b.y;
+		}
+		for (cx = 0; cx < width; cx++) {
+			const t_complex b = { bx[cx], by[cx] };
+
+			row[cx] = source_interpol(b, half_width, half_height, max_x, max_y);
+		}
+		for (cx = 0; cx < width; cx++) {
+			const t_complex mirrored = { -bx[cx], -by[cx] };
+
+			missed[cx] = !mirrors(mirror_interpol(row[cx], width, height),
+					      source_interpol(mirrored, half_width, half_height,
+							      max_x, max_y));
+		}
+		for (cx = 0; cx < width; cx++)
+			if (missed[cx]) {
+				const gint32 offset = cy * width + cx;
+
+				g_array_append_val(misses, offset);
+			}
+	}
+	g_free(bx);
+	g_free(missed);
+}
+
+typedef void (*mirrored_rows_func)(t_interpol *vector, GArray *misses, gint32 p1, gint32 p2,
+				   gint32 width, gint32 height, gint32 rows);
+
+#define SPECIALIZE_MIRRORED(n) \
+static void mirrored_rows_##n(t_interpol *vector, GArray *misses, gint32 p1, gint32 p2, \
+			      gint32 width, gint32 height, gint32 rows) \
+{ \
+	mirrored_rows_of(vector, misses, n, p1, p2, width, height, rows); \
+}
+
+SPECIALIZE_MIRRORED(0)
+SPECIALIZE_MIRRORED(1)
+SPECIALIZE_MIRRORED(2)
+SPECIALIZE_MIRRORED(3)
+SPECIALIZE_MIRRORED(4)
+SPECIALIZE_MIRRORED(5)
+
+static const mirrored_rows_func mirrored_rows[] = {
+	mirrored_rows_0, mirrored_rows_1, mirrored_rows_2,
+	mirrored_rows_3, mirrored_rows_4, mirrored_rows_5,
+};
+
+/*
+ * The edges of vector, the first rows of effect, once its other rows are
+ * mirrored. Only the pixels mirroring the misses that mirrored_rows_of()
+ * found are made, through source_points(), a row at a time, or every
+ * pixel without misses. NULL if the mirror misses more than an eighth of
+ * them: the effect is not symmetric, whatever points it was found to be
+ * at. The first column of an even width has no mirror on the surface.
+ */
+static compute_edges_t *edges_new(const t_interpol *vector, const GArray *misses, guint32 effect,
+				  gint32 p1, gint32 p2, gint32 width, gint32 height, gint32 rows)
+{
+	const gint32 first = width % 2 == 0 ? 1 : 0;
+	const guint limit = (guint)((gsize)MAX(height - rows, 0) * width / 8);
+	compute_edges_t *edges;
+	GArray *columns = g_array_new(FALSE, FALSE, sizeof(gint32));
+	GArray *vectors = g_array_new(FALSE, FALSE, sizeof(t_interpol));
+	gint32 *starts = g_new(gint32, MAX(height - rows, 0) + 1);
+	gfloat *ax = g_new(gfloat, 4 * (gsize)width), *ay = ax + width;
+	gfloat *bx = ay + width, *by = bx + width;
+	gint32 *xs = g_new(gint32, width);
+	guint next = misses != NULL ? misses->len : 0;
+	gint32 cx, cy, i, n;
+
+	for (cy = rows; cy < height && columns->len <= limit; cy++) {
+		const t_interpol *mirrored = mirrored_row(vector, cy, width, height);
+		const gint32 top = (gint32)(mirrored - vector); /* the offset mirroring column 0 */
+
+		starts[cy - rows] = (gint32)columns->len;
+		n = 0;
+		if (misses == NULL) {
+			for (cx = 0; cx < width; cx++)
+				xs[n++] = cx;
+		} else {
+			/* Those of the misses mirroring the row, from the last */
+			if (first)
+				xs[n++] = 0;
+			while (next > 0 && g_array_index(misses, gint32, next - 1) > top - first)
+				next--;
+			while (next > 0 && g_array_index(misses, gint32, next - 1) > top - width)
+				xs[n++] = top - g_array_index(misses, gint32, --next);
+		}
+		for (i = 0; i < n; i++) {
+			ax[i] = (gfloat)(xs[i] - width / 2);
+			ay[i] = (gfloat)(cy - height / 2);
+		}
+		source_points(effect, p1, p2, width, height, ax, ay, n, bx, by);
+		for (i = 0; i < n; i++) {
+			const t_interpol exact = effect_interpol(effect, bx[i], by[i], width, height);
+
+			cx = xs[i];
+			if (cx < first || !mirrors(mirror_interpol(mirrored[-cx], width, height), exact)) {
+				g_array_append_val(columns, cx);
+				g_array_append_val(vectors, exact);
+			}
+		}
+	}
+	g_free(ax);
+	g_free(xs);
+	if (columns->len > limit) {
+		g_array_free(columns, TRUE);
+		g_array_free(vectors, TRUE);
+		g_free(starts);
+		return NULL;
+	}
+	starts[MAX(height - rows, 0)] = (gint32)columns->len;
+	edges = g_new(compute_edges_t, 1);
+	edges->starts = starts;
+	edges->columns = (gint32 *)(gpointer)g_array_free(columns, FALSE);
+	edges->vectors = (t_interpol *)(gpointer)g_array_free(vectors, FALSE);
+	return edges;
+}
+
+static gsize edges_bytes(const vector_field_t *vector_field, guint32 effect)
+{
+	const compute_edges_t *edges = vector_field->edges[effect];
+	const gint32 rows = vector_field->height - vector_field->rows;
+
+	if (edges == NULL)
+		return 0;
+	return (gsize)(rows + 1) * sizeof(gint32)
+	       + (gsize)edges->starts[rows] * (sizeof(gint32) + sizeof(t_interpol));
+}
+
+/*
+ * A field with the first rows of the vectors of effects.
+ */
+static vector_field_t *vector_field_new(gint32 width, gint32 height, gint32 rows, guint32 effects)
 {
 	vector_field_t *field;
+	guint32 f;
 
 	field = g_new0(vector_field_t, 1);
-	field->vector = g_new0(t_interpol, width * height * NB_FCT);
 	field->width = width;
 	field->height = height;
+	field->p1 = field->p2 = COMPUTE_DEFAULT_PARAM;
+	field->rows = rows;
+	field->ref_count = 1;
+	for (f = 0; f < COMPUTE_MAX_EFFECTS; f++)
+		if (effects & (1u << f))
+			field->vector[f] = g_new0(t_interpol, (gsize)width * effect_rows(field, f));
 	return field;
 }
 
+vector_field_t *compute_vector_field_new_for(gint32 width, gint32 height, guint32 effects)
+{
+	return vector_field_new(width, height, height, effects);
+}
+
+vector_field_t *compute_vector_field_new(gint32 width, gint32 height)
+{
+	return compute_vector_field_new_for(width, height, (1u << compute_effect_count()) - 1);
+}
+
 void compute_vector_field_destroy(vector_field_t *vector_field)
 {
+	guint32 f;
+
 	g_return_if_fail(vector_field != NULL);
 
-	g_free(vector_field->vector);
+	for (f = 0; f < COMPUTE_MAX_EFFECTS; f++) {
+		g_free(vector_field->vector[f]);
+		if (vector_field->grid[f] != NULL)
+			grid_destroy(vector_field->grid[f]);
+		if (vector_field->edges[f] != NULL)
+			edges_destroy(vector_field->edges[f]);
+	}
 	g_free(vector_field);
 }
 
-void compute_quit()
+static gsize effect_bytes(const vector_field_t *vector_field, guint32 effect)
+{
+	const compute_grid_t *grid = vector_field->grid[effect];
+	gsize bytes = 0;
+
+	if (vector_field->vector[effect] != NULL)
+		bytes += (gsize)vector_field->width * effect_rows(vector_field, effect)
+			 * sizeof(t_interpol);
+	if (grid != NULL)
+		bytes += (gsize)2 * grid->columns * grid->rows * sizeof(gfloat);
+	return bytes + edges_bytes(vector_field, effect);
+}
+
+gsize compute_vector_field_bytes(const vector_field_t *vector_field)
+{
+	gsize bytes = 0;
+	guint32 f;
+
+	for (f = 0; f < COMPUTE_MAX_EFFECTS; f++)
+		bytes += effect_bytes(vector_field, f);
+	return bytes;
+}
+
+/* With the lock held */
+static gsize fields_budget(void)
+{
+	if (!budget_set) {
+		const gchar *value = g_getenv("INFINITY_FIELD_BUDGET");
+
+		if (value != NULL)
+			fields_budget_bytes = (gsize)g_ascii_strtoull(value, NULL, 10) * 1048576;
+		budget_set = TRUE;
+	}
+	return fields_budget_bytes;
+}
+
+/* With the lock held */
+static void free_effect(vector_field_t *vector_field, guint32 effect)
+{
+	fields_bytes -= effect_bytes(vector_field, effect);
+	g_free(vector_field->vector[effect]);
+	vector_field->vector[effect] = NULL;
+	if (vector_field->grid[effect] != NULL)
+		grid_destroy(vector_field->grid[effect]);
+	vector_field->grid[effect] = NULL;
+	if (vector_field->edges[effect] != NULL)
+		edges_destroy(vector_field->edges[effect]);
+	vector_field->edges[effect] = NULL;
+}
+
+/*
+ * Whether a vector of bytes more does not fit the budget along with
+ * those held, or memory was short a moment ago. With the lock held.
+ */
+static gboolean under_pressure(gsize bytes)
+{
+	GSList *l;
+	guint32 f;
+
+	if (g_get_monotonic_time() < pressure_until)
+		return TRUE;
+	for (l = shared_fields; l != NULL; l = l->next) {
+		const vector_field_t *field = l->data;
+
+		for (f = 0; f < COMPUTE_MAX_EFFECTS; f++)
+			if (field->holds[f] > 0)
+				bytes += effect_bytes(field, f);
+	}
+	return bytes > fields_budget();
+}
+
+/*
+ * Whether to make a vector smaller the way the variable name turns on or
+ * off: if it is set to "on", and else when under pressure.
+ */
+static gboolean make_smaller(const gchar *name, gboolean pressure)
+{
+	const gchar *value = g_getenv(name);
+
+	if (value == NULL || (strcmp(value, "on") != 0 && strcmp(value, "off") != 0))
+		return pressure;
+	return strcmp(value, "on") == 0;
+}
+
+/*
+ * Frees the least recently used vectors nobody holds until the fields
+ * are within the budget. With the lock held.
+ */
+static void evict(void)
+{
+	while (fields_bytes > fields_budget()) {
+		vector_field_t *oldest = NULL;
+		guint32 oldest_effect = 0, f;
+		GSList *l;
+
+		for (l = shared_fields; l != NULL; l = l->next) {
+			vector_field_t *field = l->data;
+
+			for (f = 0; f < COMPUTE_MAX_EFFECTS; f++)
+				if (field->holds[f] == 0 && effect_bytes(field, f) > 0 &&
+				    (oldest == NULL || field->used[f] < oldest->used[oldest_effect])) {
+					oldest = field;
+					oldest_effect = f;
+				}
+		}
+		if (oldest == NULL)
+			return;
+		g_debug("Infinity: evicting the %dx%d field of effect %u", oldest->width,
+			oldest->height, oldest_effect);
+		free_effect(oldest, oldest_effect);
+	}
+}
+
+/*
+ * Whether expr is symmetric through the center, as the built-in effects
+ * are, at points all around it for a few sizes and parameters. Only the
+ * fields of those are mirrored, and edges_new() still compares every
+ * point with its mirror.
+ */
+static gboolean is_symmetric(const warpexpr_t *expr)
+{
+	static const gint32 sizes[][4] = {
+		{ 320, 200, 0, 0 }, { 640, 480, 2, 2 }, { 1920, 1080, 4, 4 }, { 1280, 720, 0, 4 }
+	};
+	gfloat ax[2 * WARPEXPR_LANES], ay[2 * WARPEXPR_LANES];
+	gfloat bx[2 * WARPEXPR_LANES], by[2 * WARPEXPR_LANES];
+	gint32 i;
+	guint k;
+
+	for (i = 0; i < WARPEXPR_LANES; i++) {
+		const gfloat angle = 2.39996f * i, radius = 1.5f + 8.0f * i;
+
+		ax[i] = radius * cosf(angle);
+		ay[i] = radius * sinf(angle);
+		ax[WARPEXPR_LANES + i] = -ax[i];
+		ay[WARPEXPR_LANES + i] = -ay[i];
+	}
+	for (k = 0; k < G_N_ELEMENTS(sizes); k++) {
+		warpexpr_eval(expr, ax, ay, 2 * WARPEXPR_LANES, sizes[k][0], sizes[k][1],
+			      sizes[k][2], sizes[k][3], bx, by);
+		for (i = 0; i < WARPEXPR_LANES; i++)
+			if (!(fabsf(bx[i] + bx[WARPEXPR_LANES + i]) <= 0.001f * (1.0f + fabsf(bx[i]))) ||
+			    !(fabsf(by[i] + by[WARPEXPR_LANES + i]) <= 0.001f * (1.0f + fabsf(by[i]))))
+				return FALSE;
+	}
+	return TRUE;
+}
+
+gint32 compute_add_effect(warpexpr_t *expr)
+{
+	gint32 effect;
+
+	g_return_val_if_fail(expr != NULL, -1);
+
+	G_LOCK(shared_fields);
+	effect = effect_count;
+	if (effect == COMPUTE_MAX_EFFECTS) {
+		G_UNLOCK(shared_fields);
+		warpexpr_destroy(expr);
+		return -1;
+	}
+	expr_effects[effect] = expr;
+	if (is_symmetric(expr))
+		symmetric_effects |= 1u << effect;
+	g_atomic_int_set(&effect_count, effect + 1);
+	G_UNLOCK(shared_fields);
+	return effect;
+}
+
+guint32 compute_effect_count(void)
+{
+	return (guint32)g_atomic_int_get(&effect_count);
+}
+
+void compute_warp_params(guint32 effect, gint32 *p1, gint32 *p2)
+{
+	guint32 uses = 0;
+
+	if (effect < NB_FCT)
+		uses = effect_params[effect];
+	else if (effect < compute_effect_count())
+		uses = warpexpr_params(expr_effects[effect]);
+
+	*p1 = uses & 1 ? CLAMP(*p1, 0, COMPUTE_NB_PARAMS - 1) : COMPUTE_DEFAULT_PARAM;
+	*p2 = uses & 2 ? CLAMP(*p2, 0, COMPUTE_NB_PARAMS - 1) : COMPUTE_DEFAULT_PARAM;
+}
+
+vector_field_t *compute_vector_field_get(gint32 width, gint32 height, gint32 p1, gint32 p2,
+					 guint32 fieldless)
+{
+	const guint32 effects = ((1u << COMPUTE_MAX_EFFECTS) - 1) & ~(fieldless & FAST_WARP_EFFECTS);
+	vector_field_t *field;
+	GSList *l;
+
+	G_LOCK(shared_fields);
+	for (l = shared_fields; l != NULL; l = l->next) {
+		field = l->data;
+		if (field->width == width && field->height == height && field->p1 == p1 &&
+		    field->p2 == p2 && field->effects == effects) {
+			field->ref_count++;
+			G_UNLOCK(shared_fields);
+			return field;
+		}
+	}
+	field = vector_field_new(width, height, height / 2 + 1, 0);
+	field->p1 = p1;
+	field->p2 = p2;
+	field->effects = effects;
+	shared_fields = g_slist_prepend(shared_fields, field);
+	G_UNLOCK(shared_fields);
+	return field;
+}
+
+typedef struct {
+	vector_field_t *	vector_field;
+	guint32			effect;
+} prefetch_t;
+
+/* With the lock held */
+static void drop_prefetches(const vector_field_t *vector_field)
+{
+	GSList *l = prefetches;
+
+	while (l != NULL) {
+		prefetch_t *job = l->data;
+
+		l = l->next;
+		if (job->vector_field == vector_field) {
+			prefetches = g_slist_remove(prefetches, job);
+			g_free(job);
+		}
+	}
+}
+
+void compute_vector_field_unref(vector_field_t *vector_field)
 {
-	g_free(surface1);
-	g_free(surface2);
+	GThreadPool *pool = NULL;
+
+	g_return_if_fail(vector_field != NULL);
+
+	G_LOCK(shared_fields);
+	if (--vector_field->ref_count > 0) {
+		G_UNLOCK(shared_fields);
+		return;
+	}
+	/* Unlinked first, so that nobody gets it while the prefetcher ends */
+	shared_fields = g_slist_remove(shared_fields, vector_field);
+	drop_prefetches(vector_field);
+	while (vector_field->generating != 0)
+		g_cond_wait(&field_generated, &G_LOCK_NAME(shared_fields));
+	fields_bytes -= compute_vector_field_bytes(vector_field);
+	/* Its thread goes with the last field, before a plugin is unloaded */
+	if (shared_fields == NULL) {
+		pool = prefetcher;
+		prefetcher = NULL;
+	}
+	G_UNLOCK(shared_fields);
+	if (pool != NULL)
+		g_thread_pool_free(pool, TRUE, TRUE);
+	compute_vector_field_destroy(vector_field);
+}
+
+/*
+ * Generates effect in vector_field unless it has it. With the lock held,
+ * which is let go while generating: others asking for it wait for it.
+ */
+static void generate_effect(vector_field_t *vector_field, guint32 effect)
+{
+	const gint32 width = vector_field->width, height = vector_field->height;
+	const gint32 p1 = vector_field->p1, p2 = vector_field->p2;
+	compute_grid_t *grid = NULL;
+	t_interpol *vector = NULL;
+	compute_edges_t *edges = NULL;
+	GArray *misses = NULL;
+	gboolean pressure, sparse, mirror;
+
+	while (vector_field->generating & (1u << effect))
+		g_cond_wait(&field_generated, &G_LOCK_NAME(shared_fields));
+	if (!(vector_field->effects & (1u << effect)) || effect >= compute_effect_count() ||
+	    effect_bytes(vector_field, effect) > 0)
+		return;
+	pressure = under_pressure((gsize)width * height * sizeof(t_interpol));
+	sparse = make_smaller("INFINITY_SPARSE_FIELD", pressure);
+	mirror = (symmetric_effects & (1u << effect)) != 0 &&
+		 make_smaller("INFINITY_SYMMETRIC_FIELD", pressure);
+	vector_field->generating |= 1u << effect;
+	G_UNLOCK(shared_fields);
+
+	if (sparse)
+		grid = grid_for(effect, p1, p2, width, height);
+	if (grid == NULL) {
+		const gint32 rows = mirror ? vector_field->rows : height;
+
+		vector = g_new(t_interpol, (gsize)width * rows);
+		if (mirror && (ODD_EFFECTS & (1u << effect))) {
+			misses = g_array_new(FALSE, FALSE, sizeof(gint32));
+			mirrored_rows[effect](vector, misses, p1, p2, width, height, rows);
+		} else {
+			generate_vector(vector, effect, p1, p2, width, height, rows);
+		}
+		if (mirror)
+			edges = edges_new(vector, misses, effect, p1, p2, width, height, rows);
+		if (misses != NULL)
+			g_array_free(misses, TRUE);
+		if (mirror && edges == NULL) {
+			/* Not symmetric after all: the bottom rows are made too */
+			vector = g_renew(t_interpol, vector, (gsize)width * height);
+			generate_vector(vector, effect, p1, p2, width, height, height);
+		}
+	}
+
+	G_LOCK(shared_fields);
+	vector_field->grid[effect] = grid;
+	vector_field->vector[effect] = vector;
+	vector_field->edges[effect] = edges;
+	vector_field->generating &= ~(1u << effect);
+	fields_bytes += effect_bytes(vector_field, effect);
+	g_cond_broadcast(&field_generated);
+	evict();
+}
+
+void compute_vector_field_hold(vector_field_t *vector_field, guint32 effect)
+{
+	g_return_if_fail(vector_field != NULL && effect < COMPUTE_MAX_EFFECTS);
+
+	G_LOCK(shared_fields);
+	vector_field->holds[effect]++;
+	vector_field->used[effect] = ++fields_clock;
+	generate_effect(vector_field, effect);
+	G_UNLOCK(shared_fields);
+}
+
+/*
+ * Makes the latest prefetch, if those of its field were not dropped. Its
+ * field is only destroyed once it is no longer generating.
+ */
+static void prefetch(gpointer data, gpointer user_data)
+{
+	prefetch_t *job;
+
+	(void)data;
+	(void)user_data;
+	G_LOCK(shared_fields);
+	if (prefetches != NULL) {
+		job = prefetches->data;
+		prefetches = g_slist_remove(prefetches, job);
+		generate_effect(job->vector_field, job->effect);
+		g_free(job);
+	}
+	G_UNLOCK(shared_fields);
+}
+
+void compute_vector_field_prefetch(vector_field_t *vector_field, guint32 effect)
+{
+	prefetch_t *job;
+
+	g_return_if_fail(vector_field != NULL && effect < COMPUTE_MAX_EFFECTS);
+
+	job = g_new(prefetch_t, 1);
+	job->vector_field = vector_field;
+	job->effect = effect;
+	G_LOCK(shared_fields);
+	vector_field->holds[effect]++;
+	vector_field->used[effect] = ++fields_clock;
+	if (prefetcher == NULL)
+		prefetcher = g_thread_pool_new(prefetch, NULL, 1, FALSE, NULL);
+	prefetches = g_slist_prepend(prefetches, job);
+	g_thread_pool_push(prefetcher, GINT_TO_POINTER(1), NULL);
+	G_UNLOCK(shared_fields);
+}
+
+void compute_vector_field_release(vector_field_t *vector_field, guint32 effect)
+{
+	g_return_if_fail(vector_field != NULL && effect < COMPUTE_MAX_EFFECTS);
+
+	G_LOCK(shared_fields);
+	if (vector_field->holds[effect] > 0) {
+		vector_field->holds[effect]--;
+		vector_field->used[effect] = ++fields_clock;
+		evict();
+	}
+	G_UNLOCK(shared_fields);
+}
+
+void compute_fields_set_budget(gsize bytes)
+{
+	G_LOCK(shared_fields);
+	fields_budget_bytes = bytes;
+	budget_set = TRUE;
+	evict();
+	G_UNLOCK(shared_fields);
+}
+
+gsize compute_fields_trim(void)
+{
+	gsize freed;
+	GSList *l;
+	guint32 f;
+
+	G_LOCK(shared_fields);
+	freed = fields_bytes;
+	for (l = shared_fields; l != NULL; l = l->next) {
+		vector_field_t *field = l->data;
+
+		for (f = 0; f < COMPUTE_MAX_EFFECTS; f++)
+			if (field->holds[f] == 0)
+				free_effect(field, f);
+	}
+	freed -= fields_bytes;
+	G_UNLOCK(shared_fields);
+	return freed;
+}
+
+void compute_fields_pressure(void)
+{
+	G_LOCK(shared_fields);
+	pressure_until = g_get_monotonic_time() + COMPUTE_PRESSURE_USECS;
+	G_UNLOCK(shared_fields);
+}
+
+gsize compute_fields_bytes(void)
+{
+	gsize bytes;
+
+	G_LOCK(shared_fields);
+	bytes = fields_bytes;
+	G_UNLOCK(shared_fields);
+	return bytes;
 }
 
 void compute_generate_vector_field(vector_field_t *vector_field)
 {
-	guint32 f, i, _height;
+	guint32 f;
 
 	g_return_if_fail(vector_field != NULL);
 	g_return_if_fail(vector_field->height >= 0);
 
-	_height = (guint32)vector_field->height;
+	for (f = 0; f < compute_effect_count(); f++)
+		if (vector_field->vector[f] != NULL)
+			generate_vector(vector_field->vector[f], f, vector_field->p1, vector_field->p2,
+					vector_field->width, vector_field->height,
+					effect_rows(vector_field, f));
+}
+
+gint32 compute_kernel_count(void)
+{
+	return (gint32)G_N_ELEMENTS(kernels);
+}
+
+const compute_kernel_t *compute_kernel_info(gint32 kernel)
+{
+	g_return_val_if_fail(kernel >= 0 && kernel < compute_kernel_count(), NULL);
+
+	return &kernels[kernel];
+}
+
+void compute_set_kernel(compute_t *compute, gint32 kernel)
+{
+	g_return_if_fail(kernel >= 0 && kernel < compute_kernel_count());
+
+	compute->kernel = kernel;
+}
 
-	for (f = 0; f < NB_FCT; f++)
-		for (i = 0; i < _height; i += 10)
-			compute_generate_sector(f, f, 2, 2, i, 10, vector_field);
+gint32 compute_get_kernel(const compute_t *compute)
+{
+	return compute->kernel;
 }
 
-inline byte *compute_surface(t_interpol *vector, gint32 width, gint32 height)
+static void warp_reference(const t_interpol *vector, const byte *src, byte *dest,
+			   gint32 width, gint32 height)
 {
 	gint32 i, j;
 	gint32 add_dest = 0;
 	guint32 add_src;
-	t_interpol *interpol;
-	register byte *ptr_pix;
+	const t_interpol *interpol;
+	register const byte *ptr_pix;
 	guint32 color;
-	byte *ptr_swap;
 
 	for (j = 0; j < height; ++j)
 		for (i = 0; i < width; ++i) {
 			interpol = &vector[add_dest];
 			add_src = (interpol->coord & 0xFFFF) * width + (interpol->coord >> 16);
-			ptr_pix = &((byte *)surface1)[add_src];
+			ptr_pix = &src[add_src];
 			color = ((guint32)(*(ptr_pix)) * (interpol->weight >> 24)
 				 + (guint32)(*(ptr_pix + 1)) * ((interpol->weight & 0xFFFFFF) >> 16)
 				 + (guint32)(*(ptr_pix + width)) * ((interpol->weight & 0xFFFF) >> 8)
 				 + (guint32)(*(ptr_pix + width + 1)) * (interpol->weight & 0xFF)) >> 8;
 			if (color > 255)
-				surface2[add_dest] = (byte)255;
+				dest[add_dest] = (byte)255;
 			else
-				surface2[add_dest] = (byte)color;
+				dest[add_dest] = (byte)color;
 			++add_dest;
 		}
-	ptr_swap = surface2;
-	surface2 = surface1;
-	surface1 = ptr_swap;
+}
+
+/*
+ * Same as warp_reference() in a single loop and without clamping: the
+ * four weights of a vector add up to at most 249, so color stays below 256.
+ */
+static void warp_flat(const t_interpol *vector, const byte *src, byte *dest,
+		      gint32 width, gint32 height)
+{
+	const gsize n = (gsize)width * height;
+	gsize i;
+
+	for (i = 0; i < n; i++) {
+		const guint32 coord = vector[i].coord;
+		const guint32 weight = vector[i].weight;
+		const byte *p = src + (coord & 0xFFFF) * width + (coord >> 16);
+
+		dest[i] = (byte)((p[0] * (weight >> 24) + p[1] * ((weight >> 16) & 0xFF)
+				  + p[width] * ((weight >> 8) & 0xFF) + p[width + 1] * (weight & 0xFF)) >> 8);
+	}
+}
+
+inline byte *compute_surface(compute_t *compute, const t_interpol *vector)
+{
+	byte *ptr_swap;
+
+	kernels[compute->kernel].warp(vector, compute->surface1, compute->surface2,
+				      compute->width, compute->height);
+	ptr_swap = compute->surface2;
+	compute->surface2 = compute->surface1;
+	compute->surface1 = ptr_swap;
+
+	return compute->surface1;
+}
+
+gboolean compute_has_fast_warp(guint32 effect)
+{
+	return effect < NB_FCT && (FAST_WARP_EFFECTS & (1u << effect)) != 0;
+}
+
+/*
+ * Effects 3 and 4 turn or scale each point by amounts of its distance to
+ * the center alone, which take a square root and a sine or more: their
+ * table holds them for each point of a quarter of the surface, worked out
+ * as warp_at() does, and the other quarters mirror it. Effect 3 has the
+ * cosine and the sine of its angle there, effect 4 its speed.
+ */
+static const gfloat *radial_table(compute_t *compute, guint32 effect)
+{
+	const gint32 columns = compute->width / 2 + 1, rows = compute->height / 2 + 1;
+	gfloat *table;
+	gint32 x, y;
+
+	if (effect != 3 && effect != 4)
+		return NULL;
+	if (compute->radial[effect] != NULL)
+		return compute->radial[effect];
+
+	table = g_new(gfloat, (effect == 3 ? 2 : 1) * (gsize)columns * rows);
+	for (y = 0; y < rows; y++)
+		for (x = 0; x < columns; x++) {
+			const gfloat d = (gfloat)x * (gfloat)x + (gfloat)y * (gfloat)y;
+			const gsize i = (gsize)y * columns + x;
+			gfloat an;
+
+			if (effect == 3) {
+				an = turn_angle(d);
+				table[2 * i] = cos(an);
+				table[2 * i + 1] = sin(an);
+			} else {
+				table[i] = radial_speed(d);
+			}
+		}
+	compute->radial[effect] = table;
+	return table;
+}
+
+/*
+ * Row cy of the vector of effect n, the very one rows_of() makes, but
+ * with the angle of effect 3 and the speed of effect 4 read from their
+ * table.
+ */
+static inline void exact_row_of(t_interpol *row, const guint32 n, const warp_consts_t *k,
+				const gfloat *table, gint32 cy, gint32 width, gint32 height)
+{
+	const gfloat half_width = width / 2, half_height = height / 2;
+	const gfloat max_x = (gfloat)width - 1, max_y = (gfloat)height - 1;
+	const gfloat ay = (gfloat)cy - half_height;
+	const gint32 columns = width / 2 + 1;
+	const gfloat *quarter = table == NULL ? NULL :
+		table + (n == 3 ? 2 : 1) * (gsize)ABS(cy - height / 2) * columns;
+	gint32 cx;
+
+	for (cx = 0; cx < width; cx++) {
+		const t_complex a = { (gfloat)cx - half_width, ay };
+		const gint32 x = ABS(cx - width / 2);
+		t_complex b;
+
+		if (n == 3)
+			b = turn_and_scale(a, n, quarter[2 * x], quarter[2 * x + 1],
+					   k->circle_size, k->speed);
+		else if (n == 4)
+			b = turn_and_scale(a, n, k->co, k->si, k->circle_size, quarter[x]);
+		else
+			b = warp_at(a, n, k);
+		row[cx] = source_interpol(b, half_width, half_height, max_x, max_y);
+	}
+}
+
+typedef void (*exact_row_func)(t_interpol *row, const warp_consts_t *k, const gfloat *table,
+			       gint32 cy, gint32 width, gint32 height);
+
+#define SPECIALIZE_ROW(n) \
+static void exact_row_##n(t_interpol *row, const warp_consts_t *k, const gfloat *table, \
+			  gint32 cy, gint32 width, gint32 height) \
+{ \
+	exact_row_of(row, n, k, table, cy, width, height); \
+}
+
+SPECIALIZE_ROW(0)
+SPECIALIZE_ROW(1)
+SPECIALIZE_ROW(2)
+SPECIALIZE_ROW(3)
+SPECIALIZE_ROW(4)
+SPECIALIZE_ROW(5)
+
+static const exact_row_func exact_rows[FAST_WARP_ANGULAR] = {
+	exact_row_0, exact_row_1, exact_row_2, exact_row_3, exact_row_4, exact_row_5,
+};
+
+/*
+ * Effect 6 scales by 1 + 0.02 cos(6 atan(x / y)) after turning by a fixed
+ * angle: with c^2 = cos^2(atan(x / y)) = y^2 / (x^2 + y^2), cos(6 atan)
+ * is the Chebyshev polynomial 32 c^6 - 48 c^4 + 18 c^2 - 1, so the row
+ * needs neither atan() nor cos(), only a division per pixel.
+ */
+static void angular_row(t_interpol *row, gint32 cy, gint32 width, gint32 height)
+{
+	const gfloat co = cosf(0.002f), si = sinf(0.002f);
+	const gfloat ay = (gfloat)cy - height / 2;
+	const gfloat dy = ay + 0.00001f;
+	gint32 cx;
+
+	for (cx = 0; cx < width; cx++) {
+		const gfloat ax = (gfloat)(cx - width / 2);
+		const gfloat c2 = dy * dy / (dy * dy + ax * ax);
+		const gfloat fact = 1.0f + (((32.0f * c2 - 48.0f) * c2 + 18.0f) * c2 - 1.0f) * 0.02f;
+
+		row[cx] = interpol_at((co * ax - si * ay) * fact, (si * ax + co * ay) * fact,
+				      width, height);
+	}
+}
+
+/*
+ * The row is interpolated between the two rows of the grid around it,
+ * then linearly between the points of the result, into points: its
+ * source points, made into vectors in a loop of their own.
+ */
+static void grid_row(const compute_grid_t *grid, gfloat *points, t_interpol *row, gint32 cy,
+		     gint32 width, gint32 height)
+{
+	const gint32 step = grid->step, i = cy / step;
+	const gfloat fy = (gfloat)(cy - i * step) / step;
+	const gfloat *top = grid->points + 2 * i * grid->columns;
+	const gfloat *bottom = top + 2 * grid->columns;
+	gfloat *xs = points + 2 * grid->columns, *ys = xs + width;
+	gint32 j, k, cx;
+
+	for (j = 0; j < 2 * grid->columns; j++)
+		points[j] = top[j] + fy * (bottom[j] - top[j]);
+	for (j = 0, cx = 0; cx < width; j++) {
+		const gfloat x = points[2 * j], y = points[2 * j + 1];
+		const gfloat dx = (points[2 * j + 2] - x) / step, dy = (points[2 * j + 3] - y) / step;
+		const gint32 n = MIN(step, width - cx);
+
+		for (k = 0; k < n; k++) {
+			xs[cx + k] = x + k * dx;
+			ys[cx + k] = y + k * dy;
+		}
+		cx += n;
+	}
+	for (cx = 0; cx < width; cx++)
+		row[cx] = interpol_at(xs[cx], ys[cx], width, height);
+}
+
+/*
+ * The vectors of a row are made in a buffer that stays in the first
+ * level cache, then warped through by the kernel of compute.
+ */
+static gboolean warp_fast(compute_t *compute, guint32 effect, gint32 p1, gint32 p2,
+			  const byte *src, byte *dest)
+{
+	const gint32 width = compute->width, height = compute->height;
+	const compute_warp_func warp = kernels[compute->kernel].warp;
+	const warp_consts_t k = warp_consts(effect, p1, p2, height);
+	const gfloat *table;
+	gint32 cy;
+
+	if (!compute_has_fast_warp(effect))
+		return FALSE;
+	table = radial_table(compute, effect);
+	for (cy = 0; cy < height; cy++) {
+		if (effect == FAST_WARP_ANGULAR)
+			angular_row(compute->row, cy, width, height);
+		else
+			exact_rows[effect](compute->row, &k, table, cy, width, height);
+		warp(compute->row, src, dest + (gsize)cy * width, width, 1);
+	}
+	return TRUE;
+}
+
+gboolean compute_warp_fast(compute_t *compute, guint32 effect, const byte *src, byte *dest)
+{
+	return warp_fast(compute, effect, COMPUTE_DEFAULT_PARAM, COMPUTE_DEFAULT_PARAM, src, dest);
+}
+
+/*
+ * Row cy of the bottom half of a mirrored vector: the mirror of the top
+ * half, but for its edges.
+ */
+static void mirror_row(const vector_field_t *vector_field, guint32 effect, t_interpol *row,
+		       gint32 cy)
+{
+	const gint32 width = vector_field->width, height = vector_field->height;
+	const compute_edges_t *edges = vector_field->edges[effect];
+	const gint32 *starts = edges->starts + (cy - vector_field->rows);
+	const t_interpol *mirrored = mirrored_row(vector_field->vector[effect], cy, width, height);
+	gint32 cx, i;
+
+	for (cx = width % 2 == 0 ? 1 : 0; cx < width; cx++)
+		row[cx] = mirror_interpol(mirrored[-cx], width, height);
+	for (i = starts[0]; i < starts[1]; i++)
+		row[edges->columns[i]] = edges->vectors[i];
+}
+
+gboolean compute_warp_effect(compute_t *compute, const vector_field_t *vector_field,
+			     guint32 effect, const byte *src, byte *dest)
+{
+	const gint32 width = compute->width, height = compute->height;
+	const compute_warp_func warp = kernels[compute->kernel].warp;
+	const compute_grid_t *grid = vector_field->grid[effect];
+	const gint32 rows = effect_rows(vector_field, effect);
+	gint32 cy;
+
+	if (vector_field->vector[effect] != NULL) {
+		warp(vector_field->vector[effect], src, dest, width, MIN(rows, height));
+		for (cy = rows; cy < height; cy++) {
+			mirror_row(vector_field, effect, compute->row, cy);
+			warp(compute->row, src, dest + (gsize)cy * width, width, 1);
+		}
+		return TRUE;
+	}
+	if (grid == NULL)
+		return warp_fast(compute, effect, vector_field->p1, vector_field->p2, src, dest);
+	for (cy = 0; cy < height; cy++) {
+		grid_row(grid, compute->grid_row, compute->row, cy, width, height);
+		warp(compute->row, src, dest + (gsize)cy * width, width, 1);
+	}
+	return TRUE;
+}
+
+byte *compute_surface_effect(compute_t *compute, const vector_field_t *vector_field,
+			     guint32 effect)
+{
+	byte *ptr_swap;
 
-	return surface1;
+	compute_warp_effect(compute, vector_field, effect, compute->surface1, compute->surface2);
+	ptr_swap = compute->surface2;
+	compute->surface2 = compute->surface1;
+	compute->surface1 = ptr_swap;
+	return compute->surface1;
 }
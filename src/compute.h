@@ -18,10 +18,41 @@
 
 #include <glib.h>
 #include "types.h"
+#include "warpexpr.h"
 
-#define NB_FCT 7
+#define NB_FCT 7 /* built-in effects */
 #define PI 3.14159
 
+/* The built-in effects, then those of compute_add_effect() */
+#define COMPUTE_MAX_EFFECTS 16
+
+/*
+ * Adds an effect warping as expr does, which it takes: returns its
+ * number, -1 if there are COMPUTE_MAX_EFFECTS already. Effects are added
+ * before any field is made.
+ */
+gint32 compute_add_effect(warpexpr_t *expr);
+
+/*
+ * NB_FCT, and the effects added.
+ */
+guint32 compute_effect_count(void);
+
+/*
+ * The effects turn by an angle set by a rotation p1 and move at a speed
+ * p2, both from 0 to COMPUTE_NB_PARAMS - 1. Effects 0 and 1 use both,
+ * effect 2 the speed only and the others neither.
+ */
+#define COMPUTE_NB_PARAMS	5
+#define COMPUTE_DEFAULT_PARAM	2
+
+/*
+ * Clamps p1 and p2 for effect, and replaces those it does not use by
+ * COMPUTE_DEFAULT_PARAM: the parameters of effect that give the same
+ * warp get the same values.
+ */
+void compute_warp_params(guint32 effect, gint32 *p1, gint32 *p2);
+
 /*
  * Represents the interpollation information.
  */
@@ -31,47 +62,244 @@ typedef struct {
 } t_interpol;
 
 /*
- * Represents a field of interpollation vectors.
- *
- * Warning: don't use width*height*sizeof(::t_interpol) for
- * to calculate the memory size of an object of this type
- * because this is actually not true.
+ * The source points of an effect, relative to the center, on a grid of
+ * step pixels from the top left corner: the warp interpolates them
+ * bilinearly for the pixels in between.
+ */
+typedef struct {
+	gint32		step;
+	gint32		columns; /* (width - 1) / step + 2 */
+	gint32		rows;    /* (height - 1) / step + 2 */
+	gfloat *	points;  /* x and y of each point, row by row */
+} compute_grid_t;
+
+/*
+ * The vectors of the bottom rows of a mirrored vector that the mirror of
+ * the top rows does not give, row by row from the first mirrored one:
+ * those of the pixels whose source is next to an edge.
+ */
+typedef struct {
+	gint32 *	starts;  /* of the entries of each row, then their end */
+	gint32 *	columns; /* of each entry */
+	t_interpol *	vectors; /* of each entry */
+} compute_edges_t;
+
+/*
+ * Largest difference, in levels, between the warp through a mirrored
+ * vector and through the exact one.
+ */
+#define COMPUTE_MIRROR_TOLERANCE 3
+
+/*
+ * Largest distance, in source pixels, between a point interpolated on a
+ * grid and the exact one for a grid to stand for the vector of an effect.
+ */
+#define COMPUTE_GRID_TOLERANCE 0.125f
+
+/*
+ * Represents a field of interpollation vectors, one vector of
+ * width * height ::t_interpol per effect, or a grid of its points, with
+ * the same parameters for every effect.
  */
 typedef struct {
 	gint32		width;  /* number of vectors */
 	gint32		height; /* length of each vector */
-	t_interpol *	vector; /* pointer to the vector field */
+	gint32		p1, p2; /* COMPUTE_DEFAULT_PARAM but for compute_vector_field_get() */
+	gint32		rows; /* of each mirrored vector, height / 2 + 1: the other rows mirror these */
+	t_interpol *	vector[COMPUTE_MAX_EFFECTS]; /* per effect, NULL for those warped without it */
+	compute_grid_t *grid[COMPUTE_MAX_EFFECTS]; /* per effect, instead of the vector */
+	compute_edges_t *edges[COMPUTE_MAX_EFFECTS]; /* per effect whose vector is mirrored */
+	gint		ref_count; /* of fields from compute_vector_field_get() */
+	/* Of fields from compute_vector_field_get() only */
+	guint32		effects; /* that it can hold */
+	guint32		generating; /* effects being generated, without the lock */
+	gint		holds[COMPUTE_MAX_EFFECTS]; /* compute_vector_field_hold() calls not released */
+	guint64		used[COMPUTE_MAX_EFFECTS]; /* when each was last held or released */
 } vector_field_t;
 
 /*
- * The constructor of the ::vector_field_t type.
+ * The constructor of the ::vector_field_t type, with the vectors of
+ * every effect.
  */
 vector_field_t *compute_vector_field_new(int width, int height);
 
+/*
+ * Same, with the vectors of the effects in the bit mask effects only.
+ */
+vector_field_t *compute_vector_field_new_for(gint32 width, gint32 height, guint32 effects);
+
 /*
  * The destructor of the ::vector_field_t type.
  *
  * @param vector_field Must be non NULL pointer to a
- * ::vector_field_t object.
+ * ::vector_field_t object obtained from compute_vector_field_new().
  */
 void compute_vector_field_destroy(vector_field_t *vector_field);
 
+void compute_generate_vector_field(vector_field_t *vector_field);
+
+/*
+ * Returns a read-only field of the given size and parameters, shared
+ * with every other caller asking for the same size, parameters and
+ * fieldless effects, with no vector yet: see compute_vector_field_hold().
+ * Release it with compute_vector_field_unref(). Can be called from any
+ * thread.
+ *
+ * Ask for the parameters given by compute_warp_params() for the effects
+ * that are to be held, so that the effects ignoring them share a field.
+ *
+ * It has no vector for the effects in the bit mask fieldless that have a
+ * fast path: compute_surface_effect() computes their warp every frame.
+ * The other effects get the coarsest grid within COMPUTE_GRID_TOLERANCE
+ * of their vector instead of it, if any, when it is generated under
+ * pressure: when it would not fit the budget with the vectors held, or
+ * after compute_fields_pressure(). INFINITY_SPARSE_FIELD set to "on" or
+ * "off" makes them always or never use one. Without a grid, the vectors
+ * of the effects found symmetric through the center then only keep the
+ * top half of the rows, which the bottom half mirrors, and the edges,
+ * the vectors the mirror does not give within COMPUTE_MIRROR_TOLERANCE:
+ * INFINITY_SYMMETRIC_FIELD likewise makes them always or never do.
+ */
+vector_field_t *compute_vector_field_get(gint32 width, gint32 height, gint32 p1, gint32 p2,
+					 guint32 fieldless);
+void compute_vector_field_unref(vector_field_t *vector_field);
+
+/*
+ * Generates the vector or grid of effect in a field from
+ * compute_vector_field_get(), unless it has it, and keeps it until
+ * compute_vector_field_release(). Holding the next effect before
+ * switching to it prefetches it.
+ *
+ * Released vectors stay cached while all the fields take less than a
+ * budget, INFINITY_FIELD_BUDGET megabytes, 128 by default: past it the
+ * least recently used ones nobody holds are freed, and generated again
+ * by the next hold. Those held are kept whatever the budget.
+ */
+void compute_vector_field_hold(vector_field_t *vector_field, guint32 effect);
+void compute_vector_field_release(vector_field_t *vector_field, guint32 effect);
+
+/*
+ * Holds effect like compute_vector_field_hold(), but returns right away
+ * and generates it in a thread of its own, for the next hold. The
+ * prefetches not made yet are dropped with the field, and the thread
+ * goes with the last field.
+ */
+void compute_vector_field_prefetch(vector_field_t *vector_field, guint32 effect);
+
+/*
+ * Replaces the budget, in bytes, freeing what is past it.
+ */
+void compute_fields_set_budget(gsize bytes);
+
+/*
+ * Frees the vectors of all the fields that nobody holds, and returns the
+ * bytes freed.
+ */
+gsize compute_fields_trim(void);
+
+/*
+ * Makes the fields generated for the next COMPUTE_PRESSURE_USECS as small
+ * as they can be, as memory is short.
+ */
+#define COMPUTE_PRESSURE_USECS	60000000
+void compute_fields_pressure(void);
+
 /*
- * It frees any allocated resource and mades clenaup work.
+ * Bytes taken by the vectors of all the fields from
+ * compute_vector_field_get().
  */
-void compute_quit(void);
+gsize compute_fields_bytes(void);
 
-void compute_init(gint32 width, gint32 height, gint32 scale);
+/*
+ * Bytes taken by the vectors of vector_field.
+ */
+gsize compute_vector_field_bytes(const vector_field_t *vector_field);
+
+/*
+ * The warp state of one engine instance: the two surfaces
+ * compute_surface() swaps, and the kernel it uses.
+ */
+typedef struct _compute compute_t;
+
+compute_t *compute_new(gint32 width, gint32 height);
+void compute_destroy(compute_t *compute);
 
 /*
- * Tell the module that the screen has been resized.
+ * Reallocates the surfaces, which get cleared.
+ */
+void compute_resize(compute_t *compute, gint32 width, gint32 height);
+
+/*
+ * An implementation of the warp done by compute_surface(): it reads the
+ * (width + 1) * (height + 1) surface src through vector and writes the
+ * width * height first bytes of dest.
+ */
+typedef void (*compute_warp_func)(const t_interpol *vector, const byte *src, byte *dest,
+				  gint32 width, gint32 height);
+
+typedef struct {
+	const gchar *		name;
+	compute_warp_func	warp;
+	gint32			tolerance; /* max difference per pixel to "reference", 0 if bit-exact */
+} compute_kernel_t;
+
+/*
+ * Kernels are numbered from 0, which is the reference implementation,
+ * to compute_kernel_count() - 1.
+ */
+gint32 compute_kernel_count(void);
+const compute_kernel_t *compute_kernel_info(gint32 kernel);
+
+/*
+ * Selects the kernel used by compute_surface(), "reference" by default.
+ */
+void compute_set_kernel(compute_t *compute, gint32 kernel);
+gint32 compute_get_kernel(const compute_t *compute);
+
+/*
+ * Warps the last surface through vector, which has the size of compute,
+ * and returns the result.
+ */
+byte *compute_surface(compute_t *compute, const t_interpol *vector);
+
+/*
+ * Fast paths: the built-in effects compute their source coordinates
+ * along each row instead of reading them from the field. Those in
+ * COMPUTE_EXACT_FAST_WARPS make the very vectors of the field; the
+ * angular effect 6 approximates its angle, and differs from the field by
+ * at most COMPUTE_FAST_WARP_TOLERANCE per pixel, in a few pixels in a
+ * hundred.
  *
- * Warning: may be this will be deprecated.
+ * Which effects use them is up to the caller, see
+ * compute_vector_field_get().
  */
-void compute_resize(gint32 width, gint32 height);
+#define COMPUTE_EXACT_FAST_WARPS ((1u << 6) - 1)
+#define COMPUTE_FAST_WARP_TOLERANCE 3
 
-void compute_generate_vector_field(vector_field_t *vector_field);
+gboolean compute_has_fast_warp(guint32 effect);
+
+/*
+ * Warps the width * height first bytes of src, of size (width + 1) *
+ * (height + 1), into dest with the fast path of effect with the default
+ * parameters, for the size of compute. Returns FALSE when effect has
+ * none.
+ */
+gboolean compute_warp_fast(compute_t *compute, guint32 effect, const byte *src, byte *dest);
 
-byte *compute_surface(t_interpol *vector, gint32 width, gint32 height);
+/*
+ * Warps src into dest, as compute_warp_fast() does, for effect with the
+ * parameters of vector_field: through its vector or its grid in
+ * vector_field, or with its fast path when the field has neither.
+ * Returns FALSE when effect has none of them.
+ */
+gboolean compute_warp_effect(compute_t *compute, const vector_field_t *vector_field,
+			     guint32 effect, const byte *src, byte *dest);
+
+/*
+ * Warps the last surface for effect with compute_warp_effect(), and
+ * returns the result.
+ */
+byte *compute_surface_effect(compute_t *compute, const vector_field_t *vector_field,
+			     guint32 effect);
 
 #endif /* __INFINITY_COMPUTE__ */
@@ -19,6 +19,9 @@
 #include <glib.h>
 #include "config.h"
 #include "display.h"
+#include "hud.h"
+#include "metrics.h"
+#include "perfcount.h"
 #include "types.h"
 #include "ui.h"
 
@@ -30,59 +33,72 @@ typedef struct sincos {
 	gfloat *f;
 } sincos_t;
 
-static gint16 pcm_data[2][512];
-G_LOCK_DEFINE_STATIC(pcm_data);
-
-static gint32 width, height, scale;
-
-/* Little optimization for cos/sin functions */
-static sincos_t cosw = { 0, NULL };
-static sincos_t sinw = { 0, NULL };
-
-static vector_field_t *vector_field;
-static GMutex render_mutex;
-
-static guint16 *render_buffer;
-
 typedef struct {
 	guint8 r;
 	guint8 g;
 	guint8 b;
 } color_entry_t;
 
+/* Shared by all displays, generated by the first one */
 static color_entry_t color_table[NB_PALETTES][256];
-static gint16 current_colors[256];
-
-static byte *surface1;
-static Player *player;
-
-static gchar error_msg[256];
-static gboolean initialized;
-static gboolean pending_resize;
-static gint32 pending_width;
-static gint32 pending_height;
-static gboolean window_closed;
-static gboolean visible;
-
-static gboolean allocate_render_buffer() {
-	g_free(render_buffer);
-	render_buffer = g_new0(guint16, width * height);
-	if (render_buffer == NULL) {
-		g_snprintf(error_msg, 256, "Infinity cannot allocate render buffer");
-		player->notify_critical_error(error_msg);
-		return FALSE;
-	}
-	return TRUE;
-}
+static gboolean colors_generated;
+G_LOCK_DEFINE_STATIC(color_table);
 
-static gboolean ui_init_window()
+/* The display shown in the UI window, target of display_notify_*() */
+static display_t *ui_display;
+
+/*
+ * A field shared with the displays of the same size and parameters, and
+ * the effect held in it.
+ */
+typedef struct {
+	vector_field_t *vector_field; /* NULL if none */
+	guint32		effect;
+} held_field_t;
+
+struct _display {
+	gint32		width, height, scale;
+	Player *	player;
+
+	gint16		pcm_data[2][512];
+	GMutex		pcm_mutex;
+	/* Snapshot of pcm_data taken by the frame being drawn */
+	gint16		frame_pcm[2][512];
+
+	/* Little optimization for cos/sin functions */
+	sincos_t	cosw;
+	sincos_t	sinw;
+
+	held_field_t	current; /* of the effect of display_blur(), got on first use */
+	held_field_t	next; /* of the effect of display_prefetch() */
+	guint32		fieldless; /* effects warped without a field */
+	compute_t *	compute;
+	GMutex		render_mutex;
+	gint16		current_colors[256];
+	byte *		surface1;
+
+	gchar		error_msg[256];
+	gboolean	pending_resize;
+	gint32		pending_width;
+	gint32		pending_height;
+	gboolean	window_closed;
+	gboolean	visible;
+	gboolean	offscreen;
+	gboolean	hud_visible;
+	hud_t *		hud;
+
+	metrics_t *	metrics;
+	perfcount_t *	perfcount;
+};
+
+static gboolean ui_init_window(display_t *display)
 {
-	if (! ui_init(width, height)) {
-		g_snprintf(error_msg, 256, "Infinity cannot initialize UI window");
-		player->notify_critical_error(error_msg);
+	if (! ui_init(display->width, display->height)) {
+		g_snprintf(display->error_msg, 256, "Infinity cannot initialize UI window");
+		display->player->notify_critical_error(display->error_msg);
 		return FALSE;
 	}
-	return allocate_render_buffer();
+	return TRUE;
 }
 
 static void generate_colors()
@@ -106,21 +122,117 @@ static void generate_colors()
 	}
 }
 
-static void display_surface()
+static inline guint8 expand5(guint16 c)
 {
+	return (guint8)((c << 3) | (c >> 2));
+}
+
+static inline guint8 expand6(guint16 c)
+{
+	return (guint8)((c << 2) | (c >> 4));
+}
+
+gint32 display_format_bytes(infinity_format_t format)
+{
+	static const gint32 bytes[INFINITY_NB_FORMATS] = { 2, 3, 4, 4 };
+
+	g_return_val_if_fail(format >= 0 && format < INFINITY_NB_FORMATS, 0);
+	return bytes[format];
+}
+
+void display_map_frame(display_t *display, gpointer pixels, gint32 stride,
+		       infinity_format_t format)
+{
+	const gint32 width = display->width, height = display->height;
+	const byte *psrc = display->surface1;
+	gint64 t_begin;
 	gint32 i, j;
-	byte *psrc;
 
-	psrc = surface1;
-	for (i = 0; i < height; i++) {
-		guint16 *pdest = render_buffer + (i * width);
-		for (j = 0; j < width; j++) {
-			*pdest++ = current_colors[*psrc++];
+	g_return_if_fail(stride >= width * display_format_bytes(format));
+
+	t_begin = g_get_monotonic_time();
+	perfcount_begin(display->perfcount, PERFCOUNT_SURFACE);
+	if (format == INFINITY_FORMAT_RGB565) {
+		for (i = 0; i < height; i++) {
+			guint16 *pdest = (guint16 *)((guint8 *)pixels + (gsize)i * stride);
+			for (j = 0; j < width; j++) {
+				*pdest++ = display->current_colors[*psrc++];
+			}
+		}
+	} else if (format == INFINITY_FORMAT_RGB24) {
+		guint8 lut[256][3];
+
+		for (i = 0; i < 256; i++) {
+			const guint16 c = (guint16)display->current_colors[i];
+
+			lut[i][0] = expand5(c >> 11);
+			lut[i][1] = expand6((c >> 5) & 0x3F);
+			lut[i][2] = expand5(c & 0x1F);
+		}
+		for (i = 0; i < height; i++) {
+			guint8 *pdest = (guint8 *)pixels + (gsize)i * stride;
+			for (j = 0; j < width; j++, pdest += 3) {
+				const guint8 *rgb = lut[*psrc++];
+
+				pdest[0] = rgb[0];
+				pdest[1] = rgb[1];
+				pdest[2] = rgb[2];
+			}
+		}
+	} else {
+		const gint32 red_shift = format == INFINITY_FORMAT_XRGB32 ? 16 : 0;
+		guint32 lut[256];
+
+		for (i = 0; i < 256; i++) {
+			const guint16 c = (guint16)display->current_colors[i];
+
+			lut[i] = 0xFF000000u | ((guint32)expand5(c >> 11) << red_shift)
+				 | ((guint32)expand6((c >> 5) & 0x3F) << 8)
+				 | ((guint32)expand5(c & 0x1F) << (16 - red_shift));
+		}
+		for (i = 0; i < height; i++) {
+			guint32 *pdest = (guint32 *)((guint8 *)pixels + (gsize)i * stride);
+			for (j = 0; j < width; j++) {
+				*pdest++ = lut[*psrc++];
+			}
 		}
 	}
-	ui_present(render_buffer, width, height);
+	perfcount_end(display->perfcount, PERFCOUNT_SURFACE);
+	metrics_record(display->metrics, METRICS_PALETTE, g_get_monotonic_time() - t_begin);
+}
+
+void display_present(display_t *display, guint16 *frame)
+{
+	const gint64 t_begin = g_get_monotonic_time();
+
+	g_return_if_fail(!display->offscreen);
+
+	if (display->hud_visible)
+		hud_draw(display->hud, frame, display->width, display->height, display->metrics,
+			 compute_get_kernel(display->compute),
+			 compute_fields_bytes());
+	ui_present(frame, display->width, display->height);
+	metrics_record(display->metrics, METRICS_PRESENT, g_get_monotonic_time() - t_begin);
 }
 
+gpointer display_acquire_frame(display_t *display, infinity_format_t *format, gint32 *stride)
+{
+	g_return_val_if_fail(!display->offscreen, NULL);
+
+	if (display->hud_visible)
+		return NULL;
+	return ui_acquire_frame(display->width, display->height, format, stride);
+}
+
+void display_present_acquired(display_t *display)
+{
+	const gint64 t_begin = g_get_monotonic_time();
+
+	ui_present_acquired();
+	metrics_record(display->metrics, METRICS_PRESENT, g_get_monotonic_time() - t_begin);
+}
+
+/* plot1() and plot2() draw on surface1, of size width x height, in scope */
 #define plot1(x, y, c) \
 \
 	if ((x) > 0 && (x) < width - 3 && (y) > 0 && (y) < height - 3) \
@@ -144,8 +256,10 @@ static void display_surface()
 	y ^= x; \
 	x ^= y;
 
-static void line(gint32 x1, gint32 y1, gint32 x2, gint32 y2, gint32 c)
+static void line(display_t *display, gint32 x1, gint32 y1, gint32 x2, gint32 y2, gint32 c)
 {
+	const gint32 width = display->width, height = display->height;
+	byte *surface1 = display->surface1;
 	gint32 dx, dy, cxy, dxy;
 
 	/* calculate the distances */
@@ -192,100 +306,188 @@ static void line(gint32 x1, gint32 y1, gint32 x2, gint32 y2, gint32 c)
 	}
 }
 
-static void ui_quit_window() {
-	g_free(render_buffer);
-	render_buffer = NULL;
-	ui_quit();
+static void drop_held(held_field_t *held)
+{
+	if (held->vector_field == NULL)
+		return;
+	compute_vector_field_release(held->vector_field, held->effect);
+	compute_vector_field_unref(held->vector_field);
+	held->vector_field = NULL;
 }
 
-gboolean display_init(gint32 _width, gint32 _height, gint32 _scale, Player *_player)
+static gboolean is_held(const held_field_t *held, guint32 effect, gint32 p1, gint32 p2)
 {
-	width = _width;
-	height = _height;
-	scale = _scale;
-	player = _player;
-	pending_resize = FALSE;
-	window_closed = FALSE;
-	visible = TRUE;
-	g_mutex_init(&render_mutex);
+	return held->vector_field != NULL && held->effect == effect &&
+	       held->vector_field->p1 == p1 && held->vector_field->p2 == p2;
+}
 
-	if (! effects_load_effects(player)) {
-		return FALSE;
+/*
+ * Holds effect with p1 and p2 in held instead of what it held, generating
+ * it right away or in the background. With the render mutex held.
+ */
+static void hold(display_t *display, held_field_t *held, guint32 effect, gint32 p1, gint32 p2,
+		 gboolean background)
+{
+	vector_field_t *vector_field = compute_vector_field_get(display->width, display->height,
+								p1, p2, display->fieldless);
+
+	if (background)
+		compute_vector_field_prefetch(vector_field, effect);
+	else
+		compute_vector_field_hold(vector_field, effect);
+	drop_held(held);
+	held->vector_field = vector_field;
+	held->effect = effect;
+}
+
+/* With the render mutex held */
+static void drop_field(display_t *display)
+{
+	drop_held(&display->current);
+	drop_held(&display->next);
+}
+
+display_t *display_new(gint32 width, gint32 height, gint32 scale, Player *player,
+		       gboolean offscreen)
+{
+	display_t *display;
+
+	g_return_val_if_fail(player != NULL, NULL);
+
+	if (! effects_load_effects(player))
+		return NULL;
+	if (!offscreen && ui_display != NULL) {
+		g_critical("Infinity: the UI window already shows another display");
+		return NULL;
 	}
-	if (! ui_init_window()) {
-		ui_quit_window();
-		return FALSE;
+	display = g_new0(display_t, 1);
+	display->width = width;
+	display->height = height;
+	display->scale = scale;
+	display->player = player;
+	display->visible = TRUE;
+	display->offscreen = offscreen;
+	g_mutex_init(&display->pcm_mutex);
+	g_mutex_init(&display->render_mutex);
+	if (!offscreen) {
+		if (! ui_init_window(display)) {
+			ui_quit();
+			g_mutex_clear(&display->pcm_mutex);
+			g_mutex_clear(&display->render_mutex);
+			g_free(display);
+			return NULL;
+		}
+		ui_display = display;
 	}
-	compute_init(width, height, scale);
-	generate_colors();
-	vector_field = compute_vector_field_new(width, height);
-	compute_generate_vector_field(vector_field);
-	initialized = TRUE;
-	return TRUE;
+	G_LOCK(color_table);
+	if (!colors_generated) {
+		generate_colors();
+		colors_generated = TRUE;
+	}
+	G_UNLOCK(color_table);
+	display->compute = compute_new(width, height);
+	display->hud = hud_new();
+	return display;
 }
 
-void display_quit(void)
+void display_destroy(display_t *display)
 {
-	if (! initialized)
-		return;
-	g_mutex_lock(&render_mutex);
-	compute_vector_field_destroy(vector_field);
-	compute_quit();
-	ui_quit_window();
-	g_mutex_unlock(&render_mutex);
-	g_mutex_clear(&render_mutex);
-	initialized = FALSE;
+	g_return_if_fail(display != NULL);
+
+	g_mutex_lock(&display->render_mutex);
+	drop_field(display);
+	compute_destroy(display->compute);
+	if (!display->offscreen) {
+		ui_quit();
+		ui_display = NULL;
+	}
+	g_mutex_unlock(&display->render_mutex);
+	g_mutex_clear(&display->render_mutex);
+	g_mutex_clear(&display->pcm_mutex);
+	hud_destroy(display->hud);
+	g_free(display->cosw.f);
+	g_free(display->sinw.f);
+	g_free(display);
 }
 
-gboolean display_resize(gint32 _width, gint32 _height)
+void display_set_instruments(display_t *display, metrics_t *metrics, perfcount_t *perfcount)
 {
-	g_mutex_lock(&render_mutex);
-	width = _width;
-	height = _height;
+	display->metrics = metrics;
+	display->perfcount = perfcount;
+}
 
-	gboolean screen_ok = allocate_render_buffer();
-	compute_vector_field_destroy(vector_field);
-	vector_field = compute_vector_field_new(width, height);
-	compute_generate_vector_field(vector_field);
-	compute_resize(width, height);
-	g_mutex_unlock(&render_mutex);
-	return screen_ok;
+void display_resize(display_t *display, gint32 width, gint32 height)
+{
+	metrics_lock_mutex(display->metrics, &display->render_mutex, METRICS_LOCK_RENDER);
+	display->width = width;
+	display->height = height;
+	drop_field(display);
+	compute_resize(display->compute, width, height);
+	g_mutex_unlock(&display->render_mutex);
 }
 
-gboolean display_take_resize(gint32 *out_width, gint32 *out_height)
+gboolean display_take_resize(display_t *display, gint32 *out_width, gint32 *out_height)
 {
-	if (!pending_resize) {
+	if (!display->pending_resize) {
 		return FALSE;
 	}
-	pending_resize = FALSE;
-	*out_width = pending_width;
-	*out_height = pending_height;
+	display->pending_resize = FALSE;
+	*out_width = display->pending_width;
+	*out_height = display->pending_height;
 	return TRUE;
 }
 
-gboolean display_window_closed(void)
+gboolean display_window_closed(display_t *display)
+{
+	return display->window_closed;
+}
+
+gboolean display_is_visible(display_t *display)
 {
-	return window_closed;
+	return display->visible;
 }
 
-gboolean display_is_visible(void)
+/* A float sample in [-1, 1] as a 16 bit one, clamped; NaN is silence */
+static inline gint16 pcm_sample(float value)
 {
-	return visible;
+	value *= 32767.0f;
+	if (value >= 32767.0f)
+		return 32767;
+	if (value <= -32768.0f)
+		return -32768;
+	return value == value ? (gint16)lrintf(value) : 0;
 }
 
-inline void display_set_pcm_data(const float *data, int channels)
+inline void display_set_pcm_data(display_t *display, const float *data, int channels)
 {
+	gint32 i;
+
 	if (channels != 2) {
 		g_critical("Unsupported number of channels (%d)\n", channels);
 		return;
 	}
-	G_LOCK(pcm_data);
-	// TODO check this out, different types here...
-	memcpy(pcm_data, data, 2 * 512 * sizeof(gint16));
-	G_UNLOCK(pcm_data);
+	metrics_lock_mutex(display->metrics, &display->pcm_mutex, METRICS_LOCK_PCM);
+	for (i = 0; i < 512; i++) {
+		display->pcm_data[0][i] = pcm_sample(data[2 * i]);
+		display->pcm_data[1][i] = pcm_sample(data[2 * i + 1]);
+	}
+	g_mutex_unlock(&display->pcm_mutex);
+	metrics_pcm_update(display->metrics);
+}
+
+void display_set_raw_pcm_data(display_t *display, const gint16 data[2][512])
+{
+	metrics_lock_mutex(display->metrics, &display->pcm_mutex, METRICS_LOCK_PCM);
+	memcpy(display->pcm_data, data, sizeof(display->pcm_data));
+	g_mutex_unlock(&display->pcm_mutex);
 }
 
-void change_color(gint32 t2, gint32 t1, gint32 w)
+void display_get_frame_pcm_data(display_t *display, gint16 data[2][512])
+{
+	memcpy(data, display->frame_pcm, sizeof(display->frame_pcm));
+}
+
+void change_color(display_t *display, gint32 t2, gint32 t1, gint32 w)
 {
 	gint32 i;
 	gint32 r, g, b;
@@ -294,23 +496,44 @@ void change_color(gint32 t2, gint32 t1, gint32 w)
 		r = ((color_table[t1][i].r * w + color_table[t2][i].r * (256 - w)) >> 11);
 		g = ((color_table[t1][i].g * w + color_table[t2][i].g * (256 - w)) >> 10);
 		b = ((color_table[t1][i].b * w + color_table[t2][i].b * (256 - w)) >> 11);
-		current_colors[i] = (r << 11) + (g << 5) + b;
+		display->current_colors[i] = (r << 11) + (g << 5) + b;
 	}
 }
 
-inline void display_blur(guint32 effect_index)
+inline void display_blur(display_t *display, const t_effect *effect)
 {
-	g_mutex_lock(&render_mutex);
-	const guint32 wh = (guint32)vector_field->width * (guint32)vector_field->height;
-	effect_index %= NB_FCT;
-	surface1 = compute_surface(vector_field->vector + effect_index * wh,
-				   vector_field->width, vector_field->height);
-	display_surface();
-	g_mutex_unlock(&render_mutex);
+	const guint32 effect_index = (guint32)effect->num_effect % compute_effect_count();
+	gint32 p1 = effect->rotation, p2 = effect->speed;
+	gint64 t_begin;
+
+	compute_warp_params(effect_index, &p1, &p2);
+	metrics_lock_mutex(display->metrics, &display->render_mutex, METRICS_LOCK_RENDER);
+	if (!is_held(&display->current, effect_index, p1, p2)) {
+		if (is_held(&display->next, effect_index, p1, p2)) {
+			/* waits for the prefetch if it is not done */
+			compute_vector_field_hold(display->next.vector_field, effect_index);
+			compute_vector_field_release(display->next.vector_field, effect_index);
+			drop_held(&display->current);
+			display->current = display->next;
+			display->next.vector_field = NULL;
+		} else {
+			hold(display, &display->current, effect_index, p1, p2, FALSE);
+		}
+	}
+	t_begin = g_get_monotonic_time();
+	perfcount_begin(display->perfcount, PERFCOUNT_WARP);
+	display->surface1 = compute_surface_effect(display->compute, display->current.vector_field,
+						   effect_index);
+	perfcount_end(display->perfcount, PERFCOUNT_WARP);
+	metrics_record(display->metrics, METRICS_WARP, g_get_monotonic_time() - t_begin);
+	g_mutex_unlock(&display->render_mutex);
 }
 
-void spectral(t_effect *current_effect)
+void spectral(display_t *display, t_effect *current_effect)
 {
+	const gint32 width = display->width, height = display->height;
+	gint16 (*frame_pcm)[512] = display->frame_pcm;
+	sincos_t *cosw = &display->cosw, *sinw = &display->sinw;
 	gint32 i, halfheight, halfwidth;
 	gfloat old_y1, old_y2;
 	gfloat y1, y2;
@@ -318,32 +541,34 @@ void spectral(t_effect *current_effect)
 	const gint32 step = 4;
 	const gint32 shift = (current_effect->spectral_shift * height) >> 8;
 
-	G_LOCK(pcm_data);
-	y1 = (gfloat)((((pcm_data[0][0] + pcm_data[1][0]) >> 9) * current_effect->spectral_amplitude * height) >> 12);
-	y2 = (gfloat)((((pcm_data[0][0] + pcm_data[1][0]) >> 9) * current_effect->spectral_amplitude * height) >> 12);
-	if (cosw.i != width || sinw.i != width) {
-		g_free(cosw.f);
-		g_free(sinw.f);
-		sinw.f = cosw.f = NULL;
-		sinw.i = cosw.i = 0;
+	metrics_lock_mutex(display->metrics, &display->pcm_mutex, METRICS_LOCK_PCM);
+	memcpy(display->frame_pcm, display->pcm_data, sizeof(display->frame_pcm));
+	g_mutex_unlock(&display->pcm_mutex);
+	y1 = (gfloat)((((frame_pcm[0][0] + frame_pcm[1][0]) >> 9) * current_effect->spectral_amplitude * height) >> 12);
+	y2 = (gfloat)((((frame_pcm[0][0] + frame_pcm[1][0]) >> 9) * current_effect->spectral_amplitude * height) >> 12);
+	if (cosw->i != width || sinw->i != width) {
+		g_free(cosw->f);
+		g_free(sinw->f);
+		sinw->f = cosw->f = NULL;
+		sinw->i = cosw->i = 0;
 	}
-	if (cosw.i == 0 || cosw.f == NULL) {
+	if (cosw->i == 0 || cosw->f == NULL) {
 		gfloat halfPI = (gfloat)PI / 2;
-		cosw.i = width;
-		if (cosw.f != NULL)
-			g_free(cosw.f);
-		cosw.f = g_malloc(sizeof(gfloat) * width);
-		for (i = 0; i < width; i += step)
-			cosw.f[i] = cos((gfloat)i / width * PI + halfPI);
+		cosw->i = width;
+		if (cosw->f != NULL)
+			g_free(cosw->f);
+		cosw->f = g_malloc(sizeof(gfloat) * width);
+		for (i = 0; i < width; i++)
+			cosw->f[i] = cos((gfloat)i / width * PI + halfPI);
 	}
-	if (sinw.i == 0 || sinw.f == NULL) {
+	if (sinw->i == 0 || sinw->f == NULL) {
 		gfloat halfPI = (gfloat)PI / 2;
-		sinw.i = width;
-		if (sinw.f != NULL)
-			g_free(sinw.f);
-		sinw.f = g_malloc(sizeof(gfloat) * width);
-		for (i = 0; i < width; i += step)
-			sinw.f[i] = sin((gfloat)i / width * PI + halfPI);
+		sinw->i = width;
+		if (sinw->f != NULL)
+			g_free(sinw->f);
+		sinw->f = g_malloc(sizeof(gfloat) * width);
+		for (i = 0; i < width; i++)
+			sinw->f[i] = sin((gfloat)i / width * PI + halfPI);
 	}
 	if (current_effect->mode_spectre == 3) {
 		if (y1 < 0.0)
@@ -356,36 +581,36 @@ void spectral(t_effect *current_effect)
 	for (i = step; i < width; i += step) {
 		old_y1 = y1;
 		old_y2 = y2;
-		y1 = (gfloat)(((pcm_data[1][(i << 9) / width / density_lines] >> 8) *
+		y1 = (gfloat)(((frame_pcm[1][(i << 9) / width / density_lines] >> 8) *
 			       current_effect->spectral_amplitude * height) >> 12);
-		y2 = (gfloat)(((pcm_data[0][(i << 9) / width / density_lines] >> 8) *
+		y2 = (gfloat)(((frame_pcm[0][(i << 9) / width / density_lines] >> 8) *
 			       current_effect->spectral_amplitude * height) >> 12);
 		/* end CS */
 		switch (current_effect->mode_spectre) {
 		case 0:
-			line(i - step, halfheight + shift + old_y2,
+			line(display, i - step, halfheight + shift + old_y2,
 			     i, halfheight + shift + y2,
 			     current_effect->spectral_color);
 			break;
 		case 1:
-			line(i - step, halfheight + shift + old_y1,
+			line(display, i - step, halfheight + shift + old_y1,
 			     i, halfheight + shift + y1,
 			     current_effect->spectral_color);
-			line(i - step, halfheight - shift + old_y2,
+			line(display, i - step, halfheight - shift + old_y2,
 			     i, halfheight - shift + y2,
 			     current_effect->spectral_color);
 			break;
 		case 2:
-			line(i - step, halfheight + shift + old_y1,
+			line(display, i - step, halfheight + shift + old_y1,
 			     i, halfheight + shift + y1,
 			     current_effect->spectral_color);
-			line(i - step, halfheight - shift + old_y1,
+			line(display, i - step, halfheight - shift + old_y1,
 			     i, halfheight - shift + y1,
 			     current_effect->spectral_color);
-			line(halfwidth + shift + old_y2, i - step,
+			line(display, halfwidth + shift + old_y2, i - step,
 			     halfwidth + shift + y2, i,
 			     current_effect->spectral_color);
-			line(halfwidth - shift + old_y2, i - step,
+			line(display, halfwidth - shift + old_y2, i - step,
 			     halfwidth - shift + y2, i,
 			     current_effect->spectral_color);
 			break;
@@ -395,25 +620,24 @@ void spectral(t_effect *current_effect)
 			if (y2 < 0.0)
 				y2 = 0.0;
 		case 4:
-			line(halfwidth + cosw.f[i - step] * (shift + old_y1),
-			     halfheight + sinw.f[i - step] * (shift + old_y1),
-			     halfwidth + cosw.f[i] * (shift + y1),
-			     halfheight + sinw.f[i] * (shift + y1),
+			line(display, halfwidth + cosw->f[i - step] * (shift + old_y1),
+			     halfheight + sinw->f[i - step] * (shift + old_y1),
+			     halfwidth + cosw->f[i] * (shift + y1),
+			     halfheight + sinw->f[i] * (shift + y1),
 			     current_effect->spectral_color);
-			line(halfwidth - cosw.f[i - step] * (shift + old_y2),
-			     halfheight + sinw.f[i - step] * (shift + old_y2),
-			     halfwidth - cosw.f[i] * (shift + y2),
-			     halfheight + sinw.f[i] * (shift + y2),
+			line(display, halfwidth - cosw->f[i - step] * (shift + old_y2),
+			     halfheight + sinw->f[i - step] * (shift + old_y2),
+			     halfwidth - cosw->f[i] * (shift + y2),
+			     halfheight + sinw->f[i] * (shift + y2),
 			     current_effect->spectral_color);
 			break;
 		}
 	}
-	G_UNLOCK(pcm_data);
 	if (current_effect->mode_spectre == 3 || current_effect->mode_spectre == 4) {
-		line(halfwidth + cosw.f[width - step] * (shift + y1),
-		     halfheight + sinw.f[width - step] * (shift + y1),
-		     halfwidth - cosw.f[width - step] * (shift + y2),
-		     halfheight + sinw.f[width - step] * (shift + y2),
+		line(display, halfwidth + cosw->f[width - step] * (shift + y1),
+		     halfheight + sinw->f[width - step] * (shift + y1),
+		     halfwidth - cosw->f[width - step] * (shift + y2),
+		     halfheight + sinw->f[width - step] * (shift + y2),
 		     current_effect->spectral_color);
 	}
 }
@@ -422,8 +646,10 @@ void spectral(t_effect *current_effect)
  * TODO current_effect->curve_color must be a byte. This is related to
  * t_effect typo.
  */
-void curve(t_effect *current_effect)
+void curve(display_t *display, t_effect *current_effect)
 {
+	const gint32 width = display->width, height = display->height;
+	byte *surface1 = display->surface1;
 	gint32 i, j, k;
 	gfloat v, vr;
 	gfloat x, y;
@@ -445,6 +671,58 @@ void curve(t_effect *current_effect)
 	current_effect->x_curve = k;
 }
 
+void display_set_fieldless(display_t *display, guint32 fieldless)
+{
+	g_mutex_lock(&display->render_mutex);
+	if (fieldless != display->fieldless)
+		drop_field(display);
+	display->fieldless = fieldless;
+	g_mutex_unlock(&display->render_mutex);
+}
+
+void display_prefetch(display_t *display, const t_effect *effect)
+{
+	const guint32 effect_index = (guint32)effect->num_effect % compute_effect_count();
+	gint32 p1 = effect->rotation, p2 = effect->speed;
+
+	compute_warp_params(effect_index, &p1, &p2);
+	g_mutex_lock(&display->render_mutex);
+	if (!is_held(&display->current, effect_index, p1, p2) &&
+	    !is_held(&display->next, effect_index, p1, p2))
+		hold(display, &display->next, effect_index, p1, p2, TRUE);
+	g_mutex_unlock(&display->render_mutex);
+}
+
+void display_release_field(display_t *display)
+{
+	g_mutex_lock(&display->render_mutex);
+	drop_field(display);
+	g_mutex_unlock(&display->render_mutex);
+}
+
+void display_copy_frame(display_t *display, byte *surface, guint16 colors[256])
+{
+	memcpy(surface, display->surface1, (gsize)display->width * display->height);
+	memcpy(colors, display->current_colors, sizeof(display->current_colors));
+}
+
+void display_set_kernel(display_t *display, gint32 kernel)
+{
+	g_mutex_lock(&display->render_mutex);
+	compute_set_kernel(display->compute, kernel);
+	g_mutex_unlock(&display->render_mutex);
+}
+
+gint32 display_get_kernel(display_t *display)
+{
+	return compute_get_kernel(display->compute);
+}
+
+void display_toggle_hud(display_t *display)
+{
+	display->hud_visible = !display->hud_visible;
+}
+
 void display_toggle_fullscreen(void)
 {
 	ui_toggle_fullscreen();
@@ -459,25 +737,29 @@ inline void display_save_effect(t_effect *effect)
 	effects_append_effect(effect);
 }
 
-inline void display_load_random_effect(t_effect *effect)
+inline void display_load_random_effect(t_effect *effect, GRand *rng)
 {
-	effects_load_random_effect(effect);
+	effects_load_random_effect(effect, rng);
 }
 
 void display_notify_resize(gint32 _width, gint32 _height)
 {
-	pending_resize = TRUE;
-	pending_width = _width;
-	pending_height = _height;
-	visible = TRUE;
+	if (ui_display == NULL)
+		return;
+	ui_display->pending_width = _width;
+	ui_display->pending_height = _height;
+	ui_display->pending_resize = TRUE;
+	ui_display->visible = TRUE;
 }
 
 void display_notify_close(void)
 {
-	window_closed = TRUE;
+	if (ui_display != NULL)
+		ui_display->window_closed = TRUE;
 }
 
 void display_notify_visibility(gboolean is_visible)
 {
-	visible = is_visible;
+	if (ui_display != NULL)
+		ui_display->visible = is_visible;
 }
@@ -20,63 +20,170 @@
 
 #include "compute.h"
 #include "effects.h"
+#include "metrics.h"
 #include "music-player.h"
+#include "perfcount.h"
 
 #define NB_PALETTES 5
 
 /*
- * Initializes the display related structures and UI window.
+ * A display owns the surfaces, palette, PCM data and UI state of one
+ * visualizer instance. Displays of the same size share their vector
+ * field. Only one of them at a time is shown in the UI window; the others
+ * are offscreen.
+ */
+typedef struct _display display_t;
+
+/*
+ * Creates a display and, unless offscreen, the UI window showing it.
  *
- * Returns true on success; and false otherwise.
+ * Returns NULL on failure.
  */
-gboolean display_init(gint32 _width, gint32 _height, gint32 _scale, Player *player);
+display_t *display_new(gint32 width, gint32 height, gint32 scale, Player *player,
+		       gboolean offscreen);
 
 /*
- * Closes the display module.
+ * Destroys display and closes its UI window.
  */
-void display_quit(void);
+void display_destroy(display_t *display);
+
+/*
+ * Sets where the display reports stage timings and hardware counters.
+ * Either may be NULL.
+ */
+void display_set_instruments(display_t *display, metrics_t *metrics, perfcount_t *perfcount);
 
 /*
  * Change the size of the display to the new dimension
  * width x height.
- *
- * Returns true on success; and false otherwise.
  */
-gboolean display_resize(gint32 width, gint32 height);
+void display_resize(display_t *display, gint32 width, gint32 height);
 
-gboolean display_take_resize(gint32 *out_width, gint32 *out_height);
-gboolean display_window_closed(void);
-gboolean display_is_visible(void);
+gboolean display_take_resize(display_t *display, gint32 *out_width, gint32 *out_height);
+gboolean display_window_closed(display_t *display);
+gboolean display_is_visible(display_t *display);
 
 /*
- * Set data as the data PCM data of this module.
+ * Set data as the data PCM data of this display: 512 interleaved stereo
+ * frames of floats in [-1, 1], kept as 16 bit samples, one array per
+ * channel.
  *
  * This function makes a copy of data.
  *
  * Warning: be aware that this function locks a mutex.
  *
- * See display_quit().
+ * See display_destroy().
  */
-void display_set_pcm_data(const float *data, int channels);
+void display_set_pcm_data(display_t *display, const float *data, int channels);
 
-void display_show(void);
+/*
+ * Same as display_set_pcm_data() but takes the samples in the layout
+ * the display keeps them, as handed out by display_get_frame_pcm_data().
+ */
+void display_set_raw_pcm_data(display_t *display, const gint16 data[2][512]);
+
+/*
+ * Copies the PCM data the last call to spectral() drew with.
+ *
+ * Must be called from the rendering thread.
+ */
+void display_get_frame_pcm_data(display_t *display, gint16 data[2][512]);
 
-void change_color(gint32 old_p, gint32 p, gint32 w);
-void display_blur(guint32 effect_index);
-void spectral(t_effect *current_effect);
-void curve(t_effect *current_effect);
+void change_color(display_t *display, gint32 old_p, gint32 p, gint32 w);
+
+/*
+ * Warps the last surface through the field of effect, with its rotation
+ * and speed.
+ */
+void display_blur(display_t *display, const t_effect *effect);
+
+/*
+ * Selects the effects display_blur() warps without a stored field, a bit
+ * mask of effect numbers, none by default. The fields of the other ones
+ * are shared with the displays of the same size, selection, rotation and
+ * speed, and the vector of each effect is made by the first
+ * display_blur() with it, then held until display_blur() moves to
+ * another effect.
+ *
+ * Must be called from the rendering thread.
+ */
+void display_set_fieldless(display_t *display, guint32 fieldless);
+
+/*
+ * Makes the vector of effect in the background, for the next
+ * display_blur() with it, and holds it until then or the next
+ * display_prefetch().
+ */
+void display_prefetch(display_t *display, const t_effect *effect);
+
+/*
+ * Lets the fields go, freeing them unless another display uses them.
+ * The next display_blur() gets its own back.
+ */
+void display_release_field(display_t *display);
+
+/*
+ * Copies the last blurred surface (width * height palette indexes) and
+ * the RGB565 palette it must be shown with.
+ *
+ * Must be called from the rendering thread, between display_blur() and
+ * the drawing of spectral() and curve().
+ */
+void display_copy_frame(display_t *display, byte *surface, guint16 colors[256]);
+
+/*
+ * Bytes per pixel of format.
+ */
+gint32 display_format_bytes(infinity_format_t format);
+
+/*
+ * Maps the last blurred surface through the palette into pixels, whose
+ * rows are stride bytes apart.
+ *
+ * Same calling constraints as display_copy_frame().
+ */
+void display_map_frame(display_t *display, gpointer pixels, gint32 stride,
+		       infinity_format_t format);
+
+/*
+ * Draws the HUD, if shown, over frame, an RGB565 frame of the display
+ * size without padding, and hands it to the UI window.
+ */
+void display_present(display_t *display, guint16 *frame);
+
+/*
+ * Where the UI backend takes the next frame in place, in *format with
+ * rows *stride bytes apart, or NULL to render into an RGB565 frame for
+ * display_present(). Never in place while the HUD, drawn over RGB565
+ * frames, is shown.
+ */
+gpointer display_acquire_frame(display_t *display, infinity_format_t *format, gint32 *stride);
+void display_present_acquired(display_t *display);
+void spectral(display_t *display, t_effect *current_effect);
+void curve(display_t *display, t_effect *current_effect);
+
+/*
+ * Selects the warp kernel of display, see compute_kernel_info().
+ */
+void display_set_kernel(display_t *display, gint32 kernel);
+gint32 display_get_kernel(display_t *display);
 
 /*
  * Makes the plugin screen switch to full-screen mode.
  *
- * See display_init().
+ * See display_new().
  */
 void display_toggle_fullscreen(void);
 
 void display_exit_fullscreen_if_needed(void);
 
+/*
+ * Shows or hides the performance HUD drawn over presented frames.
+ */
+void display_toggle_hud(display_t *display);
+
 void display_save_effect(t_effect *effect);
-void display_load_random_effect(t_effect *effect);
+void display_load_random_effect(t_effect *effect, GRand *rng);
 
 void display_notify_resize(gint32 width, gint32 height);
 void display_notify_close(void);
@@ -1,100 +1,533 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <glib.h>
 
+#include <compute.h>
 #include <effects.h>
-#include <assert.h>
+
+/*
+ * Preset store.
+ *
+ * Effects files are mapped, not read: each effect is a record of the
+ * ten t_effect fields as little endian 32 bit integers, in the order
+ * of the structure, after a header of four little endian 32 bit words:
+ *
+ *   "IFST"  version (1)  record bytes (40)  reserved (0)
+ *
+ * Readers skip what is past the fields they know in longer records.
+ * Records of 32 bytes, written before the rotation and speed, get the
+ * default ones. Files without the magic are read as records of 32
+ * bytes alone, the format written by earlier versions.
+ *
+ * The system file, the personal one and the personal one of earlier
+ * versions, ~/infinite_states, are merged in this order, once per
+ * process, without duplicate records. Effects are indexed by field
+ * number and spectral mode.
+ *
+ * The fields written as expressions, in the EXPRESSION_SUFFIX files next
+ * to the system file and the personal one, are then added after the
+ * built-in ones, see warpexpr.h.
+ */
 
 #define EFFECTS_FILE	(DATADIR "/infinite_states")
+#define EXPRESSION_SUFFIX	".warp"
+
+#define STORE_MAGIC		"IFST"
+#define STORE_VERSION		1
+#define STORE_HEADER_BYTES	16
+#define RECORD_BYTES		(10 * 4)
+#define SHORT_RECORD_BYTES	(8 * 4) /* without the rotation and speed */
+#define ANY			(-1)
+
+G_STATIC_ASSERT(sizeof(t_effect) == RECORD_BYTES);
 
-static t_effect effects[100];
-static gint32 nb_effects = 0;
-static gboolean initialized = FALSE;
+/* The record pointers point into these */
+static GPtrArray *mapped_files;
+/* Records of 40 bytes in the order they were merged */
+static GPtrArray *records;
+/* Record -> record, to merge without duplicates */
+static GHashTable *unique;
+/* index_key() -> GArray of indexes into records */
+static GHashTable *by_key;
+static gboolean loaded = FALSE;
+/* INFINITY_EFFECT and INFINITY_SPECTRAL_MODE, or ANY */
+static gint32 only_effect = ANY, only_mode = ANY;
 static gchar error_msg[256];
+/* The effects are shared by all the visualizer instances */
+G_LOCK_DEFINE_STATIC(effects);
+
+static guint record_hash(gconstpointer record)
+{
+	const byte *p = record;
+	guint32 h = 2166136261u;
+	gint32 i;
+
+	for (i = 0; i < RECORD_BYTES; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+static gboolean record_equal(gconstpointer a, gconstpointer b)
+{
+	return memcmp(a, b, RECORD_BYTES) == 0;
+}
+
+static void decode_record(const byte *record, t_effect *effect)
+{
+	gint32 *fields = (gint32 *)effect;
+	guint32 value;
+	gint32 i;
+
+	for (i = 0; i < RECORD_BYTES / 4; i++) {
+		memcpy(&value, record + 4 * i, 4);
+		fields[i] = (gint32)GUINT32_FROM_LE(value);
+	}
+}
+
+static void encode_record(const t_effect *effect, byte *record)
+{
+	const gint32 *fields = (const gint32 *)effect;
+	guint32 value;
+	gint32 i;
+
+	for (i = 0; i < RECORD_BYTES / 4; i++) {
+		value = GUINT32_TO_LE((guint32)fields[i]);
+		memcpy(record + 4 * i, &value, 4);
+	}
+}
+
+/* Never 0: (ANY, ANY) is not indexed, all the records match it */
+static gpointer index_key(gint32 num_effect, gint32 mode_spectre)
+{
+	return GUINT_TO_POINTER(((guint)(num_effect + 1) & 0xffff) << 16 |
+				((guint)(mode_spectre + 1) & 0xffff));
+}
+
+static void index_record(gpointer key, guint32 position)
+{
+	GArray *bucket = g_hash_table_lookup(by_key, key);
+
+	if (bucket == NULL) {
+		bucket = g_array_new(FALSE, FALSE, sizeof(guint32));
+		g_hash_table_insert(by_key, key, bucket);
+	}
+	g_array_append_val(bucket, position);
+}
+
+/*
+ * Adds a record that outlives the store, unless it is already there.
+ */
+static gboolean add_record(const byte *record)
+{
+	const guint32 position = records->len;
+	t_effect effect;
+
+	if (g_hash_table_lookup(unique, record) != NULL)
+		return FALSE;
+	g_hash_table_insert(unique, (gpointer)record, (gpointer)record);
+	g_ptr_array_add(records, (gpointer)record);
+	decode_record(record, &effect);
+	index_record(index_key(effect.num_effect, effect.mode_spectre), position);
+	index_record(index_key(effect.num_effect, ANY), position);
+	index_record(index_key(ANY, effect.mode_spectre), position);
+	return TRUE;
+}
+
+/*
+ * Finds the records of the length bytes of file at data: returns their
+ * number, and sets where the first one is and the bytes of each.
+ */
+static gsize find_records(const gchar *file, const byte *data, gsize length,
+			  gsize *offset, gsize *stride)
+{
+	gsize n;
+
+	*offset = 0;
+	*stride = SHORT_RECORD_BYTES;
+	if (length >= 4 && memcmp(data, STORE_MAGIC, 4) == 0) {
+		guint32 header[4];
+
+		if (length < STORE_HEADER_BYTES)
+			return 0;
+		memcpy(header, data, sizeof(header));
+		*offset = STORE_HEADER_BYTES;
+		*stride = GUINT32_FROM_LE(header[2]);
+		if (GUINT32_FROM_LE(header[1]) != STORE_VERSION || *stride < SHORT_RECORD_BYTES) {
+			g_warning("Infinity: '%s' is of unknown version %u, skipped",
+				  file, GUINT32_FROM_LE(header[1]));
+			return 0;
+		}
+	}
+	n = length > *offset ? (length - *offset) / *stride : 0;
+	if (*offset + n * *stride != length)
+		g_warning("Infinity: '%s' is truncated, its last effect is skipped", file);
+	return n;
+}
+
+/*
+ * record, of stride bytes, as a record of RECORD_BYTES: itself, or a
+ * copy with the default rotation and speed that is never freed.
+ */
+static const byte *full_record(const byte *record, gsize stride)
+{
+	const guint32 param = GUINT32_TO_LE(COMPUTE_DEFAULT_PARAM);
+	byte *full;
+
+	if (stride >= RECORD_BYTES)
+		return record;
+	full = g_malloc(RECORD_BYTES);
+	memcpy(full, record, SHORT_RECORD_BYTES);
+	memcpy(full + SHORT_RECORD_BYTES, &param, 4);
+	memcpy(full + SHORT_RECORD_BYTES + 4, &param, 4);
+	return full;
+}
+
+/*
+ * Maps file and merges its records. Only a missing required file is an
+ * error; unreadable parts are skipped with a warning.
+ */
+static gboolean merge_file(const gchar *file, gboolean required, Player *player)
+{
+	GMappedFile *mapped;
+	GError *error = NULL;
+	const byte *data;
+	gsize offset, stride, n, i, added = 0;
+
+	mapped = g_mapped_file_new(file, FALSE, &error);
+	if (mapped == NULL) {
+		if (required) {
+			g_snprintf(error_msg, 256, "Cannot open file '%s' for loading effects: %s",
+				   file, error->message);
+			player->notify_critical_error(error_msg);
+		}
+		g_error_free(error);
+		return !required;
+	}
+	data = (const byte *)g_mapped_file_get_contents(mapped);
+	n = find_records(file, data, g_mapped_file_get_length(mapped), &offset, &stride);
+
+	for (i = 0; i < n; i++) {
+		const byte *record = full_record(data + offset + i * stride, stride);
+
+		if (add_record(record))
+			added++;
+		else if (record != data + offset + i * stride)
+			g_free((byte *)record);
+	}
+	if (added > 0)
+		g_ptr_array_add(mapped_files, mapped);
+	else
+		g_mapped_file_unref(mapped);
+	return TRUE;
+}
+
+static gchar *personal_file(void)
+{
+	return g_build_filename(g_get_user_config_dir(), "infinity-plugin", "infinite_states", NULL);
+}
+
+static gint32 getenv_filter(const gchar *name)
+{
+	const gchar *value = g_getenv(name);
+
+	return value != NULL ? (gint32)g_ascii_strtoll(value, NULL, 10) : ANY;
+}
+
+/*
+ * The records matching num_effect and mode_spectre, ANY for either, as
+ * indexes into records, or NULL for all of them.
+ */
+static GArray *lookup(gint32 num_effect, gint32 mode_spectre)
+{
+	static GArray *empty;
+	GArray *bucket = NULL;
+
+	if (num_effect == ANY && mode_spectre == ANY)
+		return NULL;
+	if (empty == NULL)
+		empty = g_array_new(FALSE, FALSE, sizeof(guint32));
+	if (by_key != NULL)
+		bucket = g_hash_table_lookup(by_key, index_key(num_effect, mode_spectre));
+	return bucket != NULL ? bucket : empty;
+}
+
+static gint32 count_locked(gint32 num_effect, gint32 mode_spectre)
+{
+	GArray *bucket = lookup(num_effect, mode_spectre);
+
+	if (bucket != NULL)
+		return bucket->len;
+	return records != NULL ? records->len : 0;
+}
+
+static const byte *get_locked(gint32 num_effect, gint32 mode_spectre, gint32 nth)
+{
+	GArray *bucket = lookup(num_effect, mode_spectre);
+
+	if (nth < 0 || nth >= count_locked(num_effect, mode_spectre))
+		return NULL;
+	if (bucket != NULL)
+		nth = g_array_index(bucket, guint32, nth);
+	return g_ptr_array_index(records, nth);
+}
+
+/*
+ * Adds the field written as an expression in file, and gives it a record
+ * of its own unless one uses it already: the first one, with its number.
+ * With the lock held.
+ */
+static void load_expression(const gchar *file)
+{
+	gchar *source, *error = NULL;
+	warpexpr_t *expr = NULL;
+	gsize length;
+	gint32 effect;
+
+	if (!g_file_get_contents(file, &source, &length, NULL)) {
+		g_warning("Infinity: cannot read '%s'", file);
+		return;
+	}
+	if (strlen(source) == length)
+		expr = warpexpr_compile(source, &error);
+	else
+		error = g_strdup("not text");
+	g_free(source);
+	if (expr == NULL) {
+		g_warning("Infinity: '%s' rejected: %s", file, error);
+		g_free(error);
+		return;
+	}
+	effect = compute_add_effect(expr);
+	if (effect < 0) {
+		g_warning("Infinity: '%s' skipped, there are %d fields already", file,
+			  COMPUTE_MAX_EFFECTS);
+		return;
+	}
+	g_message("Infinity: field %d is '%s'", effect, file);
+	if (count_locked(effect, ANY) == 0 && records->len > 0) {
+		const guint32 value = GUINT32_TO_LE((guint32)effect);
+		byte *record = g_malloc(RECORD_BYTES);
+
+		memcpy(record, g_ptr_array_index(records, 0), RECORD_BYTES);
+		memcpy(record, &value, 4);
+		if (!add_record(record))
+			g_free(record);
+	}
+}
+
+static gint compare_names(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const gchar *const *)a, *(const gchar *const *)b);
+}
+
+/* The expressions of dir, in the order of their names */
+static void load_expressions(const gchar *dir)
+{
+	GDir *listing = g_dir_open(dir, 0, NULL);
+	GPtrArray *names;
+	const gchar *name;
+	guint i;
+
+	if (listing == NULL)
+		return;
+	names = g_ptr_array_new();
+	while ((name = g_dir_read_name(listing)) != NULL)
+		if (g_str_has_suffix(name, EXPRESSION_SUFFIX))
+			g_ptr_array_add(names, g_build_filename(dir, name, NULL));
+	g_dir_close(listing);
+	g_ptr_array_sort(names, compare_names);
+	for (i = 0; i < names->len; i++) {
+		load_expression(g_ptr_array_index(names, i));
+		g_free(g_ptr_array_index(names, i));
+	}
+	g_ptr_array_free(names, TRUE);
+}
+
+static void put_header(GString *out)
+{
+	const guint32 header[4] = {
+		0, GUINT32_TO_LE(STORE_VERSION), GUINT32_TO_LE(RECORD_BYTES), 0
+	};
+	byte bytes[STORE_HEADER_BYTES];
+
+	memcpy(bytes, header, sizeof(header));
+	memcpy(bytes, STORE_MAGIC, 4);
+	g_string_append_len(out, (const gchar *)bytes, STORE_HEADER_BYTES);
+}
+
+/*
+ * Rewrites file with records of RECORD_BYTES if it has shorter ones, so
+ * that more can be appended.
+ */
+static void upgrade_file(const gchar *file)
+{
+	GError *error = NULL;
+	gchar *contents;
+	GString *out;
+	gsize length, offset, stride, n, i;
+
+	if (!g_file_get_contents(file, &contents, &length, NULL))
+		return;
+	n = find_records(file, (const byte *)contents, length, &offset, &stride);
+	if (n == 0 || stride >= RECORD_BYTES) {
+		g_free(contents);
+		return;
+	}
+	out = g_string_new(NULL);
+	put_header(out);
+	for (i = 0; i < n; i++) {
+		const byte *record = (const byte *)contents + offset + i * stride;
+		const byte *full = full_record(record, stride);
+
+		g_string_append_len(out, (const gchar *)full, RECORD_BYTES);
+		g_free((byte *)full);
+	}
+	if (!g_file_set_contents(file, out->str, out->len, &error)) {
+		g_warning("Infinity: cannot rewrite '%s' with rotation and speed: %s",
+			  file, error->message);
+		g_error_free(error);
+	}
+	g_string_free(out, TRUE);
+	g_free(contents);
+}
 
 void effects_append_effect(t_effect *effect)
 {
 	FILE *f;
-	gint32 i;
-	gchar *personal_states = g_strconcat(g_get_home_dir(), "/infinite_states", NULL);
+	byte *record;
+	gchar *personal_states = personal_file();
+	gchar *dir;
 
 	g_return_if_fail(effect != NULL);
 
-	f = fopen (personal_states, "a");
+	record = g_malloc(RECORD_BYTES);
+	encode_record(effect, record);
+	G_LOCK(effects);
+	if (records != NULL && g_hash_table_lookup(unique, record) != NULL) {
+		G_UNLOCK(effects);
+		g_message("Infinity: effect already saved");
+		g_free(record);
+		g_free(personal_states);
+		return;
+	}
+	G_UNLOCK(effects);
+
+	dir = g_path_get_dirname(personal_states);
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+	upgrade_file(personal_states);
+	f = fopen(personal_states, "ab");
 	if (f == NULL) {
 		g_critical("Cannot open file '%s' for saving effects", personal_states);
 		g_free(personal_states);
+		g_free(record);
 		return;
 	}
+	fseek(f, 0, SEEK_END);
+	if (ftell(f) == 0) {
+		GString *header = g_string_new(NULL);
+
+		put_header(header);
+		fwrite(header->str, 1, header->len, f);
+		g_string_free(header, TRUE);
+	}
+	fwrite(record, 1, RECORD_BYTES, f);
+	fclose(f);
 	g_message("Infinity appended effect to '%s'", personal_states);
 	g_free(personal_states);
-	for (i = 0; i < sizeof(t_effect); i++)
-		fputc(*((byte *)effect + i), f);
-	fclose(f);
+
+	/* Selectable right away */
+	G_LOCK(effects);
+	if (records == NULL || !add_record(record))
+		g_free(record);
+	G_UNLOCK(effects);
 }
 
 gboolean effects_load_effects(Player *player)
 {
-	FILE *f;
-	gint32 finished = 0;
-	gint32 i, b, c, d, e;
+	const gchar *effects_file;
+	gchar *file, *dir;
+	gboolean ok;
 
 	g_return_val_if_fail(player != NULL, FALSE);
 
-	f = fopen (EFFECTS_FILE, "r");
-	if (f == NULL) {
-		g_snprintf(error_msg, 256, "Cannot open file '%s' for loading effects",
-			   EFFECTS_FILE);
-		player->notify_critical_error(error_msg);
-		return FALSE;
+	G_LOCK(effects);
+	if (loaded) {
+		G_UNLOCK(effects);
+		return TRUE;
 	}
-	while (!finished) {
-		byte *ptr_effect = (byte *)&effects[nb_effects];
-		for (i = 0; i < sizeof(t_effect); i += 4) {
-			b = fgetc(f);
-			if (b != EOF) {
-				c = fgetc(f);
-				assert(c != EOF);
-				d = fgetc(f);
-				assert(d != EOF);
-				e = fgetc(f);
-				assert(e != EOF);
-#if BYTE_ORDER == BIG_ENDIAN
-				ptr_effect[i] = (byte)e;
-				ptr_effect[i + 1] = (byte)d;
-				ptr_effect[i + 2] = (byte)c;
-				ptr_effect[i + 3] = (byte)b;
-#else
-				ptr_effect[i] = (byte)b;
-				ptr_effect[i + 1] = (byte)c;
-				ptr_effect[i + 2] = (byte)d;
-				ptr_effect[i + 3] = (byte)e;
-#endif
-			} else {
-				finished = 1;
-			}
+	mapped_files = g_ptr_array_new();
+	records = g_ptr_array_new();
+	unique = g_hash_table_new(record_hash, record_equal);
+	by_key = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	/* Lets tools and tests run from the build tree */
+	effects_file = g_getenv("INFINITY_STATES");
+	if (effects_file == NULL)
+		effects_file = EFFECTS_FILE;
+	ok = merge_file(effects_file, TRUE, player);
+	if (ok) {
+		file = personal_file();
+		merge_file(file, FALSE, player);
+		g_free(file);
+		file = g_build_filename(g_get_home_dir(), "infinite_states", NULL);
+		merge_file(file, FALSE, player);
+		g_free(file);
+		file = g_path_get_dirname(effects_file);
+		dir = g_build_filename(g_get_user_config_dir(), "infinity-plugin", NULL);
+		load_expressions(file);
+		if (strcmp(file, dir) != 0)
+			load_expressions(dir);
+		g_free(dir);
+		g_free(file);
+
+		only_effect = getenv_filter("INFINITY_EFFECT");
+		only_mode = getenv_filter("INFINITY_SPECTRAL_MODE");
+		if (count_locked(only_effect, only_mode) == 0) {
+			g_warning("Infinity: no effect of field %d and spectral mode %d, using all",
+				  only_effect, only_mode);
+			only_effect = only_mode = ANY;
 		}
-		nb_effects++;
+		loaded = TRUE;
 	}
-	nb_effects--;
-	fclose(f);
-	return TRUE;
+	G_UNLOCK(effects);
+	return ok;
 }
 
-void effects_load_random_effect(t_effect *effect)
+void effects_load_random_effect(t_effect *effect, GRand *rng)
 {
-	gint32 trash;
+	gint32 n;
 
-	if (!initialized) {
-		#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
-		srand(trash);
-		initialized = TRUE;
-	}
-	if (nb_effects > 0) {
-		gint32 num_effect = rand() % nb_effects;
-		gint32 i;
+	g_return_if_fail(rng != NULL);
 
-		for (i = 0; i < sizeof(t_effect); i++)
-			*((byte *)effect + i) = *((byte *)(&effects[num_effect]) + i);
-	}
+	G_LOCK(effects);
+	n = count_locked(only_effect, only_mode);
+	if (n > 0)
+		decode_record(get_locked(only_effect, only_mode, g_rand_int_range(rng, 0, n)), effect);
+	G_UNLOCK(effects);
+}
+
+gint32 effects_count(gint32 num_effect, gint32 mode_spectre)
+{
+	gint32 n;
+
+	G_LOCK(effects);
+	n = count_locked(num_effect, mode_spectre);
+	G_UNLOCK(effects);
+	return n;
+}
+
+gboolean effects_get(gint32 num_effect, gint32 mode_spectre, gint32 nth, t_effect *effect)
+{
+	const byte *record;
+
+	g_return_val_if_fail(effect != NULL, FALSE);
+
+	G_LOCK(effects);
+	record = get_locked(num_effect, mode_spectre, nth);
+	if (record != NULL)
+		decode_record(record, effect);
+	G_UNLOCK(effects);
+	return record != NULL;
 }
@@ -35,10 +35,14 @@ typedef struct {
 	gint32  spectral_color;
 	gint32  mode_spectre;
 	gint32  spectral_shift;
+	gint32  rotation; /* p1 of the field, see compute_warp_params() */
+	gint32  speed;    /* p2 of the field */
 } t_effect;
 
 /*
- * Appends effect to file ~/infinite_states
+ * Appends effect to the personal effects file,
+ * ~/.config/infinity-plugin/infinite_states, unless it is already known,
+ * and makes it selectable right away.
  *
  * @param effect Must be a non NULL reference to a ::t_effect
  * object.
@@ -46,12 +50,37 @@ typedef struct {
 void    effects_append_effect (t_effect *effect);
 
 /*
- * Loads effects from file {DATADIR}/infinite_states
+ * Maps the effects of file {DATADIR}/infinite_states, or of the file
+ * named by the INFINITY_STATES environment variable if set, and merges
+ * the personal ones. Done once per process; later calls return TRUE.
+ *
+ * INFINITY_EFFECT and INFINITY_SPECTRAL_MODE restrict the random effects
+ * to those of a field number and of a spectral mode.
  *
  * Returns TRUE on success or FALSE otherwise.
  */
 gboolean effects_load_effects (Player *player);
 
-void    effects_load_random_effect (t_effect *effect);
+/*
+ * Copies a randomly chosen effect into effect.
+ *
+ * @param rng Random generator to draw from. Seeding it with the same
+ * value reproduces the same sequence of effects.
+ */
+void    effects_load_random_effect (t_effect *effect, GRand *rng);
+
+/*
+ * Number of loaded effects of field num_effect and spectral mode
+ * mode_spectre, -1 for any.
+ */
+gint32  effects_count (gint32 num_effect, gint32 mode_spectre);
+
+/*
+ * Copies the nth of the effects counted by effects_count() into effect.
+ *
+ * Returns FALSE when there is no such effect.
+ */
+gboolean effects_get (gint32 num_effect, gint32 mode_spectre, gint32 nth,
+		      t_effect *effect);
 
 #endif /* __INFINITY_EFFECTS__ */
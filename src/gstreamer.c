@@ -0,0 +1,236 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <string.h>
+#include <glib.h>
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <gst/video/video.h>
+#include <gst/pbutils/gstaudiovisualizer.h>
+
+#include "config.h"
+#include "infinity.h"
+#include "types.h"
+
+/*
+ * GStreamer element infinityvis: an audio visualizer rendering each
+ * frame straight into the negotiated video buffer, at the size and frame
+ * rate downstream asks for, with an offline instance of its own.
+ *
+ *   gst-launch-1.0 audiotestsrc ! infinityvis ! videoconvert ! autovideosink
+ */
+
+#define PCM_WINDOW	512 /* stereo frames the engine looks at per frame */
+
+/* Byte orders of the 32 bit words of INFINITY_FORMAT_XRGB32 and XBGR32 */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define VIDEO_FORMATS		"{ BGRx, RGBx }"
+#define VIDEO_FORMAT_XRGB32	GST_VIDEO_FORMAT_BGRx
+#define VIDEO_FORMAT_XBGR32	GST_VIDEO_FORMAT_RGBx
+#else
+#define VIDEO_FORMATS		"{ xRGB, xBGR }"
+#define VIDEO_FORMAT_XRGB32	GST_VIDEO_FORMAT_xRGB
+#define VIDEO_FORMAT_XBGR32	GST_VIDEO_FORMAT_xBGR
+#endif
+
+GST_DEBUG_CATEGORY_STATIC(infinity_vis_debug);
+#define GST_CAT_DEFAULT infinity_vis_debug
+
+#define GST_TYPE_INFINITY_VIS (gst_infinity_vis_get_type())
+G_DECLARE_FINAL_TYPE(GstInfinityVis, gst_infinity_vis, GST, INFINITY_VIS, GstAudioVisualizer)
+
+struct _GstInfinityVis {
+	GstAudioVisualizer	parent;
+	infinity_t *		inf;
+	infinity_format_t	format;
+	gint32			fps;
+};
+
+G_DEFINE_TYPE(GstInfinityVis, gst_infinity_vis, GST_TYPE_AUDIO_VISUALIZER)
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS,
+	GST_STATIC_CAPS("video/x-raw, format = (string) " VIDEO_FORMATS ", "
+			"width = (int) [ 16, MAX ], height = (int) [ 16, MAX ], "
+			"framerate = (fraction) [ 0/1, MAX ]"));
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink",
+	GST_PAD_SINK, GST_PAD_ALWAYS,
+	GST_STATIC_CAPS("audio/x-raw, format = (string) " GST_AUDIO_NE(S16) ", "
+			"layout = (string) interleaved, rate = (int) [ 8000, 192000 ], "
+			"channels = (int) { 1, 2 }"));
+
+/*
+ * InfParameters carry no instance, so the negotiated values are handed
+ * to infinity_new_offline() through these, under the lock. The instance
+ * only reads them while it is created.
+ */
+static gint32 new_width, new_height, new_fps;
+G_LOCK_DEFINE_STATIC(new_instance);
+
+static gint32 get_width(void) { return new_width; }
+static gint32 get_height(void) { return new_height; }
+static void set_size(gint32 size) { (void)size; }
+static gint32 get_scale(void) { return 1; }
+static gint32 get_interval(void) { return 100; }
+static gint32 get_max_fps(void) { return new_fps; }
+
+static InfParameters params = {
+	.get_width = get_width,
+	.set_width = set_size,
+	.get_height = get_height,
+	.set_height = set_size,
+	.get_scale = get_scale,
+	.get_effect_interval = get_interval,
+	.get_color_interval = get_interval,
+	.get_max_fps = get_max_fps
+};
+
+static gboolean is_playing(void) { return TRUE; }
+static gchar *get_title(void) { return NULL; }
+static void do_nothing(void) { }
+static void seek(gint32 usecs) { (void)usecs; }
+static void adjust_volume(gint delta) { (void)delta; }
+
+static void notify_critical_error(const gchar *message)
+{
+	GST_ERROR("%s", message);
+}
+
+static Player player = {
+	.is_playing = is_playing,
+	.get_title = get_title,
+	.play = do_nothing,
+	.pause = do_nothing,
+	.stop = do_nothing,
+	.previous = do_nothing,
+	.next = do_nothing,
+	.seek = seek,
+	.adjust_volume = adjust_volume,
+	.notify_critical_error = notify_critical_error,
+	.disable_plugin = do_nothing
+};
+
+/*
+ * Called on every caps change, from the streaming thread.
+ */
+static gboolean gst_infinity_vis_setup(GstAudioVisualizer *scope)
+{
+	GstInfinityVis *self = GST_INFINITY_VIS(scope);
+	const gint32 width = GST_VIDEO_INFO_WIDTH(&scope->vinfo);
+	const gint32 height = GST_VIDEO_INFO_HEIGHT(&scope->vinfo);
+	const gint fps_n = GST_VIDEO_INFO_FPS_N(&scope->vinfo);
+	const gint fps_d = GST_VIDEO_INFO_FPS_D(&scope->vinfo);
+	const gint32 fps = fps_n > 0 && fps_d > 0 ? MAX(fps_n / fps_d, 1) : 60;
+
+	if (GST_VIDEO_INFO_FORMAT(&scope->vinfo) == VIDEO_FORMAT_XBGR32)
+		self->format = INFINITY_FORMAT_XBGR32;
+	else
+		self->format = INFINITY_FORMAT_XRGB32;
+	scope->req_spf = PCM_WINDOW;
+
+	/* The frame rate is only read at creation, for the synthetic input */
+	if (self->inf != NULL && fps != self->fps) {
+		infinity_destroy(self->inf);
+		self->inf = NULL;
+	}
+	if (self->inf == NULL) {
+		G_LOCK(new_instance);
+		new_width = width;
+		new_height = height;
+		new_fps = fps;
+		self->inf = infinity_new_offline(&params, &player);
+		G_UNLOCK(new_instance);
+		if (self->inf == NULL) {
+			GST_ELEMENT_ERROR(self, LIBRARY, INIT, (NULL), ("cannot create Infinity instance"));
+			return FALSE;
+		}
+		self->fps = fps;
+	} else {
+		infinity_resize(self->inf, width, height);
+	}
+	GST_DEBUG_OBJECT(self, "rendering %dx%d at %d fps", width, height, fps);
+	return TRUE;
+}
+
+static gboolean gst_infinity_vis_render(GstAudioVisualizer *scope, GstBuffer *audio,
+					GstVideoFrame *video)
+{
+	GstInfinityVis *self = GST_INFINITY_VIS(scope);
+	const gint channels = GST_AUDIO_INFO_CHANNELS(&scope->ainfo);
+	gint16 pcm[2][PCM_WINDOW];
+	const gint16 *samples;
+	GstMapInfo map;
+	gsize frames, i;
+
+	if (!gst_buffer_map(audio, &map, GST_MAP_READ))
+		return FALSE;
+	samples = (const gint16 *)map.data;
+	frames = MIN(map.size / (sizeof(gint16) * channels), PCM_WINDOW);
+	for (i = 0; i < frames; i++) {
+		pcm[0][i] = samples[i * channels];
+		pcm[1][i] = samples[i * channels + channels - 1];
+	}
+	memset(&pcm[0][frames], 0, sizeof(gint16) * (PCM_WINDOW - frames));
+	memset(&pcm[1][frames], 0, sizeof(gint16) * (PCM_WINDOW - frames));
+	gst_buffer_unmap(audio, &map);
+
+	/* The samples are taken as they are, without going through floats */
+	infinity_render_raw_pcm(self->inf, pcm);
+	infinity_render_into(self->inf, NULL, 2, GST_VIDEO_FRAME_PLANE_DATA(video, 0),
+			     GST_VIDEO_FRAME_PLANE_STRIDE(video, 0), self->format);
+	return TRUE;
+}
+
+static void gst_infinity_vis_finalize(GObject *object)
+{
+	GstInfinityVis *self = GST_INFINITY_VIS(object);
+
+	if (self->inf != NULL)
+		infinity_destroy(self->inf);
+	G_OBJECT_CLASS(gst_infinity_vis_parent_class)->finalize(object);
+}
+
+static void gst_infinity_vis_class_init(GstInfinityVisClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+	GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+	GstAudioVisualizerClass *scope_class = GST_AUDIO_VISUALIZER_CLASS(klass);
+
+	gobject_class->finalize = gst_infinity_vis_finalize;
+	gst_element_class_set_static_metadata(element_class, "Infinity",
+		"Visualization", "Infinity audio visualization",
+		"Duilio Protti <https://dprotti.github.io/infinity-plugin>");
+	gst_element_class_add_static_pad_template(element_class, &src_template);
+	gst_element_class_add_static_pad_template(element_class, &sink_template);
+	scope_class->setup = GST_DEBUG_FUNCPTR(gst_infinity_vis_setup);
+	scope_class->render = GST_DEBUG_FUNCPTR(gst_infinity_vis_render);
+}
+
+static void gst_infinity_vis_init(GstInfinityVis *self)
+{
+	/* Infinity blurs the previous frame itself: no shading pass */
+	g_object_set(self, "shader", GST_AUDIO_VISUALIZER_SHADER_NONE, NULL);
+}
+
+static gboolean plugin_init(GstPlugin *plugin)
+{
+	GST_DEBUG_CATEGORY_INIT(infinity_vis_debug, "infinityvis", 0, "Infinity visualization");
+	return gst_element_register(plugin, "infinityvis", GST_RANK_NONE, GST_TYPE_INFINITY_VIS);
+}
+
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR, GST_VERSION_MINOR, infinity,
+		  "Infinity audio visualization", plugin_init, PACKAGE_VERSION,
+		  "GPL", PACKAGE, "https://dprotti.github.io/infinity-plugin")
@@ -0,0 +1,195 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "config.h"
+#include "compute.h"
+#include "hud.h"
+#include "metrics.h"
+
+#define GLYPH_WIDTH	5
+#define GLYPH_HEIGHT	7
+#define NB_LINES	5
+#define LINE_LENGTH	48
+#define MARGIN		4
+#define REFRESH_USECS	(G_USEC_PER_SEC / 2)
+
+/* 5x7 glyphs, one byte per row, most significant of the 5 bits on the left */
+static const gchar glyph_chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:/-%_?";
+static const guint8 glyphs[][GLYPH_HEIGHT] = {
+	{ 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E }, /* 0 */
+	{ 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+	{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },
+	{ 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+	{ 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },
+	{ 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+	{ 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },
+	{ 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+	{ 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },
+	{ 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C }, /* 9 */
+	{ 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 }, /* A */
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },
+	{ 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },
+	{ 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },
+	{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F },
+	{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },
+	{ 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F },
+	{ 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+	{ 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },
+	{ 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },
+	{ 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },
+	{ 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },
+	{ 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },
+	{ 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },
+	{ 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },
+	{ 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D },
+	{ 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },
+	{ 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },
+	{ 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },
+	{ 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A },
+	{ 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },
+	{ 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 },
+	{ 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F }, /* Z */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C }, /* . */
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 }, /* : */
+	{ 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, /* / */
+	{ 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }, /* - */
+	{ 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, /* % */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F }, /* _ */
+	{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 }, /* ? */
+};
+
+struct _hud {
+	gchar	lines[NB_LINES][LINE_LENGTH];
+	gint64	t_refresh;
+};
+
+/* Resident set size in bytes, 0 if unknown */
+static gsize resident_bytes(void)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	unsigned long size, resident = 0;
+
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+	return (gsize)resident * (gsize)sysconf(_SC_PAGESIZE);
+}
+
+static void refresh_lines(hud_t *hud, gint32 width, gint32 height,
+			  metrics_t *metrics, gint32 kernel, gsize field_bytes)
+{
+	const gsize rss = resident_bytes();
+	gchar (*lines)[LINE_LENGTH] = hud->lines;
+
+	g_snprintf(lines[0], LINE_LENGTH, "FPS %.1f", metrics_fps(metrics));
+	g_snprintf(lines[1], LINE_LENGTH, "FRAME MS P50 %.1f P95 %.1f P99 %.1f",
+		   metrics_percentile(metrics, METRICS_FRAME, 50) / 1e3,
+		   metrics_percentile(metrics, METRICS_FRAME, 95) / 1e3,
+		   metrics_percentile(metrics, METRICS_FRAME, 99) / 1e3);
+	g_snprintf(lines[2], LINE_LENGTH, "RES %dX%d", width, height);
+	g_snprintf(lines[3], LINE_LENGTH, "KERNEL %s",
+		   compute_kernel_info(kernel)->name);
+	if (rss > 0)
+		g_snprintf(lines[4], LINE_LENGTH, "MEM %.1f MB FIELD %.1f MB",
+			   rss / 1048576.0, field_bytes / 1048576.0);
+	else
+		g_snprintf(lines[4], LINE_LENGTH, "MEM ? FIELD %.1f MB", field_bytes / 1048576.0);
+}
+
+static const guint8 *glyph_of(gchar c)
+{
+	const gchar *p;
+
+	if (c == ' ')
+		return NULL;
+	p = strchr(glyph_chars, g_ascii_toupper(c));
+	if (p == NULL || *p == '\0')
+		p = strchr(glyph_chars, '?');
+	return glyphs[p - glyph_chars];
+}
+
+static void draw_line(guint16 *buffer, gint32 width, gint32 height,
+		      const gchar *text, gint32 x0, gint32 y0, gint32 zoom)
+{
+	gint32 x, y, row, col;
+
+	for (; *text != '\0'; text++, x0 += (GLYPH_WIDTH + 1) * zoom) {
+		const guint8 *glyph = glyph_of(*text);
+
+		if (glyph == NULL)
+			continue;
+		for (row = 0; row < GLYPH_HEIGHT * zoom; row++) {
+			y = y0 + row;
+			if (y >= height)
+				return;
+			for (col = 0; col < GLYPH_WIDTH * zoom; col++) {
+				x = x0 + col;
+				if (x >= width)
+					return;
+				if (glyph[row / zoom] & (0x10 >> (col / zoom)))
+					buffer[y * width + x] = 0xFFFF;
+			}
+		}
+	}
+}
+
+hud_t *hud_new(void)
+{
+	return g_new0(hud_t, 1);
+}
+
+void hud_destroy(hud_t *hud)
+{
+	g_free(hud);
+}
+
+void hud_draw(hud_t *hud, guint16 *buffer, gint32 width, gint32 height,
+	      metrics_t *metrics, gint32 kernel, gsize field_bytes)
+{
+	const gint64 now = g_get_monotonic_time();
+	const gint32 zoom = height >= 720 ? 2 : 1;
+	const gint32 line_height = (GLYPH_HEIGHT + 2) * zoom;
+	gint32 i, x, y, box_width = 0, box_height;
+
+	if (now - hud->t_refresh >= REFRESH_USECS) {
+		refresh_lines(hud, width, height, metrics, kernel, field_bytes);
+		hud->t_refresh = now;
+	}
+	for (i = 0; i < NB_LINES; i++)
+		box_width = MAX(box_width, (gint32)strlen(hud->lines[i]) * (GLYPH_WIDTH + 1) * zoom);
+	box_width = MIN(box_width + 2 * MARGIN, width);
+	box_height = MIN(NB_LINES * line_height + 2 * MARGIN, height);
+
+	/* darken the frame behind the text to a quarter */
+	for (y = 0; y < box_height; y++) {
+		guint16 *p = buffer + y * width;
+
+		for (x = 0; x < box_width; x++)
+			p[x] = (p[x] >> 2) & 0x39E7;
+	}
+	for (i = 0; i < NB_LINES; i++)
+		draw_line(buffer, width, height, hud->lines[i],
+			  MARGIN, MARGIN + i * line_height, zoom);
+}
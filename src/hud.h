@@ -0,0 +1,40 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_HUD__
+#define __INFINITY_HUD__
+
+#include <glib.h>
+
+#include "metrics.h"
+
+typedef struct _hud hud_t;
+
+hud_t *hud_new(void);
+void hud_destroy(hud_t *hud);
+
+/*
+ * On-screen display of fps, frame time percentiles, resolution, warp
+ * kernel and memory use, drawn over the RGB565 frame before it is
+ * presented. Its text is refreshed twice per second.
+ *
+ * metrics supplies the timings, kernel is the warp kernel in use and
+ * field_bytes the size of the vector fields of all the displays.
+ * Must be called from the thread rendering the hud's display.
+ */
+void hud_draw(hud_t *hud, guint16 *buffer, gint32 width, gint32 height,
+	      metrics_t *metrics, gint32 kernel, gsize field_bytes);
+
+#endif /* __INFINITY_HUD__ */
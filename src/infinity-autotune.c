@@ -0,0 +1,100 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "autotune.h"
+#include "compute.h"
+
+/*
+ * Runs the warp kernel trial, then the one of the effects warped without
+ * a field with the winner, by hand, for the given resolutions or the
+ * common ones, and saves the winners where the plugin will use them.
+ */
+
+static gboolean dry_run = FALSE;
+
+static const GOptionEntry entries[] = {
+	{ "dry-run", 'n', 0, G_OPTION_ARG_NONE, &dry_run, "Print timings without saving the winners", NULL },
+	{ NULL }
+};
+
+static const gchar *default_resolutions[] = {
+	"640x360", "800x600", "1280x720", "1920x1080", NULL
+};
+
+static gboolean tune(gint32 width, gint32 height)
+{
+	gint64 usecs[compute_kernel_count()];
+	gint64 field_usecs[NB_FCT], fieldless_usecs[NB_FCT];
+	vector_field_t *vector_field;
+	gint32 kernel, best;
+	guint32 effect, fieldless;
+
+	vector_field = compute_vector_field_new(width, height);
+	compute_generate_vector_field(vector_field);
+	best = autotune_trial(vector_field, usecs);
+	compute_vector_field_destroy(vector_field);
+
+	g_print("%dx%d\n", width, height);
+	for (kernel = 0; kernel < compute_kernel_count(); kernel++)
+		g_print("  %c %-16s %8.2f ms\n", kernel == best ? '*' : ' ',
+			compute_kernel_info(kernel)->name, usecs[kernel] / 1e3);
+
+	fieldless = autotune_trial_fieldless(width, height, best, field_usecs, fieldless_usecs);
+	for (effect = 0; effect < NB_FCT; effect++)
+		if (compute_has_fast_warp(effect))
+			g_print("    effect %u: field %8.2f ms, without %8.2f ms%s\n", effect,
+				field_usecs[effect] / 1e3, fieldless_usecs[effect] / 1e3,
+				fieldless & (1u << effect) ? " *" : "");
+	return dry_run || (autotune_save(width, height, best) &&
+			   autotune_save_fieldless(width, height, fieldless));
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	const gchar **resolutions = default_resolutions;
+	gchar *model;
+	gint32 i, width, height;
+	int status = 0;
+
+	context = g_option_context_new("[WIDTHxHEIGHT...] - find the fastest warp kernel and effect warps");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("infinity-autotune: %s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(context);
+	if (argc > 1)
+		resolutions = (const gchar **)argv + 1;
+
+	model = autotune_cpu_model();
+	g_print("CPU: %s\n", model);
+	g_free(model);
+	for (i = 0; resolutions[i] != NULL; i++) {
+		if (sscanf(resolutions[i], "%dx%d", &width, &height) != 2 || width < 16 || height < 16) {
+			g_printerr("infinity-autotune: invalid resolution '%s'\n", resolutions[i]);
+			return 1;
+		}
+		if (!tune(width, height))
+			status = 1;
+	}
+	return status;
+}
@@ -0,0 +1,254 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "infinity.h"
+#include "pcm_source.h"
+#include "trace.h"
+#include "types.h"
+
+/*
+ * Standalone player of the visualization: reads PCM from a file, a named
+ * pipe or the standard input at its sample rate, and shows Infinity in a
+ * window of the UI backend it is linked with, as the plugin does inside
+ * Audacious.
+ *
+ * With --headless there is no window: frames are rendered at the frame
+ * rate by an offline instance and only reach the shared memory export,
+ * if INFINITY_EXPORT is set. This runs the engine, and profiles it,
+ * without a display or a player.
+ *
+ * A reader thread feeds the engine the latest PCM_WINDOW frames every
+ * PCM_HOP frames of input, sleeping to keep to the sample rate.
+ */
+
+#define PCM_WINDOW	512 /* stereo frames the engine looks at per frame */
+#define PCM_HOP		256
+
+static gint32 width = 640;
+static gint32 height = 360;
+static gint32 fps = 60;
+static gint32 rate = 44100;
+static gint32 channels = 2;
+static gint32 max_frames = 0;
+static gint32 effect_interval = 100;
+static gint32 color_interval = 100;
+static gchar *pcm_format_name = "s16";
+static gboolean headless = FALSE;
+
+static const GOptionEntry entries[] = {
+	{ "width", 'W', 0, G_OPTION_ARG_INT, &width, "Initial width (640)", "N" },
+	{ "height", 'H', 0, G_OPTION_ARG_INT, &height, "Initial height (360)", "N" },
+	{ "fps", 'r', 0, G_OPTION_ARG_INT, &fps, "Maximum frame rate (60)", "N" },
+	{ "rate", 0, 0, G_OPTION_ARG_INT, &rate, "PCM sample rate (44100)", "HZ" },
+	{ "channels", 'c', 0, G_OPTION_ARG_INT, &channels, "PCM channels (2)", "N" },
+	{ "pcm-format", 'f', 0, G_OPTION_ARG_STRING, &pcm_format_name, "PCM sample format: s16 or f32 (s16)", "FORMAT" },
+	{ "headless", 0, 0, G_OPTION_ARG_NONE, &headless, "Render without a window", NULL },
+	{ "frames", 'n', 0, G_OPTION_ARG_INT, &max_frames, "With --headless, stop after N frames (whole input)", "N" },
+	{ "effect-interval", 0, 0, G_OPTION_ARG_INT, &effect_interval, "Frames between effect changes (100)", "N" },
+	{ "palette-interval", 0, 0, G_OPTION_ARG_INT, &color_interval, "Frames between palette changes (100)", "N" },
+	{ NULL }
+};
+
+static pcm_source_t *source;
+static infinity_t *inf;
+static GMainLoop *main_loop;
+
+/* Latest PCM, for the headless render loop */
+static float latest_pcm[2 * PCM_WINDOW];
+static GMutex pcm_lock;
+static gint input_done;
+
+static gint32 get_width(void) { return width; }
+static void set_width(gint32 w) { width = w; }
+static gint32 get_height(void) { return height; }
+static void set_height(gint32 h) { height = h; }
+static gint32 get_scale(void) { return 1; }
+static gint32 get_effect_interval(void) { return effect_interval; }
+static gint32 get_color_interval(void) { return color_interval; }
+static gint32 get_max_fps(void) { return fps; }
+
+static InfParameters params = {
+	.get_width = get_width,
+	.set_width = set_width,
+	.get_height = get_height,
+	.set_height = set_height,
+	.get_scale = get_scale,
+	.get_effect_interval = get_effect_interval,
+	.get_color_interval = get_color_interval,
+	.get_max_fps = get_max_fps
+};
+
+static gboolean is_playing(void) { return !g_atomic_int_get(&input_done); }
+static gchar *get_title(void) { return NULL; }
+static void do_nothing(void) { }
+static void seek(gint32 usecs) { (void)usecs; }
+static void adjust_volume(gint delta) { (void)delta; }
+
+static void notify_critical_error(const gchar *message)
+{
+	g_printerr("infinity-play: %s\n", message);
+}
+
+/* The window was closed */
+static void disable_plugin(void)
+{
+	g_atomic_int_set(&input_done, TRUE);
+	if (main_loop != NULL)
+		g_main_loop_quit(main_loop);
+}
+
+static Player player = {
+	.is_playing = is_playing,
+	.get_title = get_title,
+	.play = do_nothing,
+	.pause = do_nothing,
+	.stop = do_nothing,
+	.previous = do_nothing,
+	.next = do_nothing,
+	.seek = seek,
+	.adjust_volume = adjust_volume,
+	.notify_critical_error = notify_critical_error,
+	.disable_plugin = disable_plugin
+};
+
+static gpointer pcm_reader(gpointer data)
+{
+	float window[2 * PCM_WINDOW];
+	gint64 t_begin, t_due, now, frames = 0;
+	gint32 got;
+
+	(void)data;
+	trace_thread_name("pcm");
+	memset(window, 0, sizeof(window));
+	t_begin = g_get_monotonic_time();
+	while (!g_atomic_int_get(&input_done)) {
+		memmove(window, window + 2 * PCM_HOP, sizeof(float) * 2 * (PCM_WINDOW - PCM_HOP));
+		got = pcm_source_read(source, window + 2 * (PCM_WINDOW - PCM_HOP), PCM_HOP);
+		if (got < PCM_HOP || g_atomic_int_get(&input_done))
+			break;
+		frames += got;
+
+		if (headless) {
+			g_mutex_lock(&pcm_lock);
+			memcpy(latest_pcm, window, sizeof(window));
+			g_mutex_unlock(&pcm_lock);
+		} else {
+			infinity_render_pcm(inf, window, 2);
+		}
+
+		/* Files and pipes ahead of the clock are read at the sample rate */
+		t_due = t_begin + frames * G_USEC_PER_SEC / rate;
+		now = g_get_monotonic_time();
+		if (t_due > now)
+			g_usleep(t_due - now);
+	}
+	disable_plugin();
+	return NULL;
+}
+
+/*
+ * Renders at the frame rate until the input ends or max_frames.
+ */
+static gint64 run_headless(void)
+{
+	const gint64 frame_length = G_USEC_PER_SEC / fps;
+	float pcm[2 * PCM_WINDOW];
+	guint16 *frame;
+	gint64 n, t_begin;
+
+	frame = g_new0(guint16, (gsize)width * height);
+	for (n = 0; !g_atomic_int_get(&input_done) && (max_frames == 0 || n < max_frames); n++) {
+		t_begin = g_get_monotonic_time();
+		g_mutex_lock(&pcm_lock);
+		memcpy(pcm, latest_pcm, sizeof(pcm));
+		g_mutex_unlock(&pcm_lock);
+		infinity_render_into(inf, pcm, 2, frame, width * sizeof(guint16), INFINITY_FORMAT_RGB565);
+		t_begin += frame_length;
+		if (t_begin > g_get_monotonic_time())
+			g_usleep(t_begin - g_get_monotonic_time());
+	}
+	g_free(frame);
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	pcm_format_t pcm_format;
+	gint64 n = 0, t_begin, elapsed;
+
+	context = g_option_context_new("PCM-FILE - play Infinity from raw PCM");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("infinity-play: %s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(context);
+	if (argc != 2) {
+		g_printerr("infinity-play: expected one PCM file or pipe, - for standard input\n");
+		return 1;
+	}
+	if (!pcm_format_from_name(pcm_format_name, &pcm_format)) {
+		g_printerr("infinity-play: unknown PCM format '%s'\n", pcm_format_name);
+		return 1;
+	}
+	if (width < 16 || height < 16 || fps <= 0 || rate <= 0 || channels <= 0
+	    || effect_interval <= 0 || color_interval <= 0) {
+		g_printerr("infinity-play: invalid size, rate, channels or interval\n");
+		return 1;
+	}
+
+	source = pcm_source_new(argv[1], pcm_format, channels);
+	if (source == NULL)
+		return 1;
+	g_mutex_init(&pcm_lock);
+	if (headless)
+		inf = infinity_new_offline(&params, &player);
+	else
+		inf = infinity_new(&params, &player);
+	if (inf == NULL)
+		return 1;
+
+	if (!headless)
+		main_loop = g_main_loop_new(NULL, FALSE);
+
+	t_begin = g_get_monotonic_time();
+	g_thread_unref(g_thread_new("infinity_pcm", pcm_reader, NULL));
+	if (headless) {
+		n = run_headless();
+		g_atomic_int_set(&input_done, TRUE);
+	} else {
+		g_main_loop_run(main_loop);
+	}
+	elapsed = g_get_monotonic_time() - t_begin;
+
+	/*
+	 * The reader may be blocked on a silent pipe: it is left behind, and
+	 * stops feeding the instance once input_done is set.
+	 */
+	infinity_destroy(inf);
+	if (main_loop != NULL)
+		g_main_loop_unref(main_loop);
+	if (headless)
+		g_printerr("infinity-play: %" G_GINT64_FORMAT " frames in %.2f s, %.1f fps\n",
+			   n, elapsed / 1e6, elapsed > 0 ? n / (elapsed / 1e6) : 0.0);
+	return 0;
+}
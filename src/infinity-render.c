@@ -0,0 +1,390 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "infinity.h"
+#include "pcm_source.h"
+#include "trace.h"
+#include "types.h"
+
+/*
+ * Offline renderer: turns a PCM file into Y4M or raw RGB24 video as fast
+ * as possible, at a fixed simulated frame rate.
+ *
+ * Three stages run concurrently on their own threads:
+ *   warp     (main thread) blur, spectral and curve of frame n
+ *   palette  palette indexes to RGB24 of frame n - 1
+ *   encode   RGB24 to the output format and write of frame n - 2
+ */
+
+#define PCM_WINDOW	512 /* stereo frames the engine looks at per frame */
+#define FRAMES_IN_FLIGHT 4
+
+typedef enum {
+	VIDEO_Y4M,
+	VIDEO_RGB
+} video_format_t;
+
+typedef struct {
+	byte *		surface;
+	guint16		colors[256];
+	guint8 *	rgb;
+} frame_t;
+
+static gint32 width = 1280;
+static gint32 height = 720;
+static gint32 fps = 60;
+static gint32 rate = 44100;
+static gint32 channels = 2;
+static gint32 max_frames = 0;
+static gint32 effect_interval = 100;
+static gint32 color_interval = 100;
+static gchar *pcm_format_name = "s16";
+static gchar *video_format_name = "y4m";
+static gchar *output_name = "-";
+
+static video_format_t video_format;
+static FILE *output;
+static GAsyncQueue *free_frames;
+static GAsyncQueue *palette_frames;
+static GAsyncQueue *encode_frames;
+static frame_t end_of_stream;
+
+static const GOptionEntry entries[] = {
+	{ "width", 'W', 0, G_OPTION_ARG_INT, &width, "Frame width (1280)", "N" },
+	{ "height", 'H', 0, G_OPTION_ARG_INT, &height, "Frame height (720)", "N" },
+	{ "fps", 'r', 0, G_OPTION_ARG_INT, &fps, "Simulated frame rate (60)", "N" },
+	{ "rate", 0, 0, G_OPTION_ARG_INT, &rate, "PCM sample rate (44100)", "HZ" },
+	{ "channels", 'c', 0, G_OPTION_ARG_INT, &channels, "PCM channels (2)", "N" },
+	{ "pcm-format", 'f', 0, G_OPTION_ARG_STRING, &pcm_format_name, "PCM sample format: s16 or f32 (s16)", "FORMAT" },
+	{ "video-format", 'v', 0, G_OPTION_ARG_STRING, &video_format_name, "Output format: y4m or rgb (y4m)", "FORMAT" },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_name, "Output file or pipe, - for standard output (-)", "FILE" },
+	{ "frames", 'n', 0, G_OPTION_ARG_INT, &max_frames, "Stop after N frames (whole input)", "N" },
+	{ "effect-interval", 0, 0, G_OPTION_ARG_INT, &effect_interval, "Frames between effect changes (100)", "N" },
+	{ "palette-interval", 0, 0, G_OPTION_ARG_INT, &color_interval, "Frames between palette changes (100)", "N" },
+	{ NULL }
+};
+
+static gint32 get_width(void) { return width; }
+static void set_width(gint32 w) { (void)w; }
+static gint32 get_height(void) { return height; }
+static void set_height(gint32 h) { (void)h; }
+static gint32 get_scale(void) { return 1; }
+static gint32 get_effect_interval(void) { return effect_interval; }
+static gint32 get_color_interval(void) { return color_interval; }
+static gint32 get_max_fps(void) { return fps; }
+
+static InfParameters params = {
+	.get_width = get_width,
+	.set_width = set_width,
+	.get_height = get_height,
+	.set_height = set_height,
+	.get_scale = get_scale,
+	.get_effect_interval = get_effect_interval,
+	.get_color_interval = get_color_interval,
+	.get_max_fps = get_max_fps
+};
+
+static gboolean is_playing(void) { return TRUE; }
+static gchar *get_title(void) { return NULL; }
+static void do_nothing(void) { }
+static void seek(gint32 usecs) { (void)usecs; }
+static void adjust_volume(gint delta) { (void)delta; }
+
+static void notify_critical_error(const gchar *message)
+{
+	g_printerr("infinity-render: %s\n", message);
+}
+
+static Player player = {
+	.is_playing = is_playing,
+	.get_title = get_title,
+	.play = do_nothing,
+	.pause = do_nothing,
+	.stop = do_nothing,
+	.previous = do_nothing,
+	.next = do_nothing,
+	.seek = seek,
+	.adjust_volume = adjust_volume,
+	.notify_critical_error = notify_critical_error,
+	.disable_plugin = do_nothing
+};
+
+/* Keeps the standard output for video only */
+static void log_to_stderr(const gchar *domain, GLogLevelFlags level,
+			  const gchar *message, gpointer data)
+{
+	(void)domain;
+	(void)level;
+	(void)data;
+	fprintf(stderr, "%s\n", message);
+}
+
+static gpointer palette_stage(gpointer data)
+{
+	const gsize pixels = (gsize)width * height;
+	frame_t *frame;
+
+	(void)data;
+	trace_thread_name("palette");
+	while ((frame = g_async_queue_pop(palette_frames)) != &end_of_stream) {
+		guint8 lut[256][3];
+		guint8 *dest = frame->rgb;
+		gsize i;
+
+		trace_begin("rgb");
+
+		for (i = 0; i < 256; i++) {
+			const guint16 c = frame->colors[i];
+			const guint8 r = c >> 11, g = (c >> 5) & 0x3F, b = c & 0x1F;
+
+			lut[i][0] = (guint8)((r << 3) | (r >> 2));
+			lut[i][1] = (guint8)((g << 2) | (g >> 4));
+			lut[i][2] = (guint8)((b << 3) | (b >> 2));
+		}
+		for (i = 0; i < pixels; i++) {
+			const guint8 *c = lut[frame->surface[i]];
+
+			*dest++ = c[0];
+			*dest++ = c[1];
+			*dest++ = c[2];
+		}
+		trace_end("rgb");
+		g_async_queue_push(encode_frames, frame);
+	}
+	g_async_queue_push(encode_frames, &end_of_stream);
+	return NULL;
+}
+
+/*
+ * RGB24 to Y4M C420jpeg (full range BT.601), chroma averaged over 2x2 pixels.
+ */
+static void write_y4m_frame(const guint8 *rgb, guint8 *planes)
+{
+	const gint32 cw = (width + 1) / 2, ch = (height + 1) / 2;
+	guint8 *y_plane = planes;
+	guint8 *u_plane = y_plane + (gsize)width * height;
+	guint8 *v_plane = u_plane + (gsize)cw * ch;
+	gint32 x, y;
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++) {
+			const guint8 *p = rgb + 3 * ((gsize)y * width + x);
+
+			y_plane[(gsize)y * width + x] = (guint8)((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+		}
+	for (y = 0; y < ch; y++)
+		for (x = 0; x < cw; x++) {
+			const gint32 x1 = MIN(2 * x + 1, width - 1), y1 = MIN(2 * y + 1, height - 1);
+			const guint8 *p00 = rgb + 3 * ((gsize)(2 * y) * width + 2 * x);
+			const guint8 *p01 = rgb + 3 * ((gsize)(2 * y) * width + x1);
+			const guint8 *p10 = rgb + 3 * ((gsize)y1 * width + 2 * x);
+			const guint8 *p11 = rgb + 3 * ((gsize)y1 * width + x1);
+			const gint32 r = p00[0] + p01[0] + p10[0] + p11[0];
+			const gint32 g = p00[1] + p01[1] + p10[1] + p11[1];
+			const gint32 b = p00[2] + p01[2] + p10[2] + p11[2];
+
+			u_plane[(gsize)y * cw + x] = (guint8)(((-43 * r - 85 * g + 128 * b + 512) >> 10) + 128);
+			v_plane[(gsize)y * cw + x] = (guint8)(((128 * r - 107 * g - 21 * b + 512) >> 10) + 128);
+		}
+	fputs("FRAME\n", output);
+	fwrite(planes, 1, (gsize)width * height + 2 * (gsize)cw * ch, output);
+}
+
+static gpointer encode_stage(gpointer data)
+{
+	guint8 *planes = NULL;
+	frame_t *frame;
+
+	(void)data;
+	if (video_format == VIDEO_Y4M) {
+		planes = g_malloc((gsize)width * height + 2 * (gsize)((width + 1) / 2) * ((height + 1) / 2));
+		fprintf(output, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+	}
+	trace_thread_name("encode");
+	while ((frame = g_async_queue_pop(encode_frames)) != &end_of_stream) {
+		trace_begin("encode");
+		if (video_format == VIDEO_Y4M)
+			write_y4m_frame(frame->rgb, planes);
+		else
+			fwrite(frame->rgb, 3, (gsize)width * height, output);
+		trace_end("encode");
+		g_async_queue_push(free_frames, frame);
+	}
+	g_free(planes);
+	return NULL;
+}
+
+/*
+ * Sliding window over the PCM input, in stereo frames.
+ */
+typedef struct {
+	pcm_source_t *	source;
+	float *		data;
+	gint32		capacity;
+	gint64		start;  /* position of data[0] */
+	gint32		length;
+	gboolean	eof;
+} pcm_window_t;
+
+static void pcm_window_fill(pcm_window_t *w)
+{
+	gint32 got = pcm_source_read(w->source, w->data + 2 * w->length, w->capacity - w->length);
+
+	if (got == 0)
+		w->eof = TRUE;
+	w->length += got;
+}
+
+/*
+ * Copies to pcm the PCM_WINDOW frames starting at pos, zero padded past
+ * the end of the input. Returns FALSE once pos is past the end.
+ */
+static gboolean pcm_window_at(pcm_window_t *w, gint64 pos, float *pcm)
+{
+	gint32 available;
+
+	while (w->start < pos && !(w->eof && w->length == 0)) {
+		gint32 skip;
+
+		if (w->length == 0)
+			pcm_window_fill(w);
+		skip = (gint32)MIN(pos - w->start, (gint64)w->length);
+		memmove(w->data, w->data + 2 * skip, sizeof(float) * 2 * (w->length - skip));
+		w->length -= skip;
+		w->start += skip;
+	}
+	while (!w->eof && w->length < PCM_WINDOW)
+		pcm_window_fill(w);
+	if (w->length == 0)
+		return FALSE;
+	available = MIN(w->length, PCM_WINDOW);
+	memcpy(pcm, w->data, sizeof(float) * 2 * available);
+	memset(pcm + 2 * available, 0, sizeof(float) * 2 * (PCM_WINDOW - available));
+	return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	GThread *palette_thread, *encode_thread;
+	pcm_format_t pcm_format;
+	pcm_window_t window;
+	float pcm[2 * PCM_WINDOW];
+	frame_t frames[FRAMES_IN_FLIGHT];
+	gint64 n, t_begin, elapsed;
+	gint32 i;
+
+	context = g_option_context_new("PCM-FILE - render Infinity offline");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("infinity-render: %s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(context);
+	if (argc != 2) {
+		g_printerr("infinity-render: expected one PCM file, - for standard input\n");
+		return 1;
+	}
+	if (!pcm_format_from_name(pcm_format_name, &pcm_format)) {
+		g_printerr("infinity-render: unknown PCM format '%s'\n", pcm_format_name);
+		return 1;
+	}
+	if (strcmp(video_format_name, "y4m") == 0)
+		video_format = VIDEO_Y4M;
+	else if (strcmp(video_format_name, "rgb") == 0)
+		video_format = VIDEO_RGB;
+	else {
+		g_printerr("infinity-render: unknown video format '%s'\n", video_format_name);
+		return 1;
+	}
+	if (width < 16 || height < 16 || fps <= 0 || rate <= 0 || channels <= 0
+	    || effect_interval <= 0 || color_interval <= 0) {
+		g_printerr("infinity-render: invalid size, rate, channels or interval\n");
+		return 1;
+	}
+	g_log_set_default_handler(log_to_stderr, NULL);
+
+	window.source = pcm_source_new(argv[1], pcm_format, channels);
+	if (window.source == NULL)
+		return 1;
+	window.capacity = PCM_WINDOW + rate / fps + 1;
+	window.data = g_new(float, 2 * window.capacity);
+	window.start = 0;
+	window.length = 0;
+	window.eof = FALSE;
+
+	output = strcmp(output_name, "-") == 0 ? stdout : fopen(output_name, "wb");
+	if (output == NULL) {
+		g_printerr("infinity-render: cannot open '%s' for writing\n", output_name);
+		return 1;
+	}
+	setvbuf(output, NULL, _IOFBF, 1 << 20);
+
+	if (!infinity_init_offline(&params, &player))
+		return 1;
+
+	free_frames = g_async_queue_new();
+	palette_frames = g_async_queue_new();
+	encode_frames = g_async_queue_new();
+	for (i = 0; i < FRAMES_IN_FLIGHT; i++) {
+		frames[i].surface = g_malloc((gsize)width * height);
+		frames[i].rgb = g_malloc((gsize)width * height * 3);
+		g_async_queue_push(free_frames, &frames[i]);
+	}
+	palette_thread = g_thread_new("infinity_palette", palette_stage, NULL);
+	encode_thread = g_thread_new("infinity_encode", encode_stage, NULL);
+
+	t_begin = g_get_monotonic_time();
+	for (n = 0; max_frames == 0 || n < max_frames; n++) {
+		frame_t *frame;
+
+		if (!pcm_window_at(&window, n * rate / fps, pcm))
+			break;
+		trace_begin("wait free frame");
+		frame = g_async_queue_pop(free_frames);
+		trace_end("wait free frame");
+		infinity_render_offline_frame(pcm, 2, frame->surface, frame->colors);
+		g_async_queue_push(palette_frames, frame);
+	}
+	g_async_queue_push(palette_frames, &end_of_stream);
+	g_thread_join(palette_thread);
+	g_thread_join(encode_thread);
+	elapsed = g_get_monotonic_time() - t_begin;
+
+	infinity_finish();
+	if (output != stdout)
+		fclose(output);
+	else
+		fflush(output);
+	pcm_source_destroy(window.source);
+	g_free(window.data);
+	for (i = 0; i < FRAMES_IN_FLIGHT; i++) {
+		g_free(frames[i].surface);
+		g_free(frames[i].rgb);
+	}
+	g_async_queue_unref(free_frames);
+	g_async_queue_unref(palette_frames);
+	g_async_queue_unref(encode_frames);
+
+	g_printerr("infinity-render: %" G_GINT64_FORMAT " frames in %.2f s, %.1fx real time\n",
+		   n, elapsed / 1e6, elapsed > 0 ? (gdouble)n / fps / (elapsed / 1e6) : 0.0);
+	return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "shmexport.h"
+
+/*
+ * Sample reader of the frames exported with INFINITY_EXPORT: waits for
+ * them, prints the frame rate, latency and drops once a second, and can
+ * write the frames, without their row padding, to a file.
+ */
+
+static gint32 max_frames = 0;
+static gint32 timeout = 5;
+static gchar *output_name = NULL;
+
+static const GOptionEntry entries[] = {
+	{ "frames", 'n', 0, G_OPTION_ARG_INT, &max_frames, "Stop after N frames (never)", "N" },
+	{ "timeout", 't', 0, G_OPTION_ARG_INT, &timeout, "Give up after S seconds without a frame (5)", "S" },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_name, "Write the raw frames to FILE, - for standard output", "FILE" },
+	{ NULL }
+};
+
+static const gchar *format_names[INFINITY_NB_FORMATS] = { "rgb565", "rgb24", "xrgb32", "xbgr32" };
+static const gint32 format_bytes[INFINITY_NB_FORMATS] = { 2, 3, 4, 4 };
+
+static gboolean write_frame(FILE *output, const shmexport_frame_t *frame)
+{
+	const gsize row_bytes = (gsize)frame->width * format_bytes[frame->format];
+	gint32 i;
+
+	for (i = 0; i < frame->height; i++)
+		if (fwrite(frame->pixels + (gsize)i * frame->stride, 1, row_bytes, output) != row_bytes)
+			return FALSE;
+	return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	shmexport_reader_t *reader;
+	shmexport_frame_t frame;
+	FILE *output = NULL;
+	gint64 t_report, now, latency = 0;
+	guint32 last = 0;
+	gint32 frames = 0, period_frames = 0, dropped = 0, torn = 0;
+
+	context = g_option_context_new("NAME - read frames exported by Infinity");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("infinity-shmread: %s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(context);
+	if (argc != 2) {
+		g_printerr("infinity-shmread: expected the export name\n");
+		return 1;
+	}
+	reader = shmexport_reader_open(argv[1]);
+	if (reader == NULL) {
+		g_printerr("infinity-shmread: cannot open export '%s'\n", argv[1]);
+		return 1;
+	}
+	if (output_name != NULL) {
+		output = strcmp(output_name, "-") == 0 ? stdout : fopen(output_name, "wb");
+		if (output == NULL) {
+			g_printerr("infinity-shmread: cannot open %s\n", output_name);
+			return 1;
+		}
+	}
+
+	t_report = g_get_monotonic_time();
+	while (max_frames == 0 || frames < max_frames) {
+		if (!shmexport_reader_next(reader, (gint64)timeout * G_USEC_PER_SEC, &frame)) {
+			g_printerr("infinity-shmread: no frame for %d s\n", timeout);
+			break;
+		}
+		now = g_get_monotonic_time();
+		if (frame.format >= INFINITY_NB_FORMATS)
+			continue;
+		if (output != NULL && !write_frame(output, &frame)) {
+			g_printerr("infinity-shmread: write error\n");
+			break;
+		}
+		if (!shmexport_reader_done(reader, &frame))
+			torn++;
+		if (last != 0)
+			dropped += frame.sequence - last - 1;
+		last = frame.sequence;
+		latency += now - frame.timestamp;
+		frames++;
+		period_frames++;
+		if (now - t_report >= G_USEC_PER_SEC) {
+			g_printerr("#%u %dx%d %s  %.1f fps  latency %.2f ms  dropped %d  torn %d\n",
+				   frame.sequence, frame.width, frame.height, format_names[frame.format],
+				   period_frames * 1e6 / (now - t_report),
+				   latency / 1e3 / period_frames, dropped, torn);
+			t_report = now;
+			period_frames = 0;
+			latency = 0;
+		}
+	}
+
+	if (output != NULL && output != stdout)
+		fclose(output);
+	shmexport_reader_close(reader);
+	return frames > 0 ? 0 : 1;
+}
@@ -19,154 +19,559 @@
 #include <glib.h>
 
 #include "config.h"
+#include "autotune.h"
 #include "display.h"
+#include "mempressure.h"
+#include "metrics.h"
+#include "perfcount.h"
+#include "trace.h"
 #include "effects.h"
 #include "infinity.h"
 #include "input.h"
+#include "replay.h"
+#include "shmexport.h"
+#include "synth.h"
 #include "types.h"
 
 #define wrap(a)         (a < 0 ? 0 : (a > 255 ? 255 : a))
-#define next_effect()   (t_last_effect++)
-#define next_color()    (t_last_color++)
+/* The window hidden for this long, the vector fields are let go */
+#define HIDDEN_RELEASE_USECS	(10 * G_USEC_PER_SEC)
 
 typedef gint32 t_color;
 typedef gint32 t_num_effect;
 
-static InfParameters * params;
-static Player * player;
+struct _infinity {
+	InfParameters *		params;
+	Player *		player;
 
-static gint32 width, height, scale;
-static t_effect current_effect;
-static t_color color, old_color, t_last_color;
-static t_num_effect t_last_effect;
+	gint32			width, height, scale;
+	t_effect		current_effect;
+	t_color			color, old_color, t_last_color;
+	t_num_effect		t_last_effect;
+	gint32			fps;
+	gint32			t_between_effects, t_between_colors;
 
-static gboolean must_resize;
-static gboolean finished;
-static gboolean resizing;
-G_LOCK_DEFINE_STATIC(resize_lock);
-static gboolean initializing = FALSE;
-static gboolean quiting;
+	gboolean		must_resize;
+	gboolean		finished;
+	gboolean		resizing;
+	GMutex			resize_lock;
+	gboolean		initializing;
+	gboolean		quiting;
+	gboolean		offline;
 #ifdef INFINITY_DEBUG
-static gboolean interactive_mode;
+	gboolean		interactive_mode;
 #endif
 
-static GThread *thread;
-static GAsyncQueue *key_queue;
+	GThread *		thread;
+	GAsyncQueue *		key_queue;
+
+	GRand *			rng;
+	replay_writer_t *	capture;
+	replay_reader_t *	replay;
+	replay_frame_t		replay_frame;
+	synth_t *		synth;
+
+	display_t *		display;
+	guint16 *		frame; /* RGB565 frame presented in the UI window */
+	metrics_t *		metrics;
+	perfcount_t *		perfcount;
+	shmexport_t *		export;
+	mempressure_t *		mempressure;
+};
+
+/* Instance driven by the infinity_init() family of functions */
+static infinity_t *default_instance;
+/* Instance shown in the UI window, target of infinity_queue_key() */
+static infinity_t *ui_instance;
+G_LOCK_DEFINE_STATIC(ui_instance);
+/* Number of instances exporting frames, to tell their regions apart */
+static gint32 nb_exports;
+G_LOCK_DEFINE_STATIC(nb_exports);
 
 static gpointer renderer(void *arg);
-static void handle_key_event(InfinityKey key);
-static void process_key_queue(void);
+static void begin_frame(infinity_t *inf, const float *data, int channels);
+static void finish_frame(infinity_t *inf);
+static void handle_key_event(infinity_t *inf, InfinityKey key);
+static void process_key_queue(infinity_t *inf);
 
-void infinity_init(InfParameters * _params, Player * _player)
+/*
+ * Sets up the random generator and the capture, replay and synthetic
+ * input modes, which are selected through the environment:
+ *
+ *   INFINITY_SEED=n        seed for effect and palette changes
+ *   INFINITY_CAPTURE=file  record PCM, effects and palettes to file
+ *   INFINITY_REPLAY=file   render from a capture instead of the player
+ *   INFINITY_SYNTH=signal  render from silence, sine, noise, transients or mix
+ */
+static void init_input_modes(infinity_t *inf)
 {
-	gint32 _try;
+	const gchar *value;
+	guint32 seed;
 
-	if (initializing) {
-		g_warning("Infinity: is already initializing...");
-		_try = 0;
-		while (initializing) {
-			g_usleep(1000000);
-			(void)sleep(1);
-			if (_try++ > 10)
-				return;
+	value = g_getenv("INFINITY_SEED");
+	seed = value != NULL ? (guint32)g_ascii_strtoull(value, NULL, 10) : g_random_int();
+
+	value = g_getenv("INFINITY_REPLAY");
+	if (value != NULL) {
+		inf->replay = replay_reader_new(value);
+		if (inf->replay != NULL) {
+			gint32 replay_width, replay_height;
+
+			seed = replay_reader_get_seed(inf->replay);
+			memset(&inf->replay_frame, 0, sizeof(inf->replay_frame));
+			replay_reader_get_size(inf->replay, &replay_width, &replay_height);
+			g_message("Infinity: replaying '%s'", value);
+			if (replay_width != inf->width || replay_height != inf->height)
+				g_message("Infinity: capture was %dx%d, frames will differ at %dx%d",
+					  replay_width, replay_height, inf->width, inf->height);
 		}
 	}
-	initializing = TRUE;
-	if (key_queue == NULL) {
-		key_queue = g_async_queue_new();
+	value = g_getenv("INFINITY_SYNTH");
+	if (value != NULL && inf->replay == NULL) {
+		synth_signal_t signal;
+
+		if (synth_signal_from_name(value, &signal))
+			inf->synth = synth_new(signal, seed);
+		else
+			g_warning("Infinity: unknown synthetic signal '%s'", value);
+	}
+	value = g_getenv("INFINITY_CAPTURE");
+	if (value != NULL) {
+		inf->capture = replay_writer_new(value, seed, inf->width, inf->height);
+		if (inf->capture != NULL)
+			g_message("Infinity: capturing to '%s'", value);
+	}
+	g_message("Infinity: random seed is %u", seed);
+	inf->rng = g_rand_new_with_seed(seed);
+}
+
+/*
+ * INFINITY_EXPORT names a shared memory region the frames are published
+ * to, see shmexport.h. Instances after the first add -2, -3... to it.
+ */
+static void init_export(infinity_t *inf)
+{
+	static const gchar *format_names[INFINITY_NB_FORMATS] = { "rgb565", "rgb24", "xrgb32", "xbgr32" };
+	infinity_format_t format = INFINITY_FORMAT_XRGB32;
+	const gchar *name, *value;
+	gchar *unique;
+	gint32 i, n;
+
+	name = g_getenv("INFINITY_EXPORT");
+	if (name == NULL || *name == '\0')
+		return;
+	value = g_getenv("INFINITY_EXPORT_FORMAT");
+	if (value != NULL) {
+		for (i = 0; i < INFINITY_NB_FORMATS; i++)
+			if (g_ascii_strcasecmp(value, format_names[i]) == 0)
+				format = i;
+		if (g_ascii_strcasecmp(value, format_names[format]) != 0)
+			g_warning("Infinity: unknown export format '%s', using %s",
+				  value, format_names[format]);
+	}
+	G_LOCK(nb_exports);
+	n = ++nb_exports;
+	G_UNLOCK(nb_exports);
+	unique = n > 1 ? g_strdup_printf("%s-%d", name, n) : g_strdup(name);
+	inf->export = shmexport_new(unique, inf->width, inf->height, format);
+	g_free(unique);
+}
+
+static void quit_input_modes(infinity_t *inf)
+{
+	if (inf->capture != NULL) {
+		replay_writer_destroy(inf->capture);
+		inf->capture = NULL;
+	}
+	if (inf->replay != NULL) {
+		replay_reader_destroy(inf->replay);
+		inf->replay = NULL;
 	}
-	params = _params;
-	player = _player;
-	width = params->get_width();
-	height = params->get_height();
-	scale = params->get_scale();
+	if (inf->synth != NULL) {
+		synth_destroy(inf->synth);
+		inf->synth = NULL;
+	}
+	if (inf->rng != NULL) {
+		g_rand_free(inf->rng);
+		inf->rng = NULL;
+	}
+}
 
-	if (! display_init(width, height, scale, player)) {
+static void load_random_effect(infinity_t *inf)
+{
+	display_load_random_effect(&inf->current_effect, inf->rng);
+	if (inf->capture != NULL)
+		replay_writer_effect(inf->capture, &inf->current_effect);
+}
+
+/*
+ * Draws the effect the next scheduled change will draw, from a copy of
+ * the random generator taken past the palette changes before it, and
+ * makes its field in the background. The INFINITY_SEED sequence is left
+ * as it is: a change of the intervals or a key meanwhile only makes the
+ * field made on the switch instead.
+ */
+static void prefetch_next_effect(infinity_t *inf)
+{
+	GRand *lookahead = g_rand_copy(inf->rng);
+	gint32 t_color = inf->t_last_color, t;
+	t_effect next_effect;
+
+	for (t = inf->t_last_effect + 1; t % inf->t_between_effects != 0; t++)
+		if (++t_color % inf->t_between_colors == 0) {
+			g_rand_int_range(lookahead, 0, NB_PALETTES);
+			t_color = 0;
+		}
+	display_load_random_effect(&next_effect, lookahead);
+	g_rand_free(lookahead);
+	display_prefetch(inf->display, &next_effect);
+}
+
+static void set_palette(infinity_t *inf, t_color new_color)
+{
+	inf->old_color = inf->color;
+	inf->color = new_color;
+	inf->t_last_color = 0;
+	if (inf->capture != NULL)
+		replay_writer_palette(inf->capture, inf->old_color, inf->color);
+}
+
+/*
+ * Called on memory pressure, from the thread waiting for it.
+ */
+static void trim_fields(gpointer data)
+{
+	gsize freed;
+
+	(void)data;
+	compute_fields_pressure();
+	freed = compute_fields_trim();
+	if (freed > 0)
+		g_message("Infinity: memory pressure, freed %.1f MB of vector fields",
+			  freed / 1048576.0);
+}
+
+/*
+ * Selects the warp kernel for the current resolution, and the effects
+ * warped without a field with it.
+ */
+static void select_kernel(infinity_t *inf)
+{
+	const gint32 kernel = autotune_select_kernel(inf->width, inf->height);
+
+	display_set_kernel(inf->display, kernel);
+	display_set_fieldless(inf->display, autotune_select_fieldless(inf->width, inf->height, kernel));
+}
+
+/*
+ * Sets up what the rendering thread owns: hardware counters count the
+ * thread that opens them.
+ */
+static void start_rendering(infinity_t *inf)
+{
+	trace_thread_name("renderer");
+	inf->perfcount = perfcount_new();
+	display_set_instruments(inf->display, inf->metrics, inf->perfcount);
+	select_kernel(inf);
+}
+
+static infinity_t *infinity_alloc(InfParameters * params, Player * player, gboolean offline)
+{
+	infinity_t *inf = g_new0(infinity_t, 1);
+
+	inf->params = params;
+	inf->player = player;
+	inf->width = params->get_width();
+	inf->height = params->get_height();
+	inf->scale = params->get_scale();
+	inf->offline = offline;
+	inf->initializing = TRUE;
+	g_mutex_init(&inf->resize_lock);
+
+	inf->display = display_new(inf->width, inf->height, inf->scale, player, offline);
+	if (inf->display == NULL) {
 		g_critical("Infinity: cannot initialize display");
-		initializing = FALSE;
-		finished = TRUE;
+		g_mutex_clear(&inf->resize_lock);
+		g_free(inf);
+		return NULL;
+	}
+
+	inf->fps = params->get_max_fps();
+	inf->t_between_effects = params->get_effect_interval();
+	inf->t_between_colors = params->get_color_interval();
+
+	init_input_modes(inf);
+	init_export(inf);
+	inf->metrics = metrics_new();
+	display_set_instruments(inf->display, inf->metrics, NULL);
+	inf->mempressure = mempressure_new(trim_fields, NULL);
+	trace_init();
+	load_random_effect(inf);
+	prefetch_next_effect(inf);
+	return inf;
+}
+
+infinity_t *infinity_new(InfParameters * params, Player * player)
+{
+	infinity_t *inf;
+
+	g_return_val_if_fail(params != NULL, NULL);
+	g_return_val_if_fail(player != NULL, NULL);
+
+	inf = infinity_alloc(params, player, FALSE);
+	if (inf == NULL) {
 		player->disable_plugin();
+		return NULL;
+	}
+	inf->key_queue = g_async_queue_new();
+	inf->frame = g_new0(guint16, (gsize)inf->width * inf->height);
+	G_LOCK(ui_instance);
+	ui_instance = inf;
+	G_UNLOCK(ui_instance);
+	inf->thread = g_thread_new("infinity_renderer", renderer, inf);
+	return inf;
+}
+
+infinity_t *infinity_new_offline(InfParameters * params, Player * player)
+{
+	infinity_t *inf;
+
+	g_return_val_if_fail(params != NULL, NULL);
+	g_return_val_if_fail(player != NULL, NULL);
+
+	inf = infinity_alloc(params, player, TRUE);
+	if (inf == NULL)
+		return NULL;
+	start_rendering(inf);
+	inf->initializing = FALSE;
+	return inf;
+}
+
+void infinity_render_frame(infinity_t *inf, const float *data, int channels,
+			   byte *surface, guint16 colors[256])
+{
+	gint64 t_begin;
+
+	g_return_if_fail(inf != NULL && inf->offline);
+	g_return_if_fail(surface != NULL && colors != NULL);
+
+	t_begin = g_get_monotonic_time();
+	begin_frame(inf, data, channels);
+	display_copy_frame(inf->display, surface, colors);
+	finish_frame(inf);
+	metrics_frame_done(inf->metrics, g_get_monotonic_time() - t_begin, 0);
+	perfcount_frame_done(inf->perfcount, inf->width, inf->height);
+}
+
+/*
+ * Maps the frame straight into the next slot of the export region.
+ */
+static void export_frame(infinity_t *inf)
+{
+	gpointer pixels;
+	gint32 stride;
+
+	pixels = shmexport_begin(inf->export, inf->width, inf->height, &stride);
+	if (pixels == NULL)
 		return;
+	display_map_frame(inf->display, pixels, stride, shmexport_get_format(inf->export));
+	shmexport_commit(inf->export);
+}
+
+/*
+ * One frame of infinity_render_into(), without the frame accounting
+ * left to the caller.
+ */
+static void render_into(infinity_t *inf, const float *data, int channels,
+			gpointer pixels, gint32 stride, infinity_format_t format)
+{
+	begin_frame(inf, data, channels);
+	display_map_frame(inf->display, pixels, stride, format);
+	if (inf->export != NULL)
+		export_frame(inf);
+	finish_frame(inf);
+}
+
+void infinity_render_into(infinity_t *inf, const float *data, int channels,
+			  gpointer pixels, gint32 stride, infinity_format_t format)
+{
+	gint64 t_begin;
+
+	g_return_if_fail(inf != NULL && inf->offline);
+	g_return_if_fail(pixels != NULL);
+	g_return_if_fail(format >= 0 && format < INFINITY_NB_FORMATS);
+	g_return_if_fail(stride >= inf->width * display_format_bytes(format));
+
+	t_begin = g_get_monotonic_time();
+	render_into(inf, data, channels, pixels, stride, format);
+	metrics_frame_done(inf->metrics, g_get_monotonic_time() - t_begin, 0);
+	perfcount_frame_done(inf->perfcount, inf->width, inf->height);
+}
+
+/*
+ * Resizes everything sized by the frame and selects the kernel for the
+ * new size. Must be called from the rendering thread.
+ */
+static void resize(infinity_t *inf, gint32 width, gint32 height)
+{
+	const gint64 t_begin = g_get_monotonic_time();
+
+	inf->width = width;
+	inf->height = height;
+	display_resize(inf->display, width, height);
+	if (inf->frame != NULL) {
+		g_free(inf->frame);
+		inf->frame = g_new0(guint16, (gsize)width * height);
 	}
+	inf->params->set_width(width);
+	inf->params->set_height(height);
+	select_kernel(inf);
+	metrics_record(inf->metrics, METRICS_RESIZE, g_get_monotonic_time() - t_begin);
+}
 
-	old_color = 0;
-	color = 0;
+void infinity_resize(infinity_t *inf, gint32 width, gint32 height)
+{
+	g_return_if_fail(inf != NULL && inf->offline);
+	g_return_if_fail(width > 0 && height > 0);
 
-	finished = FALSE;
-	must_resize = FALSE;
-	resizing = FALSE;
-#ifdef INFINITY_DEBUG
-	interactive_mode = FALSE;
-#endif
-	quiting = FALSE;
+	if (width != inf->width || height != inf->height)
+		resize(inf, width, height);
+}
 
-	display_load_random_effect(&current_effect);
+void infinity_render_pcm(infinity_t *inf, const float *data, int channels)
+{
+	if (!inf->initializing && !inf->quiting && inf->replay == NULL && inf->synth == NULL) {
+		trace_thread_name("audio");
+		trace_begin("pcm update");
+		display_set_pcm_data(inf->display, data, channels);
+		trace_end("pcm update");
+	}
+}
 
-	thread = g_thread_new("infinity_renderer", renderer, NULL);
+void infinity_render_raw_pcm(infinity_t *inf, const gint16 data[2][512])
+{
+	if (!inf->initializing && !inf->quiting && inf->replay == NULL && inf->synth == NULL) {
+		trace_thread_name("audio");
+		trace_begin("pcm update");
+		display_set_raw_pcm_data(inf->display, data);
+		metrics_pcm_update(inf->metrics);
+		trace_end("pcm update");
+	}
 }
 
-void infinity_finish(void)
+void infinity_destroy(infinity_t *inf)
 {
 	gint32 _try;
 
-	if (finished)
-		return;
-	if (initializing) {
+	g_return_if_fail(inf != NULL);
+
+	if (inf->initializing) {
 		g_warning("The plugin have not yet initialized");
 		_try = 0;
-		while (initializing) {
+		while (inf->initializing) {
 			g_usleep(1000000);
 			if (_try++ > 10)
 				return;
 		}
 	}
-	quiting = TRUE;
-	finished = TRUE;
-	if (thread != NULL) {
-		if (g_thread_self() == thread) {
-			g_warning("Infinity: cannot join renderer thread from itself");
-			thread = NULL;
-		} else {
-			g_thread_join(thread);
-			thread = NULL;
+	inf->quiting = TRUE;
+	inf->finished = TRUE;
+	if (!inf->offline) {
+		if (inf->thread != NULL) {
+			if (g_thread_self() == inf->thread)
+				g_warning("Infinity: cannot join renderer thread from itself");
+			else
+				g_thread_join(inf->thread);
+			inf->thread = NULL;
 		}
+		G_LOCK(ui_instance);
+		if (ui_instance == inf)
+			ui_instance = NULL;
+		G_UNLOCK(ui_instance);
+		g_async_queue_unref(inf->key_queue);
+		/*
+		 * Take some time to let it know infinity_render_pcm()
+		 * that must not call display_set_pcm_data().
+		 * If it do that while calling display_destroy(),
+		 * we could make Audacious crash, because display_destroy
+		 * destroy a mutex where display_set_pcm_data
+		 * could be blocked.
+		 *
+		 * See display.h::display_set_pcm_data()
+		 */
+		g_usleep(1000000);
 	}
-	if (key_queue != NULL) {
-		g_async_queue_unref(key_queue);
-		key_queue = NULL;
+	mempressure_destroy(inf->mempressure);
+	display_destroy(inf->display);
+	quit_input_modes(inf);
+	g_free(inf->frame);
+	metrics_destroy(inf->metrics);
+	trace_quit();
+	perfcount_destroy(inf->perfcount);
+	shmexport_destroy(inf->export);
+	g_mutex_clear(&inf->resize_lock);
+	if (!inf->offline)
+		g_message("Infinity is shut down");
+	g_free(inf);
+}
+
+void infinity_init(InfParameters * _params, Player * _player)
+{
+	if (default_instance != NULL) {
+		g_warning("Infinity: is already initialized");
+		return;
+	}
+	default_instance = infinity_new(_params, _player);
+}
+
+gboolean infinity_init_offline(InfParameters * _params, Player * _player)
+{
+	if (default_instance != NULL) {
+		g_warning("Infinity: is already initialized");
+		return FALSE;
 	}
-	/*
-	 * Take some time to let it know infinity_render_multi_pcm()
-	 * that must not call display_set_pcm_data().
-	 * If it do that while calling display_quit(),
-	 * we could make Audacious crash, because display_quit
-	 * destroy a mutex where display_set_pcm_data
-	 * could be blocked.
-	 *
-	 * See display.h::display_set_pcm_data()
-	 */
-	g_usleep(1000000);
-	display_quit();
-
-	g_message("Infinity is shut down");
+	default_instance = infinity_new_offline(_params, _player);
+	return default_instance != NULL;
+}
+
+void infinity_render_offline_frame(const float *data, int channels,
+				   byte *surface, guint16 colors[256])
+{
+	g_return_if_fail(default_instance != NULL);
+
+	infinity_render_frame(default_instance, data, channels, surface, colors);
+}
+
+void infinity_finish(void)
+{
+	infinity_t *inf = default_instance;
+
+	if (inf == NULL)
+		return;
+	default_instance = NULL;
+	infinity_destroy(inf);
 }
 
 void infinity_render_multi_pcm(const float *data, int channels)
 {
-	if (!initializing && !quiting)
-		display_set_pcm_data(data, channels);
+	infinity_t *inf = default_instance;
+
+	if (inf != NULL)
+		infinity_render_pcm(inf, data, channels);
 }
 
 void infinity_queue_key(InfinityKey key)
 {
-	if (key_queue == NULL) {
-		return;
-	}
-	g_async_queue_push(key_queue, GINT_TO_POINTER(key));
+	G_LOCK(ui_instance);
+	if (ui_instance != NULL)
+		g_async_queue_push(ui_instance->key_queue, GINT_TO_POINTER(key));
+	G_UNLOCK(ui_instance);
 }
 
-static void handle_key_event(InfinityKey key)
+static void handle_key_event(infinity_t *inf, InfinityKey key)
 {
+	Player *player = inf->player;
+
 	switch (key) {
 	case INFINITY_KEY_RIGHT:
 		if (player->is_playing())
@@ -204,20 +609,26 @@ static void handle_key_event(InfinityKey key)
 		display_exit_fullscreen_if_needed();
 		break;
 	case INFINITY_KEY_NEXT_PALETTE:
-		if (t_last_color > 32) {
-			t_last_color = 0;
-			old_color = color;
-			color = (color + 1) % NB_PALETTES;
-		}
+		if (inf->t_last_color > 32 && inf->replay == NULL)
+			set_palette(inf, (inf->color + 1) % NB_PALETTES);
 		break;
 	case INFINITY_KEY_NEXT_EFFECT:
-		display_load_random_effect(&current_effect);
-		t_last_effect = 0;
+		if (inf->replay != NULL)
+			break;
+		load_random_effect(inf);
+		inf->t_last_effect = 0;
+		prefetch_next_effect(inf);
+		break;
+	case INFINITY_KEY_TOGGLE_HUD:
+		display_toggle_hud(inf->display);
+		break;
+	case INFINITY_KEY_DUMP_TRACE:
+		trace_dump();
 		break;
 	case INFINITY_KEY_TOGGLE_INTERACTIVE:
 #ifdef INFINITY_DEBUG
-		interactive_mode = !interactive_mode;
-		g_message("Infinity %s interactive mode", interactive_mode ? "entered" : "leaved");
+		inf->interactive_mode = !inf->interactive_mode;
+		g_message("Infinity %s interactive mode", inf->interactive_mode ? "entered" : "leaved");
 #endif
 		break;
 	default:
@@ -225,17 +636,17 @@ static void handle_key_event(InfinityKey key)
 	}
 }
 
-static void process_key_queue(void)
+static void process_key_queue(infinity_t *inf)
 {
-	if (key_queue == NULL) {
+	if (inf->key_queue == NULL) {
 		return;
 	}
 	for (;;) {
-		gpointer key_ptr = g_async_queue_try_pop(key_queue);
+		gpointer key_ptr = g_async_queue_try_pop(inf->key_queue);
 		if (key_ptr == NULL) {
 			break;
 		}
-		handle_key_event((InfinityKey)GPOINTER_TO_INT(key_ptr));
+		handle_key_event(inf, (InfinityKey)GPOINTER_TO_INT(key_ptr));
 	}
 }
 
@@ -246,95 +657,188 @@ static gint64 calculate_frame_length_usecs(gint32 fps, int line) {
 	return frame_length;
 }
 
+/*
+ * Loads the PCM data and the effect and palette changes of the next
+ * captured frame, starting over when the capture is exhausted.
+ */
+static void load_replay_frame(infinity_t *inf)
+{
+	replay_frame_t *replay_frame = &inf->replay_frame;
+
+	if (!replay_reader_next_frame(inf->replay, replay_frame)) {
+		g_message("Infinity: end of replay, starting over");
+		replay_reader_rewind(inf->replay);
+		g_rand_set_seed(inf->rng, replay_reader_get_seed(inf->replay));
+		if (!replay_reader_next_frame(inf->replay, replay_frame))
+			return;
+	}
+	if (replay_frame->has_effect) {
+		inf->current_effect = replay_frame->effect;
+		inf->t_last_effect = 0;
+		if (inf->capture != NULL)
+			replay_writer_effect(inf->capture, &inf->current_effect);
+	}
+	if (replay_frame->has_palette) {
+		inf->color = replay_frame->old_color;
+		set_palette(inf, replay_frame->color);
+	}
+	display_set_raw_pcm_data(inf->display, replay_frame->pcm);
+}
+
+static void load_synth_frame(infinity_t *inf)
+{
+	float data[2 * SYNTH_FRAMES];
+
+	synth_render_block(inf->synth, data, SYNTH_RATE / inf->fps);
+	display_set_pcm_data(inf->display, data, 2);
+}
+
+/*
+ * Schedules effect and palette changes. Replays follow the captured
+ * schedule instead.
+ */
+static void schedule_changes(infinity_t *inf)
+{
+	gboolean effect_changed = FALSE;
+
+	inf->t_last_color++;
+	inf->t_last_effect++;
+	if (inf->replay != NULL)
+		return;
+#ifdef INFINITY_DEBUG
+	if (inf->interactive_mode)
+		return;
+#endif
+	if (inf->t_last_effect % inf->t_between_effects == 0) {
+		load_random_effect(inf);
+		inf->t_last_effect = 0;
+		inf->t_between_effects = inf->params->get_effect_interval();
+		effect_changed = TRUE;
+	}
+	if (inf->t_last_color % inf->t_between_colors == 0) {
+		set_palette(inf, g_rand_int_range(inf->rng, 0, NB_PALETTES));
+		inf->t_between_colors = inf->params->get_color_interval();
+	}
+	if (effect_changed)
+		prefetch_next_effect(inf);
+}
+
+/*
+ * Takes the PCM data of the next frame, from data unless it is NULL or
+ * the replay or synthetic input is selected, and warps it. The frame can
+ * then be taken out of the display, before finish_frame() draws the
+ * spectrum and curve it will carry over to the next frame.
+ */
+static void begin_frame(infinity_t *inf, const float *data, int channels)
+{
+	if (inf->replay != NULL)
+		load_replay_frame(inf);
+	else if (inf->synth != NULL)
+		load_synth_frame(inf);
+	else if (data != NULL)
+		display_set_pcm_data(inf->display, data, channels);
+	display_blur(inf->display, &inf->current_effect);
+}
+
+static void finish_frame(infinity_t *inf)
+{
+	display_t *display = inf->display;
+	gint64 t_begin, t_spectral;
+
+	t_begin = g_get_monotonic_time();
+	perfcount_begin(inf->perfcount, PERFCOUNT_SPECTRAL);
+	spectral(display, &inf->current_effect);
+	perfcount_end(inf->perfcount, PERFCOUNT_SPECTRAL);
+	t_spectral = g_get_monotonic_time();
+	metrics_record(inf->metrics, METRICS_SPECTRAL, t_spectral - t_begin);
+	perfcount_begin(inf->perfcount, PERFCOUNT_CURVE);
+	curve(display, &inf->current_effect);
+	perfcount_end(inf->perfcount, PERFCOUNT_CURVE);
+	metrics_record(inf->metrics, METRICS_CURVE, g_get_monotonic_time() - t_spectral);
+	if (inf->t_last_color <= 32)
+		change_color(display, inf->old_color, inf->color, inf->t_last_color * 8);
+	if (inf->capture != NULL) {
+		gint16 pcm[2][512];
+
+		display_get_frame_pcm_data(display, pcm);
+		replay_writer_frame(inf->capture, pcm);
+	}
+	schedule_changes(inf);
+}
+
 static gpointer renderer(void *arg)
 {
+	infinity_t *inf = arg;
+	infinity_format_t format;
+	gpointer pixels;
+	gint32 stride;
 	gint64 now, render_time, t_begin;
+	gint64 hidden_since = 0; /* -1 once the fields are let go */
+	gint32 new_width, new_height;
 	gint32 frame_length;
-	gint32 fps, new_fps;
-	gint32 t_between_effects, t_between_colors;
-
-	fps = params->get_max_fps();
-	frame_length = calculate_frame_length_usecs(fps, __LINE__);
-	t_between_effects = params->get_effect_interval();
-	t_between_colors = params->get_color_interval();
-	initializing = FALSE;
+	gint32 new_fps;
+
+	frame_length = calculate_frame_length_usecs(inf->fps, __LINE__);
+	start_rendering(inf);
+	inf->initializing = FALSE;
 	for (;; ) { /* ever... */
-		if (display_window_closed()) {
-			player->disable_plugin();
+		if (display_window_closed(inf->display)) {
+			inf->player->disable_plugin();
 			break;
 		}
-		if (!display_is_visible()) {
-			if (finished)
+		if (!display_is_visible(inf->display)) {
+			if (inf->finished)
 				break;
+			now = g_get_monotonic_time();
+			if (hidden_since == 0) {
+				hidden_since = now;
+			} else if (hidden_since > 0 && now - hidden_since > HIDDEN_RELEASE_USECS) {
+				display_release_field(inf->display);
+				hidden_since = -1;
+			}
 			g_usleep(3 * frame_length);
 			continue;
 		}
-		process_key_queue();
-		if (display_take_resize(&width, &height)) {
-			G_LOCK(resize_lock);
-			resizing = TRUE;
-			G_UNLOCK(resize_lock);
-			must_resize = TRUE;
+		hidden_since = 0;
+		t_begin = g_get_monotonic_time();
+		process_key_queue(inf);
+		metrics_record(inf->metrics, METRICS_INPUT, g_get_monotonic_time() - t_begin);
+		if (display_take_resize(inf->display, &new_width, &new_height)) {
+			g_mutex_lock(&inf->resize_lock);
+			inf->resizing = TRUE;
+			g_mutex_unlock(&inf->resize_lock);
+			inf->must_resize = TRUE;
 		}
-		if (finished)
+		if (inf->finished)
 			break;
-		if (must_resize) {
-			if (! display_resize(width, height)) {
-				player->disable_plugin();
-				break;
-			}
-			params->set_width(width);
-			params->set_height(height);
-			must_resize = FALSE;
-			G_LOCK(resize_lock);
-			resizing = FALSE;
-			G_UNLOCK(resize_lock);
-		}
-		t_begin = g_get_monotonic_time();
-		display_blur(current_effect.num_effect);
-		spectral(&current_effect);
-		curve(&current_effect);
-		if (t_last_color <= 32)
-			change_color(old_color, color, t_last_color * 8);
-		next_color();
-		next_effect();
-		if (t_last_effect % t_between_effects == 0) {
-#ifdef INFINITY_DEBUG
-			if (!interactive_mode) {
-				display_load_random_effect(&current_effect);
-				t_last_effect = 0;
-				t_between_effects = params->get_effect_interval();
-			}
-#else
-			display_load_random_effect(&current_effect);
-			t_last_effect = 0;
-			t_between_effects = params->get_effect_interval();
-#endif
+		if (inf->must_resize) {
+			resize(inf, new_width, new_height);
+			inf->must_resize = FALSE;
+			g_mutex_lock(&inf->resize_lock);
+			inf->resizing = FALSE;
+			g_mutex_unlock(&inf->resize_lock);
 		}
-		if (t_last_color % t_between_colors == 0) {
-#ifdef INFINITY_DEBUG
-			if (!interactive_mode) {
-				old_color = color;
-				color = rand() % NB_PALETTES;
-				t_last_color = 0;
-				t_between_colors = params->get_color_interval();
-			}
-#else
-			old_color = color;
-			color = rand() % NB_PALETTES;
-			t_last_color = 0;
-			t_between_colors = params->get_color_interval();
-#endif
+		/* PCM data comes from infinity_render_pcm() */
+		pixels = display_acquire_frame(inf->display, &format, &stride);
+		if (pixels != NULL) {
+			render_into(inf, NULL, 0, pixels, stride, format);
+			display_present_acquired(inf->display);
+		} else {
+			render_into(inf, NULL, 0, inf->frame, inf->width * sizeof(guint16),
+				    INFINITY_FORMAT_RGB565);
+			display_present(inf->display, inf->frame);
 		}
 
-		new_fps = params->get_max_fps();
-		if (new_fps != fps) {
-			fps = new_fps;
-			frame_length = calculate_frame_length_usecs(fps, __LINE__);
+		new_fps = inf->params->get_max_fps();
+		if (new_fps != inf->fps) {
+			inf->fps = new_fps;
+			frame_length = calculate_frame_length_usecs(inf->fps, __LINE__);
 		}
 
 		now = g_get_monotonic_time();
 		render_time = now - t_begin;
+		metrics_frame_done(inf->metrics, render_time, frame_length);
+		perfcount_frame_done(inf->perfcount, inf->width, inf->height);
 		if (render_time < frame_length) {
 			g_usleep(frame_length - render_time);
 		}
@@ -18,6 +18,7 @@
 
 #include <glib.h>
 #include "music-player.h"
+#include "types.h"
 
 typedef struct _InfParameters {
     gint32  (*get_width)        (void);
@@ -31,20 +32,105 @@ typedef struct _InfParameters {
 } InfParameters;
 
 /*
- * Initializes rendering process.
+ * A visualizer instance. Several of them can render concurrently, each
+ * on its own thread; only one can be shown in the UI window.
+ */
+typedef struct _infinity infinity_t;
+
+/*
+ * Creates an instance shown in the UI window.
  *
  * Reads configuration parameters and launches a thread where most of the
- * plugin job gets done.
+ * instance job gets done. Returns NULL on failure.
+ */
+infinity_t *infinity_new(InfParameters * params, Player * player);
+
+/*
+ * Creates an instance for offline rendering or for hosts with their own
+ * render loop: there is no renderer thread, no window and no frame
+ * limiter. Frames are rendered on demand by infinity_render_into() or
+ * infinity_render_frame(), from the calling thread, params->get_max_fps()
+ * being the simulated frame rate for the synthetic input.
+ *
+ * Returns NULL on failure.
+ */
+infinity_t *infinity_new_offline(InfParameters * params, Player * player);
+
+/*
+ * Renders the next frame of an offline instance from data, which has the
+ * layout of infinity_render_pcm() PCM data, or from the replay or
+ * synthetic input if one is selected.
+ *
+ * The frame comes out as width * height palette indexes in surface, to be
+ * shown with the RGB565 palette colors.
+ */
+void infinity_render_frame(infinity_t * inf, const float *data, int channels,
+			   byte *surface, guint16 colors[256]);
+
+/*
+ * Same as infinity_render_frame() but the frame comes out in pixels,
+ * width * height pixels of the given format whose rows are stride bytes
+ * apart. data may be NULL to render from the PCM data of the previous
+ * frame.
+ */
+void infinity_render_into(infinity_t * inf, const float *data, int channels,
+			  gpointer pixels, gint32 stride, infinity_format_t format);
+
+/*
+ * Changes the size of the frames of an instance created by
+ * infinity_new_offline(). Must be called from the thread rendering them.
+ */
+void infinity_resize(infinity_t * inf, gint32 width, gint32 height);
+
+/*
+ * Expected to be called periodically by the player to provide actual PCM
+ * data to an instance created by infinity_new(): 512 interleaved stereo
+ * frames of floats in [-1, 1].
+ */
+void infinity_render_pcm(infinity_t * inf, const float *data, int channels);
+
+/*
+ * Same as infinity_render_pcm() but takes 16 bit samples, 512 per
+ * channel, in one array per channel, as the engine keeps them. For hosts
+ * with samples of that kind, which render the next frame from NULL data.
+ */
+void infinity_render_raw_pcm(infinity_t * inf, const gint16 data[2][512]);
+
+/*
+ * Stops the instance and frees it.
+ */
+void infinity_destroy(infinity_t * inf);
+
+/*
+ * The functions below drive a single default instance, for the player
+ * plugins and tools that need no more.
+ */
+
+/*
+ * Initializes rendering process, see infinity_new().
  */
 void infinity_init(InfParameters * params, Player * player);
 
+/*
+ * Initializes the engine for offline rendering, see infinity_new_offline().
+ *
+ * Returns TRUE on success; and FALSE otherwise.
+ */
+gboolean infinity_init_offline(InfParameters * params, Player * player);
+
+/*
+ * See infinity_render_frame().
+ */
+void infinity_render_offline_frame(const float *data, int channels,
+				   byte *surface, guint16 colors[256]);
+
 /*
  * Closes rendering process.
  */
 void infinity_finish(void);
 
 /*
- * Expected to be called periodically by the player to provide actual PCM data.
+ * See infinity_render_pcm().
  */
 void infinity_render_multi_pcm(const float *data, int channels);
 
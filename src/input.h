@@ -17,7 +17,9 @@ typedef enum {
 	INFINITY_KEY_EXIT_FULLSCREEN,
 	INFINITY_KEY_NEXT_PALETTE,
 	INFINITY_KEY_NEXT_EFFECT,
-	INFINITY_KEY_TOGGLE_INTERACTIVE
+	INFINITY_KEY_TOGGLE_INTERACTIVE,
+	INFINITY_KEY_TOGGLE_HUD,
+	INFINITY_KEY_DUMP_TRACE
 } InfinityKey;
 
 #ifdef __cplusplus
@@ -0,0 +1,135 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <glib.h>
+
+#include "config.h"
+#include "mempressure.h"
+
+#ifdef HAVE_POLL
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+#define PSI_MEMORY	"/proc/pressure/memory"
+
+struct _mempressure {
+	mempressure_func	func;
+	gpointer		data;
+	gint			fd;      /* of PSI_MEMORY, with the trigger written */
+	gint			wake[2]; /* written to stop the thread */
+	GThread *		thread;
+};
+
+#ifdef HAVE_POLL
+
+static gpointer wait_pressure(gpointer arg)
+{
+	mempressure_t *mempressure = arg;
+	struct pollfd fds[2] = {
+		{ .fd = mempressure->fd, .events = POLLPRI },
+		{ .fd = mempressure->wake[0], .events = POLLIN },
+	};
+
+	for (;;) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			g_warning("Infinity: cannot wait for memory pressure: %s", g_strerror(errno));
+			break;
+		}
+		if (fds[1].revents != 0)
+			break;
+		/* the trigger is gone with its cgroup */
+		if (fds[0].revents & POLLERR)
+			break;
+		if (fds[0].revents & POLLPRI)
+			mempressure->func(mempressure->data);
+	}
+	return NULL;
+}
+
+mempressure_t *mempressure_new(mempressure_func func, gpointer data)
+{
+	mempressure_t *mempressure;
+	gchar trigger[64];
+	gint fd;
+
+	g_return_val_if_fail(func != NULL, NULL);
+
+	fd = open(PSI_MEMORY, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		g_debug("Infinity: no memory pressure notifications, cannot open %s: %s",
+			PSI_MEMORY, g_strerror(errno));
+		return NULL;
+	}
+	g_snprintf(trigger, sizeof(trigger), "some %d %d", MEMPRESSURE_STALL_USECS,
+		   MEMPRESSURE_WINDOW_USECS);
+	/* with the terminating NUL */
+	if (write(fd, trigger, strlen(trigger) + 1) < 0) {
+		g_debug("Infinity: no memory pressure notifications, %s refuses '%s': %s",
+			PSI_MEMORY, trigger, g_strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	mempressure = g_new0(mempressure_t, 1);
+	if (pipe(mempressure->wake) < 0) {
+		close(fd);
+		g_free(mempressure);
+		return NULL;
+	}
+	mempressure->func = func;
+	mempressure->data = data;
+	mempressure->fd = fd;
+	mempressure->thread = g_thread_new("infinity_mempressure", wait_pressure, mempressure);
+	return mempressure;
+}
+
+void mempressure_destroy(mempressure_t *mempressure)
+{
+	const gchar stop = 0;
+
+	if (mempressure == NULL)
+		return;
+	/* left running, it would use what is freed below */
+	if (write(mempressure->wake[1], &stop, 1) < 0) {
+		g_warning("Infinity: cannot stop waiting for memory pressure: %s", g_strerror(errno));
+		return;
+	}
+	g_thread_join(mempressure->thread);
+	close(mempressure->wake[0]);
+	close(mempressure->wake[1]);
+	close(mempressure->fd);
+	g_free(mempressure);
+}
+
+#else
+
+mempressure_t *mempressure_new(mempressure_func func, gpointer data)
+{
+	(void)func;
+	(void)data;
+	return NULL;
+}
+
+void mempressure_destroy(mempressure_t *mempressure)
+{
+	(void)mempressure;
+}
+
+#endif /* HAVE_POLL */
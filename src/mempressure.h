@@ -0,0 +1,47 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_MEMPRESSURE__
+#define __INFINITY_MEMPRESSURE__
+
+#include <glib.h>
+
+/*
+ * Memory pressure notifications of the Linux pressure stall information
+ * (PSI): a thread of its own waits for tasks to stall on memory for
+ * more than MEMPRESSURE_STALL_USECS in a MEMPRESSURE_WINDOW_USECS window,
+ * and calls back from that thread each time they do.
+ *
+ * Kernels without PSI, or refusing the trigger, notify nothing.
+ */
+
+#define MEMPRESSURE_STALL_USECS		150000
+#define MEMPRESSURE_WINDOW_USECS	2000000 /* the shortest an unprivileged trigger may use */
+
+typedef struct _mempressure mempressure_t;
+
+typedef void (*mempressure_func)(gpointer data);
+
+/*
+ * Starts waiting for memory pressure, NULL if it cannot be notified.
+ */
+mempressure_t *mempressure_new(mempressure_func func, gpointer data);
+
+/*
+ * Stops waiting, and returns once func is no longer called. Accepts NULL.
+ */
+void mempressure_destroy(mempressure_t *mempressure);
+
+#endif /* __INFINITY_MEMPRESSURE__ */
@@ -0,0 +1,271 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "compute.h"
+#include "metrics.h"
+#include "trace.h"
+
+/*
+ * Buckets are exact below LINEAR_BUCKETS microseconds, then split each
+ * power of two in SUB_BUCKETS, which keeps them within 1/16 of the value.
+ */
+#define LINEAR_BUCKETS	16
+#define SUB_BUCKETS	8
+#define NB_BUCKETS	(LINEAR_BUCKETS + SUB_BUCKETS * 28)
+
+typedef struct {
+	guint32	counts[NB_BUCKETS];
+	guint32	total;
+	gint64	max;
+} histogram_t;
+
+typedef struct {
+	gint64		begin;
+	histogram_t	stages[METRICS_NB_STAGES];
+	histogram_t	pcm_updates;
+	guint32		frames;
+	guint32		late;
+	guint32		dropped;
+} window_t;
+
+static const gchar *stage_names[METRICS_NB_STAGES] = {
+	"input", "resize", "warp", "palette", "spectral", "curve", "present", "frame"
+};
+
+static const gchar *lock_names[METRICS_NB_LOCKS] = {
+	"render_mutex", "pcm_data"
+};
+
+static const gchar *lock_wait_names[METRICS_NB_LOCKS] = {
+	"wait render_mutex", "wait pcm_data"
+};
+
+struct _metrics {
+	window_t	windows[2];
+	window_t *	current;
+	window_t *	previous;
+	gint64		interval;
+	gchar *		dump_target;
+
+	volatile gint	lock_waits[METRICS_NB_LOCKS];
+	volatile gint	lock_wait_usecs[METRICS_NB_LOCKS];
+	volatile gint	pcm_updates;
+};
+
+static gint32 bucket_of(gint64 usecs)
+{
+	gint32 msb;
+
+	if (usecs < LINEAR_BUCKETS)
+		return usecs < 0 ? 0 : (gint32)usecs;
+	msb = 63 - __builtin_clzll((guint64)usecs);
+	return MIN(LINEAR_BUCKETS + (msb - 4) * SUB_BUCKETS
+		   + (gint32)((usecs >> (msb - 3)) & (SUB_BUCKETS - 1)), NB_BUCKETS - 1);
+}
+
+/* Middle of the range of values that fall in bucket */
+static gint64 bucket_value(gint32 bucket)
+{
+	gint32 msb, sub;
+
+	if (bucket < LINEAR_BUCKETS)
+		return bucket;
+	msb = (bucket - LINEAR_BUCKETS) / SUB_BUCKETS + 4;
+	sub = (bucket - LINEAR_BUCKETS) % SUB_BUCKETS;
+	return ((gint64)(SUB_BUCKETS + sub) << (msb - 3)) + ((gint64)1 << (msb - 4));
+}
+
+static void histogram_add(histogram_t *h, gint64 value)
+{
+	h->counts[bucket_of(value)]++;
+	h->total++;
+	if (value > h->max)
+		h->max = value;
+}
+
+static gint64 percentile(const histogram_t *a, const histogram_t *b, gdouble p)
+{
+	const guint32 total = a->total + (b != NULL ? b->total : 0);
+	guint32 rank, seen = 0;
+	gint32 i;
+
+	if (total == 0)
+		return 0;
+	rank = (guint32)(p / 100.0 * total + 0.5);
+	rank = CLAMP(rank, 1, total);
+	for (i = 0; i < NB_BUCKETS; i++) {
+		seen += a->counts[i] + (b != NULL ? b->counts[i] : 0);
+		if (seen >= rank)
+			return bucket_value(i);
+	}
+	return MAX(a->max, b != NULL ? b->max : 0);
+}
+
+metrics_t *metrics_new(void)
+{
+	metrics_t *metrics = g_new0(metrics_t, 1);
+	const gchar *value;
+
+	metrics->current = &metrics->windows[0];
+	metrics->previous = &metrics->windows[1];
+	metrics->current->begin = metrics->previous->begin = g_get_monotonic_time();
+
+	value = g_getenv("INFINITY_METRICS_INTERVAL");
+	metrics->interval = (value != NULL ? g_ascii_strtoll(value, NULL, 10) : 10) * G_USEC_PER_SEC;
+	if (metrics->interval <= 0)
+		metrics->interval = 10 * G_USEC_PER_SEC;
+	metrics->dump_target = g_strdup(g_getenv("INFINITY_METRICS"));
+	return metrics;
+}
+
+void metrics_destroy(metrics_t *metrics)
+{
+	g_return_if_fail(metrics != NULL);
+
+	g_free(metrics->dump_target);
+	g_free(metrics);
+}
+
+void metrics_record(metrics_t *metrics, metrics_stage_t stage, gint64 usecs)
+{
+	if (metrics == NULL)
+		return;
+	histogram_add(&metrics->current->stages[stage], usecs);
+	trace_complete(stage_names[stage], usecs);
+}
+
+void metrics_lock_mutex(metrics_t *metrics, GMutex *mutex, metrics_lock_t lock)
+{
+	gint64 t_begin, wait;
+
+	if (g_mutex_trylock(mutex))
+		return;
+	t_begin = g_get_monotonic_time();
+	g_mutex_lock(mutex);
+	if (metrics == NULL)
+		return;
+	wait = g_get_monotonic_time() - t_begin;
+	g_atomic_int_inc(&metrics->lock_waits[lock]);
+	g_atomic_int_add(&metrics->lock_wait_usecs[lock], (gint)wait);
+	trace_complete(lock_wait_names[lock], wait);
+}
+
+void metrics_pcm_update(metrics_t *metrics)
+{
+	if (metrics != NULL)
+		g_atomic_int_inc(&metrics->pcm_updates);
+}
+
+static void dump(metrics_t *metrics, gint64 now)
+{
+	const window_t *current = metrics->current;
+	const gchar *dump_target = metrics->dump_target;
+	GString *out = g_string_new(NULL);
+	const gdouble seconds = (now - current->begin) / 1e6;
+	gint32 i;
+
+	g_string_append_printf(out, "Infinity metrics: %.1f s, %u frames (%.1f fps), %u late, %u dropped\n",
+			       seconds, current->frames, seconds > 0 ? current->frames / seconds : 0.0,
+			       current->late, current->dropped);
+	for (i = 0; i < METRICS_NB_STAGES; i++) {
+		const histogram_t *h = &current->stages[i];
+
+		if (h->total == 0)
+			continue;
+		g_string_append_printf(out, "  %-9s p50 %6" G_GINT64_FORMAT " us  p95 %6" G_GINT64_FORMAT
+				       " us  p99 %6" G_GINT64_FORMAT " us  max %6" G_GINT64_FORMAT " us\n",
+				       stage_names[i], percentile(h, NULL, 50), percentile(h, NULL, 95),
+				       percentile(h, NULL, 99), h->max);
+	}
+	g_string_append_printf(out, "  pcm updates per frame p50 %" G_GINT64_FORMAT " p99 %" G_GINT64_FORMAT "\n",
+			       percentile(&current->pcm_updates, NULL, 50),
+			       percentile(&current->pcm_updates, NULL, 99));
+	for (i = 0; i < METRICS_NB_LOCKS; i++)
+		g_string_append_printf(out, "  %s waits %d (%d us)\n", lock_names[i],
+				       g_atomic_int_get(&metrics->lock_waits[i]),
+				       g_atomic_int_get(&metrics->lock_wait_usecs[i]));
+	g_string_append_printf(out, "  vector fields %.1f MB\n", compute_fields_bytes() / 1048576.0);
+
+	if (strcmp(dump_target, "log") == 0) {
+		g_string_truncate(out, out->len - 1);
+		g_message("%s", out->str);
+	} else {
+		FILE *f = fopen(dump_target, "a");
+
+		if (f != NULL) {
+			fputs(out->str, f);
+			fclose(f);
+		} else {
+			g_warning("Infinity: cannot append metrics to '%s'", dump_target);
+		}
+	}
+	g_string_free(out, TRUE);
+}
+
+void metrics_frame_done(metrics_t *metrics, gint64 frame_usecs, gint64 budget_usecs)
+{
+	const gint64 now = g_get_monotonic_time();
+	window_t *current;
+	gint updates;
+	gint32 i;
+
+	if (metrics == NULL)
+		return;
+	current = metrics->current;
+	updates = g_atomic_int_get(&metrics->pcm_updates);
+	g_atomic_int_add(&metrics->pcm_updates, -updates);
+	histogram_add(&current->stages[METRICS_FRAME], frame_usecs);
+	trace_complete(stage_names[METRICS_FRAME], frame_usecs);
+	histogram_add(&current->pcm_updates, updates);
+	current->frames++;
+	if (budget_usecs > 0 && frame_usecs > budget_usecs) {
+		current->late++;
+		current->dropped += (guint32)(frame_usecs / budget_usecs);
+	}
+	if (now - current->begin < metrics->interval)
+		return;
+	if (metrics->dump_target != NULL)
+		dump(metrics, now);
+	for (i = 0; i < METRICS_NB_LOCKS; i++) {
+		g_atomic_int_set(&metrics->lock_waits[i], 0);
+		g_atomic_int_set(&metrics->lock_wait_usecs[i], 0);
+	}
+	metrics->previous = current;
+	metrics->current = current == &metrics->windows[0] ? &metrics->windows[1] : &metrics->windows[0];
+	memset(metrics->current, 0, sizeof(window_t));
+	metrics->current->begin = now;
+}
+
+gint64 metrics_percentile(metrics_t *metrics, metrics_stage_t stage, gdouble p)
+{
+	if (metrics == NULL)
+		return 0;
+	return percentile(&metrics->current->stages[stage], &metrics->previous->stages[stage], p);
+}
+
+gdouble metrics_fps(metrics_t *metrics)
+{
+	gdouble seconds;
+
+	if (metrics == NULL)
+		return 0.0;
+	seconds = (g_get_monotonic_time() - metrics->previous->begin) / 1e6;
+	return seconds > 0 ? (metrics->current->frames + metrics->previous->frames) / seconds : 0.0;
+}
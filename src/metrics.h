@@ -0,0 +1,94 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_METRICS__
+#define __INFINITY_METRICS__
+
+#include <glib.h>
+
+/*
+ * Always-on frame timing of an engine instance.
+ *
+ * Stage durations go into log-scale histograms covering the current and
+ * the previous interval, so percentiles always span between one and two
+ * intervals. Setting INFINITY_METRICS to "log" or to a file name dumps
+ * them every INFINITY_METRICS_INTERVAL seconds (10 by default).
+ *
+ * Stages and contended locks are also recorded as trace events.
+ */
+
+typedef enum {
+	METRICS_INPUT,    /* key handling */
+	METRICS_RESIZE,
+	METRICS_WARP,     /* compute_surface() */
+	METRICS_PALETTE,  /* palette mapping of the surface */
+	METRICS_SPECTRAL,
+	METRICS_CURVE,
+	METRICS_PRESENT,  /* display_present(), HUD included */
+	METRICS_FRAME,    /* whole frame, sleep excluded */
+	METRICS_NB_STAGES
+} metrics_stage_t;
+
+typedef enum {
+	METRICS_LOCK_RENDER, /* render_mutex of display.c */
+	METRICS_LOCK_PCM,    /* pcm_data lock of display.c */
+	METRICS_NB_LOCKS
+} metrics_lock_t;
+
+typedef struct _metrics metrics_t;
+
+metrics_t *metrics_new(void);
+void metrics_destroy(metrics_t *metrics);
+
+/*
+ * The functions below accept a NULL metrics, which records nothing.
+ */
+
+/*
+ * Records that stage took usecs microseconds in the current frame.
+ * Must be called from the rendering thread.
+ */
+void metrics_record(metrics_t *metrics, metrics_stage_t stage, gint64 usecs);
+
+/*
+ * Locks mutex, counting the lock as a wait if it was contended.
+ * Can be called from any thread.
+ */
+void metrics_lock_mutex(metrics_t *metrics, GMutex *mutex, metrics_lock_t lock);
+
+/*
+ * Counts a PCM update from the player. Can be called from any thread.
+ */
+void metrics_pcm_update(metrics_t *metrics);
+
+/*
+ * Closes the current frame, which took frame_usecs out of a budget of
+ * budget_usecs (0 for no budget), and dumps the metrics when due.
+ * Must be called from the rendering thread.
+ */
+void metrics_frame_done(metrics_t *metrics, gint64 frame_usecs, gint64 budget_usecs);
+
+/*
+ * Returns the p-th percentile (0 < p < 100) of stage durations in
+ * microseconds, or 0 if none was recorded yet.
+ */
+gint64 metrics_percentile(metrics_t *metrics, metrics_stage_t stage, gdouble p);
+
+/*
+ * Returns frames per second over the last interval.
+ */
+gdouble metrics_fps(metrics_t *metrics);
+
+#endif /* __INFINITY_METRICS__ */
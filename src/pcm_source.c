@@ -0,0 +1,123 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "pcm_source.h"
+
+#define CHUNK_FRAMES 1024
+
+struct pcm_source {
+	FILE *		file;
+	pcm_format_t	format;
+	gint32		channels;
+	gint32		sample_size;
+	guint8 *	chunk;
+};
+
+pcm_source_t *pcm_source_new(const gchar *path, pcm_format_t format, gint32 channels)
+{
+	pcm_source_t *source;
+	FILE *f;
+
+	g_return_val_if_fail(path != NULL, NULL);
+	g_return_val_if_fail(channels > 0, NULL);
+
+	if (strcmp(path, "-") == 0) {
+		f = stdin;
+	} else {
+		f = fopen(path, "rb");
+		if (f == NULL) {
+			g_critical("Cannot open PCM input '%s'", path);
+			return NULL;
+		}
+	}
+	source = g_new0(pcm_source_t, 1);
+	source->file = f;
+	source->format = format;
+	source->channels = channels;
+	source->sample_size = format == PCM_FORMAT_S16 ? 2 : 4;
+	source->chunk = g_malloc((gsize)CHUNK_FRAMES * channels * source->sample_size);
+	return source;
+}
+
+void pcm_source_destroy(pcm_source_t *source)
+{
+	g_return_if_fail(source != NULL);
+
+	if (source->file != stdin)
+		fclose(source->file);
+	g_free(source->chunk);
+	g_free(source);
+}
+
+gboolean pcm_format_from_name(const gchar *name, pcm_format_t *format)
+{
+	g_return_val_if_fail(name != NULL, FALSE);
+
+	if (strcmp(name, "s16") == 0)
+		*format = PCM_FORMAT_S16;
+	else if (strcmp(name, "f32") == 0)
+		*format = PCM_FORMAT_F32;
+	else
+		return FALSE;
+	return TRUE;
+}
+
+/* 16 bit samples are scaled as Infinity scales them back, to come out the same */
+static float sample_at(const pcm_source_t *source, const guint8 *p)
+{
+	if (source->format == PCM_FORMAT_S16)
+		return (gint16)(p[0] | (p[1] << 8)) / 32767.0f;
+	else {
+		union {
+			guint32 u;
+			float f;
+		} v;
+
+		v.u = (guint32)p[0] | ((guint32)p[1] << 8) | ((guint32)p[2] << 16) | ((guint32)p[3] << 24);
+		return v.f;
+	}
+}
+
+gint32 pcm_source_read(pcm_source_t *source, float *data, gint32 frames)
+{
+	const gsize frame_size = (gsize)source->channels * source->sample_size;
+	gint32 done = 0;
+
+	g_return_val_if_fail(source != NULL, 0);
+
+	while (done < frames) {
+		gint32 want = MIN(frames - done, CHUNK_FRAMES);
+		gint32 got, i;
+
+		got = (gint32)fread(source->chunk, frame_size, (gsize)want, source->file);
+		for (i = 0; i < got; i++) {
+			const guint8 *frame = source->chunk + i * frame_size;
+			float left = sample_at(source, frame);
+			float right = source->channels > 1 ? sample_at(source, frame + source->sample_size) : left;
+
+			data[2 * (done + i)] = left;
+			data[2 * (done + i) + 1] = right;
+		}
+		done += got;
+		if (got < want)
+			break;
+	}
+	return done;
+}
@@ -0,0 +1,57 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_PCM_SOURCE__
+#define __INFINITY_PCM_SOURCE__
+
+#include <glib.h>
+
+/*
+ * Reads raw interleaved PCM from a file, a named pipe or the standard
+ * input and converts it to the stereo float layout Infinity takes.
+ */
+
+typedef enum {
+	PCM_FORMAT_S16,  /* signed 16 bits, little endian */
+	PCM_FORMAT_F32   /* 32 bits float, little endian */
+} pcm_format_t;
+
+typedef struct pcm_source pcm_source_t;
+
+/*
+ * Opens path, or the standard input if path is "-".
+ *
+ * Returns NULL if it cannot be opened.
+ */
+pcm_source_t *pcm_source_new(const gchar *path, pcm_format_t format, gint32 channels);
+
+void pcm_source_destroy(pcm_source_t *source);
+
+/*
+ * Parses "s16" or "f32". Returns FALSE if name is none of them.
+ */
+gboolean pcm_format_from_name(const gchar *name, pcm_format_t *format);
+
+/*
+ * Reads up to frames frames into data as interleaved stereo floats in
+ * [-1, 1], 16 bit samples divided by 32767 (-32768 is just past -1).
+ * Mono input is duplicated; channels past the second are dropped.
+ *
+ * Blocks until frames frames are read or the input ends.
+ * Returns the number of frames read, 0 at the end of the input.
+ */
+gint32 pcm_source_read(pcm_source_t *source, float *data, gint32 frames);
+
+#endif /* __INFINITY_PCM_SOURCE__ */
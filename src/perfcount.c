@@ -0,0 +1,310 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "perfcount.h"
+
+#ifdef HAVE_PERF_EVENT
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#define NB_COUNTERS 4
+
+typedef struct {
+	guint64 enabled;  /* time the group was enabled */
+	guint64 running;  /* time it was counting, less if multiplexed */
+	guint64 values[NB_COUNTERS];
+} reading_t;
+
+typedef struct {
+	gint32	width;
+	gint32	height;
+	guint64	frames;
+	gdouble	counts[PERFCOUNT_NB_STAGES][NB_COUNTERS];
+} resolution_t;
+
+static const gchar *counter_names[NB_COUNTERS] = {
+	"cycles", "instructions", "LLC misses", "dTLB misses"
+};
+
+static const gchar *stage_names[PERFCOUNT_NB_STAGES] = {
+	"warp", "surface", "spectral", "curve"
+};
+
+struct _perfcount {
+	gchar *		report_target;
+	gint		fds[NB_COUNTERS];
+	gint32		slots[NB_COUNTERS]; /* position in a group read, -1 if not counted */
+	gint32		nb_slots;
+	reading_t	begins[PERFCOUNT_NB_STAGES];
+	gdouble		frame_counts[PERFCOUNT_NB_STAGES][NB_COUNTERS];
+	GPtrArray *	resolutions;
+	resolution_t *	current;
+};
+
+static void report(perfcount_t *perfcount, const resolution_t *res)
+{
+	const gint32 *slots = perfcount->slots;
+	GString *out = g_string_new(NULL);
+	gint32 s, c;
+
+	g_string_append_printf(out, "Infinity perf counters at %dx%d, per frame over %" G_GUINT64_FORMAT " frames\n",
+			       res->width, res->height, res->frames);
+	g_string_append_printf(out, "  %-9s %14s %14s %6s %12s %12s\n", "stage",
+			       counter_names[0], counter_names[1], "IPC", counter_names[2], counter_names[3]);
+	for (s = 0; s < PERFCOUNT_NB_STAGES; s++) {
+		gdouble avg[NB_COUNTERS];
+
+		for (c = 0; c < NB_COUNTERS; c++)
+			avg[c] = res->counts[s][c] / res->frames;
+		g_string_append_printf(out, "  %-9s", stage_names[s]);
+		for (c = 0; c < NB_COUNTERS; c++) {
+			const gint32 w = c < 2 ? 14 : 12;
+
+			if (c == 2) {
+				if (slots[0] >= 0 && slots[1] >= 0 && avg[0] > 0)
+					g_string_append_printf(out, " %6.2f", avg[1] / avg[0]);
+				else
+					g_string_append_printf(out, " %6s", "n/a");
+			}
+			if (slots[c] >= 0)
+				g_string_append_printf(out, " %*.0f", w, avg[c]);
+			else
+				g_string_append_printf(out, " %*s", w, "n/a");
+		}
+		g_string_append_c(out, '\n');
+	}
+
+	if (strcmp(perfcount->report_target, "log") == 0) {
+		g_string_truncate(out, out->len - 1);
+		g_message("%s", out->str);
+	} else {
+		FILE *f = fopen(perfcount->report_target, "a");
+
+		if (f != NULL) {
+			fputs(out->str, f);
+			fclose(f);
+		} else {
+			g_warning("Infinity: cannot append perf counters to '%s'", perfcount->report_target);
+		}
+	}
+	g_string_free(out, TRUE);
+}
+
+#ifdef HAVE_PERF_EVENT
+
+static gint open_counter(guint32 type, guint64 config, gint group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+			   | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	/* pid 0 and cpu -1: the calling thread on any CPU */
+	return (gint)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+static gboolean open_counters(perfcount_t *perfcount)
+{
+	static const struct {
+		guint32 type;
+		guint64 config;
+	} events[NB_COUNTERS] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+				      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	};
+	gint *fds = perfcount->fds;
+	gint32 c;
+
+	perfcount->nb_slots = 0;
+	for (c = 0; c < NB_COUNTERS; c++) {
+		fds[c] = open_counter(events[c].type, events[c].config, c == 0 ? -1 : fds[0]);
+		if (fds[c] < 0) {
+			if (c == 0) {
+				g_message("Infinity: perf counters unavailable: %s%s", g_strerror(errno),
+					  errno == EACCES || errno == EPERM
+					  ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+				return FALSE;
+			}
+			g_message("Infinity: perf counter '%s' unavailable: %s",
+				  counter_names[c], g_strerror(errno));
+			perfcount->slots[c] = -1;
+		} else {
+			perfcount->slots[c] = perfcount->nb_slots++;
+		}
+	}
+	return TRUE;
+}
+
+static void close_counters(perfcount_t *perfcount)
+{
+	gint32 c;
+
+	for (c = 0; c < NB_COUNTERS; c++)
+		if (perfcount->fds[c] >= 0) {
+			close(perfcount->fds[c]);
+			perfcount->fds[c] = -1;
+		}
+}
+
+static gboolean read_counters(perfcount_t *perfcount, reading_t *r)
+{
+	guint64 buf[3 + NB_COUNTERS];
+	gint32 c;
+
+	if (read(perfcount->fds[0], buf, sizeof(buf)) < (gssize)((3 + perfcount->nb_slots) * sizeof(guint64)))
+		return FALSE;
+	r->enabled = buf[1];
+	r->running = buf[2];
+	for (c = 0; c < NB_COUNTERS; c++)
+		r->values[c] = perfcount->slots[c] >= 0 ? buf[3 + perfcount->slots[c]] : 0;
+	return TRUE;
+}
+
+#else
+
+static gboolean open_counters(perfcount_t *perfcount)
+{
+	(void)perfcount;
+	g_message("Infinity: perf counters are not supported on this platform");
+	return FALSE;
+}
+
+static void close_counters(perfcount_t *perfcount)
+{
+	(void)perfcount;
+}
+
+static gboolean read_counters(perfcount_t *perfcount, reading_t *r)
+{
+	(void)perfcount;
+	(void)r;
+	return FALSE;
+}
+
+#endif /* HAVE_PERF_EVENT */
+
+perfcount_t *perfcount_new(void)
+{
+	const gchar *value = g_getenv("INFINITY_PERF");
+	perfcount_t *perfcount;
+
+	if (value == NULL || *value == '\0')
+		return NULL;
+	perfcount = g_new0(perfcount_t, 1);
+	if (!open_counters(perfcount)) {
+		g_free(perfcount);
+		return NULL;
+	}
+	perfcount->report_target = g_strdup(value);
+	perfcount->resolutions = g_ptr_array_new_with_free_func(g_free);
+	return perfcount;
+}
+
+void perfcount_destroy(perfcount_t *perfcount)
+{
+	guint i;
+
+	if (perfcount == NULL)
+		return;
+	for (i = 0; i < perfcount->resolutions->len; i++) {
+		const resolution_t *res = g_ptr_array_index(perfcount->resolutions, i);
+
+		if (res->frames > 0)
+			report(perfcount, res);
+	}
+	close_counters(perfcount);
+	g_ptr_array_free(perfcount->resolutions, TRUE);
+	g_free(perfcount->report_target);
+	g_free(perfcount);
+}
+
+void perfcount_begin(perfcount_t *perfcount, perfcount_stage_t stage)
+{
+	if (perfcount != NULL && !read_counters(perfcount, &perfcount->begins[stage]))
+		perfcount->begins[stage].running = G_MAXUINT64;
+}
+
+void perfcount_end(perfcount_t *perfcount, perfcount_stage_t stage)
+{
+	const reading_t *begin;
+	reading_t end;
+	gdouble scale = 1.0;
+	gint32 c;
+
+	if (perfcount == NULL)
+		return;
+	begin = &perfcount->begins[stage];
+	if (begin->running == G_MAXUINT64 || !read_counters(perfcount, &end))
+		return;
+	/* extrapolate when the counters were multiplexed with other events */
+	if (end.running > begin->running && end.running - begin->running < end.enabled - begin->enabled)
+		scale = (gdouble)(end.enabled - begin->enabled) / (end.running - begin->running);
+	for (c = 0; c < NB_COUNTERS; c++)
+		perfcount->frame_counts[stage][c] += (end.values[c] - begin->values[c]) * scale;
+}
+
+static resolution_t *find_resolution(perfcount_t *perfcount, gint32 width, gint32 height)
+{
+	resolution_t *res;
+	guint i;
+
+	for (i = 0; i < perfcount->resolutions->len; i++) {
+		res = g_ptr_array_index(perfcount->resolutions, i);
+		if (res->width == width && res->height == height)
+			return res;
+	}
+	res = g_new0(resolution_t, 1);
+	res->width = width;
+	res->height = height;
+	g_ptr_array_add(perfcount->resolutions, res);
+	return res;
+}
+
+void perfcount_frame_done(perfcount_t *perfcount, gint32 width, gint32 height)
+{
+	resolution_t *current;
+	gint32 s, c;
+
+	if (perfcount == NULL)
+		return;
+	current = perfcount->current;
+	if (current == NULL || current->width != width || current->height != height) {
+		if (current != NULL)
+			report(perfcount, current);
+		current = perfcount->current = find_resolution(perfcount, width, height);
+	}
+	for (s = 0; s < PERFCOUNT_NB_STAGES; s++)
+		for (c = 0; c < NB_COUNTERS; c++)
+			current->counts[s][c] += perfcount->frame_counts[s][c];
+	current->frames++;
+	memset(perfcount->frame_counts, 0, sizeof(perfcount->frame_counts));
+}
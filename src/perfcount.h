@@ -0,0 +1,66 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_PERFCOUNT__
+#define __INFINITY_PERFCOUNT__
+
+#include <glib.h>
+
+/*
+ * Optional hardware counters (cycles, instructions, LLC misses and dTLB
+ * load misses) of the rendering thread, attributed to render stages.
+ *
+ * Setting INFINITY_PERF to "log" or to a file name enables them; the
+ * per-frame averages of each stage are reported for every resolution
+ * rendered at, when the resolution changes and by perfcount_destroy().
+ * If the counters cannot be opened (no perf_event support, restrictive
+ * perf_event_paranoid, virtual machine without a PMU...) a message says
+ * why and perfcount_new() returns NULL; counters that are missing on
+ * their own are reported as n/a.
+ *
+ * Everything but perfcount_destroy() must be called from the rendering
+ * thread, and accepts a NULL perfcount, which counts nothing.
+ */
+
+typedef enum {
+	PERFCOUNT_WARP,     /* compute_surface() */
+	PERFCOUNT_SURFACE,  /* display_map_frame() */
+	PERFCOUNT_SPECTRAL,
+	PERFCOUNT_CURVE,
+	PERFCOUNT_NB_STAGES
+} perfcount_stage_t;
+
+typedef struct _perfcount perfcount_t;
+
+/*
+ * Opens the counters for the calling thread, NULL if INFINITY_PERF is
+ * not set or they are unavailable.
+ */
+perfcount_t *perfcount_new(void);
+
+/*
+ * Reports and closes the counters.
+ */
+void perfcount_destroy(perfcount_t *perfcount);
+
+void perfcount_begin(perfcount_t *perfcount, perfcount_stage_t stage);
+void perfcount_end(perfcount_t *perfcount, perfcount_stage_t stage);
+
+/*
+ * Closes the current frame, rendered at width x height.
+ */
+void perfcount_frame_done(perfcount_t *perfcount, gint32 width, gint32 height);
+
+#endif /* __INFINITY_PERFCOUNT__ */
@@ -0,0 +1,290 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "compute.h"
+#include "replay.h"
+
+#define MAGIC		"INFC"
+#define HEADER_SIZE	20
+
+struct replay_writer {
+	FILE *		file;
+	gboolean	has_pcm;
+	gint16		last_pcm[2][512];
+};
+
+struct replay_reader {
+	FILE *		file;
+	gint32		effect_fields; /* in each effect change */
+	guint32		seed;
+	gint32		width;
+	gint32		height;
+};
+
+static void write_u16(FILE *f, guint16 v)
+{
+	fputc(v & 0xFF, f);
+	fputc(v >> 8, f);
+}
+
+static void write_u32(FILE *f, guint32 v)
+{
+	write_u16(f, v & 0xFFFF);
+	write_u16(f, v >> 16);
+}
+
+static gboolean read_u16(FILE *f, guint16 *v)
+{
+	gint lo, hi;
+
+	lo = fgetc(f);
+	hi = fgetc(f);
+	if (lo == EOF || hi == EOF)
+		return FALSE;
+	*v = (guint16)(lo | (hi << 8));
+	return TRUE;
+}
+
+static gboolean read_u32(FILE *f, guint32 *v)
+{
+	guint16 lo, hi;
+
+	if (!read_u16(f, &lo) || !read_u16(f, &hi))
+		return FALSE;
+	*v = (guint32)lo | ((guint32)hi << 16);
+	return TRUE;
+}
+
+static void write_i32_array(FILE *f, const gint32 *values, gint32 n)
+{
+	gint32 i;
+
+	for (i = 0; i < n; i++)
+		write_u32(f, (guint32)values[i]);
+}
+
+static gboolean read_i32_array(FILE *f, gint32 *values, gint32 n)
+{
+	gint32 i;
+
+	for (i = 0; i < n; i++)
+		if (!read_u32(f, (guint32 *)&values[i]))
+			return FALSE;
+	return TRUE;
+}
+
+static void write_pcm(FILE *f, const gint16 pcm[2][512])
+{
+	gint32 c, i;
+
+	for (c = 0; c < 2; c++)
+		for (i = 0; i < 512; i++)
+			write_u16(f, (guint16)pcm[c][i]);
+}
+
+static gboolean read_pcm(FILE *f, gint16 pcm[2][512])
+{
+	gint32 c, i;
+
+	for (c = 0; c < 2; c++)
+		for (i = 0; i < 512; i++)
+			if (!read_u16(f, (guint16 *)&pcm[c][i]))
+				return FALSE;
+	return TRUE;
+}
+
+/*
+ * t_effect is made of gint32 fields only; they are written in declaration order.
+ */
+#define EFFECT_FIELDS ((gint32)(sizeof(t_effect) / sizeof(gint32)))
+/* Up to the spectral shift */
+#define VERSION_1_EFFECT_FIELDS 8
+
+replay_writer_t *replay_writer_new(const gchar *path, guint32 seed,
+				   gint32 width, gint32 height)
+{
+	replay_writer_t *writer;
+	FILE *f;
+
+	g_return_val_if_fail(path != NULL, NULL);
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		g_critical("Cannot open file '%s' for capturing", path);
+		return NULL;
+	}
+	fwrite(MAGIC, 1, 4, f);
+	write_u16(f, REPLAY_VERSION);
+	write_u16(f, 0);
+	write_u32(f, seed);
+	write_u32(f, (guint32)width);
+	write_u32(f, (guint32)height);
+
+	writer = g_new0(replay_writer_t, 1);
+	writer->file = f;
+	return writer;
+}
+
+void replay_writer_destroy(replay_writer_t *writer)
+{
+	g_return_if_fail(writer != NULL);
+
+	if (fclose(writer->file) != 0)
+		g_warning("Infinity: capture file could not be completely written");
+	g_free(writer);
+}
+
+void replay_writer_effect(replay_writer_t *writer, const t_effect *effect)
+{
+	g_return_if_fail(writer != NULL);
+	g_return_if_fail(effect != NULL);
+
+	fputc('E', writer->file);
+	write_i32_array(writer->file, (const gint32 *)effect, EFFECT_FIELDS);
+}
+
+void replay_writer_palette(replay_writer_t *writer, gint32 old_color, gint32 color)
+{
+	g_return_if_fail(writer != NULL);
+
+	fputc('C', writer->file);
+	write_u32(writer->file, (guint32)old_color);
+	write_u32(writer->file, (guint32)color);
+}
+
+void replay_writer_frame(replay_writer_t *writer, const gint16 pcm[2][512])
+{
+	g_return_if_fail(writer != NULL);
+
+	if (!writer->has_pcm || memcmp(writer->last_pcm, pcm, sizeof(writer->last_pcm)) != 0) {
+		fputc('P', writer->file);
+		write_pcm(writer->file, pcm);
+		memcpy(writer->last_pcm, pcm, sizeof(writer->last_pcm));
+		writer->has_pcm = TRUE;
+	}
+	fputc('F', writer->file);
+}
+
+replay_reader_t *replay_reader_new(const gchar *path)
+{
+	replay_reader_t *reader;
+	gchar magic[4];
+	guint16 version, reserved;
+	guint32 seed, width, height;
+	FILE *f;
+
+	g_return_val_if_fail(path != NULL, NULL);
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		g_critical("Cannot open capture file '%s'", path);
+		return NULL;
+	}
+	if (fread(magic, 1, 4, f) != 4 || memcmp(magic, MAGIC, 4) != 0
+	    || !read_u16(f, &version) || !read_u16(f, &reserved)
+	    || !read_u32(f, &seed) || !read_u32(f, &width) || !read_u32(f, &height)) {
+		g_critical("'%s' is not an Infinity capture file", path);
+		fclose(f);
+		return NULL;
+	}
+	if (version != REPLAY_VERSION && version != 1) {
+		g_critical("Unsupported capture file version %d in '%s'", version, path);
+		fclose(f);
+		return NULL;
+	}
+	reader = g_new0(replay_reader_t, 1);
+	reader->file = f;
+	reader->effect_fields = version == 1 ? VERSION_1_EFFECT_FIELDS : EFFECT_FIELDS;
+	reader->seed = seed;
+	reader->width = (gint32)width;
+	reader->height = (gint32)height;
+	return reader;
+}
+
+void replay_reader_destroy(replay_reader_t *reader)
+{
+	g_return_if_fail(reader != NULL);
+
+	fclose(reader->file);
+	g_free(reader);
+}
+
+guint32 replay_reader_get_seed(replay_reader_t *reader)
+{
+	g_return_val_if_fail(reader != NULL, 0);
+
+	return reader->seed;
+}
+
+void replay_reader_get_size(replay_reader_t *reader, gint32 *width, gint32 *height)
+{
+	g_return_if_fail(reader != NULL);
+
+	*width = reader->width;
+	*height = reader->height;
+}
+
+gboolean replay_reader_next_frame(replay_reader_t *reader, replay_frame_t *frame)
+{
+	gint tag;
+
+	g_return_val_if_fail(reader != NULL, FALSE);
+	g_return_val_if_fail(frame != NULL, FALSE);
+
+	frame->has_effect = FALSE;
+	frame->has_palette = FALSE;
+	for (;;) {
+		tag = fgetc(reader->file);
+		switch (tag) {
+		case 'E':
+			frame->effect.rotation = COMPUTE_DEFAULT_PARAM;
+			frame->effect.speed = COMPUTE_DEFAULT_PARAM;
+			if (!read_i32_array(reader->file, (gint32 *)&frame->effect,
+					    reader->effect_fields))
+				return FALSE;
+			frame->has_effect = TRUE;
+			break;
+		case 'C':
+			if (!read_u32(reader->file, (guint32 *)&frame->old_color)
+			    || !read_u32(reader->file, (guint32 *)&frame->color))
+				return FALSE;
+			frame->has_palette = TRUE;
+			break;
+		case 'P':
+			if (!read_pcm(reader->file, frame->pcm))
+				return FALSE;
+			break;
+		case 'F':
+			return TRUE;
+		case EOF:
+			return FALSE;
+		default:
+			g_warning("Infinity: unknown record '%c' in capture file", tag);
+			return FALSE;
+		}
+	}
+}
+
+void replay_reader_rewind(replay_reader_t *reader)
+{
+	g_return_if_fail(reader != NULL);
+
+	fseek(reader->file, HEADER_SIZE, SEEK_SET);
+}
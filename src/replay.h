@@ -0,0 +1,105 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_REPLAY__
+#define __INFINITY_REPLAY__
+
+#include <glib.h>
+#include "effects.h"
+
+/*
+ * Capture files record what the renderer consumed, frame by frame, so a
+ * run can be replayed and render the very same frames.
+ *
+ * Layout (all integers little endian):
+ *
+ *   header:  "INFC", guint16 version, guint16 reserved, guint32 seed,
+ *            gint32 width, gint32 height
+ *   records: a guint8 tag followed by its payload
+ *     'E'  effect change: the ten gint32 fields of ::t_effect, the first
+ *          eight in version 1 files, which read with the default
+ *          rotation and speed
+ *     'C'  palette change: gint32 old palette, gint32 new palette
+ *     'P'  PCM data the frame was drawn with: 2 * 512 gint16.
+ *          Only written when it differs from the previous frame.
+ *     'F'  end of frame
+ *
+ * Changes are recorded before the frame they first apply to.
+ */
+
+#define REPLAY_VERSION 2
+
+typedef struct replay_writer replay_writer_t;
+typedef struct replay_reader replay_reader_t;
+
+/*
+ * What a frame needs to be rendered again.
+ */
+typedef struct {
+	gboolean	has_effect;  /* effect changed before this frame */
+	t_effect	effect;
+	gboolean	has_palette; /* palette changed before this frame */
+	gint32		old_color;
+	gint32		color;
+	gint16		pcm[2][512]; /* kept from the previous frame if unchanged */
+} replay_frame_t;
+
+/*
+ * Creates the capture file path, truncating it if it exists.
+ *
+ * Returns NULL if the file cannot be created.
+ */
+replay_writer_t *replay_writer_new(const gchar *path, guint32 seed,
+				   gint32 width, gint32 height);
+
+/*
+ * Flushes and closes the capture file.
+ */
+void replay_writer_destroy(replay_writer_t *writer);
+
+void replay_writer_effect(replay_writer_t *writer, const t_effect *effect);
+void replay_writer_palette(replay_writer_t *writer, gint32 old_color, gint32 color);
+
+/*
+ * Closes the current frame, which was drawn with pcm.
+ */
+void replay_writer_frame(replay_writer_t *writer, const gint16 pcm[2][512]);
+
+/*
+ * Opens a capture file for replaying.
+ *
+ * Returns NULL if the file cannot be read or is not a capture file.
+ */
+replay_reader_t *replay_reader_new(const gchar *path);
+
+void replay_reader_destroy(replay_reader_t *reader);
+
+guint32 replay_reader_get_seed(replay_reader_t *reader);
+void replay_reader_get_size(replay_reader_t *reader, gint32 *width, gint32 *height);
+
+/*
+ * Reads the next frame into frame, which must be the same object on
+ * every call since unchanged PCM data is not stored.
+ *
+ * Returns FALSE at the end of the capture or if it is truncated.
+ */
+gboolean replay_reader_next_frame(replay_reader_t *reader, replay_frame_t *frame);
+
+/*
+ * Goes back to the first frame.
+ */
+void replay_reader_rewind(replay_reader_t *reader);
+
+#endif /* __INFINITY_REPLAY__ */
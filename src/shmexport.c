@@ -0,0 +1,368 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "config.h"
+#include "display.h"
+#include "shmexport.h"
+
+#ifdef HAVE_FUTEX
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#define PAGE_BYTES	4096
+#define ROW_ALIGN	64
+#define ALIGN(n, a)	(((n) + (a) - 1) / (a) * (a))
+
+struct _shmexport {
+	gchar *			path;
+	gint			fd;
+	shmexport_header_t *	header;
+	gsize			mapped;
+	infinity_format_t	format;
+	guint32			sequence;
+	guint32			slot;  /* being written, between begin and commit */
+	gint32			width, height, stride;
+};
+
+struct _shmexport_reader {
+	gint			fd;
+	shmexport_header_t *	header;
+	gsize			mapped;
+	guint32			last;       /* sequence of the frame last returned */
+	guint32			slot;       /* where it was */
+	guint64			slot_bytes; /* layout it was read with */
+};
+
+/*
+ * shm_open() wants a single leading slash and no other.
+ */
+static gchar *shm_path(const gchar *name)
+{
+	while (*name == '/')
+		name++;
+	if (*name == '\0' || strchr(name, '/') != NULL)
+		return NULL;
+	return g_strconcat("/", name, NULL);
+}
+
+static guint64 region_bytes(guint64 slot_bytes)
+{
+	return ALIGN(sizeof(shmexport_header_t), PAGE_BYTES) + SHMEXPORT_SLOTS * slot_bytes;
+}
+
+static guint8 *slot_pixels(shmexport_header_t *header, guint32 slot)
+{
+	return (guint8 *)header + header->header_bytes + slot * header->slot_bytes;
+}
+
+static void futex_wake(guint32 *word)
+{
+#ifdef HAVE_FUTEX
+	syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+	(void)word;
+#endif
+}
+
+/*
+ * Waits until *word differs from value, a wake-up or timeout. Without
+ * futexes readers just poll.
+ */
+static void futex_wait(guint32 *word, guint32 value, gint64 timeout_usecs)
+{
+#ifdef HAVE_FUTEX
+	struct timespec timeout;
+
+	timeout.tv_sec = timeout_usecs / G_USEC_PER_SEC;
+	timeout.tv_nsec = (timeout_usecs % G_USEC_PER_SEC) * 1000;
+	syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0);
+#else
+	(void)word;
+	(void)value;
+	g_usleep(MIN(timeout_usecs, 1000));
+#endif
+}
+
+/*
+ * Sizes the region for slots of slot_bytes and maps it again. Slots are
+ * marked as being written first, since their offsets change.
+ */
+static gboolean grow(shmexport_t *shmexport, guint64 slot_bytes)
+{
+	shmexport_header_t *header = shmexport->header;
+	const guint64 total_bytes = region_bytes(slot_bytes);
+	gpointer mapping;
+	gint32 i;
+
+	if (header != NULL) {
+		for (i = 0; i < SHMEXPORT_SLOTS; i++)
+			g_atomic_int_set(&header->slots[i].sequence, 0);
+		g_atomic_int_set(&header->sequence, 0);
+	}
+	if (ftruncate(shmexport->fd, total_bytes) < 0) {
+		g_warning("Infinity: cannot size %s: %s", shmexport->path, g_strerror(errno));
+		return FALSE;
+	}
+	mapping = mmap(NULL, total_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shmexport->fd, 0);
+	if (mapping == MAP_FAILED) {
+		g_warning("Infinity: cannot map %s: %s", shmexport->path, g_strerror(errno));
+		return FALSE;
+	}
+	if (header != NULL)
+		munmap(header, shmexport->mapped);
+	shmexport->header = header = mapping;
+	shmexport->mapped = total_bytes;
+
+	header->header_bytes = ALIGN(sizeof(shmexport_header_t), PAGE_BYTES);
+	header->nb_slots = SHMEXPORT_SLOTS;
+	header->slot_bytes = slot_bytes;
+	/* Published last: readers remap when it exceeds their mapping */
+	__sync_synchronize();
+	header->total_bytes = total_bytes;
+	return TRUE;
+}
+
+shmexport_t *shmexport_new(const gchar *name, gint32 width, gint32 height,
+			   infinity_format_t format)
+{
+	shmexport_t *shmexport;
+	gchar *path;
+
+	g_return_val_if_fail(name != NULL, NULL);
+	g_return_val_if_fail(width > 0 && height > 0, NULL);
+	g_return_val_if_fail(format >= 0 && format < INFINITY_NB_FORMATS, NULL);
+
+	path = shm_path(name);
+	if (path == NULL) {
+		g_warning("Infinity: invalid shared memory name '%s'", name);
+		return NULL;
+	}
+	shm_unlink(path);
+	shmexport = g_new0(shmexport_t, 1);
+	shmexport->path = path;
+	shmexport->format = format;
+	shmexport->fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (shmexport->fd < 0) {
+		g_warning("Infinity: cannot create %s: %s", path, g_strerror(errno));
+		g_free(path);
+		g_free(shmexport);
+		return NULL;
+	}
+	shmexport->stride = ALIGN(width * display_format_bytes(format), ROW_ALIGN);
+	if (!grow(shmexport, ALIGN((guint64)shmexport->stride * height, PAGE_BYTES))) {
+		shmexport_destroy(shmexport);
+		return NULL;
+	}
+	shmexport->width = width;
+	shmexport->height = height;
+	shmexport->header->version = SHMEXPORT_VERSION;
+	__sync_synchronize();
+	shmexport->header->magic = SHMEXPORT_MAGIC;
+	g_message("Infinity: exporting frames to %s", path);
+	return shmexport;
+}
+
+void shmexport_destroy(shmexport_t *shmexport)
+{
+	if (shmexport == NULL)
+		return;
+	if (shmexport->header != NULL)
+		munmap(shmexport->header, shmexport->mapped);
+	close(shmexport->fd);
+	shm_unlink(shmexport->path);
+	g_free(shmexport->path);
+	g_free(shmexport);
+}
+
+gpointer shmexport_begin(shmexport_t *shmexport, gint32 width, gint32 height, gint32 *stride)
+{
+	shmexport_header_t *header;
+	guint64 slot_bytes;
+
+	g_return_val_if_fail(shmexport != NULL && stride != NULL, NULL);
+
+	if (width != shmexport->width || height != shmexport->height) {
+		shmexport->stride = ALIGN(width * display_format_bytes(shmexport->format), ROW_ALIGN);
+		slot_bytes = ALIGN((guint64)shmexport->stride * height, PAGE_BYTES);
+		/* Never shrinks, readers may still map the larger size */
+		if (slot_bytes > shmexport->header->slot_bytes && !grow(shmexport, slot_bytes))
+			return NULL;
+		shmexport->width = width;
+		shmexport->height = height;
+	}
+	header = shmexport->header;
+	shmexport->slot = (header->latest + 1) % SHMEXPORT_SLOTS;
+	g_atomic_int_set(&header->slots[shmexport->slot].sequence, 0);
+	/* The pixels must not be seen written before the slot is marked */
+	__sync_synchronize();
+	*stride = shmexport->stride;
+	return slot_pixels(header, shmexport->slot);
+}
+
+void shmexport_commit(shmexport_t *shmexport)
+{
+	shmexport_header_t *header;
+	shmexport_slot_t *slot;
+
+	g_return_if_fail(shmexport != NULL);
+
+	header = shmexport->header;
+	slot = &header->slots[shmexport->slot];
+	if (++shmexport->sequence == 0)
+		shmexport->sequence = 1;
+	slot->format = shmexport->format;
+	slot->width = shmexport->width;
+	slot->height = shmexport->height;
+	slot->stride = shmexport->stride;
+	slot->timestamp = g_get_monotonic_time();
+	g_atomic_int_set(&slot->sequence, shmexport->sequence);
+	g_atomic_int_set(&header->latest, shmexport->slot);
+	g_atomic_int_set(&header->sequence, shmexport->sequence);
+	g_atomic_int_inc(&header->futex);
+	futex_wake(&header->futex);
+}
+
+infinity_format_t shmexport_get_format(const shmexport_t *shmexport)
+{
+	return shmexport->format;
+}
+
+/*
+ * Maps the region as large as the writer made it.
+ */
+static gboolean reader_map(shmexport_reader_t *reader)
+{
+	struct stat st;
+	gpointer mapping;
+
+	if (fstat(reader->fd, &st) < 0 || (gsize)st.st_size < sizeof(shmexport_header_t))
+		return FALSE;
+	mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, reader->fd, 0);
+	if (mapping == MAP_FAILED)
+		return FALSE;
+	if (reader->header != NULL)
+		munmap(reader->header, reader->mapped);
+	reader->header = mapping;
+	reader->mapped = st.st_size;
+	return TRUE;
+}
+
+shmexport_reader_t *shmexport_reader_open(const gchar *name)
+{
+	shmexport_reader_t *reader;
+	gchar *path;
+
+	g_return_val_if_fail(name != NULL, NULL);
+
+	path = shm_path(name);
+	if (path == NULL)
+		return NULL;
+	reader = g_new0(shmexport_reader_t, 1);
+	reader->fd = shm_open(path, O_RDONLY, 0);
+	g_free(path);
+	if (reader->fd < 0 || !reader_map(reader) ||
+	    g_atomic_int_get(&reader->header->magic) != SHMEXPORT_MAGIC ||
+	    reader->header->version != SHMEXPORT_VERSION) {
+		shmexport_reader_close(reader);
+		return NULL;
+	}
+	return reader;
+}
+
+void shmexport_reader_close(shmexport_reader_t *reader)
+{
+	if (reader == NULL)
+		return;
+	if (reader->header != NULL)
+		munmap(reader->header, reader->mapped);
+	if (reader->fd >= 0)
+		close(reader->fd);
+	g_free(reader);
+}
+
+gboolean shmexport_reader_next(shmexport_reader_t *reader, gint64 timeout_usecs,
+			       shmexport_frame_t *frame)
+{
+	const gint64 t_end = g_get_monotonic_time() + timeout_usecs;
+	shmexport_header_t *header;
+	shmexport_slot_t *slot;
+	guint32 futex, sequence, index;
+	gint64 now;
+
+	g_return_val_if_fail(reader != NULL && frame != NULL, FALSE);
+
+	for (;;) {
+		header = reader->header;
+		futex = g_atomic_int_get(&header->futex);
+		sequence = g_atomic_int_get(&header->sequence);
+		if (sequence != 0 && sequence != reader->last) {
+			if (header->total_bytes > reader->mapped) {
+				if (!reader_map(reader))
+					return FALSE;
+				continue;
+			}
+			index = g_atomic_int_get(&header->latest) % SHMEXPORT_SLOTS;
+			slot = &header->slots[index];
+			frame->format = slot->format;
+			frame->width = slot->width;
+			frame->height = slot->height;
+			frame->stride = slot->stride;
+			frame->timestamp = slot->timestamp;
+			reader->slot_bytes = header->slot_bytes;
+			__sync_synchronize();
+			/* Written over, or by a newer layout, since: try again */
+			if (g_atomic_int_get(&slot->sequence) != sequence ||
+			    g_atomic_int_get(&header->sequence) == 0)
+				continue;
+			if (region_bytes(reader->slot_bytes) > reader->mapped) {
+				if (!reader_map(reader))
+					return FALSE;
+				continue;
+			}
+			reader->last = frame->sequence = sequence;
+			reader->slot = index;
+			frame->pixels = (const guint8 *)header + header->header_bytes +
+					index * reader->slot_bytes;
+			return TRUE;
+		}
+		now = g_get_monotonic_time();
+		if (now >= t_end)
+			return FALSE;
+		futex_wait(&header->futex, futex, t_end - now);
+	}
+}
+
+gboolean shmexport_reader_done(shmexport_reader_t *reader, const shmexport_frame_t *frame)
+{
+	shmexport_header_t *header;
+
+	g_return_val_if_fail(reader != NULL && frame != NULL, FALSE);
+
+	header = reader->header;
+	__sync_synchronize();
+	return g_atomic_int_get(&header->slots[reader->slot].sequence) == frame->sequence &&
+	       header->slot_bytes == reader->slot_bytes;
+}
@@ -0,0 +1,125 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_SHMEXPORT__
+#define __INFINITY_SHMEXPORT__
+
+#include <glib.h>
+
+#include "types.h"
+
+/*
+ * Export of rendered frames through a POSIX shared memory region, so
+ * that local processes can map it and read the frames in place.
+ *
+ * The region starts with a shmexport_header_t followed by SHMEXPORT_SLOTS
+ * frame slots, slot_bytes apart from header_bytes on. Frames go to the
+ * slots in turn. A slot sequence is 0 while the slot is being written
+ * and the frame sequence once it is complete; readers check it again
+ * after reading to tell whether the frame was overwritten meanwhile.
+ *
+ * Each new frame increments the futex word, which readers can wait on
+ * with FUTEX_WAIT (shared, not private). The region grows when the frame
+ * size does: readers remap when total_bytes exceeds their mapping.
+ *
+ * All fields are in native byte order. Sequences start at 1 and wrap
+ * after 2^32 frames.
+ */
+
+#define SHMEXPORT_MAGIC		0x464E4649 /* "IFNF" */
+#define SHMEXPORT_VERSION	1
+#define SHMEXPORT_SLOTS		4
+
+typedef struct {
+	guint32	sequence;  /* frame sequence, 0 while written */
+	guint32	format;    /* infinity_format_t */
+	guint32	width;
+	guint32	height;
+	guint32	stride;    /* bytes between rows */
+	guint32	reserved;
+	gint64	timestamp; /* CLOCK_MONOTONIC microseconds when rendered */
+} shmexport_slot_t;
+
+typedef struct {
+	guint32			magic;
+	guint32			version;
+	guint32			header_bytes; /* offset of the first slot */
+	guint32			nb_slots;
+	guint64			slot_bytes;
+	guint64			total_bytes;  /* size of the region */
+	guint32			futex;        /* incremented on every frame */
+	guint32			latest;       /* slot of the latest complete frame */
+	guint32			sequence;     /* of the latest complete frame */
+	guint32			reserved;
+	shmexport_slot_t	slots[SHMEXPORT_SLOTS];
+} shmexport_header_t;
+
+typedef struct _shmexport shmexport_t;
+
+/*
+ * Creates the region /name, replacing any stale one, sized for frames
+ * of width x height in format. Returns NULL on failure.
+ */
+shmexport_t *shmexport_new(const gchar *name, gint32 width, gint32 height,
+			   infinity_format_t format);
+
+/*
+ * Removes the region. Readers keep their mapping.
+ */
+void shmexport_destroy(shmexport_t *shmexport);
+
+/*
+ * Returns the slot the next frame of width x height must be written to,
+ * growing the region if needed, and its row stride in *stride. The frame
+ * is published by shmexport_commit(). Returns NULL on failure.
+ */
+gpointer shmexport_begin(shmexport_t *shmexport, gint32 width, gint32 height, gint32 *stride);
+void shmexport_commit(shmexport_t *shmexport);
+
+infinity_format_t shmexport_get_format(const shmexport_t *shmexport);
+
+/*
+ * Reader side, as a sample of how to consume the region.
+ */
+typedef struct _shmexport_reader shmexport_reader_t;
+
+typedef struct {
+	guint32			sequence;
+	infinity_format_t	format;
+	gint32			width;
+	gint32			height;
+	gint32			stride;
+	gint64			timestamp;
+	const guint8 *		pixels; /* in the shared region, valid until shmexport_reader_done() */
+} shmexport_frame_t;
+
+shmexport_reader_t *shmexport_reader_open(const gchar *name);
+void shmexport_reader_close(shmexport_reader_t *reader);
+
+/*
+ * Waits up to timeout_usecs for a frame newer than the last one returned
+ * and fills frame with it, without copying the pixels. Returns FALSE on
+ * timeout.
+ */
+gboolean shmexport_reader_next(shmexport_reader_t *reader, gint64 timeout_usecs,
+			       shmexport_frame_t *frame);
+
+/*
+ * Returns TRUE if the frame last returned was not overwritten while the
+ * reader was using it.
+ */
+gboolean shmexport_reader_done(shmexport_reader_t *reader, const shmexport_frame_t *frame);
+
+#endif /* __INFINITY_SHMEXPORT__ */
@@ -0,0 +1,117 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "synth.h"
+
+#define MIX_PERIOD	(4 * SYNTH_RATE)
+#define BEAT_PERIOD	(SYNTH_RATE / 2)
+
+struct synth {
+	synth_signal_t	signal;
+	guint32		seed;
+	guint64		position;
+};
+
+static const gchar *signal_names[] = {
+	"silence", "sine", "noise", "transients", "mix"
+};
+
+/*
+ * Stateless noise: hashes seed, position and channel into [-1, 1).
+ */
+static float noise(guint32 seed, guint64 n, gint32 channel)
+{
+	guint32 h = seed ^ (guint32)(n * 2 + channel) * 0x9E3779B1u ^ (guint32)(n >> 31);
+
+	h ^= h >> 16;
+	h *= 0x7FEB352Du;
+	h ^= h >> 15;
+	h *= 0x846CA68Bu;
+	h ^= h >> 16;
+	return (float)h / 2147483648.0f - 1.0f;
+}
+
+static float sample(synth_signal_t signal, guint32 seed, guint64 n, gint32 channel)
+{
+	const gdouble t = (gdouble)n / SYNTH_RATE;
+	gdouble envelope;
+
+	switch (signal) {
+	case SYNTH_SINE:
+		envelope = 0.6 + 0.3 * sin(2 * G_PI * 0.25 * t);
+		if (channel == 0)
+			return (float)(envelope * (0.6 * sin(2 * G_PI * 220 * t) + 0.3 * sin(2 * G_PI * 1760 * t)));
+		return (float)(envelope * (0.6 * sin(2 * G_PI * 277 * t) + 0.3 * sin(2 * G_PI * 554 * t)));
+	case SYNTH_NOISE:
+		return 0.5f * noise(seed, n, channel);
+	case SYNTH_TRANSIENTS:
+		envelope = exp(-(gdouble)(n % BEAT_PERIOD) / (SYNTH_RATE / 40));
+		return (float)(envelope * noise(seed, n, channel));
+	case SYNTH_MIX:
+		return sample((synth_signal_t)((n / MIX_PERIOD + 1) % SYNTH_MIX), seed, n, channel);
+	case SYNTH_SILENCE:
+	default:
+		return 0.0f;
+	}
+}
+
+synth_t *synth_new(synth_signal_t signal, guint32 seed)
+{
+	synth_t *synth;
+
+	synth = g_new0(synth_t, 1);
+	synth->signal = signal;
+	synth->seed = seed;
+	return synth;
+}
+
+void synth_destroy(synth_t *synth)
+{
+	g_return_if_fail(synth != NULL);
+
+	g_free(synth);
+}
+
+gboolean synth_signal_from_name(const gchar *name, synth_signal_t *signal)
+{
+	guint i;
+
+	g_return_val_if_fail(name != NULL, FALSE);
+
+	for (i = 0; i < G_N_ELEMENTS(signal_names); i++)
+		if (strcmp(name, signal_names[i]) == 0) {
+			*signal = (synth_signal_t)i;
+			return TRUE;
+		}
+	return FALSE;
+}
+
+void synth_render_block(synth_t *synth, float data[2 * SYNTH_FRAMES], gint32 advance)
+{
+	gint32 i;
+
+	g_return_if_fail(synth != NULL);
+
+	for (i = 0; i < SYNTH_FRAMES; i++) {
+		data[2 * i] = sample(synth->signal, synth->seed, synth->position + i, 0);
+		data[2 * i + 1] = sample(synth->signal, synth->seed, synth->position + i, 1);
+	}
+	synth->position += advance;
+}
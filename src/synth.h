@@ -0,0 +1,57 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_SYNTH__
+#define __INFINITY_SYNTH__
+
+#include <glib.h>
+
+/*
+ * Synthetic audio for running the visualization without a player.
+ *
+ * Samples are a pure function of the seed and the sample position, so
+ * the same seed always yields the same PCM stream.
+ */
+
+#define SYNTH_RATE	44100
+#define SYNTH_FRAMES	512 /* stereo frames produced by synth_render_block() */
+
+typedef enum {
+	SYNTH_SILENCE,
+	SYNTH_SINE,
+	SYNTH_NOISE,
+	SYNTH_TRANSIENTS,
+	SYNTH_MIX       /* cycles through all of the above */
+} synth_signal_t;
+
+typedef struct synth synth_t;
+
+synth_t *synth_new(synth_signal_t signal, guint32 seed);
+void synth_destroy(synth_t *synth);
+
+/*
+ * Parses one of "silence", "sine", "noise", "transients" or "mix".
+ *
+ * Returns FALSE if name is none of them.
+ */
+gboolean synth_signal_from_name(const gchar *name, synth_signal_t *signal);
+
+/*
+ * Fills data with SYNTH_FRAMES interleaved stereo frames starting at the
+ * current position, then moves the position advance frames forward.
+ */
+void synth_render_block(synth_t *synth, float data[2 * SYNTH_FRAMES], gint32 advance);
+
+#endif /* __INFINITY_SYNTH__ */
@@ -0,0 +1,228 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "config.h"
+#include "trace.h"
+
+#define DEFAULT_EVENTS	65536
+#define MAX_THREADS	64
+
+typedef struct {
+	const gchar *	name;
+	gint64		ts;
+	gint64		dur;
+	gint32		tid;
+	gchar		phase;   /* 'B', 'E' or 'X' */
+	volatile gint	seq;     /* number of the event + 1 once written */
+} event_t;
+
+static volatile gint enabled;
+static gchar *path;
+static event_t *events;
+static guint32 mask;
+static volatile gint next_event;
+static gint64 origin;
+static gint32 dumps;
+static gint32 users; /* trace_init() calls not matched by trace_quit() yet */
+G_LOCK_DEFINE_STATIC(users);
+
+static GPrivate thread_id;
+static volatile gint nb_threads;
+static gchar *thread_names[MAX_THREADS];
+G_LOCK_DEFINE_STATIC(thread_names);
+
+static gint32 current_tid(void)
+{
+	gint32 tid = GPOINTER_TO_INT(g_private_get(&thread_id));
+
+	if (tid == 0) {
+		tid = g_atomic_int_add(&nb_threads, 1) + 1;
+		g_private_set(&thread_id, GINT_TO_POINTER(tid));
+	}
+	return tid;
+}
+
+static void record(const gchar *name, gchar phase, gint64 ts, gint64 dur)
+{
+	const guint32 n = (guint32)g_atomic_int_add(&next_event, 1);
+	event_t *e = &events[n & mask];
+
+	g_atomic_int_set(&e->seq, 0);
+	e->name = name;
+	e->ts = ts;
+	e->dur = dur;
+	e->tid = current_tid();
+	e->phase = phase;
+	g_atomic_int_set(&e->seq, (gint)(n + 1));
+}
+
+void trace_init(void)
+{
+	const gchar *value = g_getenv("INFINITY_TRACE");
+	guint32 capacity = DEFAULT_EVENTS;
+
+	G_LOCK(users);
+	if (users++ > 0 || value == NULL || *value == '\0') {
+		G_UNLOCK(users);
+		return;
+	}
+	if (g_getenv("INFINITY_TRACE_EVENTS") != NULL) {
+		const gint64 n = g_ascii_strtoll(g_getenv("INFINITY_TRACE_EVENTS"), NULL, 10);
+
+		if (n > 0 && n <= (1 << 24)) {
+			/* round up to a power of two */
+			capacity = 1;
+			while (capacity < n)
+				capacity <<= 1;
+		}
+	}
+	path = g_strdup(value);
+	events = g_new0(event_t, capacity);
+	mask = capacity - 1;
+	next_event = 0;
+	dumps = 0;
+	origin = g_get_monotonic_time();
+	g_atomic_int_set(&enabled, TRUE);
+	G_UNLOCK(users);
+	g_message("Infinity: tracing to %s (last %u events)", path, capacity);
+}
+
+static void write_json(FILE *f)
+{
+	const guint32 end = (guint32)g_atomic_int_get(&next_event);
+	const guint32 begin = end > mask ? end - mask - 1 : 0;
+	const gint pid = (gint)getpid();
+	guint32 n;
+	gint32 i;
+	gboolean first = TRUE;
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+	G_LOCK(thread_names);
+	for (i = 0; i < MAX_THREADS; i++) {
+		if (thread_names[i] == NULL)
+			continue;
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+			"\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", pid, i + 1, thread_names[i]);
+		first = FALSE;
+	}
+	G_UNLOCK(thread_names);
+	for (n = begin; n != end; n++) {
+		const event_t *e = &events[n & mask];
+
+		/* skip slots being written or already reused */
+		if ((guint32)g_atomic_int_get(&e->seq) != n + 1)
+			continue;
+		fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%" G_GINT64_FORMAT,
+			first ? "" : ",\n", e->name, e->phase, pid, e->tid, e->ts - origin);
+		if (e->phase == 'X')
+			fprintf(f, ",\"dur\":%" G_GINT64_FORMAT, e->dur);
+		fputc('}', f);
+		first = FALSE;
+	}
+	fputs("\n]}\n", f);
+}
+
+static void dump_to(const gchar *name)
+{
+	FILE *f = fopen(name, "w");
+
+	if (f == NULL) {
+		g_warning("Infinity: cannot write trace to '%s'", name);
+		return;
+	}
+	write_json(f);
+	fclose(f);
+	g_message("Infinity: trace written to %s", name);
+}
+
+void trace_dump(void)
+{
+	const gchar *dot;
+	gchar *name;
+
+	if (!g_atomic_int_get(&enabled))
+		return;
+	dot = strrchr(path, '.');
+	if (dot == NULL || strchr(dot, G_DIR_SEPARATOR) != NULL)
+		dot = path + strlen(path);
+	name = g_strdup_printf("%.*s-%d%s", (int)(dot - path), path, ++dumps, dot);
+	dump_to(name);
+	g_free(name);
+}
+
+void trace_quit(void)
+{
+	gint32 i;
+
+	G_LOCK(users);
+	if (users == 0 || --users > 0 || !g_atomic_int_get(&enabled)) {
+		G_UNLOCK(users);
+		return;
+	}
+	dump_to(path);
+	g_atomic_int_set(&enabled, FALSE);
+	g_free(events);
+	events = NULL;
+	g_free(path);
+	path = NULL;
+	G_LOCK(thread_names);
+	for (i = 0; i < MAX_THREADS; i++) {
+		g_free(thread_names[i]);
+		thread_names[i] = NULL;
+	}
+	G_UNLOCK(thread_names);
+	G_UNLOCK(users);
+}
+
+void trace_thread_name(const gchar *name)
+{
+	gint32 tid;
+
+	if (!g_atomic_int_get(&enabled))
+		return;
+	tid = current_tid();
+	if (tid > MAX_THREADS)
+		return;
+	G_LOCK(thread_names);
+	if (thread_names[tid - 1] == NULL)
+		thread_names[tid - 1] = g_strdup(name);
+	G_UNLOCK(thread_names);
+}
+
+void trace_begin(const gchar *name)
+{
+	if (g_atomic_int_get(&enabled))
+		record(name, 'B', g_get_monotonic_time(), 0);
+}
+
+void trace_end(const gchar *name)
+{
+	if (g_atomic_int_get(&enabled))
+		record(name, 'E', g_get_monotonic_time(), 0);
+}
+
+void trace_complete(const gchar *name, gint64 usecs)
+{
+	if (g_atomic_int_get(&enabled)) {
+		const gint64 now = g_get_monotonic_time();
+
+		record(name, 'X', now - usecs, usecs);
+	}
+}
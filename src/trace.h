@@ -0,0 +1,70 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_TRACE__
+#define __INFINITY_TRACE__
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Opt-in flight recorder of begin/end events, exported as Chrome trace
+ * JSON for chrome://tracing or Perfetto.
+ *
+ * Setting INFINITY_TRACE to a file name enables it; the last
+ * INFINITY_TRACE_EVENTS events (65536 by default) are kept in memory
+ * and written to that file by trace_dump() and trace_quit(). When
+ * disabled every call below returns right away.
+ *
+ * Event names are not copied and must outlive the recorder, string
+ * literals being the usual choice. Recording can be done from any thread.
+ */
+
+void trace_init(void);
+
+/*
+ * Once every trace_init() call has been matched, dumps the recorder to
+ * the file given by INFINITY_TRACE, then disables it.
+ */
+void trace_quit(void);
+
+/*
+ * Writes the events recorded so far. Dumps requested before
+ * trace_quit() go to numbered files next to it (trace-1.json, ...).
+ */
+void trace_dump(void);
+
+/*
+ * Names the calling thread in the trace. Only the first name given
+ * to a thread is kept.
+ */
+void trace_thread_name(const gchar *name);
+
+void trace_begin(const gchar *name);
+void trace_end(const gchar *name);
+
+/*
+ * Records an event that took usecs microseconds and ended now.
+ */
+void trace_complete(const gchar *name, gint64 usecs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __INFINITY_TRACE__ */
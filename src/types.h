@@ -20,4 +20,15 @@
 
 typedef uint8_t byte;
 
+/*
+ * Pixel layouts frames can be rendered in.
+ */
+typedef enum {
+	INFINITY_FORMAT_RGB565, /* 16 bit words, red in the 5 most significant bits */
+	INFINITY_FORMAT_RGB24,  /* 3 bytes: red, green, blue */
+	INFINITY_FORMAT_XRGB32, /* 32 bit words 0xffRRGGBB, as Cairo RGB24 or Qt RGB32 */
+	INFINITY_FORMAT_XBGR32, /* 32 bit words 0xffBBGGRR, bytes R, G, B, x on little endian */
+	INFINITY_NB_FORMATS
+} infinity_format_t;
+
 #endif /* __INFINITY_TYPES__ */
@@ -3,6 +3,8 @@
 
 #include <glib.h>
 
+#include "types.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -14,6 +16,23 @@ void ui_resize(gint32 width, gint32 height);
 void ui_toggle_fullscreen(void);
 void ui_exit_fullscreen_if_needed(void);
 
+/*
+ * Backends that can take frames in place return where the next frame of
+ * width x height goes, in the pixel format and with the row stride they
+ * set, to be shown by ui_present_acquired(). The others return NULL and
+ * are handed frames by ui_present().
+ */
+gpointer ui_acquire_frame(gint32 width, gint32 height, infinity_format_t *format,
+			  gint32 *stride);
+void ui_present_acquired(void);
+
+/*
+ * Headless backend only: every presented frame is handed to func.
+ */
+typedef void (*UiPresentFunc)(const guint16 *pixels, gint32 width, gint32 height,
+			      gpointer user_data);
+void ui_headless_set_present_func(UiPresentFunc func, gpointer user_data);
+
 void display_notify_resize(gint32 width, gint32 height);
 void display_notify_close(void);
 void display_notify_visibility(gboolean is_visible);
@@ -1,37 +1,204 @@
 #include "ui.h"
 #include "input.h"
+#include "trace.h"
 
 #include <gtk/gtk.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
 #include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 namespace {
 
-GtkWidget *window_instance = nullptr;
-GtkWidget *drawing_area = nullptr;
-std::vector<guint16> frame_buffer;
-gint32 frame_width = 0;
-gint32 frame_height = 0;
+/*
+ * Every window shows the frames rendered once by the engine. Each one
+ * has its own scaler thread that scales the shared frame to the window
+ * size, so the GTK main loop only paints ready-made surfaces. The engine
+ * renders at the size of the primary window, the first one.
+ */
+
+const gint32 MAX_WINDOWS = 8;
+
+struct Frame {
+	std::vector<guint16> pixels;
+	gint32 width;
+	gint32 height;
+};
+
+struct OutputWindow {
+	gint32 index = 0;
+	GtkWidget *window = nullptr;
+	GtkWidget *drawing_area = nullptr;
+	bool is_fullscreen = false;
+	bool visible = true;
+
+	std::thread scaler;
+	std::mutex mutex;
+	std::condition_variable wake;
+	/* guarded by mutex */
+	std::shared_ptr<const Frame> pending;
+	gint32 target_width = 0;
+	gint32 target_height = 0;
+	cairo_surface_t *scaled = nullptr; /* painted by on_draw */
+	cairo_surface_t *spare = nullptr;  /* recycled target of the next scale */
+	bool quit = false;
+};
+
+/* changed by the main thread only, under windows_mutex for ui_present() */
+std::vector<std::unique_ptr<OutputWindow>> windows;
+std::mutex windows_mutex;
 bool gtk_ready = false;
-bool is_fullscreen = false;
-std::mutex frame_mutex;
 
 void process_events();
 gint current_scale_factor(GtkWidget *widget);
 void notify_current_size();
 
-gboolean queue_draw(gpointer) {
-	if (drawing_area != nullptr) {
-		gtk_widget_queue_draw(drawing_area);
+OutputWindow *window_at(gint32 index) {
+	if (index < 0 || index >= static_cast<gint32>(windows.size())) {
+		return nullptr;
+	}
+	return windows[index].get();
+}
+
+OutputWindow *primary_window() {
+	return window_at(0);
+}
+
+/* The focused window, else the primary one */
+OutputWindow *active_window() {
+	for (auto &output : windows) {
+		if (output && output->window != nullptr && gtk_window_is_active(GTK_WINDOW(output->window))) {
+			return output.get();
+		}
+	}
+	return primary_window();
+}
+
+gboolean queue_draw(gpointer data) {
+	OutputWindow *output = window_at(GPOINTER_TO_INT(data));
+
+	if (output != nullptr && output->drawing_area != nullptr) {
+		gtk_widget_queue_draw(output->drawing_area);
 		process_events();
 	}
 	return G_SOURCE_REMOVE;
 }
 
+struct TraceScope {
+	explicit TraceScope(const gchar *name) : name_(name) {
+		trace_begin(name_);
+	}
+	~TraceScope() {
+		trace_end(name_);
+	}
+	const gchar *name_;
+};
+
+/*
+ * Scales frame into target, reusing it when it has the right size.
+ * Cairo image surfaces can be drawn from any thread as long as each
+ * one is used by a single thread at a time.
+ */
+cairo_surface_t *scale_frame(const Frame &frame, gint32 width, gint32 height,
+			     cairo_surface_t *target) {
+	if (target != nullptr && (cairo_image_surface_get_width(target) != width
+				  || cairo_image_surface_get_height(target) != height)) {
+		cairo_surface_destroy(target);
+		target = nullptr;
+	}
+	if (target == nullptr) {
+		target = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+	}
+
+	const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB16_565, frame.width);
+	const int row_bytes = frame.width * static_cast<int>(sizeof(guint16));
+	std::vector<unsigned char> padded;
+	unsigned char *source = reinterpret_cast<unsigned char *>(const_cast<guint16 *>(frame.pixels.data()));
+	if (stride != row_bytes) {
+		padded.resize(static_cast<size_t>(stride) * frame.height);
+		for (gint32 row = 0; row < frame.height; ++row) {
+			std::memcpy(padded.data() + (stride * row), source + (row_bytes * row), row_bytes);
+		}
+		source = padded.data();
+	}
+	cairo_surface_t *surface = cairo_image_surface_create_for_data(
+		source,
+		CAIRO_FORMAT_RGB16_565,
+		frame.width,
+		frame.height,
+		stride);
+
+	cairo_t *cr = cairo_create(target);
+	cairo_scale(cr, static_cast<double>(width) / frame.width,
+		    static_cast<double>(height) / frame.height);
+	cairo_set_source_surface(cr, surface, 0, 0);
+	cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_BILINEAR);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+	cairo_surface_flush(target);
+	return target;
+}
+
+void scaler_main(OutputWindow *output) {
+	trace_thread_name("scaler");
+	std::unique_lock<std::mutex> lock(output->mutex);
+	for (;;) {
+		output->wake.wait(lock, [output] { return output->quit || output->pending; });
+		if (output->quit) {
+			break;
+		}
+		std::shared_ptr<const Frame> frame = std::move(output->pending);
+		const gint32 width = output->target_width > 0 ? output->target_width : frame->width;
+		const gint32 height = output->target_height > 0 ? output->target_height : frame->height;
+		cairo_surface_t *target = output->spare;
+		output->spare = nullptr;
+		lock.unlock();
+		{
+			TraceScope scope("scale");
+			target = scale_frame(*frame, width, height, target);
+		}
+		lock.lock();
+		if (output->scaled != nullptr) {
+			/* recycle it unless on_draw still holds it */
+			if (output->spare == nullptr && cairo_surface_get_reference_count(output->scaled) == 1) {
+				output->spare = output->scaled;
+			} else {
+				cairo_surface_destroy(output->scaled);
+			}
+		}
+		output->scaled = target;
+		lock.unlock();
+		g_main_context_invoke(nullptr, queue_draw, GINT_TO_POINTER(output->index));
+		lock.lock();
+	}
+}
+
+void stop_scaler(OutputWindow *output) {
+	{
+		std::lock_guard<std::mutex> lock(output->mutex);
+		output->quit = true;
+	}
+	output->wake.notify_one();
+	if (output->scaler.joinable()) {
+		output->scaler.join();
+	}
+	if (output->scaled != nullptr) {
+		cairo_surface_destroy(output->scaled);
+		output->scaled = nullptr;
+	}
+	if (output->spare != nullptr) {
+		cairo_surface_destroy(output->spare);
+		output->spare = nullptr;
+	}
+}
+
 struct ResizeRequest {
 	gint32 width;
 	gint32 height;
@@ -42,25 +209,27 @@ gboolean apply_resize(gpointer data) {
 		return G_SOURCE_REMOVE;
 	}
 	std::unique_ptr<ResizeRequest> request(static_cast<ResizeRequest *>(data));
-	if (window_instance == nullptr) {
+	OutputWindow *output = primary_window();
+	if (output == nullptr) {
 		return G_SOURCE_REMOVE;
 	}
-	const gint scale = current_scale_factor(window_instance);
+	const gint scale = current_scale_factor(output->window);
 	const gint32 logical_width = std::max(request->width / scale, 1);
 	const gint32 logical_height = std::max(request->height / scale, 1);
-	gtk_window_resize(GTK_WINDOW(window_instance), logical_width, logical_height);
+	gtk_window_resize(GTK_WINDOW(output->window), logical_width, logical_height);
 	process_events();
 	return G_SOURCE_REMOVE;
 }
 
 gboolean apply_toggle_fullscreen(gpointer) {
-	if (window_instance == nullptr) {
+	OutputWindow *output = active_window();
+	if (output == nullptr) {
 		return G_SOURCE_REMOVE;
 	}
-	if (is_fullscreen) {
-		gtk_window_unfullscreen(GTK_WINDOW(window_instance));
+	if (output->is_fullscreen) {
+		gtk_window_unfullscreen(GTK_WINDOW(output->window));
 	} else {
-		gtk_window_fullscreen(GTK_WINDOW(window_instance));
+		gtk_window_fullscreen(GTK_WINDOW(output->window));
 	}
 	process_events();
 	notify_current_size();
@@ -68,10 +237,11 @@ gboolean apply_toggle_fullscreen(gpointer) {
 }
 
 gboolean apply_exit_fullscreen(gpointer) {
-	if (window_instance == nullptr || !is_fullscreen) {
+	OutputWindow *output = active_window();
+	if (output == nullptr || !output->is_fullscreen) {
 		return G_SOURCE_REMOVE;
 	}
-	gtk_window_unfullscreen(GTK_WINDOW(window_instance));
+	gtk_window_unfullscreen(GTK_WINDOW(output->window));
 	process_events();
 	notify_current_size();
 	return G_SOURCE_REMOVE;
@@ -102,76 +272,96 @@ gint current_scale_factor(GtkWidget *widget) {
 	return std::max(gtk_widget_get_scale_factor(widget), 1);
 }
 
-gboolean on_draw(GtkWidget *widget, cairo_t *cr, gpointer) {
-	std::vector<guint16> frame_copy;
-	gint32 width = 0;
-	gint32 height = 0;
+gboolean on_draw(GtkWidget *widget, cairo_t *cr, gpointer data) {
+	trace_thread_name("ui");
+	TraceScope scope("paint");
+	OutputWindow *output = window_at(GPOINTER_TO_INT(data));
+	cairo_surface_t *scaled = nullptr;
+
+	if (output == nullptr) {
+		return FALSE;
+	}
 	{
-		std::lock_guard<std::mutex> lock(frame_mutex);
-		if (frame_buffer.empty()) {
+		std::lock_guard<std::mutex> lock(output->mutex);
+		if (output->scaled == nullptr) {
 			return FALSE;
 		}
-		frame_copy = frame_buffer;
-		width = frame_width;
-		height = frame_height;
+		scaled = cairo_surface_reference(output->scaled);
 	}
 
 	const gint32 target_width = gtk_widget_get_allocated_width(widget);
 	const gint32 target_height = gtk_widget_get_allocated_height(widget);
-	if (target_width <= 0 || target_height <= 0) {
-		return FALSE;
+	if (target_width > 0 && target_height > 0) {
+		/* 1:1 in device pixels unless the window was resized meanwhile */
+		cairo_save(cr);
+		cairo_scale(cr, static_cast<double>(target_width) / cairo_image_surface_get_width(scaled),
+			    static_cast<double>(target_height) / cairo_image_surface_get_height(scaled));
+		cairo_set_source_surface(cr, scaled, 0, 0);
+		cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_BILINEAR);
+		cairo_paint(cr);
+		cairo_restore(cr);
 	}
-
-	const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB16_565, width);
-	std::vector<unsigned char> surface_buffer(static_cast<size_t>(stride) * height);
-	const unsigned char *source = reinterpret_cast<const unsigned char *>(frame_copy.data());
-	const int row_bytes = width * static_cast<int>(sizeof(guint16));
-	for (gint32 row = 0; row < height; ++row) {
-		std::memcpy(surface_buffer.data() + (stride * row),
-			    source + (row_bytes * row),
-			    row_bytes);
-	}
-
-	cairo_surface_t *surface = cairo_image_surface_create_for_data(
-		surface_buffer.data(),
-		CAIRO_FORMAT_RGB16_565,
-		width,
-		height,
-		stride);
-
-	cairo_save(cr);
-	const double scale_x = static_cast<double>(target_width) / static_cast<double>(width);
-	const double scale_y = static_cast<double>(target_height) / static_cast<double>(height);
-	cairo_scale(cr, scale_x, scale_y);
-	cairo_set_source_surface(cr, surface, 0, 0);
-	cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_BILINEAR);
-	cairo_paint(cr);
-	cairo_restore(cr);
-	cairo_surface_destroy(surface);
+	cairo_surface_destroy(scaled);
 	return FALSE;
 }
 
-void on_size_allocate(GtkWidget *widget, GtkAllocation *allocation, gpointer) {
-	if (allocation == nullptr) {
+void on_size_allocate(GtkWidget *widget, GtkAllocation *allocation, gpointer data) {
+	OutputWindow *output = window_at(GPOINTER_TO_INT(data));
+	if (allocation == nullptr || output == nullptr) {
 		return;
 	}
 	const gint scale = current_scale_factor(widget);
 	const gint32 pixel_width = allocation->width * scale;
 	const gint32 pixel_height = allocation->height * scale;
-	display_notify_resize(pixel_width, pixel_height);
+	{
+		std::lock_guard<std::mutex> lock(output->mutex);
+		output->target_width = pixel_width;
+		output->target_height = pixel_height;
+	}
+	if (output->index == 0) {
+		display_notify_resize(pixel_width, pixel_height);
+	}
 }
 
-gboolean on_delete_event(GtkWidget *, GdkEvent *, gpointer) {
-	display_notify_close();
-	return FALSE;
+void notify_visibility() {
+	bool any_visible = false;
+	for (auto &output : windows) {
+		any_visible = any_visible || (output && output->visible);
+	}
+	display_notify_visibility(any_visible);
+}
+
+void close_window(OutputWindow *output);
+
+gboolean on_delete_event(GtkWidget *, GdkEvent *, gpointer data) {
+	OutputWindow *output = window_at(GPOINTER_TO_INT(data));
+	if (output == nullptr) {
+		return FALSE;
+	}
+	if (output->index == 0) {
+		display_notify_close();
+		return FALSE;
+	}
+	/* other windows just go away */
+	close_window(output);
+	notify_visibility();
+	return TRUE;
 }
 
-void on_show(GtkWidget *, gpointer) {
-	display_notify_visibility(TRUE);
+void on_show(GtkWidget *, gpointer data) {
+	OutputWindow *output = window_at(GPOINTER_TO_INT(data));
+	if (output != nullptr) {
+		output->visible = true;
+		notify_visibility();
+	}
 }
 
-void on_hide(GtkWidget *, gpointer) {
-	display_notify_visibility(FALSE);
+void on_hide(GtkWidget *, gpointer data) {
+	OutputWindow *output = window_at(GPOINTER_TO_INT(data));
+	if (output != nullptr) {
+		output->visible = false;
+		notify_visibility();
+	}
 }
 
 gboolean on_key_press(GtkWidget *, GdkEventKey *event, gpointer) {
@@ -220,6 +410,14 @@ gboolean on_key_press(GtkWidget *, GdkEventKey *event, gpointer) {
 	case GDK_KEY_space:
 		infinity_queue_key(INFINITY_KEY_NEXT_EFFECT);
 		break;
+	case GDK_KEY_h:
+	case GDK_KEY_H:
+		infinity_queue_key(INFINITY_KEY_TOGGLE_HUD);
+		break;
+	case GDK_KEY_t:
+	case GDK_KEY_T:
+		infinity_queue_key(INFINITY_KEY_DUMP_TRACE);
+		break;
 	case GDK_KEY_Return:
 	case GDK_KEY_KP_Enter:
 		infinity_queue_key(INFINITY_KEY_TOGGLE_INTERACTIVE);
@@ -230,64 +428,116 @@ gboolean on_key_press(GtkWidget *, GdkEventKey *event, gpointer) {
 	return FALSE;
 }
 
-gboolean on_window_state(GtkWidget *, GdkEventWindowState *event, gpointer) {
-	if ((event->changed_mask & GDK_WINDOW_STATE_FULLSCREEN) == 0) {
+gboolean on_window_state(GtkWidget *, GdkEventWindowState *event, gpointer data) {
+	OutputWindow *output = window_at(GPOINTER_TO_INT(data));
+	if (output == nullptr || (event->changed_mask & GDK_WINDOW_STATE_FULLSCREEN) == 0) {
 		return FALSE;
 	}
-	is_fullscreen = (event->new_window_state & GDK_WINDOW_STATE_FULLSCREEN) != 0;
+	output->is_fullscreen = (event->new_window_state & GDK_WINDOW_STATE_FULLSCREEN) != 0;
 	return FALSE;
 }
 
 void notify_current_size() {
-	if (drawing_area == nullptr) {
+	OutputWindow *output = primary_window();
+	if (output == nullptr) {
 		return;
 	}
-	const gint scale = current_scale_factor(drawing_area);
-	const gint32 width = gtk_widget_get_allocated_width(drawing_area) * scale;
-	const gint32 height = gtk_widget_get_allocated_height(drawing_area) * scale;
+	const gint scale = current_scale_factor(output->drawing_area);
+	const gint32 width = gtk_widget_get_allocated_width(output->drawing_area) * scale;
+	const gint32 height = gtk_widget_get_allocated_height(output->drawing_area) * scale;
 	display_notify_resize(width, height);
 }
 
-} // namespace
-
-gboolean ui_init(gint32 width, gint32 height)
-{
-	if (!ensure_gtk_ready()) {
-		return FALSE;
+/*
+ * Number of windows from INFINITY_WINDOWS, one by default.
+ */
+gint32 window_count() {
+	const gchar *value = g_getenv("INFINITY_WINDOWS");
+	if (value == nullptr) {
+		return 1;
 	}
+	return std::min(std::max(static_cast<gint32>(std::atoi(value)), 1), MAX_WINDOWS);
+}
 
-	if (window_instance != nullptr) {
-		return TRUE;
-	}
+void open_window(gint32 index, gint32 width, gint32 height) {
+	auto output = std::make_unique<OutputWindow>();
+	output->index = index;
 
-	window_instance = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-	gtk_window_set_title(GTK_WINDOW(window_instance), "Infinity");
-	gtk_widget_set_size_request(window_instance, 200, 150);
-	gtk_widget_realize(window_instance);
+	GtkWidget *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_title(GTK_WINDOW(window), "Infinity");
+	gtk_widget_set_size_request(window, 200, 150);
+	gtk_widget_realize(window);
 
-	const gint scale = current_scale_factor(window_instance);
+	const gint scale = current_scale_factor(window);
 	const gint32 logical_width = std::max(width / scale, 1);
 	const gint32 logical_height = std::max(height / scale, 1);
-	gtk_window_resize(GTK_WINDOW(window_instance), logical_width, logical_height);
-	gtk_window_set_resizable(GTK_WINDOW(window_instance), TRUE);
-	gtk_window_set_default_size(GTK_WINDOW(window_instance), logical_width, logical_height);
+	gtk_window_resize(GTK_WINDOW(window), logical_width, logical_height);
+	gtk_window_set_resizable(GTK_WINDOW(window), TRUE);
+	gtk_window_set_default_size(GTK_WINDOW(window), logical_width, logical_height);
+
+	/* spread the windows over the monitors */
+	GdkDisplay *gdk_display = gtk_widget_get_display(window);
+	const gint n_monitors = gdk_display_get_n_monitors(gdk_display);
+	if (index > 0 && n_monitors > 1) {
+		GdkRectangle geometry;
+		gdk_monitor_get_geometry(gdk_display_get_monitor(gdk_display, index % n_monitors), &geometry);
+		gtk_window_move(GTK_WINDOW(window), geometry.x, geometry.y);
+	}
 
-	drawing_area = gtk_drawing_area_new();
+	GtkWidget *drawing_area = gtk_drawing_area_new();
 	gtk_widget_set_hexpand(drawing_area, TRUE);
 	gtk_widget_set_vexpand(drawing_area, TRUE);
-	gtk_container_add(GTK_CONTAINER(window_instance), drawing_area);
+	gtk_container_add(GTK_CONTAINER(window), drawing_area);
+
+	gtk_widget_add_events(window, GDK_KEY_PRESS_MASK);
+
+	gpointer data = GINT_TO_POINTER(index);
+	g_signal_connect(window, "delete-event", G_CALLBACK(on_delete_event), data);
+	g_signal_connect(window, "show", G_CALLBACK(on_show), data);
+	g_signal_connect(window, "hide", G_CALLBACK(on_hide), data);
+	g_signal_connect(window, "key-press-event", G_CALLBACK(on_key_press), data);
+	g_signal_connect(window, "window-state-event", G_CALLBACK(on_window_state), data);
+	g_signal_connect(drawing_area, "draw", G_CALLBACK(on_draw), data);
+	g_signal_connect(drawing_area, "size-allocate", G_CALLBACK(on_size_allocate), data);
+
+	output->window = window;
+	output->drawing_area = drawing_area;
+	output->scaler = std::thread(scaler_main, output.get());
+	{
+		std::lock_guard<std::mutex> lock(windows_mutex);
+		if (index >= static_cast<gint32>(windows.size())) {
+			windows.resize(index + 1);
+		}
+		windows[index] = std::move(output);
+	}
+	gtk_widget_show_all(window);
+}
 
-	gtk_widget_add_events(window_instance, GDK_KEY_PRESS_MASK);
+void close_window(OutputWindow *output) {
+	const gint32 index = output->index;
+
+	stop_scaler(output);
+	gtk_widget_destroy(output->window);
+	std::lock_guard<std::mutex> lock(windows_mutex);
+	windows[index].reset();
+}
+
+} // namespace
+
+gboolean ui_init(gint32 width, gint32 height)
+{
+	if (!ensure_gtk_ready()) {
+		return FALSE;
+	}
 
-	g_signal_connect(window_instance, "delete-event", G_CALLBACK(on_delete_event), nullptr);
-	g_signal_connect(window_instance, "show", G_CALLBACK(on_show), nullptr);
-	g_signal_connect(window_instance, "hide", G_CALLBACK(on_hide), nullptr);
-	g_signal_connect(window_instance, "key-press-event", G_CALLBACK(on_key_press), nullptr);
-	g_signal_connect(window_instance, "window-state-event", G_CALLBACK(on_window_state), nullptr);
-	g_signal_connect(drawing_area, "draw", G_CALLBACK(on_draw), nullptr);
-	g_signal_connect(drawing_area, "size-allocate", G_CALLBACK(on_size_allocate), nullptr);
+	if (primary_window() != nullptr) {
+		return TRUE;
+	}
 
-	gtk_widget_show_all(window_instance);
+	const gint32 count = window_count();
+	for (gint32 index = 0; index < count; ++index) {
+		open_window(index, width, height);
+	}
 	process_events();
 	return TRUE;
 }
@@ -299,31 +549,41 @@ void ui_ensure_app(void)
 
 void ui_quit(void)
 {
-	if (window_instance == nullptr) {
-		return;
+	for (auto &output : windows) {
+		if (output) {
+			close_window(output.get());
+		}
 	}
-	gtk_widget_destroy(window_instance);
-	window_instance = nullptr;
-	drawing_area = nullptr;
+	std::lock_guard<std::mutex> lock(windows_mutex);
+	windows.clear();
 }
 
 void ui_present(const guint16 *pixels, gint32 width, gint32 height)
 {
-	if (drawing_area == nullptr || pixels == nullptr || width <= 0 || height <= 0) {
+	if (pixels == nullptr || width <= 0 || height <= 0) {
 		return;
 	}
-	{
-		std::lock_guard<std::mutex> lock(frame_mutex);
-		frame_width = width;
-		frame_height = height;
-		frame_buffer.assign(pixels, pixels + (width * height));
+	/* the single copy of the frame, shared by every scaler */
+	auto frame = std::make_shared<Frame>();
+	frame->pixels.assign(pixels, pixels + (width * height));
+	frame->width = width;
+	frame->height = height;
+	std::lock_guard<std::mutex> windows_lock(windows_mutex);
+	for (auto &output : windows) {
+		if (!output) {
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(output->mutex);
+			output->pending = frame;
+		}
+		output->wake.notify_one();
 	}
-	g_main_context_invoke(nullptr, queue_draw, nullptr);
 }
 
 void ui_resize(gint32 width, gint32 height)
 {
-	if (window_instance == nullptr) {
+	if (primary_window() == nullptr) {
 		return;
 	}
 	auto *request = new ResizeRequest{width, height};
@@ -332,7 +592,7 @@ void ui_resize(gint32 width, gint32 height)
 
 void ui_toggle_fullscreen(void)
 {
-	if (window_instance == nullptr) {
+	if (primary_window() == nullptr) {
 		return;
 	}
 	g_main_context_invoke(nullptr, apply_toggle_fullscreen, nullptr);
@@ -340,8 +600,18 @@ void ui_toggle_fullscreen(void)
 
 void ui_exit_fullscreen_if_needed(void)
 {
-	if (window_instance == nullptr || !is_fullscreen) {
+	if (primary_window() == nullptr) {
 		return;
 	}
 	g_main_context_invoke(nullptr, apply_exit_fullscreen, nullptr);
 }
+
+gpointer ui_acquire_frame(gint32, gint32, infinity_format_t *, gint32 *)
+{
+	/* every window scales its own copy */
+	return nullptr;
+}
+
+void ui_present_acquired(void)
+{
+}
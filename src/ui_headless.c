@@ -0,0 +1,77 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <glib.h>
+
+#include "config.h"
+#include "ui.h"
+
+/*
+ * UI backend without any window, for tools and tests. Frames go to the
+ * present function, if any, and are dropped otherwise.
+ */
+
+static UiPresentFunc present_func;
+static gpointer present_data;
+
+void ui_headless_set_present_func(UiPresentFunc func, gpointer user_data)
+{
+	present_func = func;
+	present_data = user_data;
+}
+
+gboolean ui_init(gint32 width, gint32 height)
+{
+	(void)width;
+	(void)height;
+	return TRUE;
+}
+
+void ui_quit(void)
+{
+}
+
+void ui_present(const guint16 *pixels, gint32 width, gint32 height)
+{
+	if (present_func != NULL)
+		present_func(pixels, width, height, present_data);
+}
+
+void ui_resize(gint32 width, gint32 height)
+{
+	display_notify_resize(width, height);
+}
+
+void ui_toggle_fullscreen(void)
+{
+}
+
+void ui_exit_fullscreen_if_needed(void)
+{
+}
+
+gpointer ui_acquire_frame(gint32 width, gint32 height, infinity_format_t *format,
+			  gint32 *stride)
+{
+	(void)width;
+	(void)height;
+	(void)format;
+	(void)stride;
+	return NULL;
+}
+
+void ui_present_acquired(void)
+{
+}
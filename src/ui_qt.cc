@@ -1,5 +1,6 @@
 #include "ui.h"
 #include "input.h"
+#include "trace.h"
 
 #include <QApplication>
 #include <QCloseEvent>
@@ -7,38 +8,64 @@
 #include <QImage>
 #include <QKeyEvent>
 #include <QMetaObject>
-#include <QMutex>
-#include <QMutexLocker>
 #include <QPainter>
 #include <QResizeEvent>
 #include <QShowEvent>
+#include <QThread>
 #include <QWidget>
 #include <QtGlobal>
-#include <QEventLoop>
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 namespace {
 
+/*
+ * The window lives on the GUI thread, the one of the QApplication, and
+ * only that thread touches it: the renderer posts resizes and full screen
+ * changes to it and never pumps its events. Audacious, or the GLib main
+ * loop of infinity-play through the Qt GLib event dispatcher, runs the
+ * event loop.
+ *
+ * Frames are rendered in place, through ui_acquire_frame(), into
+ * buffers in the 0xffRRGGBB layout of QImage::Format_RGB32, which Qt
+ * paints without a conversion. Each buffer counts its holders under
+ * frames_mutex: the renderer while it draws into it, the window while it
+ * is the latest one, and paintEvent() while it paints it, wrapped in a
+ * QImage without copying. The renderer only takes buffers nobody holds,
+ * and a hold is only taken under the mutex, from the latest frame, so
+ * none is gained after the check. Repaint requests are coalesced, so a
+ * slow GUI thread drops frames instead of queuing them.
+ */
+
+const size_t MAX_FRAMES = 4; /* painted, latest, rendered, and one in flight */
+
+struct Frame {
+	std::unique_ptr<guint32[]> pixels;
+	gint32 width = 0;
+	gint32 height = 0;
+	int holders = 0; /* guarded by frames_mutex */
+};
+
+std::mutex frames_mutex;
+
+void release_frame(Frame *frame) {
+	if (frame != nullptr) {
+		std::lock_guard<std::mutex> lock(frames_mutex);
+		frame->holders--;
+	}
+}
+
 class InfinityWindow final : public QWidget {
 public:
 	InfinityWindow() {
 		setWindowTitle(QStringLiteral("Infinity"));
 		setMinimumSize(200, 150);
 		setFocusPolicy(Qt::StrongFocus);
-	}
-
-	void update_frame(const guint16 *pixels, gint32 width, gint32 height) {
-		if (pixels == nullptr || width <= 0 || height <= 0) {
-			return;
-		}
-
-		QImage frame(reinterpret_cast<const uchar *>(pixels), width, height, QImage::Format_RGB16);
-		{
-			QMutexLocker locker(&frame_mutex_);
-			frame_ = frame.copy();
-		}
-		QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+		setAttribute(Qt::WA_OpaquePaintEvent);
 	}
 
 	void set_fullscreen(bool enabled) {
@@ -53,17 +80,52 @@ public:
 		return isFullScreen();
 	}
 
+	~InfinityWindow() override {
+		release_frame(latest_);
+	}
+
+	/* Any thread: takes over the hold of the caller on frame */
+	void show_frame(Frame *frame) {
+		{
+			std::lock_guard<std::mutex> lock(frames_mutex);
+			if (latest_ != nullptr) {
+				latest_->holders--;
+			}
+			latest_ = frame;
+		}
+		if (!update_pending_.exchange(true)) {
+			QMetaObject::invokeMethod(this, [this] {
+				update_pending_ = false;
+				update();
+			}, Qt::QueuedConnection);
+		}
+	}
+
 protected:
 	void paintEvent(QPaintEvent *) override {
-		QPainter painter(this);
-		QImage frame_copy;
+		Frame *frame;
+
+		trace_thread_name("ui");
+		trace_begin("paint");
 		{
-			QMutexLocker locker(&frame_mutex_);
-			frame_copy = frame_;
+			std::lock_guard<std::mutex> lock(frames_mutex);
+			frame = latest_;
+			if (frame != nullptr) {
+				frame->holders++;
+			}
 		}
-		if (!frame_copy.isNull()) {
-			painter.drawImage(rect(), frame_copy);
+		QPainter painter(this);
+		if (frame != nullptr) {
+			const QImage image(reinterpret_cast<const uchar *>(frame->pixels.get()),
+					   frame->width, frame->height,
+					   frame->width * sizeof(guint32), QImage::Format_RGB32);
+			painter.drawImage(rect(), image);
+		} else {
+			painter.fillRect(rect(), Qt::black);
 		}
+		painter.end();
+		release_frame(frame);
+		trace_end("paint");
 	}
 
 	void resizeEvent(QResizeEvent *event) override {
@@ -130,6 +192,12 @@ protected:
 		case Qt::Key_Space:
 			infinity_queue_key(INFINITY_KEY_NEXT_EFFECT);
 			break;
+		case Qt::Key_H:
+			infinity_queue_key(INFINITY_KEY_TOGGLE_HUD);
+			break;
+		case Qt::Key_T:
+			infinity_queue_key(INFINITY_KEY_DUMP_TRACE);
+			break;
 		case Qt::Key_Return:
 		case Qt::Key_Enter:
 			infinity_queue_key(INFINITY_KEY_TOGGLE_INTERACTIVE);
@@ -141,13 +209,17 @@ protected:
 	}
 
 private:
-	QMutex frame_mutex_;
-	QImage frame_;
+	Frame *latest_ = nullptr; /* guarded by frames_mutex */
+	std::atomic<bool> update_pending_{false};
 };
 
-InfinityWindow *window_instance = nullptr;
+std::atomic<InfinityWindow *> window_instance{nullptr};
 std::unique_ptr<QApplication> app_instance;
 
+/* Renderer thread only */
+std::vector<std::unique_ptr<Frame>> frames;
+Frame *acquired;
+
 void ensure_app_instance() {
 	if (QApplication::instance() != nullptr) {
 		return;
@@ -158,11 +230,56 @@ void ensure_app_instance() {
 	app_instance = std::make_unique<QApplication>(argc, argv);
 }
 
-void process_events() {
-	if (QApplication::instance() == nullptr) {
+bool on_gui_thread() {
+	return QThread::currentThread() == QCoreApplication::instance()->thread();
+}
+
+/*
+ * Runs func on the GUI thread: right away from it, otherwise queued, and
+ * waited for only when wait is set.
+ */
+void run_on_gui_thread(std::function<void()> func, bool wait) {
+	if (QCoreApplication::instance() == nullptr) {
 		return;
 	}
-	QApplication::processEvents(QEventLoop::AllEvents, 1);
+	if (on_gui_thread()) {
+		func();
+	} else {
+		QMetaObject::invokeMethod(QCoreApplication::instance(), std::move(func),
+					  wait ? Qt::BlockingQueuedConnection : Qt::QueuedConnection);
+	}
+}
+
+/*
+ * A buffer of width x height that nobody holds, held by the renderer
+ * until it shows or releases it.
+ */
+Frame *free_frame(gint32 width, gint32 height) {
+	Frame *frame = nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(frames_mutex);
+		for (auto &candidate : frames) {
+			if (candidate->holders == 0) {
+				frame = candidate.get();
+				break;
+			}
+		}
+		if (frame == nullptr && frames.size() < MAX_FRAMES) {
+			frames.push_back(std::make_unique<Frame>());
+			frame = frames.back().get();
+		}
+		if (frame == nullptr) {
+			return nullptr;
+		}
+		frame->holders = 1;
+	}
+	if (frame->width != width || frame->height != height) {
+		frame->pixels.reset(new guint32[(size_t)width * height]);
+		frame->width = width;
+		frame->height = height;
+	}
+	return frame;
 }
 
 } // namespace
@@ -178,67 +295,110 @@ gboolean ui_init(gint32 width, gint32 height)
 		return TRUE;
 	}
 
-	window_instance = new InfinityWindow();
-	window_instance->resize(width, height);
-	window_instance->show();
-	window_instance->raise();
-	process_events();
+	run_on_gui_thread([width, height] {
+		InfinityWindow *window = new InfinityWindow();
+		window->resize(width, height);
+		window->show();
+		window->raise();
+		window_instance = window;
+	}, true);
 	return TRUE;
 }
 
 void ui_quit(void)
 {
-	if (window_instance == nullptr) {
+	InfinityWindow *window = window_instance.exchange(nullptr);
+
+	if (window == nullptr) {
 		return;
 	}
-	window_instance->close();
-	delete window_instance;
-	window_instance = nullptr;
+	run_on_gui_thread([window] {
+		window->close();
+		delete window;
+	}, true);
+	acquired = nullptr;
+	frames.clear();
 }
 
+/* While the HUD is shown */
 void ui_present(const guint16 *pixels, gint32 width, gint32 height)
 {
-	if (window_instance == nullptr) {
+	gint32 stride;
+	infinity_format_t format;
+	guint32 *out;
+	gint32 i;
+
+	out = static_cast<guint32 *>(ui_acquire_frame(width, height, &format, &stride));
+	if (out == nullptr || pixels == nullptr) {
 		return;
 	}
-	window_instance->update_frame(pixels, width, height);
-	process_events();
+	for (i = 0; i < width * height; i++) {
+		const guint16 p = pixels[i];
+		const guint32 r = (p >> 11) & 0x1f, g = (p >> 5) & 0x3f, b = p & 0x1f;
+		out[i] = 0xff000000u | ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) |
+			 (b << 3 | b >> 2);
+	}
+	ui_present_acquired();
 }
 
-void ui_resize(gint32 width, gint32 height)
+gpointer ui_acquire_frame(gint32 width, gint32 height, infinity_format_t *format,
+			  gint32 *stride)
 {
-	if (window_instance == nullptr) {
-		return;
+	InfinityWindow *window = window_instance;
+
+	if (window == nullptr || width <= 0 || height <= 0) {
+		return nullptr;
 	}
-	const qreal ratio = window_instance->devicePixelRatioF();
-	const gint32 logical_width = qRound(width / ratio);
-	const gint32 logical_height = qRound(height / ratio);
-	window_instance->resize(logical_width, logical_height);
-	process_events();
+	release_frame(acquired);
+	acquired = free_frame(width, height);
+	if (acquired == nullptr) {
+		return nullptr;
+	}
+	*format = INFINITY_FORMAT_XRGB32;
+	*stride = width * sizeof(guint32);
+	return acquired->pixels.get();
 }
 
-void ui_toggle_fullscreen(void)
+void ui_present_acquired(void)
 {
-	if (window_instance == nullptr) {
+	InfinityWindow *window = window_instance;
+
+	if (window == nullptr || acquired == nullptr) {
 		return;
 	}
-	window_instance->set_fullscreen(!window_instance->is_fullscreen());
-	process_events();
-	const qreal ratio = window_instance->devicePixelRatioF();
-	display_notify_resize(qRound(window_instance->width() * ratio),
-			      qRound(window_instance->height() * ratio));
+	window->show_frame(acquired);
+	acquired = nullptr;
+}
+
+void ui_resize(gint32 width, gint32 height)
+{
+	run_on_gui_thread([width, height] {
+		InfinityWindow *window = window_instance;
+		if (window == nullptr) {
+			return;
+		}
+		const qreal ratio = window->devicePixelRatioF();
+		window->resize(qRound(width / ratio), qRound(height / ratio));
+	}, false);
+}
+
+/* The new size reaches the engine through resizeEvent() */
+void ui_toggle_fullscreen(void)
+{
+	run_on_gui_thread([] {
+		InfinityWindow *window = window_instance;
+		if (window != nullptr) {
+			window->set_fullscreen(!window->is_fullscreen());
+		}
+	}, false);
 }
 
 void ui_exit_fullscreen_if_needed(void)
 {
-	if (window_instance == nullptr) {
-		return;
-	}
-	if (window_instance->is_fullscreen()) {
-		window_instance->set_fullscreen(false);
-		process_events();
-		const qreal ratio = window_instance->devicePixelRatioF();
-		display_notify_resize(qRound(window_instance->width() * ratio),
-				      qRound(window_instance->height() * ratio));
-	}
+	run_on_gui_thread([] {
+		InfinityWindow *window = window_instance;
+		if (window != nullptr && window->is_fullscreen()) {
+			window->set_fullscreen(false);
+		}
+	}, false);
 }
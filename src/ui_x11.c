@@ -0,0 +1,544 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <glib.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XShm.h>
+
+#include "config.h"
+#include "input.h"
+#include "ui.h"
+
+/*
+ * Plain X11 backend, for kiosks without a desktop: frames are rendered
+ * in place into MIT-SHM images in the pixel format of the default visual
+ * and shown with XShmPutImage, with no conversion or copy in between.
+ *
+ * There are two images: the renderer fills one while the server reads
+ * the other. An image is reused only once its ShmCompletion event came
+ * back, which paces the renderer to the server. Without MIT-SHM (remote
+ * displays) the images are sent with XPutImage instead.
+ *
+ * Events are read on a thread of their own.
+ */
+
+#define NB_IMAGES		2
+#define COMPLETION_TIMEOUT	(100 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct {
+	XImage *		ximage;
+	XShmSegmentInfo		shm;
+	gboolean		shared;
+	gboolean		busy; /* until its ShmCompletion event */
+} image_t;
+
+static Display *x_display;
+static Window window;
+static Visual *visual;
+static gint depth;
+static GC gc;
+static Atom wm_delete_window, net_wm_state, net_wm_state_fullscreen;
+static infinity_format_t native_format;
+static gboolean have_shm;
+static gint shm_completion;
+
+static image_t images[NB_IMAGES];
+static gint32 current;
+static gint32 image_width, image_height;
+static GMutex images_lock;
+static GCond image_completed;
+
+static gint32 window_width, window_height;
+static gboolean fullscreen;
+static GThread *event_thread;
+static gint wake_pipe[2] = { -1, -1 };
+
+static gboolean attach_failed;
+
+/*
+ * The pixel layouts of the engine that are also X visuals.
+ */
+static gboolean find_native_format(void)
+{
+	const gint host_order = G_BYTE_ORDER == G_LITTLE_ENDIAN ? LSBFirst : MSBFirst;
+	XImage *probe;
+	gint bpp, byte_order;
+
+	probe = XCreateImage(x_display, visual, depth, ZPixmap, 0, NULL, 1, 1, 32, 0);
+	if (probe == NULL)
+		return FALSE;
+	bpp = probe->bits_per_pixel;
+	byte_order = probe->byte_order;
+	XDestroyImage(probe);
+	if (byte_order != host_order)
+		return FALSE;
+	if (bpp == 32 && visual->red_mask == 0xFF0000 && visual->green_mask == 0xFF00
+	    && visual->blue_mask == 0xFF)
+		native_format = INFINITY_FORMAT_XRGB32;
+	else if (bpp == 32 && visual->red_mask == 0xFF && visual->green_mask == 0xFF00
+		 && visual->blue_mask == 0xFF0000)
+		native_format = INFINITY_FORMAT_XBGR32;
+	else if (bpp == 16 && visual->red_mask == 0xF800 && visual->green_mask == 0x7E0
+		 && visual->blue_mask == 0x1F)
+		native_format = INFINITY_FORMAT_RGB565;
+	else
+		return FALSE;
+	return TRUE;
+}
+
+static int on_attach_error(Display *display, XErrorEvent *event)
+{
+	(void)display;
+	(void)event;
+	attach_failed = TRUE;
+	return 0;
+}
+
+/*
+ * Attaches a shared segment to image, or returns FALSE if the server
+ * cannot, as remote ones.
+ */
+static gboolean attach_shared(image_t *image, gint32 width, gint32 height)
+{
+	int (*handler)(Display *, XErrorEvent *);
+
+	image->ximage = XShmCreateImage(x_display, visual, depth, ZPixmap, NULL, &image->shm,
+					width, height);
+	if (image->ximage == NULL)
+		return FALSE;
+	image->shm.shmid = shmget(IPC_PRIVATE, (gsize)image->ximage->bytes_per_line * height,
+				  IPC_CREAT | 0600);
+	if (image->shm.shmid < 0)
+		goto fail_image;
+	image->shm.shmaddr = shmat(image->shm.shmid, NULL, 0);
+	if (image->shm.shmaddr == (char *)-1)
+		goto fail_segment;
+	image->shm.readOnly = False;
+	image->ximage->data = image->shm.shmaddr;
+
+	XLockDisplay(x_display);
+	attach_failed = FALSE;
+	handler = XSetErrorHandler(on_attach_error);
+	XShmAttach(x_display, &image->shm);
+	XSync(x_display, False);
+	XSetErrorHandler(handler);
+	XUnlockDisplay(x_display);
+	if (attach_failed) {
+		shmdt(image->shm.shmaddr);
+		goto fail_segment;
+	}
+	/* Freed once both sides detach, even if we crash */
+	shmctl(image->shm.shmid, IPC_RMID, NULL);
+	image->shared = TRUE;
+	return TRUE;
+
+fail_segment:
+	shmctl(image->shm.shmid, IPC_RMID, NULL);
+fail_image:
+	XDestroyImage(image->ximage);
+	image->ximage = NULL;
+	return FALSE;
+}
+
+static gboolean image_create(image_t *image, gint32 width, gint32 height)
+{
+	gchar *data;
+
+	image->busy = FALSE;
+	if (have_shm) {
+		if (attach_shared(image, width, height))
+			return TRUE;
+		g_message("Infinity: MIT-SHM unavailable, using XPutImage");
+		have_shm = FALSE;
+	}
+	image->shared = FALSE;
+	image->ximage = XCreateImage(x_display, visual, depth, ZPixmap, 0, NULL,
+				     width, height, 32, 0);
+	if (image->ximage == NULL)
+		return FALSE;
+	data = g_malloc((gsize)image->ximage->bytes_per_line * height);
+	image->ximage->data = data;
+	return TRUE;
+}
+
+static void image_destroy(image_t *image)
+{
+	if (image->ximage == NULL)
+		return;
+	if (image->shared) {
+		XShmDetach(x_display, &image->shm);
+		XSync(x_display, False);
+		XDestroyImage(image->ximage);
+		shmdt(image->shm.shmaddr);
+	} else {
+		g_free(image->ximage->data);
+		image->ximage->data = NULL;
+		XDestroyImage(image->ximage);
+	}
+	image->ximage = NULL;
+}
+
+/*
+ * Must be called with images_lock held.
+ */
+static void wait_completion(image_t *image)
+{
+	const gint64 deadline = g_get_monotonic_time() + COMPLETION_TIMEOUT;
+
+	while (image->busy) {
+		if (!g_cond_wait_until(&image_completed, &images_lock, deadline)) {
+			/* The event was lost, an unmapped window for instance */
+			image->busy = FALSE;
+		}
+	}
+}
+
+static void send_wm_state(long action)
+{
+	XEvent event;
+
+	memset(&event, 0, sizeof(event));
+	event.xclient.type = ClientMessage;
+	event.xclient.window = window;
+	event.xclient.message_type = net_wm_state;
+	event.xclient.format = 32;
+	event.xclient.data.l[0] = action;
+	event.xclient.data.l[1] = net_wm_state_fullscreen;
+	event.xclient.data.l[3] = 1;
+	XSendEvent(x_display, DefaultRootWindow(x_display), False,
+		   SubstructureRedirectMask | SubstructureNotifyMask, &event);
+	XFlush(x_display);
+}
+
+static void handle_key(XKeyEvent *event)
+{
+	switch (XLookupKeysym(event, 0)) {
+	case XK_Right:
+		infinity_queue_key(INFINITY_KEY_RIGHT);
+		break;
+	case XK_Left:
+		infinity_queue_key(INFINITY_KEY_LEFT);
+		break;
+	case XK_Up:
+		infinity_queue_key(INFINITY_KEY_UP);
+		break;
+	case XK_Down:
+		infinity_queue_key(INFINITY_KEY_DOWN);
+		break;
+	case XK_z:
+		infinity_queue_key(INFINITY_KEY_PREV);
+		break;
+	case XK_x:
+		infinity_queue_key(INFINITY_KEY_PLAY);
+		break;
+	case XK_c:
+		infinity_queue_key(INFINITY_KEY_PAUSE);
+		break;
+	case XK_v:
+		infinity_queue_key(INFINITY_KEY_STOP);
+		break;
+	case XK_b:
+		infinity_queue_key(INFINITY_KEY_NEXT);
+		break;
+	case XK_F11:
+		infinity_queue_key(INFINITY_KEY_FULLSCREEN);
+		break;
+	case XK_Escape:
+		infinity_queue_key(INFINITY_KEY_EXIT_FULLSCREEN);
+		break;
+	case XK_F12:
+		infinity_queue_key(INFINITY_KEY_NEXT_PALETTE);
+		break;
+	case XK_space:
+		infinity_queue_key(INFINITY_KEY_NEXT_EFFECT);
+		break;
+	case XK_h:
+		infinity_queue_key(INFINITY_KEY_TOGGLE_HUD);
+		break;
+	case XK_t:
+		infinity_queue_key(INFINITY_KEY_DUMP_TRACE);
+		break;
+	case XK_Return:
+	case XK_KP_Enter:
+		infinity_queue_key(INFINITY_KEY_TOGGLE_INTERACTIVE);
+		break;
+	default:
+		break;
+	}
+}
+
+static void handle_event(XEvent *event)
+{
+	gint32 i;
+
+	if (event->type == shm_completion) {
+		const XShmCompletionEvent *completion = (XShmCompletionEvent *)event;
+
+		g_mutex_lock(&images_lock);
+		for (i = 0; i < NB_IMAGES; i++)
+			if (images[i].shared && images[i].shm.shmseg == completion->shmseg)
+				images[i].busy = FALSE;
+		g_cond_broadcast(&image_completed);
+		g_mutex_unlock(&images_lock);
+		return;
+	}
+	switch (event->type) {
+	case ConfigureNotify:
+		if (event->xconfigure.width != window_width
+		    || event->xconfigure.height != window_height) {
+			window_width = event->xconfigure.width;
+			window_height = event->xconfigure.height;
+			display_notify_resize(window_width, window_height);
+		}
+		break;
+	case MapNotify:
+		display_notify_visibility(TRUE);
+		break;
+	case UnmapNotify:
+		display_notify_visibility(FALSE);
+		break;
+	case ClientMessage:
+		if ((Atom)event->xclient.data.l[0] == wm_delete_window)
+			display_notify_close();
+		break;
+	case KeyPress:
+		handle_key(&event->xkey);
+		break;
+	default:
+		break;
+	}
+}
+
+static gpointer event_loop(gpointer data)
+{
+	struct pollfd fds[2];
+	XEvent event;
+
+	(void)data;
+	fds[0].fd = ConnectionNumber(x_display);
+	fds[0].events = POLLIN;
+	fds[1].fd = wake_pipe[0];
+	fds[1].events = POLLIN;
+	for (;;) {
+		while (XPending(x_display)) {
+			XNextEvent(x_display, &event);
+			handle_event(&event);
+		}
+		/*
+		 * The timeout catches events that other threads read into
+		 * the queue meanwhile, which poll() cannot see.
+		 */
+		if (poll(fds, 2, 10) < 0 && errno != EINTR)
+			break;
+		if (fds[1].revents != 0)
+			break;
+	}
+	return NULL;
+}
+
+gboolean ui_init(gint32 width, gint32 height)
+{
+	XSetWindowAttributes attributes;
+	gint screen;
+
+	if (x_display != NULL)
+		return TRUE;
+	XInitThreads();
+	x_display = XOpenDisplay(NULL);
+	if (x_display == NULL) {
+		g_message("Infinity: cannot open X display");
+		return FALSE;
+	}
+	screen = DefaultScreen(x_display);
+	visual = DefaultVisual(x_display, screen);
+	depth = DefaultDepth(x_display, screen);
+	if (!find_native_format()) {
+		g_message("Infinity: unsupported X visual (depth %d)", depth);
+		XCloseDisplay(x_display);
+		x_display = NULL;
+		return FALSE;
+	}
+	have_shm = XShmQueryExtension(x_display);
+	shm_completion = XShmGetEventBase(x_display) + ShmCompletion;
+
+	attributes.background_pixel = BlackPixel(x_display, screen);
+	attributes.event_mask = KeyPressMask | StructureNotifyMask;
+	window = XCreateWindow(x_display, RootWindow(x_display, screen), 0, 0, width, height, 0,
+			       depth, InputOutput, visual, CWBackPixel | CWEventMask, &attributes);
+	XStoreName(x_display, window, "Infinity");
+	wm_delete_window = XInternAtom(x_display, "WM_DELETE_WINDOW", False);
+	net_wm_state = XInternAtom(x_display, "_NET_WM_STATE", False);
+	net_wm_state_fullscreen = XInternAtom(x_display, "_NET_WM_STATE_FULLSCREEN", False);
+	XSetWMProtocols(x_display, window, &wm_delete_window, 1);
+	gc = XCreateGC(x_display, window, 0, NULL);
+	window_width = width;
+	window_height = height;
+	XMapWindow(x_display, window);
+	XFlush(x_display);
+
+	if (pipe(wake_pipe) < 0) {
+		g_message("Infinity: %s", g_strerror(errno));
+		ui_quit();
+		return FALSE;
+	}
+	event_thread = g_thread_new("infinity_x11", event_loop, NULL);
+	return TRUE;
+}
+
+void ui_quit(void)
+{
+	gint32 i;
+
+	if (x_display == NULL)
+		return;
+	if (event_thread != NULL) {
+		if (write(wake_pipe[1], "q", 1) != 1)
+			g_warning("Infinity: cannot stop the X event thread");
+		g_thread_join(event_thread);
+		event_thread = NULL;
+	}
+	if (wake_pipe[0] >= 0) {
+		close(wake_pipe[0]);
+		close(wake_pipe[1]);
+		wake_pipe[0] = wake_pipe[1] = -1;
+	}
+	for (i = 0; i < NB_IMAGES; i++)
+		image_destroy(&images[i]);
+	image_width = image_height = 0;
+	XFreeGC(x_display, gc);
+	XDestroyWindow(x_display, window);
+	XCloseDisplay(x_display);
+	x_display = NULL;
+}
+
+gpointer ui_acquire_frame(gint32 width, gint32 height, infinity_format_t *format,
+			  gint32 *stride)
+{
+	image_t *image;
+	gint32 i;
+
+	if (x_display == NULL)
+		return NULL;
+
+	g_mutex_lock(&images_lock);
+	if (width != image_width || height != image_height) {
+		for (i = 0; i < NB_IMAGES; i++) {
+			wait_completion(&images[i]);
+			image_destroy(&images[i]);
+		}
+		image_width = image_height = 0;
+		for (i = 0; i < NB_IMAGES; i++) {
+			if (!image_create(&images[i], width, height)) {
+				g_mutex_unlock(&images_lock);
+				return NULL;
+			}
+		}
+		image_width = width;
+		image_height = height;
+	}
+	image = &images[current];
+	wait_completion(image);
+	g_mutex_unlock(&images_lock);
+
+	*format = native_format;
+	*stride = image->ximage->bytes_per_line;
+	return image->ximage->data;
+}
+
+void ui_present_acquired(void)
+{
+	image_t *image = &images[current];
+
+	if (image->ximage == NULL)
+		return;
+	if (image->shared) {
+		g_mutex_lock(&images_lock);
+		image->busy = TRUE;
+		g_mutex_unlock(&images_lock);
+		XShmPutImage(x_display, window, gc, image->ximage, 0, 0, 0, 0,
+			     image_width, image_height, True);
+	} else {
+		XPutImage(x_display, window, gc, image->ximage, 0, 0, 0, 0,
+			  image_width, image_height);
+	}
+	XFlush(x_display);
+	current = (current + 1) % NB_IMAGES;
+}
+
+/*
+ * Frames not rendered in place, with the HUD over them.
+ */
+void ui_present(const guint16 *pixels, gint32 width, gint32 height)
+{
+	infinity_format_t format;
+	gint32 stride, i, j;
+	guint8 *dest;
+
+	dest = ui_acquire_frame(width, height, &format, &stride);
+	if (dest == NULL)
+		return;
+	for (i = 0; i < height; i++, dest += stride) {
+		const guint16 *src = pixels + (gsize)i * width;
+		guint32 *pdest = (guint32 *)dest;
+
+		if (format == INFINITY_FORMAT_RGB565) {
+			memcpy(dest, src, width * sizeof(guint16));
+			continue;
+		}
+		for (j = 0; j < width; j++) {
+			const guint32 c = src[j];
+			const guint32 r = ((c >> 8) & 0xF8) | (c >> 13);
+			const guint32 g = ((c >> 3) & 0xFC) | ((c >> 9) & 0x3);
+			const guint32 b = ((c << 3) & 0xF8) | ((c >> 2) & 0x7);
+
+			pdest[j] = format == INFINITY_FORMAT_XRGB32
+				   ? 0xFF000000u | (r << 16) | (g << 8) | b
+				   : 0xFF000000u | (b << 16) | (g << 8) | r;
+		}
+	}
+	ui_present_acquired();
+}
+
+void ui_resize(gint32 width, gint32 height)
+{
+	if (x_display == NULL)
+		return;
+	XResizeWindow(x_display, window, width, height);
+	XFlush(x_display);
+}
+
+void ui_toggle_fullscreen(void)
+{
+	if (x_display == NULL)
+		return;
+	fullscreen = !fullscreen;
+	send_wm_state(fullscreen ? 1 : 0); /* _NET_WM_STATE_ADD or _REMOVE */
+}
+
+void ui_exit_fullscreen_if_needed(void)
+{
+	if (x_display == NULL || !fullscreen)
+		return;
+	fullscreen = FALSE;
+	send_wm_state(0);
+}
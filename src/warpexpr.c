@@ -0,0 +1,644 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "warpexpr.h"
+
+/*
+ * Registers 0 to INPUTS - 1 hold the inputs, the others the constants,
+ * the names and the intermediate values, each written by one instruction
+ * at most. Intermediate values free their register once they are read.
+ */
+#define INPUTS		8
+#define MAX_REGISTERS	64
+#define MAX_CODE	1024 /* instructions */
+#define MAX_DEPTH	64 /* of nested subexpressions */
+#define MAX_NAME	32
+
+enum { IN_X, IN_Y, IN_R, IN_THETA, IN_WIDTH, IN_HEIGHT, IN_P1, IN_P2 };
+
+static const gchar *const input_names[INPUTS] = {
+	"x", "y", "r", "theta", "width", "height", "p1", "p2"
+};
+
+/* The unary ones first */
+enum {
+	OP_NEG, OP_SIN, OP_COS, OP_TAN, OP_ASIN, OP_ACOS, OP_ATAN, OP_SQRT, OP_ABS, OP_EXP,
+	OP_LOG, OP_FLOOR,
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW, OP_ATAN2, OP_MIN, OP_MAX
+};
+#define IS_BINARY(op)	((op) >= OP_ADD)
+
+static const struct {
+	const gchar *	name;
+	guint8		op;
+} functions[] = {
+	{ "sin", OP_SIN }, { "cos", OP_COS }, { "tan", OP_TAN }, { "asin", OP_ASIN },
+	{ "acos", OP_ACOS }, { "atan", OP_ATAN }, { "sqrt", OP_SQRT }, { "abs", OP_ABS },
+	{ "exp", OP_EXP }, { "log", OP_LOG }, { "floor", OP_FLOOR }, { "pow", OP_POW },
+	{ "atan2", OP_ATAN2 }, { "min", OP_MIN }, { "max", OP_MAX },
+};
+
+typedef struct {
+	guint8	op;
+	guint8	dest;
+	guint8	a;
+	guint8	b; /* of binary operations */
+} instruction_t;
+
+struct _warpexpr {
+	instruction_t *	code;
+	guint		length;
+	guint		registers; /* used by code */
+	guint64		constant_mask; /* registers holding constants */
+	gfloat		constants[MAX_REGISTERS];
+	guint32		inputs; /* bit mask of those read */
+	guint8		out_x, out_y;
+};
+
+typedef gfloat lanes_t[WARPEXPR_LANES];
+
+/*
+ * Runs ins on every lane: the loops have a constant count and no branch,
+ * the arithmetic ones are vectorized.
+ */
+static void execute(const instruction_t *ins, lanes_t *regs)
+{
+	gfloat *d = regs[ins->dest];
+	const gfloat *a = regs[ins->a], *b = regs[ins->b];
+	gint i;
+
+#define LANES(value) for (i = 0; i < WARPEXPR_LANES; i++) d[i] = (value); break
+	switch (ins->op) {
+	case OP_NEG: LANES(-a[i]);
+	case OP_SIN: LANES(sinf(a[i]));
+	case OP_COS: LANES(cosf(a[i]));
+	case OP_TAN: LANES(tanf(a[i]));
+	case OP_ASIN: LANES(asinf(a[i]));
+	case OP_ACOS: LANES(acosf(a[i]));
+	case OP_ATAN: LANES(atanf(a[i]));
+	case OP_SQRT: LANES(sqrtf(a[i]));
+	case OP_ABS: LANES(fabsf(a[i]));
+	case OP_EXP: LANES(expf(a[i]));
+	case OP_LOG: LANES(logf(a[i]));
+	case OP_FLOOR: LANES(floorf(a[i]));
+	case OP_ADD: LANES(a[i] + b[i]);
+	case OP_SUB: LANES(a[i] - b[i]);
+	case OP_MUL: LANES(a[i] * b[i]);
+	case OP_DIV: LANES(a[i] / b[i]);
+	case OP_POW: LANES(powf(a[i], b[i]));
+	case OP_ATAN2: LANES(atan2f(a[i], b[i]));
+	case OP_MIN: LANES(a[i] < b[i] ? a[i] : b[i]);
+	case OP_MAX: LANES(a[i] > b[i] ? a[i] : b[i]);
+	default:
+		break;
+	}
+#undef LANES
+}
+
+/* A value while compiling: in a register, or a constant not in one yet */
+typedef struct {
+	gint32	reg; /* -1 for a constant */
+	gfloat	value;
+} operand_t;
+
+typedef struct {
+	const gchar *	p;
+	gint		line;
+	gint		parens; /* open, within which lines go on */
+	gint		depth;
+	gchar *		error; /* the first one */
+	GArray *	code;
+	guint64		busy; /* registers */
+	guint64		temporary; /* registers of intermediate values */
+	guint64		constant_mask;
+	guint64		written; /* by an instruction, so not for constants */
+	gfloat		constants[MAX_REGISTERS];
+	GHashTable *	names; /* name -> operand_t */
+	guint32		inputs;
+	operand_t	out[2];
+	gboolean	assigned[2];
+} compiler_t;
+
+static void fail(compiler_t *c, const gchar *format, ...) G_GNUC_PRINTF(2, 3);
+
+static void fail(compiler_t *c, const gchar *format, ...)
+{
+	gchar *message;
+	va_list args;
+
+	if (c->error != NULL)
+		return;
+	va_start(args, format);
+	message = g_strdup_vprintf(format, args);
+	va_end(args);
+	c->error = g_strdup_printf("line %d: %s", c->line, message);
+	g_free(message);
+}
+
+static operand_t constant(gfloat value)
+{
+	operand_t o = { -1, value };
+
+	return o;
+}
+
+/* A free register, not one of those of excluded */
+static gint32 new_register(compiler_t *c, guint64 excluded)
+{
+	gint32 r;
+
+	for (r = INPUTS; r < MAX_REGISTERS; r++)
+		if (!((c->busy | excluded) & G_GUINT64_CONSTANT(1) << r)) {
+			c->busy |= G_GUINT64_CONSTANT(1) << r;
+			return r;
+		}
+	fail(c, "too many values at once, at most %d", MAX_REGISTERS - INPUTS);
+	return INPUTS;
+}
+
+/* The register of o, one holding its value if it is a constant */
+static gint32 in_register(compiler_t *c, operand_t o)
+{
+	gint32 r;
+
+	if (o.reg >= 0)
+		return o.reg;
+	for (r = INPUTS; r < MAX_REGISTERS; r++)
+		if ((c->constant_mask & G_GUINT64_CONSTANT(1) << r) &&
+		    memcmp(&c->constants[r], &o.value, sizeof(gfloat)) == 0)
+			return r;
+	/* Loaded once before the first block, so never written after */
+	r = new_register(c, c->written);
+	c->constant_mask |= G_GUINT64_CONSTANT(1) << r;
+	c->constants[r] = o.value;
+	return r;
+}
+
+static void consume(compiler_t *c, operand_t o)
+{
+	const guint64 bit = o.reg >= 0 ? G_GUINT64_CONSTANT(1) << o.reg : 0;
+
+	if (c->temporary & bit) {
+		c->temporary &= ~bit;
+		c->busy &= ~bit;
+	}
+}
+
+/* Keeps o past its first read */
+static void keep(compiler_t *c, operand_t o)
+{
+	if (o.reg >= 0)
+		c->temporary &= ~(G_GUINT64_CONSTANT(1) << o.reg);
+}
+
+/*
+ * op on a and b, folded into a constant when they are, with the same
+ * code as when it runs.
+ */
+static operand_t emit(compiler_t *c, guint8 op, operand_t a, operand_t b)
+{
+	instruction_t ins = { op, 0, 0, 1 };
+	operand_t result;
+
+	if (c->error != NULL)
+		return constant(0.0f);
+	if (a.reg < 0 && (b.reg < 0 || !IS_BINARY(op))) {
+		lanes_t regs[3];
+
+		memset(regs, 0, sizeof(regs));
+		regs[0][0] = a.value;
+		regs[1][0] = b.value;
+		ins.dest = 2;
+		execute(&ins, regs);
+		return constant(regs[2][0]);
+	}
+	ins.a = in_register(c, a);
+	ins.b = IS_BINARY(op) ? in_register(c, b) : ins.a;
+	consume(c, a);
+	if (IS_BINARY(op))
+		consume(c, b);
+	result.reg = ins.dest = new_register(c, 0);
+	result.value = 0.0f;
+	c->written |= G_GUINT64_CONSTANT(1) << result.reg;
+	c->temporary |= G_GUINT64_CONSTANT(1) << result.reg;
+	if (c->code->len >= MAX_CODE)
+		fail(c, "too long, at most %d operations", MAX_CODE);
+	g_array_append_val(c->code, ins);
+	return result;
+}
+
+/* The next character past blanks and comments */
+static gchar peek(compiler_t *c)
+{
+	for (;;) {
+		const gchar ch = *c->p;
+
+		if (ch == ' ' || ch == '\t' || ch == '\r') {
+			c->p++;
+		} else if (ch == '#') {
+			while (*c->p != '\0' && *c->p != '\n')
+				c->p++;
+		} else if (ch == '\n' && c->parens > 0) {
+			c->line++;
+			c->p++;
+		} else {
+			return ch;
+		}
+	}
+}
+
+static gboolean accept(compiler_t *c, gchar ch)
+{
+	if (peek(c) != ch)
+		return FALSE;
+	c->p++;
+	return TRUE;
+}
+
+static void expect(compiler_t *c, gchar ch)
+{
+	const gchar found = peek(c);
+
+	if (found == ch)
+		c->p++;
+	else if (found == '\0' || found == '\n')
+		fail(c, "'%c' expected at the end of the line", ch);
+	else
+		fail(c, "'%c' expected, found '%c'", ch, found);
+}
+
+static gboolean is_name_start(gchar ch)
+{
+	return g_ascii_isalpha(ch) || ch == '_';
+}
+
+/* Reads a name into name, of MAX_NAME bytes */
+static void read_name(compiler_t *c, gchar *name)
+{
+	const gchar *start = c->p;
+	gint n = 0;
+
+	while (g_ascii_isalnum(*c->p) || *c->p == '_') {
+		if (n < MAX_NAME - 1)
+			name[n++] = *c->p;
+		c->p++;
+	}
+	name[n] = '\0';
+	if (c->p - start > MAX_NAME - 1)
+		fail(c, "name '%s...' too long", name);
+}
+
+static operand_t expression(compiler_t *c);
+static operand_t unary(compiler_t *c);
+
+/* Enters a subexpression, unless that nests them past MAX_DEPTH */
+static gboolean enter(compiler_t *c)
+{
+	if (++c->depth > MAX_DEPTH) {
+		fail(c, "nested too deeply, at most %d levels", MAX_DEPTH);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static operand_t call(compiler_t *c, const gchar *name)
+{
+	operand_t args[2];
+	gint n = 0;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(functions); i++)
+		if (strcmp(functions[i].name, name) == 0)
+			break;
+	if (i == G_N_ELEMENTS(functions)) {
+		fail(c, "unknown function '%s'", name);
+		return constant(0.0f);
+	}
+	c->parens++;
+	c->p++;
+	do {
+		operand_t arg = expression(c);
+
+		if (n < 2)
+			args[n] = arg;
+		n++;
+	} while (c->error == NULL && accept(c, ','));
+	expect(c, ')');
+	c->parens--;
+	if (n != (IS_BINARY(functions[i].op) ? 2 : 1)) {
+		fail(c, "%s() takes %d arguments, not %d", name,
+		     IS_BINARY(functions[i].op) ? 2 : 1, n);
+		return constant(0.0f);
+	}
+	return emit(c, functions[i].op, args[0], n == 2 ? args[1] : args[0]);
+}
+
+static operand_t primary(compiler_t *c)
+{
+	const gchar ch = peek(c);
+	gchar name[MAX_NAME];
+	operand_t *named;
+	gint i;
+
+	if (g_ascii_isdigit(ch) || ch == '.') {
+		gchar *end;
+		const gdouble value = g_ascii_strtod(c->p, &end);
+
+		if (end == c->p || !isfinite((gfloat)value)) {
+			fail(c, "bad number");
+			return constant(0.0f);
+		}
+		c->p = end;
+		return constant((gfloat)value);
+	}
+	if (ch == '(') {
+		operand_t o;
+
+		c->p++;
+		c->parens++;
+		o = expression(c);
+		expect(c, ')');
+		c->parens--;
+		return o;
+	}
+	if (!is_name_start(ch)) {
+		if (ch == '\0' || ch == '\n' || ch == ';')
+			fail(c, "value expected at the end of the line");
+		else
+			fail(c, "unexpected '%c'", ch);
+		return constant(0.0f);
+	}
+	read_name(c, name);
+	if (*c->p == '\'') {
+		fail(c, "%s' is only assigned", name);
+		return constant(0.0f);
+	}
+	if (peek(c) == '(')
+		return call(c, name);
+	for (i = 0; i < INPUTS; i++)
+		if (strcmp(input_names[i], name) == 0) {
+			operand_t o = { i, 0.0f };
+
+			c->inputs |= 1u << i;
+			return o;
+		}
+	if (strcmp(name, "pi") == 0)
+		return constant((gfloat)G_PI);
+	named = g_hash_table_lookup(c->names, name);
+	if (named == NULL) {
+		fail(c, "unknown name '%s'", name);
+		return constant(0.0f);
+	}
+	return *named;
+}
+
+/* primary [ '^' unary ], right associative */
+static operand_t power(compiler_t *c)
+{
+	operand_t o = primary(c);
+
+	if (c->error == NULL && accept(c, '^')) {
+		if (!enter(c))
+			return constant(0.0f);
+		o = emit(c, OP_POW, o, unary(c));
+		c->depth--;
+	}
+	return o;
+}
+
+static operand_t unary(compiler_t *c)
+{
+	operand_t o;
+
+	if (accept(c, '-')) {
+		if (!enter(c))
+			return constant(0.0f);
+		o = emit(c, OP_NEG, unary(c), constant(0.0f));
+		c->depth--;
+		return o;
+	}
+	accept(c, '+');
+	return power(c);
+}
+
+static operand_t term(compiler_t *c)
+{
+	operand_t o = unary(c);
+
+	while (c->error == NULL) {
+		if (accept(c, '*'))
+			o = emit(c, OP_MUL, o, unary(c));
+		else if (accept(c, '/'))
+			o = emit(c, OP_DIV, o, unary(c));
+		else
+			break;
+	}
+	return o;
+}
+
+static operand_t expression(compiler_t *c)
+{
+	operand_t o;
+
+	if (!enter(c))
+		return constant(0.0f);
+	o = term(c);
+	while (c->error == NULL) {
+		if (accept(c, '+'))
+			o = emit(c, OP_ADD, o, term(c));
+		else if (accept(c, '-'))
+			o = emit(c, OP_SUB, o, term(c));
+		else
+			break;
+	}
+	c->depth--;
+	return o;
+}
+
+/* name = expression, or x' or y' = expression */
+static void assignment(compiler_t *c)
+{
+	gchar name[MAX_NAME];
+	gint output = -1;
+	operand_t o;
+	gint i;
+
+	if (!is_name_start(peek(c))) {
+		fail(c, "assignment expected");
+		return;
+	}
+	read_name(c, name);
+	if (*c->p == '\'') {
+		c->p++;
+		if (strcmp(name, "x") != 0 && strcmp(name, "y") != 0) {
+			fail(c, "only x' and y' are assigned");
+			return;
+		}
+		output = name[0] - 'x';
+	}
+	for (i = 0; i < INPUTS && output < 0; i++)
+		if (strcmp(input_names[i], name) == 0) {
+			fail(c, "'%s' is an input, it cannot be assigned", name);
+			return;
+		}
+	if (output < 0 && strcmp(name, "pi") == 0) {
+		fail(c, "'pi' cannot be assigned");
+		return;
+	}
+	if (output >= 0 ? c->assigned[output] : g_hash_table_lookup(c->names, name) != NULL) {
+		fail(c, "%s%s is assigned twice", name, output >= 0 ? "'" : "");
+		return;
+	}
+	expect(c, '=');
+	if (c->error != NULL)
+		return;
+	o = expression(c);
+	if (c->error != NULL)
+		return;
+	keep(c, o);
+	if (output >= 0) {
+		c->out[output] = o;
+		c->assigned[output] = TRUE;
+	} else {
+		operand_t *named = g_new(operand_t, 1);
+
+		*named = o;
+		g_hash_table_insert(c->names, g_strdup(name), named);
+	}
+}
+
+static void program(compiler_t *c)
+{
+	gint i;
+
+	while (c->error == NULL) {
+		const gchar ch = peek(c);
+
+		if (ch == '\0')
+			break;
+		if (ch == '\n') {
+			c->line++;
+			c->p++;
+			continue;
+		}
+		if (ch == ';') {
+			c->p++;
+			continue;
+		}
+		assignment(c);
+		if (c->error == NULL && peek(c) != '\0' && peek(c) != '\n' && peek(c) != ';')
+			fail(c, "end of the assignment expected, found '%c'", peek(c));
+	}
+	for (i = 0; i < 2 && c->error == NULL; i++)
+		if (!c->assigned[i])
+			fail(c, "%c' is not assigned", 'x' + i);
+}
+
+warpexpr_t *warpexpr_compile(const gchar *source, gchar **error)
+{
+	compiler_t c = { 0 };
+	warpexpr_t *expr = NULL;
+	gint32 out_x, out_y;
+
+	g_return_val_if_fail(source != NULL && error != NULL, NULL);
+
+	*error = NULL;
+	if (strlen(source) > WARPEXPR_MAX_SOURCE) {
+		*error = g_strdup_printf("longer than %d bytes", WARPEXPR_MAX_SOURCE);
+		return NULL;
+	}
+	c.p = source;
+	c.line = 1;
+	c.code = g_array_new(FALSE, FALSE, sizeof(instruction_t));
+	c.names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	program(&c);
+	if (c.error == NULL) {
+		out_x = in_register(&c, c.out[0]);
+		out_y = in_register(&c, c.out[1]);
+	}
+	if (c.error == NULL) {
+		expr = g_new0(warpexpr_t, 1);
+		expr->length = c.code->len;
+		expr->code = (instruction_t *)g_array_free(c.code, FALSE);
+		expr->registers = MAX_REGISTERS;
+		while (expr->registers > INPUTS &&
+		       !(c.busy & G_GUINT64_CONSTANT(1) << (expr->registers - 1)))
+			expr->registers--;
+		expr->constant_mask = c.constant_mask;
+		memcpy(expr->constants, c.constants, sizeof(c.constants));
+		expr->inputs = c.inputs;
+		expr->out_x = (guint8)out_x;
+		expr->out_y = (guint8)out_y;
+	} else {
+		g_array_free(c.code, TRUE);
+		*error = c.error;
+	}
+	g_hash_table_destroy(c.names);
+	return expr;
+}
+
+void warpexpr_destroy(warpexpr_t *expr)
+{
+	g_return_if_fail(expr != NULL);
+
+	g_free(expr->code);
+	g_free(expr);
+}
+
+guint32 warpexpr_params(const warpexpr_t *expr)
+{
+	return (expr->inputs >> IN_P1 & 1) | (expr->inputs >> IN_P2 & 1) << 1;
+}
+
+void warpexpr_eval(const warpexpr_t *expr, const gfloat *ax, const gfloat *ay, gint32 n,
+		   gint32 width, gint32 height, gint32 p1, gint32 p2, gfloat *bx, gfloat *by)
+{
+	lanes_t regs[MAX_REGISTERS];
+	const gfloat uniforms[INPUTS] = { 0, 0, 0, 0, width, height, p1, p2 };
+	gint32 start, count, i;
+	guint r;
+
+	/* The registers no instruction writes */
+	for (r = IN_WIDTH; r < expr->registers; r++) {
+		const gfloat value = r < INPUTS ? uniforms[r] : expr->constants[r];
+
+		if (r < INPUTS || (expr->constant_mask & G_GUINT64_CONSTANT(1) << r))
+			for (i = 0; i < WARPEXPR_LANES; i++)
+				regs[r][i] = value;
+	}
+	for (start = 0; start < n; start += WARPEXPR_LANES) {
+		count = MIN(WARPEXPR_LANES, n - start);
+		memcpy(regs[IN_X], ax + start, count * sizeof(gfloat));
+		memcpy(regs[IN_Y], ay + start, count * sizeof(gfloat));
+		for (i = count; i < WARPEXPR_LANES; i++)
+			regs[IN_X][i] = regs[IN_Y][i] = 0.0f;
+		if (expr->inputs & 1u << IN_R)
+			for (i = 0; i < WARPEXPR_LANES; i++)
+				regs[IN_R][i] = sqrtf(regs[IN_X][i] * regs[IN_X][i] +
+						      regs[IN_Y][i] * regs[IN_Y][i]);
+		if (expr->inputs & 1u << IN_THETA)
+			for (i = 0; i < WARPEXPR_LANES; i++)
+				regs[IN_THETA][i] = atan2f(regs[IN_Y][i], regs[IN_X][i]);
+		for (r = 0; r < expr->length; r++)
+			execute(&expr->code[r], regs);
+		memcpy(bx + start, regs[expr->out_x], count * sizeof(gfloat));
+		memcpy(by + start, regs[expr->out_y], count * sizeof(gfloat));
+	}
+}
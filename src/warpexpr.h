@@ -0,0 +1,71 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __INFINITY_WARPEXPR__
+#define __INFINITY_WARPEXPR__
+
+#include <glib.h>
+
+/*
+ * Effects written as expressions: each point (x, y) of the surface,
+ * relative to its center, is drawn from the point (x', y') they give.
+ * The source is made of assignments, one per line or separated by ';',
+ * with comments from '#' to the end of the line:
+ *
+ *   # a slow spiral
+ *   a = 0.01 * (p1 - 2) + 0.002
+ *   f = 1 - (r - height / 4) / (2000 + 500 * p2)
+ *   x' = (cos(a) * x - sin(a) * y) * f
+ *   y' = (sin(a) * x + cos(a) * y) * f
+ *
+ * They read x, y, r and theta, the polar coordinates of the point,
+ * width, height, the rotation p1 and the speed p2, from 0 to 4, pi and
+ * the names assigned before. Operators are + - * / and ^, the power;
+ * functions are sin, cos, tan, asin, acos, atan, atan2, sqrt, abs, exp,
+ * log, floor, pow, min and max. x' and y' are assigned once, and so is
+ * every other name.
+ *
+ * They are compiled into instructions on registers of WARPEXPR_LANES
+ * floats, run a block of points at a time: the loop of each instruction
+ * is over the lanes of its registers, which the compiler vectorizes.
+ */
+
+#define WARPEXPR_LANES		64
+#define WARPEXPR_MAX_SOURCE	65536 /* bytes */
+
+typedef struct _warpexpr warpexpr_t;
+
+/*
+ * Compiles source, NULL if it is not a valid effect, then setting error
+ * to a message saying why and where, to be freed with g_free().
+ */
+warpexpr_t *warpexpr_compile(const gchar *source, gchar **error);
+void warpexpr_destroy(warpexpr_t *expr);
+
+/*
+ * The parameters it reads, as compute_warp_params() has them: 1 for p1,
+ * 2 for p2.
+ */
+guint32 warpexpr_params(const warpexpr_t *expr);
+
+/*
+ * Sets (bx[i], by[i]) to (x', y') for the n points (ax[i], ay[i]). They
+ * are not finite where an expression is not defined, as log(-1).
+ * Can be called from any thread.
+ */
+void warpexpr_eval(const warpexpr_t *expr, const gfloat *ax, const gfloat *ay, gint32 n,
+		   gint32 width, gint32 height, gint32 p1, gint32 p2, gfloat *bx, gfloat *by);
+
+#endif /* __INFINITY_WARPEXPR__ */
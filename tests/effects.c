@@ -0,0 +1,189 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "config.h"
+#include "effects.h"
+
+/*
+ * Preset store test.
+ *
+ * Merges a system file, a personal file in the format of earlier
+ * versions and a truncated one of records without the rotation and
+ * speed, with duplicates across them, then checks the merged effects,
+ * the index and that saved effects are read back.
+ */
+
+static t_effect presets[] = {
+	{ 0, 100, 255, 59, 14, 255, 4, 82, 0, 4 },
+	{ 1, 200, 0, 51, 9, 255, 3, 61, 2, 2 },
+	{ 7, 300, 255, 82, 41, 0, 2, 397, 3, 1 },
+	{ 7, 400, 0, 75, 4, 0, 2, 113, 2, 2 },
+	{ 3, 500, 255, 59, 4, 255, 1, 98, 2, 2 },
+	{ 7, 600, 0, 51, 36, 255, 0, 0, 1, 1 },
+};
+
+static gint status = 0;
+
+static void notify_critical_error(const gchar *message)
+{
+	g_printerr("effects: %s\n", message);
+}
+
+static Player player = {
+	.notify_critical_error = notify_critical_error,
+};
+
+/* Of the first n fields of effect */
+static void put_record(GString *out, const t_effect *effect, gint32 n)
+{
+	const gint32 *fields = (const gint32 *)effect;
+	guint32 value;
+	gint32 i;
+
+	for (i = 0; i < n; i++) {
+		value = GUINT32_TO_LE((guint32)fields[i]);
+		g_string_append_len(out, (const gchar *)&value, 4);
+	}
+}
+
+static void put_header(GString *out, guint32 record_bytes)
+{
+	const guint32 words[3] = { GUINT32_TO_LE(1), GUINT32_TO_LE(record_bytes), 0 };
+
+	g_string_append_len(out, "IFST", 4);
+	g_string_append_len(out, (const gchar *)words, sizeof(words));
+}
+
+static void write_file(const gchar *name, GString *contents)
+{
+	gchar *dir = g_path_get_dirname(name);
+
+	g_mkdir_with_parents(dir, 0700);
+	if (!g_file_set_contents(name, contents->str, contents->len, NULL)) {
+		g_printerr("effects: cannot write %s\n", name);
+		status = 1;
+	}
+	g_string_truncate(contents, 0);
+	g_free(dir);
+}
+
+static void expect(gboolean ok, const gchar *what)
+{
+	if (!ok) {
+		g_printerr("effects: %s\n", what);
+		status = 1;
+	}
+}
+
+static gboolean same(const t_effect *a, const t_effect *b)
+{
+	return memcmp(a, b, sizeof(t_effect)) == 0;
+}
+
+int main(void)
+{
+	gchar *root = g_dir_make_tmp("infinity-effects-XXXXXX", NULL);
+	gchar *system = g_build_filename(root, "system_states", NULL);
+	gchar *config = g_build_filename(root, ".config", NULL);
+	gchar *personal = g_build_filename(config, "infinity-plugin", "infinite_states", NULL);
+	gchar *legacy = g_build_filename(root, "infinite_states", NULL);
+	GString *contents = g_string_new(NULL);
+	gchar *saved = NULL;
+	gsize saved_length = 0;
+	GRand *rng;
+	t_effect effect;
+	gint32 i;
+
+	/* Read by effects.c, and cached by GLib, on first use */
+	g_setenv("HOME", root, TRUE);
+	g_setenv("XDG_CONFIG_HOME", config, TRUE);
+	g_setenv("INFINITY_STATES", system, TRUE);
+
+	put_header(contents, 40);
+	put_record(contents, &presets[0], 10);
+	put_record(contents, &presets[1], 10);
+	put_record(contents, &presets[2], 10);
+	write_file(system, contents);
+
+	/* Of the default rotation and speed, same as the one above */
+	put_record(contents, &presets[1], 8);
+	put_record(contents, &presets[3], 8);
+	write_file(personal, contents);
+
+	put_header(contents, 32);
+	put_record(contents, &presets[3], 8);
+	put_record(contents, &presets[4], 8);
+	g_string_append_len(contents, "trunc", 5);
+	write_file(legacy, contents);
+
+	expect(effects_load_effects(&player), "cannot load");
+	expect(effects_count(-1, -1) == 5, "duplicates merged");
+	for (i = 0; i < 5; i++)
+		expect(effects_get(-1, -1, i, &effect) && same(&effect, &presets[i]),
+		       "effects out of order");
+	expect(!effects_get(-1, -1, 5, &effect), "effect past the end");
+
+	expect(effects_count(7, -1) == 2 && effects_count(-1, 2) == 2 &&
+	       effects_count(7, 2) == 2 && effects_count(7, 0) == 0 &&
+	       effects_count(3, 1) == 1, "index by field and spectral mode");
+	expect(effects_get(7, 2, 1, &effect) && same(&effect, &presets[3]), "indexed effect");
+
+	rng = g_rand_new_with_seed(7);
+	for (i = 0; i < 100; i++) {
+		gint32 j;
+		gboolean found = FALSE;
+
+		effects_load_random_effect(&effect, rng);
+		for (j = 0; j < 5; j++)
+			found = found || same(&effect, &presets[j]);
+		expect(found, "random effect not loaded");
+	}
+	g_rand_free(rng);
+
+	/*
+	 * Saved once, read back by the next loads, selectable right away,
+	 * after the records of the personal file without rotation and speed
+	 */
+	effects_append_effect(&presets[5]);
+	effects_append_effect(&presets[5]);
+	effects_append_effect(&presets[0]);
+	expect(effects_count(-1, -1) == 6 && effects_count(7, 0) == 1, "saved effect not added");
+	expect(g_file_get_contents(personal, &saved, &saved_length, NULL) && saved_length == 16 + 3 * 40,
+	       "saved effect not appended once");
+
+	if (status == 0)
+		g_print("ok\n");
+	g_unlink(personal);
+	g_unlink(legacy);
+	g_unlink(system);
+	g_free(saved);
+	saved = g_path_get_dirname(personal);
+	g_rmdir(saved);
+	g_rmdir(config);
+	g_rmdir(root);
+	g_free(saved);
+	g_string_free(contents, TRUE);
+	g_free(personal);
+	g_free(legacy);
+	g_free(config);
+	g_free(system);
+	g_free(root);
+	return status;
+}
@@ -0,0 +1,586 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "compute.h"
+#include "display.h"
+#include "synth.h"
+
+/*
+ * Golden image regression test.
+ *
+ * Renders a fixed sequence of frames for every effect at several
+ * resolutions, from synthetic PCM, and compares a hash of each sequence
+ * with the references. Every bit-exact warp kernel must reproduce them.
+ * Every kernel is also compared pixel by pixel with the reference kernel
+ * on a single warp, within the tolerance it declares, and so are the
+ * fast paths of the effects, which the sequences do not use: all but the
+ * one of effect 6 must match exactly. The grids of sparse fields, which
+ * the sequences do not use either, are compared with dense fields on a
+ * smooth surface, as they move source points by up to
+ * COMPUTE_GRID_TOLERANCE, and so are symmetric fields, on a random one;
+ * both are checked to be made only past the budget. Last, the shared
+ * fields are checked to evict and trim their vectors as their budget
+ * says.
+ *
+ * Usage: golden REFERENCES             check against REFERENCES
+ *        golden --generate REFERENCES  rewrite REFERENCES with the reference kernel
+ *
+ * The hashes depend on the floating point results of the vector field
+ * generation, so they were made on x86-64 with GCC and glibc; other
+ * platforms may need to regenerate them first.
+ */
+
+#define FRAMES 32
+/* Levels on smooth_surface() */
+#define SPARSE_TOLERANCE 2
+
+typedef struct {
+	gint32 width, height;
+} resolution_t;
+
+static const resolution_t resolutions[] = {
+	{ 96, 64 },
+	{ 320, 200 },
+	{ 333, 181 },
+	{ 640, 360 },
+};
+
+static guint64 sequence_hash;
+
+static void notify_critical_error(const gchar *message)
+{
+	g_printerr("golden: %s\n", message);
+}
+
+static Player player = {
+	.notify_critical_error = notify_critical_error,
+};
+
+/* FNV-1a over the little endian bytes of every presented pixel */
+static void hash_frame(const guint16 *pixels, gint32 width, gint32 height)
+{
+	const gsize n = (gsize)width * height;
+	guint64 h = sequence_hash;
+	gsize i;
+
+	for (i = 0; i < n; i++) {
+		h = (h ^ (pixels[i] & 0xFF)) * 0x100000001B3ull;
+		h = (h ^ (pixels[i] >> 8)) * 0x100000001B3ull;
+	}
+	sequence_hash = h;
+}
+
+/*
+ * Exercises every spectral mode and both curves, with a palette fade.
+ */
+static guint64 render_sequence(gint32 kernel, gint32 width, gint32 height, gint32 effect_index)
+{
+	t_effect effect = {
+		.num_effect = effect_index,
+		.x_curve = 0,
+		.curve_color = 200,
+		.curve_amplitude = 150 + 10 * effect_index,
+		.spectral_amplitude = 40 + 5 * effect_index,
+		.spectral_color = 255,
+		.mode_spectre = effect_index % 5,
+		.spectral_shift = 20,
+		.rotation = COMPUTE_DEFAULT_PARAM,
+		.speed = COMPUTE_DEFAULT_PARAM,
+	};
+	const gint32 old_color = effect_index % NB_PALETTES;
+	const gint32 color = (effect_index + 1) % NB_PALETTES;
+	float pcm[2 * SYNTH_FRAMES];
+	guint16 *pixels;
+	display_t *display;
+	synth_t *synth;
+	gint32 frame;
+
+	display = display_new(width, height, 1, &player, TRUE);
+	if (display == NULL)
+		return 0;
+	display_set_kernel(display, kernel);
+	pixels = g_new(guint16, (gsize)width * height);
+	sequence_hash = 0xCBF29CE484222325ull;
+	synth = synth_new(SYNTH_MIX, 1);
+	change_color(display, old_color, color, 0);
+	for (frame = 0; frame < FRAMES; frame++) {
+		synth_render_block(synth, pcm, SYNTH_RATE / 3);
+		display_set_pcm_data(display, pcm, 2);
+		display_blur(display, &effect);
+		display_map_frame(display, pixels, width * sizeof(guint16), INFINITY_FORMAT_RGB565);
+		hash_frame(pixels, width, height);
+		spectral(display, &effect);
+		curve(display, &effect);
+		change_color(display, old_color, color, MIN(frame, 32) * 8);
+	}
+	synth_destroy(synth);
+	display_destroy(display);
+	g_free(pixels);
+	return sequence_hash;
+}
+
+static byte *random_surface(gint32 width, gint32 height)
+{
+	const gsize size = (gsize)(width + 1) * (height + 1);
+	byte *src = g_malloc(size);
+	guint32 x = 2463534242u;
+	gsize i;
+
+	for (i = 0; i < size; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		src[i] = (byte)x;
+	}
+	return src;
+}
+
+/*
+ * Warps the same random surface with kernel, or with the fast path of
+ * the effect when kernel is -1, and with the reference one. Returns the
+ * largest difference between them.
+ */
+static gint32 compare_single_warp(gint32 kernel, gint32 width, gint32 height, gint32 effect_index)
+{
+	const compute_kernel_t *reference = compute_kernel_info(0);
+	const gsize size = (gsize)(width + 1) * (height + 1);
+	vector_field_t *field;
+	byte *src, *expected, *actual;
+	gint32 max_error = 0;
+	gsize i;
+
+	src = random_surface(width, height);
+	expected = g_malloc0(size);
+	actual = g_malloc0(size);
+	field = compute_vector_field_new(width, height);
+	compute_generate_vector_field(field);
+	reference->warp(field->vector[effect_index], src, expected, width, height);
+	if (kernel >= 0) {
+		compute_kernel_info(kernel)->warp(field->vector[effect_index], src, actual, width, height);
+	} else {
+		compute_t *compute = compute_new(width, height);
+
+		compute_warp_fast(compute, effect_index, src, actual);
+		compute_destroy(compute);
+	}
+	for (i = 0; i < (gsize)width * height; i++)
+		max_error = MAX(max_error, ABS((gint32)expected[i] - (gint32)actual[i]));
+	compute_vector_field_destroy(field);
+	g_free(src);
+	g_free(expected);
+	g_free(actual);
+	return max_error;
+}
+
+/* Changes by at most 6 levels per pixel, rows are width pixels apart */
+static byte *smooth_surface(gint32 width, gint32 height)
+{
+	const gsize size = (gsize)(width + 1) * (height + 1);
+	byte *src = g_malloc(size);
+	gsize i;
+
+	for (i = 0; i < size; i++)
+		src[i] = (byte)(128 + 96 * sin(i % width / 16.0) * cos(i / width / 16.0));
+	return src;
+}
+
+/*
+ * Warps src, which it frees, through the effect with p1 and p2 in a
+ * shared field and in a dense one. Returns the largest difference
+ * between them, -1 if the shared field has the vector of a dense field
+ * for the effect.
+ */
+static gint32 compare_shared_warp(gint32 width, gint32 height, gint32 effect_index,
+				  gint32 p1, gint32 p2, byte *src)
+{
+	const gsize size = (gsize)(width + 1) * (height + 1);
+	vector_field_t *shared, *dense;
+	compute_t *compute;
+	byte *expected, *actual;
+	gint32 max_error = -1;
+	gsize i;
+
+	shared = compute_vector_field_get(width, height, p1, p2, 0);
+	compute_vector_field_hold(shared, effect_index);
+	if (shared->grid[effect_index] == NULL && shared->edges[effect_index] == NULL) {
+		compute_vector_field_release(shared, effect_index);
+		compute_vector_field_unref(shared);
+		g_free(src);
+		return -1;
+	}
+	expected = g_malloc0(size);
+	actual = g_malloc0(size);
+	dense = compute_vector_field_new(width, height);
+	dense->p1 = p1;
+	dense->p2 = p2;
+	compute_generate_vector_field(dense);
+	compute = compute_new(width, height);
+	compute_warp_effect(compute, dense, effect_index, src, expected);
+	compute_warp_effect(compute, shared, effect_index, src, actual);
+	for (i = 0; i < (gsize)width * height; i++)
+		max_error = MAX(max_error, ABS((gint32)expected[i] - (gint32)actual[i]));
+	compute_destroy(compute);
+	compute_vector_field_destroy(dense);
+	compute_vector_field_release(shared, effect_index);
+	compute_vector_field_unref(shared);
+	g_free(src);
+	g_free(expected);
+	g_free(actual);
+	return max_error;
+}
+
+/*
+ * Takes interleaved float frames as planar 16 bit samples, clamped.
+ */
+static gint32 check_pcm(void)
+{
+	display_t *display = display_new(96, 64, 1, &player, TRUE);
+	t_effect effect = {
+		.num_effect = 0,
+		.rotation = COMPUTE_DEFAULT_PARAM,
+		.speed = COMPUTE_DEFAULT_PARAM,
+	};
+	float pcm[2 * 512];
+	gint16 frame_pcm[2][512];
+	gint32 failures = 0, i;
+
+	for (i = 0; i < 512; i++) {
+		pcm[2 * i] = (i - 256) / 128.0f;
+		pcm[2 * i + 1] = -0.25f;
+	}
+	display_set_pcm_data(display, pcm, 2);
+	display_blur(display, &effect);
+	spectral(display, &effect);
+	display_get_frame_pcm_data(display, frame_pcm);
+	for (i = 0; i < 512; i++)
+		if (frame_pcm[0][i] != CLAMP(lrintf((i - 256) / 128.0f * 32767.0f), -32768, 32767) ||
+		    frame_pcm[1][i] != -8192) {
+			g_print("FAIL pcm: frame %d is %d %d\n", i, frame_pcm[0][i], frame_pcm[1][i]);
+			failures++;
+			break;
+		}
+	display_destroy(display);
+	return failures;
+}
+
+/*
+ * Makes a dense vector for the zoom within the budget, and a grid past
+ * it, and a mirrored one for the first effect. Leaves a budget of a byte.
+ */
+static gint32 check_pressure(void)
+{
+	vector_field_t *field = compute_vector_field_get(320, 200, COMPUTE_DEFAULT_PARAM,
+							 COMPUTE_DEFAULT_PARAM, 0);
+	gint32 failures = 0;
+
+	compute_vector_field_hold(field, 5);
+	if (field->grid[5] != NULL || field->edges[5] != NULL || field->vector[5] == NULL) {
+		g_print("FAIL pressure: grid or mirror within the budget\n");
+		failures++;
+	}
+	compute_vector_field_release(field, 5);
+	compute_fields_trim();
+	compute_fields_set_budget(1);
+	compute_vector_field_hold(field, 5);
+	/* Mirrored where there is no grid */
+	g_setenv("INFINITY_SPARSE_FIELD", "off", TRUE);
+	compute_vector_field_hold(field, 0);
+	if (field->grid[5] == NULL || field->edges[0] == NULL) {
+		g_print("FAIL pressure: no grid or mirror past the budget\n");
+		failures++;
+	}
+	compute_vector_field_release(field, 0);
+	g_unsetenv("INFINITY_SPARSE_FIELD");
+	compute_vector_field_release(field, 5);
+	compute_vector_field_unref(field);
+	compute_fields_trim();
+	return failures;
+}
+
+/*
+ * Caches a released vector within the budget of one, evicts it for the
+ * next one and trims what is not held.
+ */
+static gint32 check_field_cache(void)
+{
+	vector_field_t *field = compute_vector_field_get(96, 64, COMPUTE_DEFAULT_PARAM,
+							 COMPUTE_DEFAULT_PARAM, 0);
+	gint32 failures = 0;
+	gsize one;
+
+	compute_vector_field_hold(field, 0);
+	one = compute_vector_field_bytes(field);
+	compute_fields_set_budget(one);
+	compute_vector_field_release(field, 0);
+	if (field->vector[0] == NULL) {
+		g_print("FAIL field cache: released vector not cached\n");
+		failures++;
+	}
+	compute_vector_field_hold(field, 1);
+	if (field->vector[0] != NULL || field->vector[1] == NULL) {
+		g_print("FAIL field cache: least recently used vector not evicted\n");
+		failures++;
+	}
+	if (compute_fields_trim() != 0 || field->vector[1] == NULL) {
+		g_print("FAIL field cache: held vector trimmed\n");
+		failures++;
+	}
+	compute_vector_field_release(field, 1);
+	if (compute_fields_trim() != one || compute_fields_bytes() != 0) {
+		g_print("FAIL field cache: released vector not trimmed\n");
+		failures++;
+	}
+	compute_vector_field_unref(field);
+	return failures;
+}
+
+/*
+ * Shares the fields of the same parameters only, mirrors the ones of the
+ * other parameters too, makes the prefetched vectors and drops them with
+ * their field.
+ */
+static gint32 check_params(void)
+{
+	static const gint32 params[][2] = { { 0, 0 }, { 4, 4 }, { 0, 4 }, { 1, 3 } };
+	vector_field_t *field, *other;
+	gint32 failures = 0, e, p1, p2;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(params); i++)
+		for (e = 0; e < NB_FCT; e++) {
+			const gint32 error = compare_shared_warp(96, 64, e, params[i][0], params[i][1],
+								 random_surface(96, 64));
+
+			if (error < 0 || error > COMPUTE_MIRROR_TOLERANCE) {
+				g_print("FAIL parameters %d %d effect %d: differs by %d from dense\n",
+					params[i][0], params[i][1], e, error);
+				failures++;
+			}
+		}
+
+	/* Effect 2 has no rotation, whatever the effect asks for */
+	p1 = 0;
+	p2 = 4;
+	compute_warp_params(2, &p1, &p2);
+	field = compute_vector_field_get(96, 64, p1, p2, 0);
+	other = compute_vector_field_get(96, 64, 0, 4, 0);
+	if (p1 != COMPUTE_DEFAULT_PARAM || p2 != 4 || field == other) {
+		g_print("FAIL parameters: not canonical\n");
+		failures++;
+	}
+	compute_vector_field_unref(other);
+
+	compute_vector_field_prefetch(field, 2);
+	compute_vector_field_hold(field, 2);
+	if (field->vector[2] == NULL) {
+		g_print("FAIL parameters: prefetched vector not made\n");
+		failures++;
+	}
+	compute_vector_field_release(field, 2);
+	compute_vector_field_release(field, 2);
+	compute_vector_field_unref(field);
+
+	/* Unref waits for the prefetch it is making and drops the others */
+	field = compute_vector_field_get(640, 480, 0, 0, 0);
+	for (e = 0; e < NB_FCT; e++)
+		compute_vector_field_prefetch(field, e);
+	compute_vector_field_unref(field);
+	compute_fields_trim();
+	return failures;
+}
+
+static gboolean lookup_reference(const gchar *references, gint32 width, gint32 height,
+				 gint32 effect_index, guint64 *hash)
+{
+	gchar **lines = g_strsplit(references, "\n", -1);
+	gboolean found = FALSE;
+	gint32 i;
+
+	for (i = 0; lines[i] != NULL && !found; i++) {
+		gint32 w, h, e;
+		guint64 value;
+
+		if (lines[i][0] == '#')
+			continue;
+		if (sscanf(lines[i], "%d %d %d %" G_GINT64_MODIFIER "x", &w, &h, &e, &value) == 4
+		    && w == width && h == height && e == effect_index) {
+			*hash = value;
+			found = TRUE;
+		}
+	}
+	g_strfreev(lines);
+	return found;
+}
+
+static int generate(const gchar *path)
+{
+	GString *out = g_string_new("# width height effect hash, see golden.c\n");
+	guint r;
+	gint32 e;
+
+	for (r = 0; r < G_N_ELEMENTS(resolutions); r++)
+		for (e = 0; e < NB_FCT; e++)
+			g_string_append_printf(out, "%d %d %d %016" G_GINT64_MODIFIER "x\n",
+					       resolutions[r].width, resolutions[r].height, e,
+					       render_sequence(0, resolutions[r].width, resolutions[r].height, e));
+	if (!g_file_set_contents(path, out->str, -1, NULL)) {
+		g_printerr("golden: cannot write '%s'\n", path);
+		g_string_free(out, TRUE);
+		return 1;
+	}
+	g_string_free(out, TRUE);
+	return 0;
+}
+
+static int check(const gchar *path)
+{
+	gchar *references;
+	gint32 kernel, e, failures = 0, grids = 0;
+	guint r;
+
+	if (!g_file_get_contents(path, &references, NULL, NULL)) {
+		g_printerr("golden: cannot read '%s'\n", path);
+		return 1;
+	}
+	for (kernel = 0; kernel < compute_kernel_count(); kernel++) {
+		const compute_kernel_t *info = compute_kernel_info(kernel);
+
+		for (r = 0; r < G_N_ELEMENTS(resolutions); r++)
+			for (e = 0; e < NB_FCT; e++) {
+				const gint32 width = resolutions[r].width, height = resolutions[r].height;
+				gint32 error = compare_single_warp(kernel, width, height, e);
+				guint64 expected, actual;
+
+				if (error > info->tolerance) {
+					g_print("FAIL %s %dx%d effect %d: differs by %d from reference\n",
+						info->name, width, height, e, error);
+					failures++;
+					continue;
+				}
+				if (info->tolerance > 0)
+					continue;
+				if (!lookup_reference(references, width, height, e, &expected)) {
+					g_print("FAIL %s %dx%d effect %d: no reference\n", info->name, width, height, e);
+					failures++;
+					continue;
+				}
+				actual = render_sequence(kernel, width, height, e);
+				if (actual != expected) {
+					g_print("FAIL %s %dx%d effect %d: hash %016" G_GINT64_MODIFIER "x, expected %016"
+						G_GINT64_MODIFIER "x\n", info->name, width, height, e, actual, expected);
+					failures++;
+				}
+			}
+		g_print("%s %s\n", failures == 0 ? "ok" : "checked", info->name);
+	}
+
+	for (r = 0; r < G_N_ELEMENTS(resolutions); r++)
+		for (e = 0; e < NB_FCT; e++) {
+			const gint32 width = resolutions[r].width, height = resolutions[r].height;
+			const gint32 tolerance = COMPUTE_EXACT_FAST_WARPS & (1u << e) ? 0 :
+						 COMPUTE_FAST_WARP_TOLERANCE;
+			gint32 error;
+
+			if (!compute_has_fast_warp(e))
+				continue;
+			error = compare_single_warp(-1, width, height, e);
+			if (error > tolerance) {
+				g_print("FAIL fast path %dx%d effect %d: differs by %d from reference\n",
+					width, height, e, error);
+				failures++;
+			}
+		}
+	g_print("%s fast paths\n", failures == 0 ? "ok" : "checked");
+
+	g_setenv("INFINITY_SPARSE_FIELD", "on", TRUE);
+	for (r = 0; r < G_N_ELEMENTS(resolutions); r++)
+		for (e = 0; e < NB_FCT; e++) {
+			const gint32 width = resolutions[r].width, height = resolutions[r].height;
+			const gint32 error = compare_shared_warp(width, height, e,
+								 COMPUTE_DEFAULT_PARAM,
+								 COMPUTE_DEFAULT_PARAM,
+								 smooth_surface(width, height));
+
+			grids += error >= 0;
+			if (error > SPARSE_TOLERANCE) {
+				g_print("FAIL sparse field %dx%d effect %d: differs by %d from dense\n",
+					width, height, e, error);
+				failures++;
+			}
+		}
+	/* The zoom is linear: it always gets one */
+	if (grids == 0) {
+		g_print("FAIL sparse field: no grid\n");
+		failures++;
+	}
+	g_print("%s sparse fields\n", failures == 0 ? "ok" : "checked");
+
+	g_unsetenv("INFINITY_SPARSE_FIELD");
+	g_unsetenv("INFINITY_SYMMETRIC_FIELD");
+	failures += check_pcm();
+	g_print("%s pcm\n", failures == 0 ? "ok" : "checked");
+	failures += check_pressure();
+	g_print("%s pressure\n", failures == 0 ? "ok" : "checked");
+
+	g_setenv("INFINITY_SPARSE_FIELD", "off", TRUE);
+	g_setenv("INFINITY_SYMMETRIC_FIELD", "on", TRUE);
+	for (r = 0; r < G_N_ELEMENTS(resolutions); r++)
+		for (e = 0; e < NB_FCT; e++) {
+			const gint32 width = resolutions[r].width, height = resolutions[r].height;
+			const gint32 error = compare_shared_warp(width, height, e,
+								 COMPUTE_DEFAULT_PARAM,
+								 COMPUTE_DEFAULT_PARAM,
+								 random_surface(width, height));
+
+			if (error < 0 || error > COMPUTE_MIRROR_TOLERANCE) {
+				g_print("FAIL symmetric field %dx%d effect %d: differs by %d from dense\n",
+					width, height, e, error);
+				failures++;
+			}
+		}
+	g_print("%s symmetric fields\n", failures == 0 ? "ok" : "checked");
+
+	g_setenv("INFINITY_SPARSE_FIELD", "off", TRUE);
+	g_setenv("INFINITY_SYMMETRIC_FIELD", "off", TRUE);
+	failures += check_field_cache();
+	g_print("%s field cache\n", failures == 0 ? "ok" : "checked");
+	g_setenv("INFINITY_SYMMETRIC_FIELD", "on", TRUE);
+	failures += check_params();
+	g_print("%s parameters\n", failures == 0 ? "ok" : "checked");
+	g_free(references);
+	return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	/*
+	 * The references are made with the fields of the default
+	 * configuration, dense as there is no pressure on the budget
+	 */
+	g_unsetenv("INFINITY_SPARSE_FIELD");
+	g_unsetenv("INFINITY_SYMMETRIC_FIELD");
+	if (argc == 3 && strcmp(argv[1], "--generate") == 0)
+		return generate(argv[2]);
+	if (argc == 2)
+		return check(argv[1]);
+	g_printerr("usage: golden [--generate] REFERENCES\n");
+	return 2;
+}
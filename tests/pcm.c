@@ -0,0 +1,185 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "config.h"
+#include "infinity.h"
+#include "pcm_source.h"
+#include "replay.h"
+
+/*
+ * PCM input test.
+ *
+ * Reads a 16 bit stereo file as infinity-render and infinity-play do and
+ * renders a frame of it through the calls of each, capturing it, then
+ * checks that the engine drew the frame with the very samples of the
+ * file, one array per channel. Last, hands them over in that layout, as
+ * the GStreamer element does.
+ */
+
+#define FRAMES 512
+
+static gint32 get_width(void) { return 160; }
+static gint32 get_height(void) { return 100; }
+static void set_size(gint32 size) { (void)size; }
+static gint32 get_scale(void) { return 1; }
+static gint32 get_interval(void) { return 100; }
+static gint32 get_max_fps(void) { return 60; }
+
+static InfParameters params = {
+	get_width, set_size, get_height, set_size,
+	get_scale, get_interval, get_interval, get_max_fps
+};
+
+static void notify_critical_error(const gchar *message)
+{
+	g_printerr("pcm: %s\n", message);
+}
+
+static gboolean is_playing(void) { return FALSE; }
+static void disable_plugin(void) { }
+
+static Player player = {
+	.notify_critical_error = notify_critical_error,
+	.disable_plugin = disable_plugin,
+	.is_playing = is_playing,
+};
+
+static gint16 samples[2][FRAMES];
+
+/* Full scale at both ends, a ramp, and the other channel inverted */
+static void write_samples(const gchar *path)
+{
+	guint8 bytes[4 * FRAMES];
+	gint32 i, c;
+
+	for (i = 0; i < FRAMES; i++) {
+		samples[0][i] = i == 0 ? -32768 : i == 1 ? 32767 : (gint16)((i - 256) * 127);
+		samples[1][i] = (gint16)-samples[0][i];
+		for (c = 0; c < 2; c++) {
+			bytes[4 * i + 2 * c] = (guint8)(samples[c][i] & 0xFF);
+			bytes[4 * i + 2 * c + 1] = (guint8)((guint16)samples[c][i] >> 8);
+		}
+	}
+	g_file_set_contents(path, (const gchar *)bytes, sizeof(bytes), NULL);
+}
+
+/*
+ * Compares the samples of the first frame of the capture at path with
+ * the ones written.
+ */
+static gboolean check_capture(const gchar *path, const gchar *what)
+{
+	replay_reader_t *reader = replay_reader_new(path);
+	replay_frame_t *replay_frame = g_new0(replay_frame_t, 1);
+	gboolean ok;
+
+	ok = reader != NULL && replay_reader_next_frame(reader, replay_frame) &&
+	     memcmp(replay_frame->pcm, samples, sizeof(samples)) == 0;
+	if (!ok)
+		g_printerr("pcm: %s not drawn with the samples given\n", what);
+	if (reader != NULL)
+		replay_reader_destroy(reader);
+	g_free(replay_frame);
+	return ok;
+}
+
+/*
+ * Renders a frame of pcm as infinity-play does, headless if it is, or
+ * else handing it over first as the thread reading the input does. With
+ * no pcm, hands the samples over as they are, as infinityvis does.
+ */
+static gboolean check_player(const float *pcm, const gchar *capture, gboolean headless)
+{
+	guint32 *pixels = g_new(guint32, 160 * 100);
+	infinity_t *inf = infinity_new_offline(&params, &player);
+
+	if (inf == NULL) {
+		g_printerr("pcm: cannot make an instance\n");
+		g_free(pixels);
+		return FALSE;
+	}
+	if (pcm == NULL) {
+		infinity_render_raw_pcm(inf, (const gint16 (*)[512])samples);
+		infinity_render_into(inf, NULL, 2, pixels, 160 * 4, INFINITY_FORMAT_XRGB32);
+	} else if (headless) {
+		infinity_render_into(inf, pcm, 2, pixels, 160 * 4, INFINITY_FORMAT_XRGB32);
+	} else {
+		infinity_render_pcm(inf, pcm, 2);
+		infinity_render_into(inf, NULL, 2, pixels, 160 * 4, INFINITY_FORMAT_XRGB32);
+	}
+	infinity_destroy(inf);
+	g_free(pixels);
+	return check_capture(capture, pcm == NULL ? "frame of 16 bit samples" :
+				      headless ? "headless frame" : "frame of the input thread");
+}
+
+int main(void)
+{
+	gchar *root = g_dir_make_tmp("infinity-pcm-XXXXXX", NULL);
+	gchar *input = g_build_filename(root, "input.pcm", NULL);
+	gchar *capture = g_build_filename(root, "run.infc", NULL);
+	float pcm[2 * FRAMES];
+	pcm_source_t *source;
+	byte *surface;
+	guint16 colors[256];
+	int status = 0;
+
+	g_setenv("INFINITY_CAPTURE", capture, TRUE);
+	g_unsetenv("INFINITY_REPLAY");
+	g_unsetenv("INFINITY_SYNTH");
+	write_samples(input);
+
+	source = pcm_source_new(input, PCM_FORMAT_S16, 2);
+	if (source == NULL || pcm_source_read(source, pcm, FRAMES) != FRAMES) {
+		g_printerr("pcm: cannot read the samples\n");
+		return 1;
+	}
+	pcm_source_destroy(source);
+
+	/* infinity-render */
+	surface = g_malloc(160 * 100);
+	if (!infinity_init_offline(&params, &player)) {
+		g_printerr("pcm: cannot make an instance\n");
+		return 1;
+	}
+	infinity_render_offline_frame(pcm, 2, surface, colors);
+	infinity_finish();
+	g_free(surface);
+	if (!check_capture(capture, "offline frame"))
+		status = 1;
+
+	/* infinity-play */
+	if (!check_player(pcm, capture, TRUE) || !check_player(pcm, capture, FALSE))
+		status = 1;
+
+	/* infinityvis */
+	if (!check_player(NULL, capture, FALSE))
+		status = 1;
+
+	if (status == 0)
+		g_print("ok\n");
+	g_unlink(capture);
+	g_unlink(input);
+	g_rmdir(root);
+	g_free(capture);
+	g_free(input);
+	g_free(root);
+	return status;
+}
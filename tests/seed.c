@@ -0,0 +1,163 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "config.h"
+#include "display.h"
+#include "infinity.h"
+#include "replay.h"
+
+/*
+ * Random seed test.
+ *
+ * Captures the changes of an offline instance with a fixed seed and
+ * checks that they are the ones drawn in turn from a generator of that
+ * seed, an effect every EFFECT_INTERVAL frames and a palette every
+ * COLOR_INTERVAL frames: drawing the next effect ahead of time must not
+ * move the sequence.
+ */
+
+#define SEED 1234
+#define FRAMES 60
+#define EFFECT_INTERVAL 5
+#define COLOR_INTERVAL 3
+
+static gint32 get_width(void) { return 160; }
+static gint32 get_height(void) { return 100; }
+static void set_size(gint32 size) { (void)size; }
+static gint32 get_scale(void) { return 1; }
+static gint32 get_effect_interval(void) { return EFFECT_INTERVAL; }
+static gint32 get_color_interval(void) { return COLOR_INTERVAL; }
+static gint32 get_max_fps(void) { return 60; }
+
+static InfParameters params = {
+	get_width, set_size, get_height, set_size,
+	get_scale, get_effect_interval, get_color_interval, get_max_fps
+};
+
+static void notify_critical_error(const gchar *message)
+{
+	g_printerr("seed: %s\n", message);
+}
+
+static gboolean is_playing(void) { return FALSE; }
+static void disable_plugin(void) { }
+
+static Player player = {
+	.notify_critical_error = notify_critical_error,
+	.disable_plugin = disable_plugin,
+	.is_playing = is_playing,
+};
+
+/*
+ * Compares the changes captured before frame with those drawn from rng,
+ * t_color frames after the last palette change.
+ */
+static gboolean check_frame(const replay_frame_t *replay_frame, gint32 frame, GRand *rng,
+			    gint32 *t_color)
+{
+	gboolean ok = TRUE;
+	t_effect effect;
+
+	if (frame == 0 || frame % EFFECT_INTERVAL == 0) {
+		display_load_random_effect(&effect, rng);
+		ok = replay_frame->has_effect &&
+		     memcmp(&replay_frame->effect, &effect, sizeof(effect)) == 0;
+	} else {
+		ok = !replay_frame->has_effect;
+	}
+	if (frame > 0 && ++*t_color % COLOR_INTERVAL == 0) {
+		ok = ok && replay_frame->has_palette &&
+		     replay_frame->color == g_rand_int_range(rng, 0, NB_PALETTES);
+		*t_color = 0;
+	} else {
+		ok = ok && !replay_frame->has_palette;
+	}
+	if (!ok)
+		g_printerr("seed: changes before frame %d differ\n", frame);
+	return ok;
+}
+
+int main(void)
+{
+	gchar *root = g_dir_make_tmp("infinity-seed-XXXXXX", NULL);
+	gchar *path = g_build_filename(root, "run.infc", NULL);
+	gchar *seed = g_strdup_printf("%d", SEED);
+	replay_reader_t *reader;
+	replay_frame_t *replay_frame;
+	infinity_t *inf;
+	guint8 *pixels;
+	float pcm[1024];
+	GRand *rng;
+	gint32 i, t_color = 0;
+	int status = 0;
+
+	g_setenv("INFINITY_SEED", seed, TRUE);
+	g_setenv("INFINITY_CAPTURE", path, TRUE);
+	g_unsetenv("INFINITY_REPLAY");
+	g_unsetenv("INFINITY_SYNTH");
+	inf = infinity_new_offline(&params, &player);
+	if (inf == NULL) {
+		g_printerr("seed: cannot make an instance\n");
+		return 1;
+	}
+	pixels = g_malloc(160 * 100 * 4);
+	for (i = 0; i < FRAMES; i++) {
+		gint32 j;
+
+		for (j = 0; j < 1024; j++)
+			pcm[j] = (float)((i * 131 + j * 17) % 200 - 100) / 100;
+		infinity_render_into(inf, pcm, 2, pixels, 160 * 4, INFINITY_FORMAT_XRGB32);
+	}
+	/* Flushes the capture */
+	infinity_destroy(inf);
+	g_free(pixels);
+
+	reader = replay_reader_new(path);
+	if (reader == NULL) {
+		g_printerr("seed: cannot read the capture\n");
+		return 1;
+	}
+	if (replay_reader_get_seed(reader) != SEED) {
+		g_printerr("seed: capture of another seed\n");
+		status = 1;
+	}
+	replay_frame = g_new0(replay_frame_t, 1);
+	rng = g_rand_new_with_seed(SEED);
+	for (i = 0; i < FRAMES; i++)
+		if (!replay_reader_next_frame(reader, replay_frame)) {
+			g_printerr("seed: capture ends at frame %d\n", i);
+			status = 1;
+			break;
+		} else if (!check_frame(replay_frame, i, rng, &t_color)) {
+			status = 1;
+		}
+
+	if (status == 0)
+		g_print("ok\n");
+	g_rand_free(rng);
+	g_free(replay_frame);
+	replay_reader_destroy(reader);
+	g_unlink(path);
+	g_rmdir(root);
+	g_free(seed);
+	g_free(path);
+	g_free(root);
+	return status;
+}
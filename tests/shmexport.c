@@ -0,0 +1,153 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "config.h"
+#include "infinity.h"
+#include "shmexport.h"
+
+/*
+ * Shared memory export test.
+ *
+ * Renders frames with an exporting offline instance and checks that a
+ * reader of the region sees each of them identical to the frame the
+ * instance rendered into memory, before and after a resize, and only
+ * the latest one when it falls behind.
+ */
+
+#define FRAMES 8
+
+static gint32 width = 160, height = 100;
+
+static gint32 get_width(void) { return width; }
+static gint32 get_height(void) { return height; }
+static void set_size(gint32 size) { (void)size; }
+static gint32 get_scale(void) { return 1; }
+static gint32 get_interval(void) { return 100; }
+static gint32 get_max_fps(void) { return 60; }
+
+static InfParameters params = {
+	get_width, set_size, get_height, set_size,
+	get_scale, get_interval, get_interval, get_max_fps
+};
+
+static void notify_critical_error(const gchar *message)
+{
+	g_printerr("shmexport: %s\n", message);
+}
+
+static gboolean is_playing(void) { return FALSE; }
+static void disable_plugin(void) { }
+
+static Player player = {
+	.notify_critical_error = notify_critical_error,
+	.disable_plugin = disable_plugin,
+	.is_playing = is_playing,
+};
+
+static void make_pcm(float *pcm, gint32 frame)
+{
+	gint32 i;
+
+	for (i = 0; i < 1024; i++)
+		pcm[i] = (float)((frame * 131 + i * 17) % 200 - 100) / 100;
+}
+
+/*
+ * Renders one frame and compares it with the one exported.
+ */
+static gboolean check_frame(infinity_t *inf, shmexport_reader_t *reader, gint32 index)
+{
+	const gint32 stride = width * 4;
+	guint8 *pixels = g_malloc((gsize)stride * height);
+	shmexport_frame_t frame;
+	float pcm[1024];
+	gboolean ok;
+	gint32 i;
+
+	make_pcm(pcm, index);
+	infinity_render_into(inf, pcm, 2, pixels, stride, INFINITY_FORMAT_XRGB32);
+	ok = shmexport_reader_next(reader, 0, &frame) &&
+	     frame.format == INFINITY_FORMAT_XRGB32 &&
+	     frame.width == width && frame.height == height && frame.stride >= stride;
+	for (i = 0; ok && i < height; i++)
+		ok = memcmp(frame.pixels + (gsize)i * frame.stride, pixels + i * stride, stride) == 0;
+	ok = ok && shmexport_reader_done(reader, &frame);
+	g_free(pixels);
+	if (!ok)
+		g_printerr("shmexport: frame %d at %dx%d differs\n", index, width, height);
+	return ok;
+}
+
+int main(void)
+{
+	gchar *name = g_strdup_printf("infinity-test-%d", (int)getpid());
+	shmexport_reader_t *reader;
+	shmexport_frame_t frame;
+	infinity_t *inf;
+	guint8 *scratch;
+	float pcm[1024];
+	gint32 i;
+	int status = 0;
+
+	g_setenv("INFINITY_EXPORT", name, TRUE);
+	g_setenv("INFINITY_EXPORT_FORMAT", "xrgb32", TRUE);
+	inf = infinity_new_offline(&params, &player);
+	reader = shmexport_reader_open(name);
+	if (inf == NULL || reader == NULL) {
+		g_printerr("shmexport: cannot set up the export\n");
+		return 1;
+	}
+
+	if (shmexport_reader_next(reader, 0, &frame)) {
+		g_printerr("shmexport: frame before any was rendered\n");
+		status = 1;
+	}
+	for (i = 0; i < FRAMES; i++)
+		if (!check_frame(inf, reader, i))
+			status = 1;
+
+	width = 333;
+	height = 181;
+	infinity_resize(inf, width, height);
+	for (i = 0; i < FRAMES; i++)
+		if (!check_frame(inf, reader, FRAMES + i))
+			status = 1;
+
+	/* A slow reader gets the latest frame, the others are overwritten */
+	scratch = g_malloc((gsize)width * height * 4);
+	for (i = 0; i < 2 * SHMEXPORT_SLOTS; i++) {
+		make_pcm(pcm, i);
+		infinity_render_into(inf, pcm, 2, scratch, width * 4, INFINITY_FORMAT_XRGB32);
+	}
+	g_free(scratch);
+	if (!check_frame(inf, reader, 0)) {
+		status = 1;
+	} else if (shmexport_reader_next(reader, 1000, &frame)) {
+		g_printerr("shmexport: frame read twice\n");
+		status = 1;
+	}
+
+	if (status == 0)
+		g_print("ok\n");
+	shmexport_reader_close(reader);
+	infinity_destroy(inf);
+	g_free(name);
+	return status;
+}
@@ -0,0 +1,383 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "config.h"
+#include "compute.h"
+#include "effects.h"
+
+/*
+ * Expression effect test.
+ *
+ * Checks that bad expressions are rejected with a message, that the
+ * expressions evaluate as the same C does, and that fields of the
+ * effects they make warp as the built-in effects they copy, symmetric
+ * or not. Last, loads them from the directory of the effects file.
+ */
+
+#define WIDTH 96
+#define HEIGHT 64
+
+static const gchar *const rejected[] = {
+	"",
+	"x' = x",
+	"x' = x; y' = y; x' = 1",
+	"x = 1; x' = x; y' = y",
+	"pi = 3; x' = x; y' = y",
+	"a = 1; a = 2; x' = x; y' = y",
+	"z' = x; x' = x; y' = y",
+	"x' = foo; y' = y",
+	"x' = foo(x); y' = y",
+	"x' = sin(x, y); y' = y",
+	"x' = atan2(x); y' = y",
+	"x' = (x; y' = y",
+	"x' = x +; y' = y",
+	"x' = x $ 2; y' = y",
+	"x' = y'; y' = y",
+	"x' = 1e999; y' = y",
+	"x' = x y' = y",
+	"x' = a; a = 1; y' = y",
+	"x' = x\ny' = (y\n",
+};
+
+static gint status = 0;
+
+static void notify_critical_error(const gchar *message)
+{
+	g_printerr("warpexpr: %s\n", message);
+}
+
+static Player player = {
+	.notify_critical_error = notify_critical_error,
+};
+
+static void expect(gboolean ok, const gchar *what)
+{
+	if (!ok) {
+		g_printerr("warpexpr: %s\n", what);
+		status = 1;
+	}
+}
+
+static gboolean is_rejected(const gchar *source)
+{
+	gchar *error = NULL;
+	warpexpr_t *expr = warpexpr_compile(source, &error);
+
+	if (expr != NULL) {
+		warpexpr_destroy(expr);
+		return FALSE;
+	}
+	g_free(error);
+	return error != NULL;
+}
+
+/* Rejected before the recursion of the parser goes as deep as source */
+static gboolean is_too_deep(const gchar *source)
+{
+	gchar *error = NULL;
+	warpexpr_t *expr = warpexpr_compile(source, &error);
+	const gboolean too_deep = error != NULL && strstr(error, "nested too deeply") != NULL;
+
+	if (expr != NULL)
+		warpexpr_destroy(expr);
+	g_free(error);
+	return too_deep;
+}
+
+static void check_rejected(void)
+{
+	GString *source = g_string_new(NULL);
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(rejected); i++)
+		if (!is_rejected(rejected[i])) {
+			g_printerr("warpexpr: '%s' not rejected\n", rejected[i]);
+			status = 1;
+		}
+
+	g_string_append(source, "a = ");
+	for (i = 0; i < 100; i++)
+		g_string_append_c(source, '(');
+	g_string_append(source, "x");
+	for (i = 0; i < 100; i++)
+		g_string_append_c(source, ')');
+	g_string_append(source, "\nx' = x; y' = y");
+	expect(is_too_deep(source->str), "too deep an expression not rejected");
+
+	g_string_truncate(source, 0);
+	g_string_append(source, "x' = ");
+	for (i = 0; i < 30000; i++)
+		g_string_append_c(source, '-');
+	g_string_append(source, "x; y' = y");
+	expect(is_too_deep(source->str), "too long a chain of '-' not rejected");
+
+	g_string_truncate(source, 0);
+	g_string_append(source, "x' = x");
+	for (i = 0; i < 30000; i++)
+		g_string_append(source, "^x");
+	g_string_append(source, "; y' = y");
+	expect(is_too_deep(source->str), "too long a chain of '^' not rejected");
+
+	g_string_truncate(source, 0);
+	for (i = 0; i < 64; i++)
+		g_string_append_printf(source, "a%u = x * %u\n", i, i + 2);
+	g_string_append(source, "x' = x; y' = y");
+	expect(is_rejected(source->str), "too many values not rejected");
+
+	g_string_truncate(source, 0);
+	g_string_append(source, "x' = x");
+	for (i = 0; i < 2000; i++)
+		g_string_append(source, " + y");
+	g_string_append(source, "; y' = y");
+	expect(is_rejected(source->str), "too long an expression not rejected");
+	g_string_free(source, TRUE);
+}
+
+static void check_eval(void)
+{
+	const gchar *source =
+		"# a comment\n"
+		"a = 0.025 * (p1 - 2) + 0.002 ; s = sin(a)\n"
+		"f = -(r - height * 0.25) / (2000 + p2 * 500) + 1  # another\n"
+		"x' = (cos(a) * x - s * y) * f + max(theta, 0) - 2 ^ -1\n"
+		"y' = (s * x + cos(a) * y) * (f\n"
+		"  + 0 * width)\n";
+	gfloat ax[100], ay[100], bx[100], by[100];
+	gchar *error = NULL;
+	warpexpr_t *expr = warpexpr_compile(source, &error);
+	gint32 i;
+
+	if (expr == NULL) {
+		g_printerr("warpexpr: rejected: %s\n", error);
+		g_free(error);
+		status = 1;
+		return;
+	}
+	expect(warpexpr_params(expr) == 3, "parameters read");
+	for (i = 0; i < 100; i++) {
+		ax[i] = (gfloat)(i * 7 % 96 - 48);
+		ay[i] = (gfloat)(i * 13 % 64 - 32);
+	}
+	warpexpr_eval(expr, ax, ay, 100, 320, 200, 1, 3, bx, by);
+	for (i = 0; i < 100; i++) {
+		const gfloat a = 0.025f * (1 - 2) + 0.002f;
+		const gfloat r = sqrtf(ax[i] * ax[i] + ay[i] * ay[i]);
+		const gfloat f = -(r - 200 * 0.25f) / (2000 + 3 * 500) + 1;
+		const gfloat x = (cosf(a) * ax[i] - sinf(a) * ay[i]) * f
+				 + MAX(atan2f(ay[i], ax[i]), 0) - 0.5f;
+		const gfloat y = (sinf(a) * ax[i] + cosf(a) * ay[i]) * f;
+
+		if (fabsf(bx[i] - x) > 1e-3f || fabsf(by[i] - y) > 1e-3f) {
+			g_printerr("warpexpr: (%g, %g) gives (%g, %g), expected (%g, %g)\n",
+				   ax[i], ay[i], bx[i], by[i], x, y);
+			status = 1;
+			break;
+		}
+	}
+	warpexpr_destroy(expr);
+
+	expr = warpexpr_compile("x' = x * (2 - 1); y' = 3", &error);
+	expect(expr != NULL && warpexpr_params(expr) == 0, "constants not folded");
+	if (expr != NULL) {
+		warpexpr_eval(expr, ax, ay, 1, 320, 200, 2, 2, bx, by);
+		expect(bx[0] == ax[0] && by[0] == 3.0f, "constant expression");
+		warpexpr_destroy(expr);
+	}
+}
+
+static byte *random_surface(void)
+{
+	byte *src = g_malloc((WIDTH + 1) * (HEIGHT + 1));
+	guint32 x = 2463534242u;
+	gint32 i;
+
+	for (i = 0; i < (WIDTH + 1) * (HEIGHT + 1); i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		src[i] = (byte)x;
+	}
+	return src;
+}
+
+static gint32 add_effect(const gchar *source)
+{
+	gchar *error = NULL;
+	warpexpr_t *expr = warpexpr_compile(source, &error);
+
+	if (expr == NULL) {
+		g_printerr("warpexpr: rejected: %s\n", error);
+		g_free(error);
+		status = 1;
+		return 0;
+	}
+	return compute_add_effect(expr);
+}
+
+/*
+ * Largest difference between the warps of effect and of builtin with
+ * p1 and p2, through the shared field of effect and a dense field of
+ * builtin.
+ */
+static gint32 compare_warps(gint32 effect, guint32 builtin, gint32 p1, gint32 p2)
+{
+	vector_field_t *shared = compute_vector_field_get(WIDTH, HEIGHT, p1, p2, 0);
+	vector_field_t *dense = compute_vector_field_new_for(WIDTH, HEIGHT, 1u << builtin);
+	compute_t *compute = compute_new(WIDTH, HEIGHT);
+	byte *src = random_surface();
+	byte *expected = g_malloc0((WIDTH + 1) * (HEIGHT + 1));
+	byte *actual = g_malloc0((WIDTH + 1) * (HEIGHT + 1));
+	gint32 i, max_error = 0;
+
+	dense->p1 = p1;
+	dense->p2 = p2;
+	compute_generate_vector_field(dense);
+	compute_vector_field_hold(shared, effect);
+	compute_warp_effect(compute, dense, builtin, src, expected);
+	compute_warp_effect(compute, shared, effect, src, actual);
+	for (i = 0; i < WIDTH * HEIGHT; i++)
+		max_error = MAX(max_error, ABS((gint32)expected[i] - (gint32)actual[i]));
+	compute_vector_field_release(shared, effect);
+	compute_vector_field_unref(shared);
+	compute_vector_field_destroy(dense);
+	compute_destroy(compute);
+	g_free(src);
+	g_free(expected);
+	g_free(actual);
+	return max_error;
+}
+
+static void check_fields(void)
+{
+	const gint32 spiral = add_effect(
+		"a = 0.025 * (p1 - 2) + 0.002\n"
+		"f = -(r - height * 0.25) / (2000 + p2 * 500) + 1\n"
+		"x' = (cos(a) * x - sin(a) * y) * f\n"
+		"y' = (sin(a) * x + cos(a) * y) * f\n");
+	const gint32 zoom = add_effect("x' = x * 1.02; y' = y * 1.02");
+	const gint32 shift = add_effect("x' = x + 0.5; y' = y");
+	const gint32 undefined = add_effect("x' = log(-1 - r); y' = y / 0");
+	vector_field_t *field;
+	gint32 p1, p2, ring;
+	gsize i;
+
+	expect(spiral == NB_FCT + 1 && undefined == NB_FCT + 4 &&
+	       compute_effect_count() == NB_FCT + 5, "effects not numbered in order");
+
+	g_setenv("INFINITY_SPARSE_FIELD", "off", TRUE);
+	expect(compare_warps(spiral, 0, 0, 4) <= COMPUTE_FAST_WARP_TOLERANCE,
+	       "spiral differs from effect 0");
+	expect(compare_warps(spiral, 0, 3, 1) <= COMPUTE_FAST_WARP_TOLERANCE,
+	       "spiral differs from effect 0 with other parameters");
+	expect(compare_warps(zoom, 5, 2, 2) <= COMPUTE_FAST_WARP_TOLERANCE,
+	       "zoom differs from effect 5");
+	g_setenv("INFINITY_SPARSE_FIELD", "on", TRUE);
+	expect(compare_warps(zoom, 5, 2, 2) <= COMPUTE_FAST_WARP_TOLERANCE,
+	       "sparse zoom differs from effect 5");
+	g_setenv("INFINITY_SPARSE_FIELD", "off", TRUE);
+
+	p1 = 4;
+	p2 = 0;
+	compute_warp_params(zoom, &p1, &p2);
+	expect(p1 == COMPUTE_DEFAULT_PARAM && p2 == COMPUTE_DEFAULT_PARAM,
+	       "parameters of the zoom not ignored");
+
+	/* Mirrored if symmetric only, defined everywhere */
+	g_setenv("INFINITY_SYMMETRIC_FIELD", "on", TRUE);
+	field = compute_vector_field_get(WIDTH, HEIGHT, 2, 2, 0);
+	compute_vector_field_hold(field, zoom);
+	compute_vector_field_hold(field, shift);
+	compute_vector_field_hold(field, undefined);
+	expect(field->edges[zoom] != NULL, "symmetric field not mirrored");
+	expect(field->edges[shift] == NULL && field->edges[undefined] == NULL,
+	       "asymmetric effects mirrored");
+	for (i = 0; i < (gsize)WIDTH * HEIGHT; i++) {
+		const t_interpol v = field->vector[undefined][i];
+
+		if ((v.coord >> 16) >= WIDTH || (v.coord & 0xFFFF) >= HEIGHT ||
+		    v.coord != field->vector[shift][i].coord) {
+			expect(FALSE, "undefined points not left in place");
+			break;
+		}
+	}
+	compute_vector_field_release(field, zoom);
+	compute_vector_field_release(field, shift);
+	compute_vector_field_release(field, undefined);
+	compute_vector_field_unref(field);
+	expect(compare_warps(shift, shift, 2, 2) == 0, "asymmetric field differs from dense one");
+
+	/*
+	 * Symmetric at the points compute_add_effect() tries, on the circles
+	 * of radius 1.5 + 8 i, only: the field made compares every point
+	 * with its mirror, and keeps it whole
+	 */
+	ring = add_effect("x' = x + 2 * sin((r - 1.5) * pi / 8) ^ 2; y' = y");
+	field = compute_vector_field_get(WIDTH, HEIGHT, 2, 2, 0);
+	compute_vector_field_hold(field, ring);
+	expect(field->vector[ring] != NULL && field->edges[ring] == NULL,
+	       "field symmetric at some points only mirrored");
+	compute_vector_field_release(field, ring);
+	compute_vector_field_unref(field);
+	expect(compare_warps(ring, ring, 2, 2) == 0, "field symmetric at some points only differs");
+}
+
+int main(void)
+{
+	gchar *root = g_dir_make_tmp("infinity-warpexpr-XXXXXX", NULL);
+	gchar *states = g_build_filename(root, "infinite_states", NULL);
+	gchar *good = g_build_filename(root, "a.warp", NULL);
+	gchar *bad = g_build_filename(root, "b.warp", NULL);
+	const gchar header[16] = "IFST\x01\0\0\0\x20\0\0\0\0\0\0\0";
+	const guint32 record[8] = { 0, GUINT32_TO_LE(100), 0, GUINT32_TO_LE(59),
+				    GUINT32_TO_LE(14), GUINT32_TO_LE(255), GUINT32_TO_LE(4), 0 };
+	gchar contents[16 + sizeof(record)];
+	t_effect effect;
+
+	check_rejected();
+	check_eval();
+
+	/* The effects of the files next to the effects file come first */
+	memcpy(contents, header, 16);
+	memcpy(contents + 16, record, sizeof(record));
+	g_file_set_contents(states, contents, sizeof(contents), NULL);
+	g_file_set_contents(good, "x' = -y\ny' = x\n", -1, NULL);
+	g_file_set_contents(bad, "x' = y'\ny' = x\n", -1, NULL);
+	g_setenv("INFINITY_STATES", states, TRUE);
+	g_setenv("XDG_CONFIG_HOME", root, TRUE);
+	expect(effects_load_effects(&player), "cannot load");
+	expect(compute_effect_count() == NB_FCT + 1, "expression file not loaded once");
+	expect(effects_count(NB_FCT, -1) == 1 && effects_get(NB_FCT, -1, 0, &effect) &&
+	       effect.x_curve == 100 && effect.rotation == COMPUTE_DEFAULT_PARAM,
+	       "no preset for the expression");
+
+	check_fields();
+
+	if (status == 0)
+		g_print("ok\n");
+	g_unlink(good);
+	g_unlink(bad);
+	g_unlink(states);
+	g_rmdir(root);
+	g_free(good);
+	g_free(bad);
+	g_free(states);
+	g_free(root);
+	return status;
+}
@@ -0,0 +1,87 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "display.h"
+#include "ui.h"
+
+/*
+ * X11 backend test, for Xvfb: presents frames rendered in place and
+ * RGB565 frames, across a size change. Skipped without a display.
+ */
+
+#define FRAMES 120
+#define SKIP 77
+
+static gboolean present_in_place(gint32 width, gint32 height, gint32 frame)
+{
+	infinity_format_t format;
+	gint32 stride, i;
+	guint8 *pixels;
+
+	pixels = ui_acquire_frame(width, height, &format, &stride);
+	if (pixels == NULL || stride < width * display_format_bytes(format)) {
+		g_printerr("x11: no in place frame at %dx%d\n", width, height);
+		return FALSE;
+	}
+	for (i = 0; i < height; i++)
+		memset(pixels + (gsize)i * stride, (frame + i) & 0xFF, stride);
+	ui_present_acquired();
+	return TRUE;
+}
+
+int main(void)
+{
+	guint16 *frame;
+	gint64 t_begin;
+	gint32 i;
+	int status = 0;
+
+	if (g_getenv("DISPLAY") == NULL) {
+		g_print("x11: no DISPLAY, skipped\n");
+		return SKIP;
+	}
+	if (!ui_init(320, 200)) {
+		g_printerr("x11: cannot open the window\n");
+		return 1;
+	}
+
+	t_begin = g_get_monotonic_time();
+	for (i = 0; i < FRAMES && status == 0; i++)
+		if (!present_in_place(320, 200, i))
+			status = 1;
+	g_print("x11: %d frames in place, %.3f ms each\n", FRAMES,
+		(g_get_monotonic_time() - t_begin) / 1e3 / FRAMES);
+
+	for (i = 0; i < FRAMES && status == 0; i++)
+		if (!present_in_place(333, 181, i))
+			status = 1;
+
+	frame = g_new(guint16, 160 * 100);
+	for (i = 0; i < 160 * 100; i++)
+		frame[i] = (guint16)(i * 37);
+	for (i = 0; i < FRAMES; i++)
+		ui_present(frame, 160, 100);
+	g_free(frame);
+
+	ui_quit();
+	if (status == 0)
+		g_print("ok\n");
+	return status;
+}